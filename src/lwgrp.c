@@ -40,6 +40,7 @@ int lwgrp_chain_set_null(lwgrp_chain* group)
     group->comm_right = MPI_PROC_NULL;
     group->group_rank = -1;
     group->group_size =  0;
+    group->tag        = LWGRP_MSG_TAG_0;
   }
 
   return LWGRP_SUCCESS;
@@ -95,6 +96,7 @@ int lwgrp_chain_build_from_mpicomm(MPI_Comm comm, lwgrp_chain* group)
     group->comm_right = right;
     group->group_rank = rank;
     group->group_size = ranks;
+    group->tag        = LWGRP_MSG_TAG_0;
   } else {
     /* passed the NULL communicator, so set the group to empty */
     lwgrp_chain_set_null(group);
@@ -136,6 +138,7 @@ int lwgrp_chain_build_from_vals(
   group->comm_right = right;
   group->group_rank = rank;
   group->group_size = size;
+  group->tag        = LWGRP_MSG_TAG_0;
 
   return LWGRP_SUCCESS;
 }
@@ -215,6 +218,7 @@ int lwgrp_ring_build_from_mpicomm(MPI_Comm comm, lwgrp_ring* group)
     group->comm_right = right;
     group->group_rank = rank;
     group->group_size = ranks;
+    group->tag        = LWGRP_MSG_TAG_0;
   } else {
     lwgrp_ring_set_null(group);
   }
@@ -272,6 +276,7 @@ int lwgrp_ring_build_from_list(MPI_Comm comm, int group_size, const int group_li
     group->comm_right = right;
     group->group_rank = group_rank;
     group->group_size = group_size;
+    group->tag        = LWGRP_MSG_TAG_0;
   } else {
     lwgrp_ring_set_null(group);
   }
@@ -311,7 +316,7 @@ int lwgrp_ring_build_from_chain(
     if (left_rank != MPI_PROC_NULL) {
       /* receive right-going data from the left */
       MPI_Irecv(
-        recv_left, 2, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        recv_left, 2, MPI_INT, left_rank, chain->tag,
         comm, &request[k]
       );
       k++;
@@ -320,7 +325,7 @@ int lwgrp_ring_build_from_chain(
        * it our partial result */
       send_left[0] = right_rank;
       MPI_Isend(
-        send_left, 2, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        send_left, 2, MPI_INT, left_rank, chain->tag,
         comm, &request[k]
       );
       k++;
@@ -332,7 +337,7 @@ int lwgrp_ring_build_from_chain(
     if (right_rank != MPI_PROC_NULL) {
       /* receive left-going data from the right */
       MPI_Irecv(
-        recv_right, 2, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        recv_right, 2, MPI_INT, right_rank, chain->tag,
         comm, &request[k]
       );
       k++;
@@ -341,7 +346,7 @@ int lwgrp_ring_build_from_chain(
        * it our partial result */
       send_right[0] = left_rank;
       MPI_Isend(
-        send_right, 2, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        send_right, 2, MPI_INT, right_rank, chain->tag,
         comm, &request[k]
       );
       k++;
@@ -380,6 +385,7 @@ int lwgrp_ring_build_from_chain(
   ring->comm_right = chain->comm_right;
   ring->group_rank = chain->group_rank;
   ring->group_size = chain->group_size;
+  ring->tag        = chain->tag;
 
   /* now form the ring by setting rank 0's left partner to be the
    * last rank in the group and setting the last ranks's right
@@ -477,14 +483,14 @@ int lwgrp_logchain_build_from_chain(
 
       /* receive next left rank from our current left rank */
       MPI_Irecv(
-        &recv_left_rank, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        &recv_left_rank, 1, MPI_INT, left_rank, group->tag,
         comm, &request[k]
       );
       k++;
 
       /* send our rightmost rank to our left rank */
       MPI_Isend(
-        &right_rank, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        &right_rank, 1, MPI_INT, left_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -499,14 +505,14 @@ int lwgrp_logchain_build_from_chain(
 
       /* receive next right rank from our current right rank */
       MPI_Irecv(
-        &recv_right_rank, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        &recv_right_rank, 1, MPI_INT, right_rank, group->tag,
         comm, &request[k]
       );
       k++;
 
       /* send our leftmost rank to our right rank */
       MPI_Isend(
-        &left_rank, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        &left_rank, 1, MPI_INT, right_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -626,6 +632,43 @@ int lwgrp_logchain_build_from_mpicomm(MPI_Comm comm, lwgrp_logchain* list)
   return LWGRP_SUCCESS;
 }
 
+/* enables a library to construct a logchain from addresses it has
+ * collected itself, left[d] and right[d] are the addresses 2^d hops
+ * away, entries that fall off either end of the chain are ignored */
+int lwgrp_logchain_build_from_vals(
+  int ranks,
+  int rank,
+  const int left[],
+  const int right[],
+  lwgrp_logchain* list)
+{
+  /* allocate ceil(log(ranks)) memory for left and right lists */
+  lwgrp_logchain_init(ranks, list);
+
+  int index = 0;
+  int count = 1;
+  while (count < ranks) {
+    if (rank - count >= 0) {
+      list->left_list[list->left_size] = left[index];
+      list->left_size++;
+    }
+    if (rank + count < ranks) {
+      list->right_list[list->right_size] = right[index];
+      list->right_size++;
+    }
+    index++;
+    count <<= 1;
+  }
+
+  /* end each list with MPI_PROC_NULL */
+  list->left_list[list->left_size]   = MPI_PROC_NULL;
+  list->right_list[list->right_size] = MPI_PROC_NULL;
+  list->left_size++;
+  list->right_size++;
+
+  return LWGRP_SUCCESS;
+}
+
 /* free off resources associated with list object */
 int lwgrp_logchain_free(lwgrp_logchain* list)
 {
@@ -684,22 +727,22 @@ int lwgrp_logring_build_from_ring(
     /* receive next left rank from current left rank,
      * and receive next right rank from current right rank */
     MPI_Irecv(
-      &recv_left_rank,  1, MPI_INT, left_rank,  LWGRP_MSG_TAG_0,
+      &recv_left_rank,  1, MPI_INT, left_rank,  group->tag,
       comm, &request[0]
     );
     MPI_Irecv(
-      &recv_right_rank, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+      &recv_right_rank, 1, MPI_INT, right_rank, group->tag,
       comm, &request[1]
     );
 
     /* send our current right rank to our left rank,
      * and send our current left rank to our right rank */
     MPI_Isend(
-      &right_rank, 1, MPI_INT, left_rank,  LWGRP_MSG_TAG_0,
+      &right_rank, 1, MPI_INT, left_rank,  group->tag,
       comm, &request[2]
     );
     MPI_Isend(
-      &left_rank,  1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+      &left_rank,  1, MPI_INT, right_rank, group->tag,
       comm, &request[3]
     );
 
@@ -721,6 +764,146 @@ int lwgrp_logring_build_from_ring(
   return LWGRP_SUCCESS;
 }
 
+void lwgrp_nb_logring_init(
+  lwgrp_nb_logring* s,
+  const lwgrp_ring* group,
+  const lwgrp_logchain* chainlist,
+  lwgrp_logring* list)
+{
+  /* allocate ceil(log(ranks)) memory for left and right lists */
+  lwgrp_logring_init(group->group_size, list);
+
+  s->group      = group;
+  s->chainlist  = chainlist;
+  s->list       = list;
+  s->index      = 0;
+  s->dist       = 1;
+  s->left_rank  = group->comm_left;
+  s->right_rank = group->comm_right;
+  s->recv_left_rank  = MPI_PROC_NULL;
+  s->recv_right_rank = MPI_PROC_NULL;
+  s->exchanged  = 0;
+}
+
+int lwgrp_nb_logring_advance(
+  lwgrp_nb_logring* s,
+  struct lwgrp_request_struct* req)
+{
+  /* get the communicator, our rank in the group, and the size of
+   * the group */
+  MPI_Comm comm = s->group->comm;
+  int rank      = s->group->group_rank;
+  int ranks     = s->group->group_size;
+  lwgrp_logring* list = s->list;
+
+  while (1) {
+    if (s->exchanged) {
+      /* take our next entries from the logchain unless they wrap */
+      s->exchanged = 0;
+      s->index++;
+      s->dist <<= 1;
+      if (rank - s->dist >= 0) {
+        s->left_rank = s->chainlist->left_list[s->index];
+      } else {
+        s->left_rank = s->recv_left_rank;
+      }
+      if (rank + s->dist < ranks) {
+        s->right_rank = s->chainlist->right_list[s->index];
+      } else {
+        s->right_rank = s->recv_right_rank;
+      }
+    }
+
+    if (s->dist >= ranks) {
+      break;
+    }
+
+    /* record our current left and right ranks in our lists */
+    list->left_list[list->left_size] = s->left_rank;
+    list->left_size++;
+    list->right_list[list->right_size] = s->right_rank;
+    list->right_size++;
+
+    int next = s->dist << 1;
+    if (next >= ranks) {
+      break;
+    }
+
+    /* entries at the next distance that wrap are the current entry
+     * of our current neighbor, we receive our own if they wrap, and
+     * send ours to neighbors whose entries wrap */
+    int posted = 0;
+    s->recv_left_rank  = MPI_PROC_NULL;
+    s->recv_right_rank = MPI_PROC_NULL;
+    if (rank - next < 0) {
+      MPI_Irecv(
+        &s->recv_left_rank, 1, MPI_INT, s->left_rank, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      posted = 1;
+    }
+    if (rank + next >= ranks) {
+      MPI_Irecv(
+        &s->recv_right_rank, 1, MPI_INT, s->right_rank, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      posted = 1;
+    }
+    int left_pos  = (rank - s->dist + ranks) % ranks;
+    int right_pos = (rank + s->dist) % ranks;
+    if (left_pos + next >= ranks) {
+      MPI_Isend(
+        &s->right_rank, 1, MPI_INT, s->left_rank, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      posted = 1;
+    }
+    if (right_pos - next < 0) {
+      MPI_Isend(
+        &s->left_rank, 1, MPI_INT, s->right_rank, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      posted = 1;
+    }
+    s->exchanged = 1;
+    if (posted) {
+      return 0;
+    }
+  }
+
+  /* end each list with MPI_PROC_NULL */
+  list->left_list[list->left_size]   = MPI_PROC_NULL;
+  list->right_list[list->right_size] = MPI_PROC_NULL;
+  list->left_size++;
+  list->right_size++;
+
+  return 1;
+}
+
+static int lwgrp_nb_logring_step(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_logring* s = (lwgrp_nb_logring*) req->state;
+  return lwgrp_nb_logring_advance(s, req);
+}
+
+/* given a ring and its logchain, build the logring, the entries
+ * that don't wrap around the end of the ring are the same as those
+ * in the logchain, so we only exchange the ones that do */
+int lwgrp_logring_build_from_logchain(
+  const lwgrp_ring* group,
+  const lwgrp_logchain* chainlist,
+  lwgrp_logring* list)
+{
+  lwgrp_nb_logring s;
+  lwgrp_nb_logring_init(&s, group, chainlist, list);
+
+  struct lwgrp_request_struct req;
+  lwgrp_request_init(&req, lwgrp_nb_logring_step, &s, group->tag);
+  lwgrp_request_complete(&req);
+
+  return LWGRP_SUCCESS;
+}
+
 /* given a group, build a list of neighbors that are 2^d away on
  * our left and right sides */
 int lwgrp_logring_build_from_mpicomm(MPI_Comm comm, lwgrp_logring* list)
@@ -825,3 +1008,232 @@ int lwgrp_logring_free(lwgrp_logring* list)
   int rc = lwgrp_logchain_free((lwgrp_logchain*)list);
   return rc;
 }
+
+/* -----------------------------------------------------
+ * Functions that operate on a klogring
+ * -------------------------------------------------- */
+
+/* allocate lists for the j*k^d entries of a group of ranks procs,
+ * filling them with MPI_PROC_NULL */
+static int lwgrp_klogring_init(int ranks, int k, lwgrp_klogring* list)
+{
+  /* a radix past the group size gives the same single round */
+  if (ranks >= 2 && k > ranks) {
+    k = ranks;
+  }
+
+  /* initialize the fields to 0 and NULL */
+  list->k          = k;
+  list->rounds     = 0;
+  list->left_list  = NULL;
+  list->right_list = NULL;
+
+  /* count the powers of k less than ranks */
+  long dist = 1;
+  while (dist < ranks) {
+    list->rounds++;
+    dist *= k;
+  }
+
+  int list_size = (k - 1) * list->rounds;
+  if (list_size > 0) {
+    list->left_list  = (int*) lwgrp_malloc(list_size * sizeof(int), sizeof(int), __FILE__, __LINE__);
+    list->right_list = (int*) lwgrp_malloc(list_size * sizeof(int), sizeof(int), __FILE__, __LINE__);
+    int i;
+    for (i = 0; i < list_size; i++) {
+      list->left_list[i]  = MPI_PROC_NULL;
+      list->right_list[i] = MPI_PROC_NULL;
+    }
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+void lwgrp_nb_klogring_init(
+  lwgrp_nb_klogring* s,
+  const lwgrp_ring* group,
+  int k,
+  lwgrp_klogring* list)
+{
+  lwgrp_klogring_init(group->group_size, k, list);
+
+  s->group = group;
+  s->list  = list;
+  s->d     = 0;
+  s->j     = 1;
+  s->dist  = 1;
+}
+
+int lwgrp_nb_klogring_advance(
+  lwgrp_nb_klogring* s,
+  struct lwgrp_request_struct* req)
+{
+  /* get the communicator and the size of the group */
+  MPI_Comm comm = s->group->comm;
+  int ranks     = s->group->group_size;
+
+  int k      = s->list->k;
+  int* left  = s->list->left_list;
+  int* right = s->list->right_list;
+  while (s->d < s->list->rounds) {
+    int base = s->d * (k - 1);
+    int j = s->j;
+    if (j >= k || j * s->dist >= ranks) {
+      /* move on to the next power of k */
+      s->d++;
+      s->j = 1;
+      s->dist *= k;
+      continue;
+    }
+    s->j++;
+
+    int index = base + j - 1;
+    if (s->d == 0 && j == 1) {
+      /* our immediate neighbors */
+      left[index]  = s->group->comm_left;
+      right[index] = s->group->comm_right;
+      continue;
+    }
+
+    /* k^d is (k-1)*k^(d-1) plus k^(d-1), and j*k^d for j > 1 is
+     * (j-1)*k^d plus k^d, we send the second hop to the partner
+     * one first hop away on the other side */
+    int hop, far;
+    if (j == 1) {
+      hop = base - 1;
+      far = base - (k - 1);
+    } else {
+      hop = index - 1;
+      far = base;
+    }
+
+    /* receive our right entry from our right partner and our left
+     * entry from our left partner, and send ours the other way,
+     * when both partners are the same proc its first message
+     * carries our right entry, so we post that receive first */
+    MPI_Irecv(
+      &right[index], 1, MPI_INT, right[hop], req->tag,
+      comm, lwgrp_request_next(req)
+    );
+    MPI_Irecv(
+      &left[index],  1, MPI_INT, left[hop],  req->tag,
+      comm, lwgrp_request_next(req)
+    );
+    MPI_Isend(
+      &right[far], 1, MPI_INT, left[hop],  req->tag,
+      comm, lwgrp_request_next(req)
+    );
+    MPI_Isend(
+      &left[far],  1, MPI_INT, right[hop], req->tag,
+      comm, lwgrp_request_next(req)
+    );
+    return 0;
+  }
+
+  return 1;
+}
+
+static int lwgrp_nb_klogring_step(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_klogring* s = (lwgrp_nb_klogring*) req->state;
+  return lwgrp_nb_klogring_advance(s, req);
+}
+
+/* given a group, build a list of neighbors that are j*k^d away on
+ * our left and right sides, each entry is the sum of two shorter
+ * hops, so we get it from the proc one hop away, which knows the
+ * other -- O(k log_k N) communication */
+int lwgrp_klogring_build_from_ring(
+  const lwgrp_ring* group,
+  int k,
+  lwgrp_klogring* list)
+{
+  lwgrp_nb_klogring s;
+  lwgrp_nb_klogring_init(&s, group, k, list);
+
+  struct lwgrp_request_struct req;
+  lwgrp_request_init(&req, lwgrp_nb_klogring_step, &s, group->tag);
+  lwgrp_request_complete(&req);
+
+  return LWGRP_SUCCESS;
+}
+
+/* given a communicator, fill in the neighbors that are j*k^d away on
+ * our left and right sides -- O(k log_k N) local */
+int lwgrp_klogring_build_from_mpicomm(MPI_Comm comm, int k, lwgrp_klogring* list)
+{
+  int rank, ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &ranks);
+
+  lwgrp_klogring_init(ranks, k, list);
+  k = list->k;
+
+  int d;
+  long dist = 1;
+  for (d = 0; d < list->rounds; d++) {
+    int j;
+    for (j = 1; j < k && j * dist < ranks; j++) {
+      int index = d * (k - 1) + j - 1;
+      int offset = (int) (j * dist);
+      list->left_list[index]  = (rank - offset + ranks) % ranks;
+      list->right_list[index] = (rank + offset) % ranks;
+    }
+    dist *= k;
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+/* build a klogring from a list of ranks -- O(N) local */
+int lwgrp_klogring_build_from_list(MPI_Comm comm, int group_size, const int group_list[], int k, lwgrp_klogring* list)
+{
+  lwgrp_klogring_init(group_size, k, list);
+  k = list->k;
+
+  /* search until we find our rank within the group_list */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  int i;
+  int group_rank = -1;
+  for (i = 0; i < group_size; i++) {
+    if (group_list[i] == rank) {
+      group_rank = i;
+      break;
+    }
+  }
+
+  if (group_rank < 0) {
+    /* ERROR: rank not found in list */
+    return LWGRP_SUCCESS;
+  }
+
+  int d;
+  long dist = 1;
+  for (d = 0; d < list->rounds; d++) {
+    int j;
+    for (j = 1; j < k && j * dist < group_size; j++) {
+      int index = d * (k - 1) + j - 1;
+      int offset = (int) (j * dist);
+      list->left_list[index]  = group_list[(group_rank - offset + group_size) % group_size];
+      list->right_list[index] = group_list[(group_rank + offset) % group_size];
+    }
+    dist *= k;
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+/* free off resources associated with list object */
+int lwgrp_klogring_free(lwgrp_klogring* list)
+{
+  if (list->left_list != NULL) {
+    lwgrp_free(&list->left_list);
+  }
+  if (list->right_list != NULL) {
+    lwgrp_free(&list->right_list);
+  }
+  list->k      = 0;
+  list->rounds = 0;
+  return LWGRP_SUCCESS;
+}
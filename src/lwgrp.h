@@ -10,6 +10,7 @@
 #ifndef _LWGRP_H
 #define _LWGRP_H
 
+#include <stdio.h>
 #include "mpi.h"
 
 #ifdef __cplusplus
@@ -43,6 +44,7 @@ typedef struct lwgrp_chain {
   int comm_right; /* address (rank) of process whose group rank is one more than local */
   int group_size; /* number of processes in our group */
   int group_rank; /* our rank within the group [0,group_size) */
+  int tag;        /* tag for messages of blocking ops on the group */
 } lwgrp_chain;
 
 /* We define a "ring", which is a chain where the endpoints wrap.
@@ -74,14 +76,85 @@ typedef struct lwgrp_logchain {
 /* again, we define a ring variant of the logchain */
 typedef lwgrp_logchain lwgrp_logring;
 
+/* A klogring generalizes the logring to radix k, it records the
+ * addresses of processes that are j*k^d ranks away to the left and
+ * right, for j = 1 to k-1 and d = 0 to ceiling(log_k N)-1.  Entries
+ * whose distance is N or more hold MPI_PROC_NULL.  Collectives on a
+ * klogring take log_k N rounds talking to k-1 partners in each
+ * direction at once rather than log_2 N rounds with one partner, which
+ * pays off when the network keeps many messages in flight. */
+typedef struct lwgrp_klogring {
+  int  k;          /* radix, 0 if the list is empty */
+  int  rounds;     /* number of powers of k less than group size */
+  int* left_list;  /* address j*k^d hops to the left at d*(k-1)+j-1 */
+  int* right_list; /* address j*k^d hops to the right at d*(k-1)+j-1 */
+} lwgrp_klogring;
+
 /* We package a ring and logring into a single comm structure.
  * This object is provides routines closer to what people
- * expect from MPI communicators. */
+ * expect from MPI communicators.  Many collectives run on the
+ * chain and logchain views of the group, so we build and cache
+ * those when the comm is created rather than on every call. */
+struct lwgrp_rma_struct;
 typedef struct lwgrp_comm {
   lwgrp_ring  ring;
   lwgrp_logring logring;
+  lwgrp_chain chain;       /* ring chopped at rank 0 and rank N-1 */
+  lwgrp_logchain logchain; /* logring chopped at rank 0 and rank N-1 */
+  int seq;                 /* number of nonblocking ops started on comm,
+                            * used to give each op its own tag */
+  int* addrs;              /* address of each group rank in the parent
+                            * comm, NULL until a sparse op needs it */
+  int* addr_ranks;         /* group ranks sorted by address, to map
+                            * addresses back to group ranks */
+  int context;             /* selects the tags used by ops on comm, a comm
+                            * built by a split gets a context that no
+                            * other comm of its members uses, so ops on
+                            * overlapping comms can be in flight at once,
+                            * comms built locally all use context 0 */
+  struct lwgrp_rma_struct* rma; /* one-sided state, NULL while ops on comm
+                                 * send messages, see lwgrp_comm_set_transport */
+  lwgrp_klogring klogring; /* radix-k view for barrier and allgather,
+                            * empty while they run on the logring,
+                            * see lwgrp_comm_set_radix */
 } lwgrp_comm;
 
+/* A hierarchical comm views a group as a set of node groups, each
+ * holding the members that share a node, plus a leader group holding
+ * the lowest rank of each node group.  Collectives run within each
+ * node, then across leaders, then within each node again, so only
+ * one proc per node sends through the network.  Every node group is
+ * ordered by rank in comm, and the leaders are ordered by rank in
+ * comm, so rank 0 of comm is leader rank 0.  With MPI-3, procs on a
+ * node also share a memory segment, through which steps within the
+ * node move data with loads and stores rather than messages. */
+struct lwgrp_shm_struct;
+typedef struct lwgrp_hcomm {
+  lwgrp_comm comm;    /* all members of the group */
+  lwgrp_comm node;    /* members of the group on our node */
+  lwgrp_comm leaders; /* rank 0 of each node group, empty on other procs */
+  struct lwgrp_shm_struct* shm; /* memory shared with the node group,
+                                 * NULL if we send messages instead */
+} lwgrp_hcomm;
+
+/* Nonblocking operations return a request, which must be completed
+ * with lwgrp_test or lwgrp_wait.  As with MPI, all procs in a comm must
+ * start nonblocking operations on that comm in the same order, and the
+ * comm must not be freed while an operation on it is outstanding. */
+typedef struct lwgrp_request_struct* lwgrp_request;
+
+#define LWGRP_REQUEST_NULL ((lwgrp_request) NULL)
+
+/* Threads: with MPI_THREAD_MULTIPLE, different threads may call lwgrp
+ * at the same time so long as they work on different comms, all state
+ * of an op lives in the comm, its request, or the scratch pool of the
+ * calling thread.  A single comm must not be used by two threads at
+ * once.  Comms built by a split have a context of their own, while
+ * comms built locally share context 0, so to run collectives from
+ * several threads at once, either split a comm for each thread or
+ * build each one from its own MPI communicator.  A nonblocking op
+ * should be completed by the thread that started it. */
+
 /* ---------------------------------
  * Methods to create and free chains
  * --------------------------------- */
@@ -111,6 +184,7 @@ int lwgrp_ring_free(lwgrp_ring* ring);
 int lwgrp_logchain_build_from_chain(const lwgrp_chain* chain, lwgrp_logchain* list);
 int lwgrp_logchain_build_from_logring(const lwgrp_ring* ring, const lwgrp_logring* logring, lwgrp_logchain* list);
 int lwgrp_logchain_build_from_mpicomm(MPI_Comm comm, lwgrp_logchain* list);
+int lwgrp_logchain_build_from_vals(int size, int rank, const int left[], const int right[], lwgrp_logchain* list);
 int lwgrp_logchain_free(lwgrp_logchain* list);
 
 /* ---------------------------------
@@ -118,10 +192,20 @@ int lwgrp_logchain_free(lwgrp_logchain* list);
  * --------------------------------- */
 
 int lwgrp_logring_build_from_ring(const lwgrp_ring* ring, lwgrp_logring* list);
+int lwgrp_logring_build_from_logchain(const lwgrp_ring* ring, const lwgrp_logchain* logchain, lwgrp_logring* list);
 int lwgrp_logring_build_from_mpicomm(MPI_Comm comm, lwgrp_logring* list);
 int lwgrp_logring_build_from_list(MPI_Comm, int size, const int ranklist[], lwgrp_logring* list);
 int lwgrp_logring_free(lwgrp_logring* list);
 
+/* ---------------------------------
+ * Methods to create and free klogrings
+ * --------------------------------- */
+
+int lwgrp_klogring_build_from_ring(const lwgrp_ring* ring, int k, lwgrp_klogring* list);
+int lwgrp_klogring_build_from_mpicomm(MPI_Comm comm, int k, lwgrp_klogring* list);
+int lwgrp_klogring_build_from_list(MPI_Comm comm, int size, const int ranklist[], int k, lwgrp_klogring* list);
+int lwgrp_klogring_free(lwgrp_klogring* list);
+
 /* ---------------------------------
  * Methods to create and free comms
  * --------------------------------- */
@@ -138,15 +222,47 @@ int lwgrp_comm_build_from_chain(
   lwgrp_comm* newcomm       /* OUT - lwgrp communicator (pointer to comm struct) */
 );
 
+/* create a lwgrp comm from a list of ranks in an MPI communicator,
+ * where the list is ordered by group rank and the calling proc must
+ * be in the list -- O(N) local */
+int lwgrp_comm_build_from_list(
+  MPI_Comm comm,          /* IN  - MPI communicator (handle) */
+  int size,               /* IN  - number of ranks in list (non-negative integer) */
+  const int ranklist[],   /* IN  - ranks of group members in comm (array of length size) */
+  lwgrp_comm* newcomm     /* OUT - lwgrp communicator (pointer to comm struct) */
+);
+
+/* create a lwgrp comm from a ring along with its logchain, for libs
+ * that collect the 2^d addresses in their own scans, only the logring
+ * entries that wrap around the end of the ring take messages */
+int lwgrp_comm_build_from_logchain(
+  const lwgrp_ring* ring,         /* IN  - lwgrp ring (pointer to ring struct) */
+  const lwgrp_logchain* logchain, /* IN  - logchain of ring (pointer to logchain struct) */
+  lwgrp_comm* newcomm             /* OUT - lwgrp communicator (pointer to comm struct) */
+);
+
 /* copy a lwgrp comm */
 int lwgrp_comm_copy(
   const lwgrp_comm* comm, /* IN  - lwgrp chain (pointer to comm struct) */
   lwgrp_comm* newcomm     /* OUT - copy of lwgrp chain (pointer to comm struct) */
 );
 
+/* set the radix k of the dissemination barrier and Bruck allgather
+ * of comm, all members must pass the same k, with k above 2 this
+ * builds a klogring and is collective over comm -- O(k log_k N)
+ * communication, while k of 2 or less goes back to the logring and
+ * is local, comms start with the radix given by LWGRP_COMM_RADIX in
+ * the environment, which is 2 unless set */
+int lwgrp_comm_set_radix(
+  lwgrp_comm* comm, /* INOUT - lwgrp communicator (pointer to comm struct) */
+  int k             /* IN    - radix (integer) */
+);
+
 /* split a lwgrp comm into subcomms, where each subcomm holds all procs
- * in the same bin, takes O(B) space and O(B*log(N)) time where B is number
- * of bins and N is the number of procs in comm */
+ * in the same bin, splits in passes over a few bits of the bin number
+ * at a time, taking O(log(B)*log(N)) time for B bins and N procs, or
+ * uses lwgrp_comm_split if B is above LWGRP_SPLIT_BIN_SORT_BINS,
+ * which can be set in the environment */
 int lwgrp_comm_split_bin(
   const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
   int bins,               /* IN  - number of bins (non-negative integer) */
@@ -164,6 +280,21 @@ int lwgrp_comm_split(
                            *       ordered by key, then rank in comm */
 );
 
+/* runs count splits of comm at once, as if calling lwgrp_comm_split
+ * once for each (colors[i],keys[i]) pair, all procs must pass the same
+ * count, the splits share one sort and one scan, so this takes about
+ * as many messages as a single split, just larger ones */
+int lwgrp_comm_split_multi(
+  const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
+  int count,              /* IN  - number of splits (non-negative integer) */
+  const int colors[],     /* IN  - non-negative color value or MPI_UNDEFINED
+                           *       for each split (array of integers) */
+  const int keys[],       /* IN  - key value to order ranks for each split
+                           *       (array of integers) */
+  lwgrp_comm newcomms[]   /* OUT - lwgrp communicator for each split
+                           *       (array of comm structs) */
+);
+
 /* assigns an id to each unique string in the union of all strings of procs in comm */
 int lwgrp_comm_rank_str(
   const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
@@ -172,6 +303,23 @@ int lwgrp_comm_rank_str(
   int* groupid            /* OUT - rank of input string (non-negative integer) */
 );
 
+/* globally sort count items per process using compare, where every
+ * process provides the same count, on output process i holds items
+ * i*count to (i+1)*count-1 of the sorted sequence in ascending order,
+ * items are copied as blocks of extent bytes, so the datatype must
+ * describe a contiguous item with a lower bound of 0, the compare
+ * function returns a negative, zero, or positive value if its first
+ * item is less than, equal to, or greater than its second, and it is
+ * passed offset as its third argument */
+int lwgrp_comm_sort(
+  void* buf,              /* INOUT - array of count items (buffer) */
+  int count,              /* IN    - number of items on each process (non-negative integer) */
+  MPI_Datatype type,      /* IN    - item datatype (handle) */
+  int (*compare)(const void*, const void*, size_t), /* IN - comparison function */
+  size_t offset,          /* IN    - value passed to compare (non-negative integer) */
+  const lwgrp_comm* comm  /* IN    - lwgrp communicator (pointer to comm struct) */
+);
+
 /* frees memory associated with comm structure */
 int lwgrp_comm_free(
   lwgrp_comm* comm /* INOUT - lwgrp comm (pointer to comm struct) */
@@ -198,6 +346,17 @@ int lwgrp_chain_barrier_dissemination(
   const lwgrp_chain* group /* IN  - group (handle) */
 );
 
+/* broadcast for very large messages, pipelines segments of segcount
+ * elements out from the root along the chain in both directions */
+int lwgrp_chain_bcast_pipelined(
+  void* buffer,            /* IN  - send buffer (on root), receive buffer otherwise */
+  int count,               /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype datatype,   /* IN  - data type of buffer elements (handle) */
+  int root,                /* IN  - rank of root process (integer) */
+  int segcount,            /* IN  - number of elements per segment (positive integer) */
+  const lwgrp_chain* group /* IN  - group (handle) */
+);
+
 /* executes an allgather-like operation of a single integer */
 int lwgrp_chain_allgather_brucks_int(
   int sendint,
@@ -239,6 +398,20 @@ int lwgrp_chain_double_exscan_recursive(
   const lwgrp_chain* group /* IN  - group (handle) */
 );
 
+/* executes a left-to-right exclusive scan that starts over at each
+ * proc that sets flag, outbuf is left alone on rank 0 and on procs
+ * that set flag, the op need not be commutative */
+int lwgrp_chain_exscan_segmented_recursive(
+  const void* inbuf,       /* IN  - input buffer for reduction */
+  void* outbuf,            /* OUT - output buffer for reduction */
+  int count,               /* IN  - number of elements in buffer
+                            *       (non-negative integer) */
+  MPI_Datatype type,       /* IN  - buffer datatype (handle) */
+  MPI_Op op,               /* IN  - reduction operation (handle) */
+  int flag,                /* IN  - nonzero if we start a segment (logical) */
+  const lwgrp_chain* group /* IN  - group (handle) */
+);
+
 /* ---------------------------------
  * Collectives using logchains
  * --------------------------------- */
@@ -266,6 +439,51 @@ int lwgrp_logchain_allreduce_recursive(
   const lwgrp_logchain* list /* IN  - list (handle) */
 );
 
+/* allreduce for any group size without folding extra ranks, runs
+ * both exclusive scans at once in ceil(log2(N)) rounds, the op need
+ * not be commutative, but each rank groups the operands differently,
+ * so inexact ops like floating point sums may differ in the last bits
+ * from rank to rank, the recursive allreduce and reduce calls on
+ * logchains and logrings use this for non-power-of-two groups only
+ * with integer types and predefined ops */
+int lwgrp_logchain_allreduce_dissemination(
+  const void* inbuf,         /* IN  - input buffer for reduction */
+  void* outbuf,              /* OUT - output buffer for reduction */
+  int count,                 /* IN  - number of elements in buffer
+                              *       (non-negative integer) */
+  MPI_Datatype type,         /* IN  - buffer datatype (handle) */
+  MPI_Op op,                 /* IN  - reduction operation (handle) */
+  const lwgrp_chain* group,  /* IN  - group (handle) */
+  const lwgrp_logchain* list /* IN  - list (handle) */
+);
+
+/* allreduce for large messages and commutative ops, reduce-scatter
+ * by recursive halving followed by allgather by recursive doubling */
+int lwgrp_logchain_allreduce_rabenseifner(
+  const void* inbuf,         /* IN  - input buffer for reduction */
+  void* outbuf,              /* OUT - output buffer for reduction */
+  int count,                 /* IN  - number of elements in buffer
+                              *       (non-negative integer) */
+  MPI_Datatype type,         /* IN  - buffer datatype (handle) */
+  MPI_Op op,                 /* IN  - commutative reduction operation (handle) */
+  const lwgrp_chain* group,  /* IN  - group (handle) */
+  const lwgrp_logchain* list /* IN  - list (handle) */
+);
+
+/* reduce-scatter by recursive halving for commutative ops, rank i
+ * gets block i of the result, which holds counts[i] elements */
+int lwgrp_logchain_reduce_scatter_halving(
+  const void* inbuf,         /* IN  - input buffer for reduction, blocks
+                              *       of all ranks in rank order */
+  void* outbuf,              /* OUT - output buffer for our block */
+  const int counts[],        /* IN  - number of elements in block of each rank
+                              *       (array of non-negative integers) */
+  MPI_Datatype type,         /* IN  - buffer datatype (handle) */
+  MPI_Op op,                 /* IN  - commutative reduction operation (handle) */
+  const lwgrp_chain* group,  /* IN  - group (handle) */
+  const lwgrp_logchain* list /* IN  - list (handle) */
+);
+
 /* ---------------------------------
  * Collectives using rings
  * --------------------------------- */
@@ -291,6 +509,31 @@ int lwgrp_ring_split_bin_radix(
                            *       bin as calling process (handle) */
 );
 
+/* allreduce for large messages and commutative ops, pipelines
+ * blocks around the ring in a reduce-scatter and then an allgather */
+int lwgrp_ring_allreduce_pipelined(
+  const void* inbuf,      /* IN  - input buffer for reduction */
+  void* outbuf,           /* OUT - output buffer for reduction */
+  int count,              /* IN  - number of elements in buffer
+                           *       (non-negative integer) */
+  MPI_Datatype type,      /* IN  - buffer datatype (handle) */
+  MPI_Op op,              /* IN  - commutative reduction operation (handle) */
+  const lwgrp_ring* group /* IN  - group (handle) */
+);
+
+/* reduce-scatter for large messages and commutative ops, pipelines
+ * blocks around the ring, rank i gets block i of the result */
+int lwgrp_ring_reduce_scatter_pipelined(
+  const void* inbuf,      /* IN  - input buffer for reduction, blocks
+                           *       of all ranks in rank order */
+  void* outbuf,           /* OUT - output buffer for our block */
+  const int counts[],     /* IN  - number of elements in block of each rank
+                           *       (array of non-negative integers) */
+  MPI_Datatype type,      /* IN  - buffer datatype (handle) */
+  MPI_Op op,              /* IN  - commutative reduction operation (handle) */
+  const lwgrp_ring* group /* IN  - group (handle) */
+);
+
 int lwgrp_ring_alltoallv_linear(
   const void* sendbuf,    /* IN  - starting address of send buffer */
   const int sendcounts[], /* IN  - non-negative integer array (of length group size) specifying
@@ -327,6 +570,17 @@ int lwgrp_logring_bcast_binomial(
   const lwgrp_logring* list /* IN  - list (handle) */
 );
 
+/* broadcast for large messages, scatters blocks down a binomial tree
+ * and then collects them with a ring allgather */
+int lwgrp_logring_bcast_scatter_allgather(
+  void* buffer,             /* IN  - send buffer (on root), receive buffer otherwise */
+  int count,                /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - data type of buffer elements (handle) */
+  int root,                 /* IN  - rank of root process (integer) */
+  const lwgrp_ring* group,  /* IN  - group (handle) */
+  const lwgrp_logring* list /* IN  - list (handle) */
+);
+
 /* TODO: problem here in MPI is that intermediate ranks may use
  * a different type for which we can't just append lots of datatypes
  * in a temporary buffer */
@@ -340,6 +594,30 @@ int lwgrp_logring_gather_brucks(
   const lwgrp_logring* list /* IN  - list (handle) */
 );
 
+/* gather over a binomial tree, each process only buffers the items
+ * of its own subtree */
+int lwgrp_logring_gather_binomial(
+  const void* sendbuf,      /* IN  - send buffer (can be MPI_IN_PLACE on root) */
+  void* recvbuf,            /* OUT - receive buffer (significant only at root) */
+  int num,                  /* IN  - number of elements on each process (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - element datatype (handle) */
+  int root,                 /* IN  - rank of root process (integer) */
+  const lwgrp_ring* group,  /* IN  - group (handle) */
+  const lwgrp_logring* list /* IN  - list (handle) */
+);
+
+/* scatter over a binomial tree, each process only buffers the items
+ * of its own subtree */
+int lwgrp_logring_scatter_binomial(
+  const void* sendbuf,      /* IN  - send buffer (significant only at root) */
+  void* recvbuf,            /* OUT - receive buffer (can be MPI_IN_PLACE on root) */
+  int num,                  /* IN  - number of elements for each process (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - element datatype (handle) */
+  int root,                 /* IN  - rank of root process (integer) */
+  const lwgrp_ring* group,  /* IN  - group (handle) */
+  const lwgrp_logring* list /* IN  - list (handle) */
+);
+
 int lwgrp_logring_allgather_brucks(
   const void* sendbuf,      /* IN  - send buffer */
   void* recvbuf,            /* OUT - recive buffer */
@@ -367,6 +645,17 @@ int lwgrp_logring_alltoall_brucks(
   const lwgrp_logring* list /* IN  - list (handle) */
 );
 
+/* Bruck's alltoall that sends each round's blocks with an hindexed
+ * datatype rather than packing them, and skips the rotations */
+int lwgrp_logring_alltoall_brucks_indexed(
+  const void* sendbuf,      /* IN  - starting address of send buffer */
+  void* recvbuf,            /* OUT - address of receive buffer */
+  int num,                  /* IN  - number of elements sent to each process (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - data type of buffer elements (handle) */
+  const lwgrp_ring* group,  /* IN  - group (handle) */
+  const lwgrp_logring* list /* IN  - list (handle) */
+);
+
 int lwgrp_logring_alltoallv_linear(
   const void* sendbuf,      /* IN  - starting address of send buffer */
   const int sendcounts[],   /* IN  - non-negative integer array (of length group size) specifying
@@ -385,6 +674,27 @@ int lwgrp_logring_alltoallv_linear(
   const lwgrp_logring* list /* IN  - list (handle) */
 );
 
+/* alltoallv that learns all peer addresses up front, then keeps a
+ * window of sends and receives in flight, skipping zero counts */
+int lwgrp_logring_alltoallv_windowed(
+  const void* sendbuf,      /* IN  - starting address of send buffer */
+  const int sendcounts[],   /* IN  - non-negative integer array (of length group size) specifying
+                                     the number of elements to send to each processor */
+  const int senddispls[],   /* IN  - integer array (of length group size).  Entry j specifies
+                                     the displacement (relative to sendbuf) from which to take
+                                     the outgoing data destined for process j */
+  void* recvbuf,            /* OUT - address of receive buffer */
+  const int recvcounts[],   /* IN  - non-negative integer array (of length group size) specifying
+                                     the number of elements that can be received from each processor */
+  const int recvdispls[],   /* IN  - integer array (of length group size).  Entry i specifies
+                                     the displacement (relative to recvbuf) at which to palce the
+                                     incoming data from process i */
+  MPI_Datatype datatype,    /* IN  - data type of buffer elements (handle) */
+  int window,               /* IN  - max number of sends and of receives in flight (positive integer) */
+  const lwgrp_ring* group,  /* IN  - group (handle) */
+  const lwgrp_logring* list /* IN  - list (handle) */
+);
+
 int lwgrp_logring_reduce_recursive(
   const void* inbuf,         /* IN  - input buffer for reduction */
   void* outbuf,              /* OUT - output buffer for reduction */
@@ -438,6 +748,26 @@ int lwgrp_logring_double_exscan_recursive(
   const lwgrp_logring* list /* IN  - list (handle) */
 );
 
+/* ---------------------------------
+ * Collectives using klogrings
+ * --------------------------------- */
+
+/* execute a barrier over the ring in log_k N rounds */
+int lwgrp_klogring_barrier_dissemination(
+  const lwgrp_ring* group,   /* IN  - group (handle) */
+  const lwgrp_klogring* list /* IN  - list (handle) */
+);
+
+/* issue an allgather using Bruck's algorithm with k-1 ports */
+int lwgrp_klogring_allgather_brucks(
+  const void* sendbuf,       /* IN  - send buffer */
+  void* recvbuf,             /* OUT - receive buffer */
+  int num,                   /* IN  - number of elements on each process (non-negative integer) */
+  MPI_Datatype datatype,     /* IN  - element datatype (handle) */
+  const lwgrp_ring* group,   /* IN  - group (handle) */
+  const lwgrp_klogring* list /* IN  - list (handle) */
+);
+
 /* ---------------------------------
  * Comm Query routines
  * --------------------------------- */
@@ -462,6 +792,11 @@ int lwgrp_comm_barrier(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+/* uses a binomial tree for small messages, a scatter followed by an
+ * allgather for messages of at least LWGRP_BCAST_LARGE_BYTES bytes,
+ * and pipelines LWGRP_BCAST_SEGMENT_BYTES segments along the chain
+ * for messages of at least LWGRP_BCAST_PIPELINE_BYTES bytes, the
+ * thresholds can be set in the environment */
 int lwgrp_comm_bcast(
   void* buffer,          /* IN  - send buffer (on root), receive buffer otherwise */
   int count,             /* IN  - number of elements in buffer (non-negative integer) */
@@ -479,6 +814,15 @@ int lwgrp_comm_gather(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+int lwgrp_comm_scatter(
+  const void* sendbuf,   /* IN  - send buffer (significant only at root) */
+  void* recvbuf,         /* OUT - receive buffer */
+  int num,               /* IN  - number of elements for each process (non-negative integer) */
+  MPI_Datatype datatype, /* IN  - element datatype (handle) */
+  int root,              /* IN  - rank of root process (integer) */
+  const lwgrp_comm* comm /* IN  - group (handle) */
+);
+
 int lwgrp_comm_allgather(
   const void* sendbuf,   /* IN  - send buffer */
   void* recvbuf,         /* OUT - recive buffer */
@@ -499,6 +843,10 @@ int lwgrp_comm_allgatherv(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+/* uses Bruck's algorithm, which sends each round's blocks with a
+ * derived datatype rather than packing them if each proc sends at
+ * least LWGRP_ALLTOALL_INDEXED_BYTES, which can be set in the
+ * environment */
 int lwgrp_comm_alltoall(
   const void* sendbuf,   /* IN  - send buffer */
   void* recvbuf,         /* OUT - recive buffer */
@@ -534,6 +882,11 @@ int lwgrp_comm_reduce(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+/* uses recursive doubling for small messages and non-commutative ops,
+ * for commutative ops of at least LWGRP_ALLREDUCE_LARGE_BYTES bytes,
+ * uses a ring allreduce if each proc's block would be at least
+ * LWGRP_ALLREDUCE_RING_BLOCK_BYTES bytes and Rabenseifner's algorithm
+ * otherwise, both thresholds can be set in the environment */
 int lwgrp_comm_allreduce(
   const void* inbuf,     /* IN  - input buffer for reduction */
   void* outbuf,          /* OUT - output buffer for reduction */
@@ -543,6 +896,33 @@ int lwgrp_comm_allreduce(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+/* implements semantics of MPI_Reduce_scatter_block, for commutative
+ * ops uses recursive halving, or a ring if each block is at least
+ * LWGRP_ALLREDUCE_RING_BLOCK_BYTES bytes, and an allreduce followed
+ * by a local copy of our block for other ops */
+int lwgrp_comm_reduce_scatter_block(
+  const void* inbuf,     /* IN  - input buffer for reduction, holds
+                          *       count elements for each rank */
+  void* outbuf,          /* OUT - output buffer for our block */
+  int count,             /* IN  - number of elements in each block (non-negative integer) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  const lwgrp_comm* comm /* IN  - group (handle) */
+);
+
+/* implements semantics of MPI_Reduce_scatter, picks algorithms as
+ * lwgrp_comm_reduce_scatter_block does by the average block size */
+int lwgrp_comm_reduce_scatter(
+  const void* inbuf,     /* IN  - input buffer for reduction, blocks
+                          *       of all ranks in rank order */
+  void* outbuf,          /* OUT - output buffer for our block */
+  const int counts[],    /* IN  - number of elements in block of each rank
+                          *       (array of non-negative integers) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  const lwgrp_comm* comm /* IN  - group (handle) */
+);
+
 int lwgrp_comm_scan(
   const void* inbuf,     /* IN  - input buffer for reduction */
   void* outbuf,          /* OUT - output buffer for reduction */
@@ -572,6 +952,578 @@ int lwgrp_comm_double_exscan(
   const lwgrp_comm* comm /* IN  - group (handle) */
 );
 
+/* inclusive scan that starts over at each proc that sets flag, so
+ * each proc ends up with the reduction of the inputs from the last
+ * proc at or before it that set flag, rank 0 always starts a segment,
+ * the op need not be commutative */
+int lwgrp_comm_scan_segmented(
+  const void* inbuf,     /* IN  - input buffer for reduction */
+  void* outbuf,          /* OUT - output buffer for reduction */
+  int count,             /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  int flag,              /* IN  - nonzero if we start a segment (logical) */
+  const lwgrp_comm* comm /* IN  - group (handle) */
+);
+
+/* exclusive form of lwgrp_comm_scan_segmented, as with exscan,
+ * outbuf is left alone on procs that start a segment */
+int lwgrp_comm_exscan_segmented(
+  const void* inbuf,     /* IN  - input buffer for reduction */
+  void* outbuf,          /* OUT - output buffer for reduction */
+  int count,             /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  int flag,              /* IN  - nonzero if we start a segment (logical) */
+  const lwgrp_comm* comm /* IN  - group (handle) */
+);
+
+/* ---------------------------------
+ * Nonblocking collectives using comms
+ * --------------------------------- */
+
+/* make progress on a nonblocking operation, sets flag to 1 and
+ * req to LWGRP_REQUEST_NULL if the operation has completed,
+ * sets flag to 0 otherwise, a persistent request is left allocated
+ * and inactive once it completes */
+int lwgrp_test(
+  lwgrp_request* req, /* INOUT - request (handle) */
+  int* flag           /* OUT   - true if operation completed (logical) */
+);
+
+/* wait for a nonblocking operation to complete,
+ * sets req to LWGRP_REQUEST_NULL unless it is persistent */
+int lwgrp_wait(
+  lwgrp_request* req /* INOUT - request (handle) */
+);
+
+int lwgrp_comm_ibarrier(
+  lwgrp_comm* comm,   /* IN  - group (handle) */
+  lwgrp_request* req  /* OUT - request (handle) */
+);
+
+int lwgrp_comm_ibcast(
+  void* buffer,          /* IN  - send buffer (on root), receive buffer otherwise */
+  int count,             /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype datatype, /* IN  - data type of buffer elements (handle) */
+  int root,              /* IN  - rank of root process (integer) */
+  lwgrp_comm* comm,      /* IN  - group (handle) */
+  lwgrp_request* req     /* OUT - request (handle) */
+);
+
+int lwgrp_comm_iallgather(
+  const void* sendbuf,   /* IN  - send buffer */
+  void* recvbuf,         /* OUT - recive buffer */
+  int num,               /* IN  - number of elements on each process (non-negative integer) */
+  MPI_Datatype datatype, /* IN  - element datatype (handle) */
+  lwgrp_comm* comm,      /* IN  - group (handle) */
+  lwgrp_request* req     /* OUT - request (handle) */
+);
+
+int lwgrp_comm_iallreduce(
+  const void* inbuf,     /* IN  - input buffer for reduction */
+  void* outbuf,          /* OUT - output buffer for reduction */
+  int count,             /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  lwgrp_comm* comm,      /* IN  - group (handle) */
+  lwgrp_request* req     /* OUT - request (handle) */
+);
+
+/* Persistent collectives are set up once with an _init call, which
+ * works out partners and allocates scratch space, and can then be run
+ * any number of times with lwgrp_start followed by lwgrp_test or
+ * lwgrp_wait, which leave the request allocated.  The _init calls are
+ * collective over comm and, like lwgrp_start, must be called in the
+ * same order on all procs along with nonblocking ops on the comm.
+ * Buffers and counts are fixed at init, though the data in them may
+ * change between runs.  Free the request with lwgrp_request_free. */
+int lwgrp_comm_barrier_init(
+  lwgrp_comm* comm,   /* IN  - group (handle) */
+  lwgrp_request* req  /* OUT - persistent request (handle) */
+);
+
+int lwgrp_comm_allgather_init(
+  const void* sendbuf,   /* IN  - send buffer, or MPI_IN_PLACE */
+  void* recvbuf,         /* OUT - recive buffer */
+  int num,               /* IN  - number of elements on each process (non-negative integer) */
+  MPI_Datatype datatype, /* IN  - element datatype (handle) */
+  lwgrp_comm* comm,      /* IN  - group (handle) */
+  lwgrp_request* req     /* OUT - persistent request (handle) */
+);
+
+int lwgrp_comm_allreduce_init(
+  const void* inbuf,     /* IN  - input buffer for reduction, or MPI_IN_PLACE */
+  void* outbuf,          /* OUT - output buffer for reduction */
+  int count,             /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype type,     /* IN  - buffer datatype (handle) */
+  MPI_Op op,             /* IN  - reduction operation (handle) */
+  lwgrp_comm* comm,      /* IN  - group (handle) */
+  lwgrp_request* req     /* OUT - persistent request (handle) */
+);
+
+/* start an inactive persistent request */
+int lwgrp_start(
+  lwgrp_request* req /* INOUT - persistent request (handle) */
+);
+
+/* free a request, waits for the op to complete if it's still active,
+ * sets req to LWGRP_REQUEST_NULL */
+int lwgrp_request_free(
+  lwgrp_request* req /* INOUT - request (handle) */
+);
+
+/* nonblocking version of lwgrp_comm_split,
+ * newcomm is valid once the request completes */
+int lwgrp_comm_isplit(
+  lwgrp_comm* comm,       /* IN  - lwgrp communicator (pointer to comm struct) */
+  int color,              /* IN  - non-negative color value or MPI_UNDEFINED (integer) */
+  int key,                /* IN  - key value to order ranks (integer) */
+  lwgrp_comm* newcomm,    /* OUT - lwgrp communicator of all procs with same color,
+                           *       ordered by key, then rank in comm */
+  lwgrp_request* req      /* OUT - request (handle) */
+);
+
+/* ---------------------------------
+ * Sparse exchanges using comms
+ * --------------------------------- */
+
+/* Each proc sends to and receives from a short list of group ranks,
+ * so count arrays are O(degree) rather than O(N).  The first sparse
+ * op on a comm builds a table to map group ranks to addresses in the
+ * parent MPI communicator, which takes O(log N) time and O(N) memory,
+ * the table is kept on the comm until it is freed, so the first call
+ * must be made by all procs in comm. */
+
+/* exchange data with neighbors, where each proc knows both who it
+ * sends to and who it receives from, zero-size messages are skipped,
+ * so the sender and receiver must agree on each count */
+int lwgrp_comm_neighbor_alltoallv(
+  const void* sendbuf,    /* IN  - starting address of send buffer */
+  int outdegree,          /* IN  - number of procs we send to (non-negative integer) */
+  const int dests[],      /* IN  - group ranks to send to (array of length outdegree) */
+  const int sendcounts[], /* IN  - number of elements to send to each dest
+                           *       (non-negative integer array of length outdegree) */
+  const int senddispls[], /* IN  - displacement in sendbuf of data for each dest
+                           *       (integer array of length outdegree) */
+  void* recvbuf,          /* OUT - starting address of receive buffer */
+  int indegree,           /* IN  - number of procs we receive from (non-negative integer) */
+  const int sources[],    /* IN  - group ranks to receive from (array of length indegree) */
+  const int recvcounts[], /* IN  - number of elements to receive from each source
+                           *       (non-negative integer array of length indegree) */
+  const int recvdispls[], /* IN  - displacement in recvbuf for data from each source
+                           *       (integer array of length indegree) */
+  MPI_Datatype datatype,  /* IN  - data type of buffer elements (handle) */
+  lwgrp_comm* comm        /* IN  - group (handle) */
+);
+
+/* exchange data where each proc knows who it sends to, but not who
+ * it receives from, all messages are received into a single newly
+ * allocated buffer, ordered by arrival, which the caller must free
+ * with lwgrp_comm_sparse_free, uses synchronous sends followed by a
+ * nonblocking barrier to detect when all messages have arrived */
+int lwgrp_comm_sparse_exchange(
+  const void* sendbuf,    /* IN  - starting address of send buffer */
+  int outdegree,          /* IN  - number of procs we send to (non-negative integer) */
+  const int dests[],      /* IN  - group ranks to send to (array of length outdegree) */
+  const int sendcounts[], /* IN  - number of elements to send to each dest
+                           *       (non-negative integer array of length outdegree) */
+  const int senddispls[], /* IN  - displacement in sendbuf of data for each dest
+                           *       (integer array of length outdegree) */
+  MPI_Datatype datatype,  /* IN  - data type of buffer elements (handle) */
+  void** recvbuf,         /* OUT - received data (buffer) */
+  int* indegree,          /* OUT - number of messages received (non-negative integer) */
+  int** sources,          /* OUT - group rank that sent each message (array of length indegree) */
+  int** recvcounts,       /* OUT - number of elements in each message (array of length indegree) */
+  int** recvdispls,       /* OUT - displacement in recvbuf of each message (array of length indegree) */
+  lwgrp_comm* comm        /* IN  - group (handle) */
+);
+
+/* free buffers returned by lwgrp_comm_sparse_exchange and set them to NULL */
+int lwgrp_comm_sparse_free(
+  void** recvbuf,         /* INOUT - received data (buffer) */
+  MPI_Datatype datatype,  /* IN    - data type of buffer elements (handle) */
+  int** sources,          /* INOUT - source array */
+  int** recvcounts,       /* INOUT - count array */
+  int** recvdispls        /* INOUT - displacement array */
+);
+
+/* ---------------------------------
+ * Group algebra using comms
+ * --------------------------------- */
+
+/* None of these build a table of all members.  Each member knows its
+ * own rank in every comm it belongs to, so a proc that is not in a
+ * comm passes the empty group, which is what lwgrp_comm_split returns
+ * to procs that give MPI_UNDEFINED.  New groups are built by a split
+ * and so get a context of their own. */
+
+/* given count ranks in comm1, return the ranks of those procs in comm2,
+ * or MPI_UNDEFINED for those not in comm2, MPI_PROC_NULL maps to
+ * MPI_PROC_NULL, if comm2 is NULL, return the rank of each proc in the
+ * MPI communicator of comm1 instead, collective over comm1, and each
+ * member may ask about a different list -- O(log N) communication */
+int lwgrp_comm_translate_ranks(
+  const lwgrp_comm* comm1, /* IN  - lwgrp communicator (pointer to comm struct) */
+  int count,               /* IN  - number of ranks to translate (non-negative integer) */
+  const int ranks1[],      /* IN  - ranks in comm1 (array of length count) */
+  const lwgrp_comm* comm2, /* IN  - lwgrp communicator (pointer to comm struct) or NULL */
+  int ranks2[]             /* OUT - corresponding ranks in comm2 (array of length count) */
+);
+
+/* build the union of comm1 and comm2, ordered as the members of comm1
+ * followed by the members of comm2 that are not in comm1, as in
+ * MPI_Group_union, collective over comm, which must hold every member
+ * of both -- O(log N) to O(log^2 N) communication */
+int lwgrp_comm_union(
+  const lwgrp_comm* comm,  /* IN  - lwgrp communicator holding comm1 and comm2
+                            *       (pointer to comm struct) */
+  const lwgrp_comm* comm1, /* IN  - first group (pointer to comm struct) */
+  const lwgrp_comm* comm2, /* IN  - second group (pointer to comm struct) */
+  lwgrp_comm* newcomm      /* OUT - union of comm1 and comm2 (pointer to comm struct) */
+);
+
+/* build the group of members of comm1 that are also in comm2, ordered
+ * by rank in comm1, collective over comm1 --
+ * O(log N) to O(log^2 N) communication */
+int lwgrp_comm_intersection(
+  const lwgrp_comm* comm1, /* IN  - first group (pointer to comm struct) */
+  const lwgrp_comm* comm2, /* IN  - second group (pointer to comm struct) */
+  lwgrp_comm* newcomm      /* OUT - intersection of comm1 and comm2 (pointer to comm struct) */
+);
+
+/* build the group of the count procs listed in ranks, in list order,
+ * as in MPI_Group_incl, all procs in comm must pass the same list,
+ * procs not in the list get the empty group -- O(count) local plus
+ * O(log N) to O(log^2 N) communication */
+int lwgrp_comm_incl(
+  const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
+  int count,              /* IN  - number of ranks in list (non-negative integer) */
+  const int ranks[],      /* IN  - distinct ranks in comm (array of length count) */
+  lwgrp_comm* newcomm     /* OUT - group of listed procs (pointer to comm struct) */
+);
+
+/* build the group of procs in comm that are not listed in ranks, in
+ * order of rank in comm, as in MPI_Group_excl, all procs in comm must
+ * pass the same list, procs in the list get the empty group --
+ * O(count) local plus O(log N) to O(log^2 N) communication */
+int lwgrp_comm_excl(
+  const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
+  int count,              /* IN  - number of ranks in list (non-negative integer) */
+  const int ranks[],      /* IN  - distinct ranks in comm (array of length count) */
+  lwgrp_comm* newcomm     /* OUT - group of procs not listed (pointer to comm struct) */
+);
+
+/* return the members of comm in order, as ranks in the MPI
+ * communicator comm was built on, compressed into (first, last,
+ * stride) triples that can be handed straight to
+ * MPI_Group_range_incl, so a contiguous or evenly strided group takes
+ * a single triple rather than a list of all members, procs not in
+ * comm get a count of 0, collective over comm, the caller frees the
+ * list with lwgrp_comm_ranges_free --
+ * O(log N) communication of the whole list */
+int lwgrp_comm_ranges(
+  const lwgrp_comm* comm, /* IN  - lwgrp communicator (pointer to comm struct) */
+  int* count,             /* OUT - number of triples (non-negative integer) */
+  int** ranges            /* OUT - array of 3*count integers */
+);
+
+/* free a list returned by lwgrp_comm_ranges and set it to NULL */
+int lwgrp_comm_ranges_free(
+  int** ranges /* INOUT - list to free (pointer to array) */
+);
+
+/* ---------------------------------
+ * One-sided transport
+ * --------------------------------- */
+
+/* With MPI-3, allgather and the binomial tree bcast of a comm can move
+ * data with MPI_Put rather than messages.  A single dynamic window is
+ * created on the parent MPI communicator and shared by every comm
+ * built on it, so picking the transport of a comm costs one exchange
+ * of addresses with its O(log N) logring partners, and creating and
+ * freeing groups stays as light as before.  Each op attaches the
+ * buffers it receives into and has receivers post their addresses to
+ * the senders, so data lands in place with one put per round.  Comms
+ * on a parent without a window, and all comms without MPI-3, keep
+ * sending messages. */
+
+enum lwgrp_transport {
+  LWGRP_TRANSPORT_P2P, /* point-to-point messages, the default */
+  LWGRP_TRANSPORT_RMA  /* puts through the window of the parent comm */
+};
+
+/* create the dynamic window shared by all comms built on comm,
+ * does nothing if comm already has one, if the MPI library fails to
+ * create the window, comms built on comm keep sending messages --
+ * collective over comm */
+int lwgrp_rma_init(
+  MPI_Comm comm /* IN  - MPI communicator (handle) */
+);
+
+/* free the window of comm, all comms built on comm that use the
+ * one-sided transport must be freed or set back to
+ * LWGRP_TRANSPORT_P2P first -- collective over comm */
+int lwgrp_rma_finalize(
+  MPI_Comm comm /* IN  - MPI communicator (handle) */
+);
+
+/* select how ops on comm move data, all members must pass the same
+ * transport, switching to LWGRP_TRANSPORT_RMA is collective over comm
+ * and O(log N) communication, switching back is local */
+int lwgrp_comm_set_transport(
+  lwgrp_comm* comm, /* INOUT - lwgrp communicator (pointer to comm struct) */
+  int transport     /* IN    - transport to use (enum lwgrp_transport) */
+);
+
+/* ---------------------------------
+ * Algorithm selection
+ * --------------------------------- */
+
+/* Comm collectives with more than one algorithm look up a table of
+ * rules.  The first rule that matches the op, the group size, the
+ * message size, and whether the group size is a power of two picks
+ * the algorithm, and ops that no rule matches use the built-in
+ * thresholds, like LWGRP_BCAST_LARGE_BYTES or LWGRP_SORT_SAMPLE_RANKS.
+ * On first use the table is read from the rules in the environment
+ * variable LWGRP_TUNE, followed by those in the file named by
+ * LWGRP_TUNE_FILE.  Rules are separated by newlines or ';', '#'
+ * starts a comment, and each rule has five fields
+ *
+ *   op  ranks  bytes  pow2  alg
+ *
+ * where ranks and bytes are a number, a range lo-hi, lo-* or *, sizes
+ * may end in K, M or G, and pow2 is 1 for power-of-two group sizes, 0
+ * for the others, or * for both.  The message size is count times the
+ * extent of the datatype, which for alltoall is the block sent to each
+ * proc, for reduce_scatter the average block each proc gets, and for
+ * sort the items each proc holds.  The ops and their algorithms are
+ *
+ *   barrier         dissemination  chain
+ *   bcast           binomial  scatter_allgather  pipelined
+ *   gather          binomial  brucks
+ *   alltoall        brucks  indexed
+ *   allreduce       recursive  rabenseifner  ring
+ *   reduce_scatter  allreduce  halving  ring
+ *   sort            gather  bitonic  sample
+ *
+ * An algorithm that can't run a given call, like rabenseifner with a
+ * non-commutative op or fewer elements than procs, gives way to the
+ * built-in choice.  All procs must use the same rules.  Running
+ * lwgrp_bench with -t writes a table measured on the machine it runs
+ * on. */
+
+/* replace the table with the rules in string, or with the rules in
+ * the environment if rules is NULL, must not be called while other
+ * threads run collectives -- local */
+int lwgrp_tune_set(
+  const char* rules /* IN  - rules (string) or NULL */
+);
+
+/* replace the table with the rules in the file at path, keeps the
+ * current table if the file can't be read -- local */
+int lwgrp_tune_load(
+  const char* path  /* IN  - name of tuning file (string) */
+);
+
+/* ---------------------------------
+ * Scratch pool
+ * --------------------------------- */
+
+/* Temporary buffers used by collectives come from a pool of
+ * power-of-two size classes, freed buffers are kept for reuse up to
+ * a limit on the bytes held in the pool, which defaults to
+ * LWGRP_SCRATCH_POOL_BYTES and can be set in the environment.  Each
+ * thread has its own pool, and the calls below act on the pool of
+ * the calling thread. */
+
+/* get the number of bytes currently handed out, the most bytes ever
+ * handed out at once, and the number of bytes cached for reuse */
+int lwgrp_scratch_query(
+  size_t* inuse,     /* OUT - bytes in use (non-negative integer) */
+  size_t* highwater, /* OUT - high-water mark of bytes in use (non-negative integer) */
+  size_t* cached     /* OUT - bytes held for reuse (non-negative integer) */
+);
+
+/* set the maximum number of bytes cached for reuse, frees cached
+ * buffers beyond the new limit, a limit of 0 frees all of them */
+int lwgrp_scratch_set_limit(
+  size_t bytes       /* IN  - maximum bytes held for reuse (non-negative integer) */
+);
+
+/* ---------------------------------
+ * Hierarchical comms
+ * --------------------------------- */
+
+/* create a hierarchical comm from an MPI communicator, the node
+ * groups are found with MPI_Comm_split_type, so this is collective
+ * over comm, without MPI-3 each proc is its own node, each node group
+ * with more than one proc allocates a shared memory window with
+ * LWGRP_SHM_SLOT_BYTES of data for each proc, which can be set in the
+ * environment, where 0 disables the shared memory path */
+int lwgrp_hcomm_build_from_mpicomm(
+  MPI_Comm comm,        /* IN  - MPI communicator (handle) */
+  lwgrp_hcomm* newcomm  /* OUT - hierarchical communicator (pointer to hcomm struct) */
+);
+
+/* implements semantics of MPI_Comm_split, members of each node group
+ * remain on the same node, so the node groups and their shared memory
+ * are split without sending anything off node */
+int lwgrp_hcomm_split(
+  const lwgrp_hcomm* comm, /* IN  - hierarchical communicator (pointer to hcomm struct) */
+  int color,               /* IN  - non-negative color value or MPI_UNDEFINED (integer) */
+  int key,                 /* IN  - key value to order ranks (integer) */
+  lwgrp_hcomm* newcomm     /* OUT - hierarchical communicator of all procs with same color,
+                            *       ordered by key, then rank in comm */
+);
+
+/* frees memory associated with hierarchical comm structure, freeing
+ * the shared memory window is collective over the procs on our node */
+int lwgrp_hcomm_free(
+  lwgrp_hcomm* comm /* INOUT - hierarchical comm (pointer to hcomm struct) */
+);
+
+int lwgrp_hcomm_barrier(
+  const lwgrp_hcomm* comm /* IN  - group (handle) */
+);
+
+/* root is a rank in comm->comm */
+int lwgrp_hcomm_bcast(
+  void* buffer,             /* IN  - send buffer (on root), receive buffer otherwise */
+  int count,                /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - buffer datatype (handle) */
+  int root,                 /* IN  - rank of root in comm (integer) */
+  const lwgrp_hcomm* comm   /* IN  - group (handle) */
+);
+
+/* gathers within each node, then across leaders, then broadcasts
+ * the result within each node, in order of rank in comm */
+int lwgrp_hcomm_allgather(
+  const void* sendbuf,      /* IN  - send buffer */
+  void* recvbuf,            /* OUT - receive buffer */
+  int count,                /* IN  - number of elements from each proc (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - buffer datatype (handle) */
+  const lwgrp_hcomm* comm   /* IN  - group (handle) */
+);
+
+/* reduces within each node, then across leaders, then broadcasts
+ * within each node, since node groups need not hold consecutive
+ * ranks, non-commutative ops use lwgrp_comm_allreduce on comm->comm */
+int lwgrp_hcomm_allreduce(
+  const void* sendbuf,      /* IN  - send buffer */
+  void* recvbuf,            /* OUT - receive buffer */
+  int count,                /* IN  - number of elements in buffer (non-negative integer) */
+  MPI_Datatype datatype,    /* IN  - buffer datatype (handle) */
+  MPI_Op op,                /* IN  - reduction operation (handle) */
+  const lwgrp_hcomm* comm   /* IN  - group (handle) */
+);
+
+/* ---------------------------------
+ * Statistics
+ * --------------------------------- */
+
+/* When built with --enable-stats, lwgrp counts the work done by each
+ * operation: calls, communication rounds, messages and bytes sent,
+ * wall time, time blocked waiting on messages, and scratch bytes
+ * allocated.  Counting is off until enabled with lwgrp_stats_enable
+ * or by setting LWGRP_STATS=1 in the environment.  An operation that
+ * calls others, like a split running allreduces, is counted once as
+ * the outermost operation.  Messages of kernels called directly on
+ * chains, rings, logchains and logrings count toward
+ * LWGRP_STATS_OTHER.  Counters are kept per thread, and these calls
+ * act on those of the calling thread.  Without --enable-stats, the
+ * calls below succeed but all counters stay zero. */
+
+enum lwgrp_stats_op {
+  LWGRP_STATS_BARRIER,
+  LWGRP_STATS_BCAST,
+  LWGRP_STATS_GATHER,
+  LWGRP_STATS_SCATTER,
+  LWGRP_STATS_ALLGATHER,
+  LWGRP_STATS_ALLGATHERV,
+  LWGRP_STATS_ALLTOALL,
+  LWGRP_STATS_ALLTOALLV,
+  LWGRP_STATS_REDUCE,
+  LWGRP_STATS_ALLREDUCE,
+  LWGRP_STATS_SCAN,
+  LWGRP_STATS_EXSCAN,
+  LWGRP_STATS_DOUBLE_EXSCAN,
+  LWGRP_STATS_REDUCE_SCATTER, /* reduce_scatter and reduce_scatter_block */
+  LWGRP_STATS_SEGMENTED_SCAN, /* scan_segmented and exscan_segmented */
+  LWGRP_STATS_SPLIT,       /* split and split_multi */
+  LWGRP_STATS_SPLIT_BIN,
+  LWGRP_STATS_RANK_STR,
+  LWGRP_STATS_SORT,
+  LWGRP_STATS_IBARRIER,
+  LWGRP_STATS_IBCAST,
+  LWGRP_STATS_IALLGATHER,
+  LWGRP_STATS_IALLREDUCE,
+  LWGRP_STATS_ISPLIT,
+  LWGRP_STATS_PERSISTENT,  /* runs of persistent ops from lwgrp_start */
+  LWGRP_STATS_NEIGHBOR,    /* neighbor_alltoallv */
+  LWGRP_STATS_SPARSE,      /* sparse_exchange */
+  LWGRP_STATS_GROUP,       /* translate_ranks, union, intersection, incl, excl */
+  LWGRP_STATS_OTHER,       /* everything outside the ops above */
+  LWGRP_STATS_OPS
+};
+
+typedef struct lwgrp_stats_counters {
+  unsigned long calls;         /* number of times the op was called */
+  unsigned long rounds;        /* blocking communication steps */
+  unsigned long messages;      /* messages sent */
+  unsigned long bytes;         /* bytes sent */
+  unsigned long scratch_bytes; /* bytes taken from the scratch pool */
+  double time;                 /* seconds spent in the op */
+  double wait_time;            /* seconds blocked waiting on messages */
+} lwgrp_stats_counters;
+
+/* events passed to a hook */
+#define LWGRP_STATS_EVENT_BEGIN (0)
+#define LWGRP_STATS_EVENT_END   (1)
+
+/* a hook is called as each outermost op begins and ends on the calling
+ * thread, counters is NULL on begin and holds the counts of just this
+ * call on end, which lets a profiler attach its own timers or totals,
+ * progress of a nonblocking op in lwgrp_test or lwgrp_wait is
+ * reported as a begin and end without adding to calls */
+typedef void (*lwgrp_stats_hook)(
+  int op,                               /* IN  - operation (lwgrp_stats_op) */
+  int event,                            /* IN  - LWGRP_STATS_EVENT_BEGIN or END */
+  const lwgrp_stats_counters* counters, /* IN  - counts of this call on end, NULL on begin */
+  void* arg                             /* IN  - argument given to lwgrp_stats_set_hook */
+);
+
+/* turn counting on or off */
+int lwgrp_stats_enable(
+  int flag /* IN  - 1 to count, 0 to stop (integer) */
+);
+
+/* zero all counters */
+int lwgrp_stats_reset(void);
+
+/* get the counters for an op */
+int lwgrp_stats_get(
+  int op,                         /* IN  - operation (lwgrp_stats_op) */
+  lwgrp_stats_counters* counters  /* OUT - counters (pointer to struct) */
+);
+
+/* returns the name of an op, like "allreduce" */
+const char* lwgrp_stats_name(
+  int op /* IN  - operation (lwgrp_stats_op) */
+);
+
+/* set the hook called on all threads, NULL removes it, the hook
+ * should be set before threads start calling lwgrp */
+int lwgrp_stats_set_hook(
+  lwgrp_stats_hook hook, /* IN  - hook function (function pointer) */
+  void* arg              /* IN  - argument passed to hook (pointer) */
+);
+
+/* print one line of counters for each op that has been called */
+int lwgrp_stats_dump(
+  FILE* stream /* IN  - where to print, stdout if NULL (file handle) */
+);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -58,8 +58,8 @@ int lwgrp_chain_split_bin_scan(
 
   /* allocate space for our send and receive buffers */
   int elements = 2 * num_bins + 1;
-  int* bins = (int*) lwgrp_malloc(
-    4 * elements * sizeof(int), sizeof(int), __FILE__, __LINE__
+  int* bins = (int*) lwgrp_scratch_alloc(
+    4 * elements * sizeof(int), __FILE__, __LINE__
   );
   if (bins == NULL) {
     /* TODO: fail */
@@ -106,7 +106,7 @@ int lwgrp_chain_split_bin_scan(
     if (left_rank != MPI_PROC_NULL) {
       /* receive right-going data from the left */
       MPI_Irecv(
-        recv_left_bins, elements, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        recv_left_bins, elements, MPI_INT, left_rank, in->tag,
         comm, &request[k]
       );
       k++;
@@ -115,7 +115,7 @@ int lwgrp_chain_split_bin_scan(
        * it our data */
       send_left_bins[rank_index] = right_rank;
       MPI_Isend(
-        send_left_bins, elements, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        send_left_bins, elements, MPI_INT, left_rank, in->tag,
         comm, &request[k]
       );
       k++;
@@ -126,7 +126,7 @@ int lwgrp_chain_split_bin_scan(
     if (right_rank != MPI_PROC_NULL) {
       /* receive left-going data from the right */
       MPI_Irecv(
-        recv_right_bins, elements, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        recv_right_bins, elements, MPI_INT, right_rank, in->tag,
         comm, &request[k]
       );
       k++;
@@ -135,7 +135,7 @@ int lwgrp_chain_split_bin_scan(
        * it our data */
       send_right_bins[rank_index] = left_rank;
       MPI_Isend(
-        send_right_bins, elements, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        send_right_bins, elements, MPI_INT, right_rank, in->tag,
         comm, &request[k]
       );
       k++;
@@ -214,12 +214,13 @@ int lwgrp_chain_split_bin_scan(
     out->comm_right = my_right;
     out->group_rank = count_left;
     out->group_size = count_left + count_right + 1;
+    out->tag        = in->tag;
   } else {
     /* create an empty group */
     lwgrp_chain_set_null(out);
   }
 
-  lwgrp_free(&bins);
+  lwgrp_scratch_free(&bins);
 
   return LWGRP_SUCCESS; 
 }
@@ -244,7 +245,7 @@ int lwgrp_chain_barrier_dissemination(const lwgrp_chain* group)
     if (left_rank != MPI_PROC_NULL) {
       /* receive right-going data from the left */
       MPI_Irecv(
-        &recv_left, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        &recv_left, 1, MPI_INT, left_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -252,7 +253,7 @@ int lwgrp_chain_barrier_dissemination(const lwgrp_chain* group)
       /* inform rank to our left of the rank on our right,
        * and send it our data */
       MPI_Isend(
-        &right_rank, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0,
+        &right_rank, 1, MPI_INT, left_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -263,7 +264,7 @@ int lwgrp_chain_barrier_dissemination(const lwgrp_chain* group)
     if (right_rank != MPI_PROC_NULL) {
       /* receive left-going data from the right */
       MPI_Irecv(
-        &recv_right, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        &recv_right, 1, MPI_INT, right_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -271,7 +272,7 @@ int lwgrp_chain_barrier_dissemination(const lwgrp_chain* group)
       /* inform rank to our right of the rank on our left,
        * and send it our data */
       MPI_Isend(
-        &left_rank, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+        &left_rank, 1, MPI_INT, right_rank, group->tag,
         comm, &request[k]
       );
       k++;
@@ -290,6 +291,105 @@ int lwgrp_chain_barrier_dissemination(const lwgrp_chain* group)
   return LWGRP_SUCCESS; 
 }
 
+/* broadcast by passing segments of segcount elements along the chain,
+ * the root sends each segment both left and right, and every other
+ * proc receives each segment from the side facing the root and
+ * forwards it away from the root, so that segment i+1 is received
+ * while segment i is being forwarded, for S segments each link
+ * carries the buffer once and the time is about (N+S) segment hops,
+ * which beats a binomial tree for very large messages */
+int lwgrp_chain_bcast_pipelined(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  int segcount,
+  const lwgrp_chain* group)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* get chain info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+
+  /* pick a valid segment size */
+  if (segcount <= 0 || segcount > count) {
+    segcount = count;
+  }
+
+  /* determine where data comes from and where we forward it */
+  int src   = MPI_PROC_NULL;
+  int dst_k = 0;
+  int dst[2];
+  if (rank == root) {
+    /* the root sends in both directions */
+    if (group->comm_left != MPI_PROC_NULL) {
+      dst[dst_k++] = group->comm_left;
+    }
+    if (group->comm_right != MPI_PROC_NULL) {
+      dst[dst_k++] = group->comm_right;
+    }
+  } else if (rank < root) {
+    /* data flows right-to-left on the left side of the root */
+    src = group->comm_right;
+    if (group->comm_left != MPI_PROC_NULL) {
+      dst[dst_k++] = group->comm_left;
+    }
+  } else {
+    /* data flows left-to-right on the right side of the root */
+    src = group->comm_left;
+    if (group->comm_right != MPI_PROC_NULL) {
+      dst[dst_k++] = group->comm_right;
+    }
+  }
+
+  /* walk through the buffer one segment at a time, we keep the sends
+   * of one segment outstanding while we receive the next */
+  MPI_Request request[2];
+  MPI_Status  status[2];
+  int k = 0;
+  int offset = 0;
+  while (offset < count) {
+    int num = count - offset;
+    if (num > segcount) {
+      num = segcount;
+    }
+    void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buffer, offset, &dt);
+
+    /* receive the segment from upstream */
+    if (src != MPI_PROC_NULL) {
+      MPI_Recv(
+        ptr, num, datatype, src, group->tag, comm, status
+      );
+    }
+
+    /* wait for the sends of the previous segment to finish */
+    if (k > 0) {
+      MPI_Waitall(k, request, status);
+      k = 0;
+    }
+
+    /* forward the segment downstream */
+    int i;
+    for (i = 0; i < dst_k; i++) {
+      MPI_Isend(
+        ptr, num, datatype, dst[i], group->tag, comm, &request[k]
+      );
+      k++;
+    }
+
+    offset += num;
+  }
+
+  /* wait for the sends of the last segment */
+  if (k > 0) {
+    MPI_Waitall(k, request, status);
+  }
+
+  return LWGRP_SUCCESS;
+}
+
 /* issues an allgather operation over the processes in the
  * specified group */
 int lwgrp_chain_allgather_brucks_int(
@@ -307,8 +407,8 @@ int lwgrp_chain_allgather_brucks_int(
   int scratch_size = 4 * buf_size;
   char* scratch = NULL;
   if (scratch_size > 0) {
-    scratch = (char*) lwgrp_malloc(
-      scratch_size, sizeof(int), __FILE__, __LINE__
+    scratch = (char*) lwgrp_scratch_alloc(
+      scratch_size, __FILE__, __LINE__
     );
   }
 
@@ -336,7 +436,7 @@ int lwgrp_chain_allgather_brucks_int(
       /* issue receive for data from left partner */
       MPI_Irecv(
         recv_left_buf, max_ints, MPI_INT, left_rank,
-        LWGRP_MSG_TAG_0, comm, &request[k]
+        group->tag, comm, &request[k]
       );
       k++;
 
@@ -353,7 +453,7 @@ int lwgrp_chain_allgather_brucks_int(
       /* send the data */
       MPI_Isend(
         (void*)send_left_buf, (1 + left_count), MPI_INT, left_rank,
-        LWGRP_MSG_TAG_0, comm, &request[k]
+        group->tag, comm, &request[k]
       );
       k++;
     }
@@ -364,7 +464,7 @@ int lwgrp_chain_allgather_brucks_int(
       /* issue receive for data from right partner */
       MPI_Irecv(
         recv_right_buf, max_ints, MPI_INT, right_rank,
-        LWGRP_MSG_TAG_0, comm, &request[k]
+        group->tag, comm, &request[k]
       );
       k++;
 
@@ -383,7 +483,7 @@ int lwgrp_chain_allgather_brucks_int(
       /* send the data */
       MPI_Isend(
         send_right_buf, (1 + right_count), MPI_INT, right_rank,
-        LWGRP_MSG_TAG_0, comm, &request[k]
+        group->tag, comm, &request[k]
       );
       k++;
     }
@@ -425,7 +525,7 @@ int lwgrp_chain_allgather_brucks_int(
   }
 
   /* free off scratch space memory */
-  lwgrp_free(&scratch);
+  lwgrp_scratch_free(&scratch);
 
   return LWGRP_SUCCESS;
 }
@@ -441,6 +541,9 @@ int lwgrp_chain_allreduce_recursive_pow2(
   MPI_Op op,
   const lwgrp_chain* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we use a recurisve doubling algorithm */
   MPI_Request request[4];
   MPI_Status  status[4];
@@ -468,8 +571,8 @@ int lwgrp_chain_allreduce_recursive_pow2(
 
     /* exchange data with partner */
     MPI_Sendrecv(
-      resultbuf,  count, type, partner, LWGRP_MSG_TAG_0,
-      scratchbuf, count, type, partner, LWGRP_MSG_TAG_0,
+      resultbuf,  count, type, partner, group->tag,
+      scratchbuf, count, type, partner, group->tag,
       comm, status
     );
 
@@ -477,13 +580,13 @@ int lwgrp_chain_allreduce_recursive_pow2(
     if (exchange_rank < rank) {
       /* higher order data is in resultbuf,
        * so resultbuf = scratchbuf + resultbuf */
-      MPI_Reduce_local(scratchbuf, resultbuf, count, type, op);
+      lwgrp_reduce_local(scratchbuf, resultbuf, count, type, op);
     } else {
       /* higher order data is in scratchbuf,
        * so scratchbuf = resultbuf + scratchbuf,
        * then copy result back to resultbuf for sending in next round */
-      MPI_Reduce_local(resultbuf, scratchbuf, count, type, op);
-      lwgrp_type_dtbuf_memcpy(resultbuf, scratchbuf, count, type);
+      lwgrp_reduce_local(resultbuf, scratchbuf, count, type, op);
+      lwgrp_desc_dtbuf_memcpy(resultbuf, scratchbuf, count, &dt);
     }
 
     /* prepare for next iteration */
@@ -502,7 +605,7 @@ int lwgrp_chain_allreduce_recursive_pow2(
         /* receive right-going data from the left */
         MPI_Irecv(
           &recv_left, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
@@ -510,7 +613,7 @@ int lwgrp_chain_allreduce_recursive_pow2(
          * it our data */
         MPI_Isend(
           &right_rank, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -521,7 +624,7 @@ int lwgrp_chain_allreduce_recursive_pow2(
         /* receive left-going data from the right */
         MPI_Irecv(
           &recv_right, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
@@ -529,7 +632,7 @@ int lwgrp_chain_allreduce_recursive_pow2(
          * it our data */
         MPI_Isend(
           &left_rank, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -556,6 +659,9 @@ int lwgrp_chain_allreduce_recursive(
   MPI_Op op,
   const lwgrp_chain* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we implement a recursive doubling algorithm, but we're careful
    * to do this to support non-commutative ops, basically we find the
    * largest power of two that is <= #ranks, then we assign the initial
@@ -582,12 +688,12 @@ int lwgrp_chain_allreduce_recursive(
 
   /* copy our data into the receive buffer */
   if (sendbuf != MPI_IN_PLACE) {
-    lwgrp_type_dtbuf_memcpy(recvbuf, sendbuf, count, type);
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &dt);
   }
 
   /* adjust for non-zero lower bounds */
-  void* tempbuf = lwgrp_type_dtbuf_alloc(
-    count, type, __FILE__, __LINE__
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(
+    count, &dt, __FILE__, __LINE__
   );
 
   /* find largest power of two that fits within group_ranks */
@@ -627,20 +733,20 @@ int lwgrp_chain_allreduce_recursive(
         if (rank & 0x1) {
           /* send reduce result to left */
           MPI_Send(
-            recvbuf, count, type, left_rank, LWGRP_MSG_TAG_0, comm
+            recvbuf, count, type, left_rank, group->tag, comm
           );
         } else {
           /* recv data from odd rank out on right */
           MPI_Recv(
             tempbuf, count, type, right_rank,
-            LWGRP_MSG_TAG_0, comm, status
+            group->tag, comm, status
           );
 
           /* we do things in a particular way here to ensure correct
            * results for non-commutative ops, since out = in + out and
            * the higher order data is in tempbuf */
-          MPI_Reduce_local(recvbuf, tempbuf, count, type, op);
-          lwgrp_type_dtbuf_memcpy(recvbuf, tempbuf, count, type);
+          lwgrp_reduce_local(recvbuf, tempbuf, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(recvbuf, tempbuf, count, &dt);
         }
       }
 
@@ -656,13 +762,13 @@ int lwgrp_chain_allreduce_recursive(
       if (left_rank != MPI_PROC_NULL) {
         MPI_Irecv(
           &new_left, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
         MPI_Isend(
           &right_rank, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -670,13 +776,13 @@ int lwgrp_chain_allreduce_recursive(
       if (right_rank != MPI_PROC_NULL && rank < cutoff) {
         MPI_Irecv(
           &new_right, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
         MPI_Isend(
           &left_rank, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -693,6 +799,7 @@ int lwgrp_chain_allreduce_recursive(
     new_group.comm_right = new_right;
     new_group.group_rank = new_rank;
     new_group.group_size = pow2;
+    new_group.tag        = group->tag;
     pow2_group = &new_group;
   }
 
@@ -709,18 +816,18 @@ int lwgrp_chain_allreduce_recursive(
         /* recv result from left rank */
         MPI_Recv(
           recvbuf, count, type, left_rank,
-          LWGRP_MSG_TAG_0, comm, status
+          group->tag, comm, status
         );
       } else {
         /* send result to right rank */
         MPI_Send(
-          recvbuf, count, type, right_rank, LWGRP_MSG_TAG_0, comm
+          recvbuf, count, type, right_rank, group->tag, comm
         );
       }
   }
 
   /* free our scratch space */
-  lwgrp_type_dtbuf_free(&tempbuf, type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
 
   return LWGRP_SUCCESS;
 }
@@ -736,6 +843,9 @@ int lwgrp_chain_exscan_recursive_pow2(
   MPI_Op op,
   const lwgrp_chain* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we use a recurisve doubling algorithm */
   MPI_Request request[4];
   MPI_Status  status[4];
@@ -746,11 +856,11 @@ int lwgrp_chain_exscan_recursive_pow2(
   int ranks     = group->group_size;
 
   /* allocate buffer to hold scan data */
-  void* sendbuf = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-  void* recvbuf = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
+  void* sendbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* recvbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
 
   /* copy input data into temporary send buffer */
-  lwgrp_type_dtbuf_memcpy(sendbuf, inbuf, count, type);
+  lwgrp_desc_dtbuf_memcpy(sendbuf, inbuf, count, &dt);
 
   /* execute recursive doubling operation */
   int initialized = 0;
@@ -771,33 +881,32 @@ int lwgrp_chain_exscan_recursive_pow2(
 
     /* exchange data with partner */
     MPI_Sendrecv(
-      sendbuf, count, type, partner, LWGRP_MSG_TAG_0,
-      recvbuf, count, type, partner, LWGRP_MSG_TAG_0,
+      sendbuf, count, type, partner, group->tag,
+      recvbuf, count, type, partner, group->tag,
       comm, status
     );
 
     /* reduce data (being careful about non-commutative ops) */
     if (exchange_rank < rank) {
       /* higher order data is in sendbuf,
-       * so sendbuf = recvbuf + sendbuf */
-      MPI_Reduce_local(recvbuf, sendbuf, count, type, op);
-
-      /* we only accumulate values in user buffer for ranks
+       * so sendbuf = recvbuf + sendbuf,
+       * we only accumulate values in user buffer for ranks
        * before the current rank, higher order data in outbuf,
        * in resultbuf,
        * so outbuf = recvbuf + outbuf */
       if (initialized) {
-          MPI_Reduce_local(recvbuf, outbuf, count, type, op);
+          lwgrp_reduce_local2(recvbuf, sendbuf, outbuf, count, type, op);
       } else {
-          lwgrp_type_dtbuf_memcpy(outbuf, recvbuf, count, type);
+          lwgrp_reduce_local(recvbuf, sendbuf, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(outbuf, recvbuf, count, &dt);
           initialized = 1;
       }
     } else {
       /* higher order data is in recvbuf,
        * so recvbuf = sendbuf + recvbuf,
        * then copy result back to sendbuf for sending in next round */
-      MPI_Reduce_local(sendbuf, recvbuf, count, type, op);
-      lwgrp_type_dtbuf_memcpy(sendbuf, recvbuf, count, type);
+      lwgrp_reduce_local(sendbuf, recvbuf, count, type, op);
+      lwgrp_desc_dtbuf_memcpy(sendbuf, recvbuf, count, &dt);
     }
 
     /* prepare for next iteration */
@@ -816,7 +925,7 @@ int lwgrp_chain_exscan_recursive_pow2(
         /* receive right-going data from the left */
         MPI_Irecv(
           &recv_left, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
@@ -824,7 +933,7 @@ int lwgrp_chain_exscan_recursive_pow2(
          * it our data */
         MPI_Isend(
           &right_rank, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -835,7 +944,7 @@ int lwgrp_chain_exscan_recursive_pow2(
         /* receive left-going data from the right */
         MPI_Irecv(
           &recv_right, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
@@ -843,7 +952,7 @@ int lwgrp_chain_exscan_recursive_pow2(
          * it our data */
         MPI_Isend(
           &left_rank, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -860,8 +969,8 @@ int lwgrp_chain_exscan_recursive_pow2(
   }
 
   /* free memory */
-  lwgrp_type_dtbuf_free(&recvbuf, type, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&sendbuf, type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&recvbuf, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&sendbuf, &dt, __FILE__, __LINE__);
 
   return LWGRP_SUCCESS;
 }
@@ -874,6 +983,9 @@ int lwgrp_chain_exscan_recursive(
   MPI_Op op,
   const lwgrp_chain* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we implement a recursive doubling algorithm, but we're careful
    * to do this to support non-commutative ops, basically we find the
    * largest power of two that is <= #ranks, then we assign the initial
@@ -899,8 +1011,8 @@ int lwgrp_chain_exscan_recursive(
   int ranks      = group->group_size;
 
   /* adjust for non-zero lower bounds */
-  void* inbuf  = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-  void* outbuf = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
+  void* inbuf  = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* outbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
 
   /* identify location of caller's input data */
   const void* userbuf = sendbuf;
@@ -910,7 +1022,7 @@ int lwgrp_chain_exscan_recursive(
   }
 
   /* copy our data into the temporary buffer */
-  lwgrp_type_dtbuf_memcpy(inbuf, userbuf, count, type);
+  lwgrp_desc_dtbuf_memcpy(inbuf, userbuf, count, &dt);
 
   /* find largest power of two that fits within group_ranks */
   int pow2, log2;
@@ -949,20 +1061,20 @@ int lwgrp_chain_exscan_recursive(
         if (rank & 0x1) {
           /* send reduce result to left */
           MPI_Send(
-            inbuf, count, type, left_rank, LWGRP_MSG_TAG_0, comm
+            inbuf, count, type, left_rank, group->tag, comm
           );
         } else {
           /* recv data from odd rank out on right */
           MPI_Recv(
             outbuf, count, type, right_rank,
-            LWGRP_MSG_TAG_0, comm, status
+            group->tag, comm, status
           );
 
           /* we do things in a particular way here to ensure correct
            * results for non-commutative ops, since out = in + out and
            * the higher order data is in outbuf */
-          MPI_Reduce_local(inbuf, outbuf, count, type, op);
-          lwgrp_type_dtbuf_memcpy(inbuf, outbuf, count, type);
+          lwgrp_reduce_local(inbuf, outbuf, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(inbuf, outbuf, count, &dt);
         }
       }
 
@@ -978,13 +1090,13 @@ int lwgrp_chain_exscan_recursive(
       if (left_rank != MPI_PROC_NULL) {
         MPI_Irecv(
           &new_left, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
         MPI_Isend(
           &right_rank, 1, MPI_INT, left_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -992,13 +1104,13 @@ int lwgrp_chain_exscan_recursive(
       if (right_rank != MPI_PROC_NULL && rank < cutoff) {
         MPI_Irecv(
           &new_right, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
 
         MPI_Isend(
           &left_rank, 1, MPI_INT, right_rank,
-          LWGRP_MSG_TAG_0, comm, &request[k]
+          group->tag, comm, &request[k]
         );
         k++;
       }
@@ -1015,6 +1127,7 @@ int lwgrp_chain_exscan_recursive(
     new_group.comm_right = new_right;
     new_group.group_rank = new_rank;
     new_group.group_size = pow2;
+    new_group.tag        = group->tag;
     pow2_group = &new_group;
   }
 
@@ -1032,7 +1145,7 @@ int lwgrp_chain_exscan_recursive(
         /* recv result from left rank */
         MPI_Recv(
           recvbuf, count, type, left_rank,
-          LWGRP_MSG_TAG_0, comm, status
+          group->tag, comm, status
         );
       } else {
         /* send result to odd rank */
@@ -1040,26 +1153,26 @@ int lwgrp_chain_exscan_recursive(
           /* there is no value before us, just send user data */
           MPI_Send(
             (void*)userbuf, count, type, right_rank,
-            LWGRP_MSG_TAG_0, comm
+            group->tag, comm
           );
         } else {
           /* got a value before us, tack on user's data then send,
            * copy contents of userbuf to inbuf,
            * inbuf = recvbuf + inbuf,
            * send inbuf to odd rank */
-          lwgrp_type_dtbuf_memcpy(inbuf, userbuf, count, type);
-          MPI_Reduce_local(recvbuf, inbuf, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(inbuf, userbuf, count, &dt);
+          lwgrp_reduce_local(recvbuf, inbuf, count, type, op);
           MPI_Send(
             inbuf, count, type, right_rank,
-            LWGRP_MSG_TAG_0, comm
+            group->tag, comm
           );
         }
       }
   }
 
   /* free our scratch space */
-  lwgrp_type_dtbuf_free(&outbuf, type, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&inbuf,  type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&outbuf, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&inbuf,  &dt, __FILE__, __LINE__);
 
   return LWGRP_SUCCESS;
 }
@@ -1076,6 +1189,9 @@ int lwgrp_chain_double_exscan_recursive(
   MPI_Op op,
   const lwgrp_chain* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* TODO: use recursive doubling so all procs do same ops */
   int i;
 
@@ -1087,21 +1203,21 @@ int lwgrp_chain_double_exscan_recursive(
   int ranks      = group->group_size;
 
   /* adjust for lower bounds */
-  void* tempsendleft  = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-  void* tempsendright = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-  void* temprecvleft  = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-  void* temprecvright = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
+  void* tempsendleft  = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* tempsendright = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* temprecvleft  = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* temprecvright = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
 
   /* intialize send buffers */
   if (sendleft != MPI_IN_PLACE) {
-    lwgrp_type_dtbuf_memcpy(tempsendleft, sendleft, count, type);
+    lwgrp_desc_dtbuf_memcpy(tempsendleft, sendleft, count, &dt);
   } else {
-    lwgrp_type_dtbuf_memcpy(tempsendleft, recvleft, count, type);
+    lwgrp_desc_dtbuf_memcpy(tempsendleft, recvleft, count, &dt);
   }
   if (sendright != MPI_IN_PLACE) {
-    lwgrp_type_dtbuf_memcpy(tempsendright, sendright, count, type);
+    lwgrp_desc_dtbuf_memcpy(tempsendright, sendright, count, &dt);
   } else {
-    lwgrp_type_dtbuf_memcpy(tempsendright, recvright, count, type);
+    lwgrp_desc_dtbuf_memcpy(tempsendright, recvright, count, &dt);
   }
 
   /* execute double, exclusive scan,
@@ -1120,12 +1236,12 @@ int lwgrp_chain_double_exscan_recursive(
      * recv its right-going data */
     if (left_rank != MPI_PROC_NULL) {
       /* receive right-going data from the left */
-      MPI_Irecv(temprecvleft, count, type, left_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Irecv(temprecvleft, count, type, left_rank, group->tag, comm, &request[k]);
       k++;
 
       /* inform rank to our left of the rank on our right, and send
        * it our data */
-      MPI_Isend(tempsendleft, count, type, left_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Isend(tempsendleft, count, type, left_rank, group->tag, comm, &request[k]);
       k++;
     }
 
@@ -1133,12 +1249,12 @@ int lwgrp_chain_double_exscan_recursive(
      * recv its left-going data */
     if (right_rank != MPI_PROC_NULL) {
       /* receive left-going data from the right */
-      MPI_Irecv(temprecvright, count, type, right_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Irecv(temprecvright, count, type, right_rank, group->tag, comm, &request[k]);
       k++;
 
       /* inform rank to our right of the rank on our left, and send
        * it our data */
-      MPI_Isend(tempsendright, count, type, right_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Isend(tempsendright, count, type, right_rank, group->tag, comm, &request[k]);
       k++;
     }
 
@@ -1150,28 +1266,32 @@ int lwgrp_chain_double_exscan_recursive(
     /* if we have a left partner, merge its data with our result and
      * our right-going data */
     if (left_rank != MPI_PROC_NULL) {
-      /* reduce data into right-going buffer */
-      MPI_Reduce_local(temprecvleft, tempsendright, count, type, op);
-
-      /* with exscan our recvbuf is not valid in the first iteration */
+      /* reduce data into right-going buffer, with exscan our recvbuf
+       * is not valid in the first iteration, after that we reduce into
+       * both buffers in one pass */
       if (recvleft_initialized) {
-        MPI_Reduce_local(temprecvleft, recvleft, count, type, op);
+        lwgrp_reduce_local2(
+          temprecvleft, tempsendright, recvleft, count, type, op
+        );
       } else {
-        lwgrp_type_dtbuf_memcpy(recvleft, temprecvleft, count, type);
+        lwgrp_reduce_local(temprecvleft, tempsendright, count, type, op);
+        lwgrp_desc_dtbuf_memcpy(recvleft, temprecvleft, count, &dt);
         recvleft_initialized = 1;
       }
     }
 
     /* if we have a right partner, merge its data with our left-going data */
     if (right_rank != MPI_PROC_NULL) {
-      /* reduce data into left-going buffer */
-      MPI_Reduce_local(temprecvright, tempsendleft, count, type, op);
-
-      /* with exscan our recvbuf is not valid in the first iteration */
+      /* reduce data into left-going buffer, with exscan our recvbuf
+       * is not valid in the first iteration, after that we reduce into
+       * both buffers in one pass */
       if (recvright_initialized) {
-        MPI_Reduce_local(temprecvright, recvright, count, type, op);
+        lwgrp_reduce_local2(
+          temprecvright, tempsendleft, recvright, count, type, op
+        );
       } else {
-        lwgrp_type_dtbuf_memcpy(recvright, temprecvright, count, type);
+        lwgrp_reduce_local(temprecvright, tempsendleft, count, type, op);
+        lwgrp_desc_dtbuf_memcpy(recvright, temprecvright, count, &dt);
         recvright_initialized = 1;
       }
     }
@@ -1183,12 +1303,12 @@ int lwgrp_chain_double_exscan_recursive(
      * recv its right-going data */
     if (left_rank != MPI_PROC_NULL) {
       /* receive right-going data from the left */
-      MPI_Irecv(&new_left, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Irecv(&new_left, 1, MPI_INT, left_rank, group->tag, comm, &request[k]);
       k++;
 
       /* inform rank to our left of the rank on our right, and send
        * it our data */
-      MPI_Isend(&right_rank, 1, MPI_INT, left_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Isend(&right_rank, 1, MPI_INT, left_rank, group->tag, comm, &request[k]);
       k++;
     }
 
@@ -1196,12 +1316,12 @@ int lwgrp_chain_double_exscan_recursive(
      * recv its left-going data */
     if (right_rank != MPI_PROC_NULL) {
       /* receive left-going data from the right */
-      MPI_Irecv(&new_right, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Irecv(&new_right, 1, MPI_INT, right_rank, group->tag, comm, &request[k]);
       k++;
 
       /* inform rank to our right of the rank on our left, and send
        * it our data */
-      MPI_Isend(&left_rank, 1, MPI_INT, right_rank, LWGRP_MSG_TAG_0, comm, &request[k]);
+      MPI_Isend(&left_rank, 1, MPI_INT, right_rank, group->tag, comm, &request[k]);
       k++;
     }
 
@@ -1216,10 +1336,132 @@ int lwgrp_chain_double_exscan_recursive(
   }
 
   /* free memory */
-  lwgrp_type_dtbuf_free(&temprecvright, type, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&temprecvleft,  type, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&tempsendright, type, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&tempsendleft,  type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&temprecvright, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&temprecvleft,  &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tempsendright, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tempsendleft,  &dt, __FILE__, __LINE__);
 
   return LWGRP_SUCCESS; 
 }
+
+/* execute a left-to-right exclusive scan that starts over at each
+ * proc that sets flag, this follows the left-to-right half of
+ * lwgrp_chain_double_exscan_recursive, but each partial result
+ * travels with a flag that is set if a segment starts within the
+ * ranks it covers, when we merge data from the left into a partial
+ * result whose flag is set, we keep the partial result as it is,
+ * this merge is associative, so ops need not be commutative */
+int lwgrp_chain_exscan_segmented_recursive(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  int flag,
+  const lwgrp_chain* group)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  /* get chain info */
+  MPI_Comm comm  = group->comm;
+  int left_rank  = group->comm_left;
+  int right_rank = group->comm_right;
+
+  /* our right-going data covers the ranks from our left partner's
+   * range up to us, it starts out with our own data and flag */
+  void* tempsend = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* temprecv = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(tempsend, sendbuf, count, &dt);
+  } else {
+    lwgrp_desc_dtbuf_memcpy(tempsend, recvbuf, count, &dt);
+  }
+  int sendflag = (flag != 0);
+  int recvflag = 0;
+
+  /* execute exclusive scan, while our flag is clear, our result
+   * covers the same ranks as our right-going data except for us, so
+   * we can merge into both at once, once it is set we don't need
+   * data from the left anymore but still pass ours on */
+  MPI_Request request[8];
+  MPI_Status  status[8];
+  int new_left  = MPI_PROC_NULL;
+  int new_right = MPI_PROC_NULL;
+  int recvbuf_initialized = 0;
+  while (left_rank != MPI_PROC_NULL || right_rank != MPI_PROC_NULL) {
+    /* first execute the scan portion */
+    int k = 0;
+
+    /* receive right-going data and its flag from the left */
+    if (left_rank != MPI_PROC_NULL) {
+      MPI_Irecv(temprecv, count, type, left_rank, group->tag, comm, &request[k]);
+      k++;
+      MPI_Irecv(&recvflag, 1, MPI_INT, left_rank, group->tag, comm, &request[k]);
+      k++;
+    }
+
+    /* send our right-going data and its flag to the right */
+    if (right_rank != MPI_PROC_NULL) {
+      MPI_Isend(tempsend, count, type, right_rank, group->tag, comm, &request[k]);
+      k++;
+      MPI_Isend(&sendflag, 1, MPI_INT, right_rank, group->tag, comm, &request[k]);
+      k++;
+    }
+
+    /* wait for all communication to complete */
+    if (k > 0) {
+      MPI_Waitall(k, request, status);
+    }
+
+    /* merge data from the left unless a segment starts between it
+     * and us, with exscan our recvbuf is not valid in the first
+     * iteration, after that we reduce into both buffers in one pass */
+    if (left_rank != MPI_PROC_NULL) {
+      if (! sendflag) {
+        if (recvbuf_initialized) {
+          lwgrp_reduce_local2(temprecv, tempsend, recvbuf, count, type, op);
+        } else {
+          lwgrp_reduce_local(temprecv, tempsend, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(recvbuf, temprecv, count, &dt);
+          recvbuf_initialized = 1;
+        }
+      }
+      sendflag |= recvflag;
+    }
+
+    /* now exchange addresses for the next iteration */
+    k = 0;
+
+    /* receive the next rank on the left and send ours on the right */
+    if (left_rank != MPI_PROC_NULL) {
+      MPI_Irecv(&new_left, 1, MPI_INT, left_rank, group->tag, comm, &request[k]);
+      k++;
+      MPI_Isend(&right_rank, 1, MPI_INT, left_rank, group->tag, comm, &request[k]);
+      k++;
+    }
+
+    /* receive the next rank on the right and send ours on the left */
+    if (right_rank != MPI_PROC_NULL) {
+      MPI_Irecv(&new_right, 1, MPI_INT, right_rank, group->tag, comm, &request[k]);
+      k++;
+      MPI_Isend(&left_rank, 1, MPI_INT, right_rank, group->tag, comm, &request[k]);
+      k++;
+    }
+
+    /* wait for all communication to complete */
+    if (k > 0) {
+      MPI_Waitall(k, request, status);
+    }
+
+    /* get next left and right processes */
+    left_rank  = new_left;
+    right_rank = new_right;
+  }
+
+  /* free memory */
+  lwgrp_desc_dtbuf_free(&temprecv, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tempsend, &dt, __FILE__, __LINE__);
+
+  return LWGRP_SUCCESS;
+}
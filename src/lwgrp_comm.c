@@ -1,18 +1,345 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "mpi.h"
 #include "lwgrp.h"
 #include "lwgrp_internal.h"
 
+/* commutative allreduce ops of at least this many bytes use a
+ * bandwidth-optimal algorithm rather than recursive doubling,
+ * can be overridden by the environment variable of the same name */
+#ifndef LWGRP_ALLREDUCE_LARGE_BYTES
+#define LWGRP_ALLREDUCE_LARGE_BYTES (64 * 1024)
+#endif
+
+/* of those, ops whose per-process block would be at least this many
+ * bytes use the ring algorithm rather than Rabenseifner's, can be
+ * overridden by the environment variable of the same name */
+#ifndef LWGRP_ALLREDUCE_RING_BLOCK_BYTES
+#define LWGRP_ALLREDUCE_RING_BLOCK_BYTES (256 * 1024)
+#endif
+
+/* broadcasts of at least this many bytes scatter the buffer and
+ * then allgather it rather than using a binomial tree, can be
+ * overridden by the environment variable of the same name */
+#ifndef LWGRP_BCAST_LARGE_BYTES
+#define LWGRP_BCAST_LARGE_BYTES (128 * 1024)
+#endif
+
+/* broadcasts of at least this many bytes are pipelined along the
+ * chain, can be overridden by the environment variable of the same
+ * name */
+#ifndef LWGRP_BCAST_PIPELINE_BYTES
+#define LWGRP_BCAST_PIPELINE_BYTES (16 * 1024 * 1024)
+#endif
+
+/* size of each segment in a pipelined broadcast, can be overridden
+ * by the environment variable of the same name */
+#ifndef LWGRP_BCAST_SEGMENT_BYTES
+#define LWGRP_BCAST_SEGMENT_BYTES (256 * 1024)
+#endif
+
+/* maximum number of sends and of receives an alltoallv keeps in
+ * flight, can be overridden by the environment variable of the same
+ * name */
+#ifndef LWGRP_ALLTOALLV_WINDOW
+#define LWGRP_ALLTOALLV_WINDOW (32)
+#endif
+
+/* alltoalls where each proc sends at least this many bytes in total
+ * describe each round with a derived datatype rather than packing
+ * blocks, can be overridden by the environment variable of the same
+ * name */
+#ifndef LWGRP_ALLTOALL_INDEXED_BYTES
+#define LWGRP_ALLTOALL_INDEXED_BYTES (16 * 1024)
+#endif
+
+/* split_bin with more than this many bins uses the sort-based split
+ * rather than multiple radix passes, can be overridden by the
+ * environment variable of the same name */
+#ifndef LWGRP_SPLIT_BIN_SORT_BINS
+#define LWGRP_SPLIT_BIN_SORT_BINS (4096)
+#endif
+
+/* radix of the barrier and allgather of new comms, above 2 each comm
+ * builds a klogring when it is created, can be overridden by the
+ * environment variable of the same name */
+#ifndef LWGRP_COMM_RADIX
+#define LWGRP_COMM_RADIX (2)
+#endif
+
+/* algorithm thresholds, read from the environment on first use */
+static pthread_once_t lwgrp_comm_tune_once = PTHREAD_ONCE_INIT;
+static size_t lwgrp_allreduce_large_bytes;
+static size_t lwgrp_allreduce_ring_block_bytes;
+static size_t lwgrp_bcast_large_bytes;
+static size_t lwgrp_bcast_pipeline_bytes;
+static size_t lwgrp_bcast_segment_bytes;
+static size_t lwgrp_alltoall_indexed_bytes;
+static size_t lwgrp_alltoallv_window;
+static size_t lwgrp_split_bin_sort_bins;
+static size_t lwgrp_comm_radix;
+
+/* look up our thresholds */
+static void lwgrp_comm_tune_init(void)
+{
+  lwgrp_allreduce_large_bytes = lwgrp_getenv_size(
+    "LWGRP_ALLREDUCE_LARGE_BYTES", LWGRP_ALLREDUCE_LARGE_BYTES
+  );
+  lwgrp_allreduce_ring_block_bytes = lwgrp_getenv_size(
+    "LWGRP_ALLREDUCE_RING_BLOCK_BYTES", LWGRP_ALLREDUCE_RING_BLOCK_BYTES
+  );
+  lwgrp_bcast_large_bytes = lwgrp_getenv_size(
+    "LWGRP_BCAST_LARGE_BYTES", LWGRP_BCAST_LARGE_BYTES
+  );
+  lwgrp_bcast_pipeline_bytes = lwgrp_getenv_size(
+    "LWGRP_BCAST_PIPELINE_BYTES", LWGRP_BCAST_PIPELINE_BYTES
+  );
+  lwgrp_bcast_segment_bytes = lwgrp_getenv_size(
+    "LWGRP_BCAST_SEGMENT_BYTES", LWGRP_BCAST_SEGMENT_BYTES
+  );
+  lwgrp_alltoall_indexed_bytes = lwgrp_getenv_size(
+    "LWGRP_ALLTOALL_INDEXED_BYTES", LWGRP_ALLTOALL_INDEXED_BYTES
+  );
+  lwgrp_alltoallv_window = lwgrp_getenv_size(
+    "LWGRP_ALLTOALLV_WINDOW", LWGRP_ALLTOALLV_WINDOW
+  );
+  lwgrp_split_bin_sort_bins = lwgrp_getenv_size(
+    "LWGRP_SPLIT_BIN_SORT_BINS", LWGRP_SPLIT_BIN_SORT_BINS
+  );
+  lwgrp_comm_radix = lwgrp_getenv_size(
+    "LWGRP_COMM_RADIX", LWGRP_COMM_RADIX
+  );
+}
+
+/* threads may start their first collectives at the same time */
+static void lwgrp_comm_tune(void)
+{
+  pthread_once(&lwgrp_comm_tune_once, lwgrp_comm_tune_init);
+}
+
+/* ---------------------------------
+ * Contexts
+ * --------------------------------- */
+
+/* number of comms we belong to using each context, context 0 is
+ * shared by all comms built locally and is never handed out by
+ * lwgrp_comm_assign_context, threads building comms at the same time
+ * update these under the lock */
+static int lwgrp_context_refs[LWGRP_CONTEXTS];
+static pthread_mutex_t lwgrp_context_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* number of contexts whose tags fit under MPI_TAG_UB, and whether
+ * other threads may be assigning contexts while we are */
+static pthread_once_t lwgrp_context_once = PTHREAD_ONCE_INIT;
+static int lwgrp_context_count = 1;
+static int lwgrp_context_threads = 0;
+
+static void lwgrp_context_init(void)
+{
+  int* tag_ub = NULL;
+  int flag = 0;
+#if MPI_VERSION >= 2
+  MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+#else
+  MPI_Attr_get(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+#endif
+
+  /* the standard guarantees at least 32767 */
+  long ub = (flag && tag_ub != NULL) ? (long) *tag_ub : 32767;
+  long count = (ub + 1 - LWGRP_MSG_TAG_0) / LWGRP_CONTEXT_TAGS;
+  if (count > LWGRP_CONTEXTS) {
+    count = LWGRP_CONTEXTS;
+  }
+  if (count < 1) {
+    count = 1;
+  }
+  lwgrp_context_count = (int) count;
+
+#if MPI_VERSION >= 2
+  int provided;
+  MPI_Query_thread(&provided);
+  lwgrp_context_threads = (provided == MPI_THREAD_MULTIPLE);
+#endif
+}
+
+int lwgrp_context_tag(int context)
+{
+  return LWGRP_MSG_TAG_0 + context * LWGRP_CONTEXT_TAGS;
+}
+
+/* add or drop a reference to context */
+static void lwgrp_context_ref(int context, int delta)
+{
+  pthread_mutex_lock(&lwgrp_context_lock);
+  lwgrp_context_refs[context] += delta;
+  pthread_mutex_unlock(&lwgrp_context_lock);
+}
+
+void lwgrp_context_mask(int mask[LWGRP_CONTEXT_WORDS])
+{
+  pthread_once(&lwgrp_context_once, lwgrp_context_init);
+  int limit = lwgrp_context_count;
+
+  int i;
+  for (i = 0; i < LWGRP_CONTEXT_WORDS; i++) {
+    mask[i] = 0;
+  }
+  pthread_mutex_lock(&lwgrp_context_lock);
+  for (i = 0; i < limit; i++) {
+    if (i == 0 || lwgrp_context_refs[i] > 0) {
+      mask[i / 32] |= (int) (1u << (i % 32));
+    }
+  }
+  pthread_mutex_unlock(&lwgrp_context_lock);
+}
+
+int lwgrp_context_pick(const int used[LWGRP_CONTEXT_WORDS])
+{
+  pthread_once(&lwgrp_context_once, lwgrp_context_init);
+  int limit = lwgrp_context_count;
+
+  int i;
+  for (i = 1; i < limit; i++) {
+    if (! (used[i / 32] & (int) (1u << (i % 32)))) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* add a reference to context unless we already use it, returns 1 if
+ * we do, context is -1 if the members found every context taken,
+ * which we can't recover from */
+static int lwgrp_context_claim(int context)
+{
+  if (context < 0) {
+    printf("ERROR: All %d contexts are in use by comms of members of a new comm @ %s:%d\n",
+      lwgrp_context_count - 1, __FILE__, __LINE__
+    );
+    exit(1);
+  }
+
+  pthread_mutex_lock(&lwgrp_context_lock);
+  int taken = (lwgrp_context_refs[context] > 0);
+  if (! taken) {
+    lwgrp_context_refs[context]++;
+  }
+  pthread_mutex_unlock(&lwgrp_context_lock);
+  return taken;
+}
+
+/* set context on comm and point the tags of its chain and ring at it,
+ * the caller holds a reference to context */
+static void lwgrp_comm_set_context(lwgrp_comm* comm, int context)
+{
+  comm->context   = context;
+  comm->ring.tag  = lwgrp_context_tag(context);
+  comm->chain.tag = lwgrp_context_tag(context);
+}
+
+int lwgrp_comm_assign_context(lwgrp_comm* comm, int tag)
+{
+  if (comm->ring.group_size == 0) {
+    return LWGRP_SUCCESS;
+  }
+
+  pthread_once(&lwgrp_context_once, lwgrp_context_init);
+
+  /* drop the shared context we were built with, and send on the tag
+   * we were given until we have a context of our own */
+  lwgrp_context_ref(comm->context, -1);
+  comm->ring.tag  = tag;
+  comm->chain.tag = tag;
+
+  int context = 0;
+  int retry = 1;
+  while (retry) {
+    /* combine the contexts of all comms we belong to with those of
+     * the other members and take the lowest one nobody uses */
+    int mine[LWGRP_CONTEXT_WORDS];
+    int used[LWGRP_CONTEXT_WORDS];
+    lwgrp_context_mask(mine);
+    lwgrp_comm_allreduce(
+      mine, used, LWGRP_CONTEXT_WORDS, MPI_INT, MPI_BOR, comm
+    );
+    context = lwgrp_context_pick(used);
+
+    /* another thread may have taken the same context for a different
+     * comm while we were agreeing on ours, in which case the members
+     * that saw it claimed start over */
+    int taken = lwgrp_context_claim(context);
+    retry = 0;
+    if (lwgrp_context_threads) {
+      lwgrp_comm_allreduce(&taken, &retry, 1, MPI_INT, MPI_MAX, comm);
+      if (retry && ! taken) {
+        lwgrp_context_ref(context, -1);
+      }
+    }
+  }
+  lwgrp_comm_set_context(comm, context);
+
+  return LWGRP_SUCCESS;
+}
+
 /* ---------------------------------
  * Constructors / destructors
  * --------------------------------- */
 
+/* given a comm with its ring and logring filled in, build and cache
+ * the chain and logchain views, reset the count of nonblocking ops,
+ * mark the address table as not yet built, and start out sending
+ * messages on the logring -- O(log N) local */
+static int lwgrp_comm_build_chains(lwgrp_comm* comm)
+{
+  comm->seq        = 0;
+  comm->addrs      = NULL;
+  comm->addr_ranks = NULL;
+  comm->rma        = NULL;
+  comm->klogring.k          = 0;
+  comm->klogring.rounds     = 0;
+  comm->klogring.left_list  = NULL;
+  comm->klogring.right_list = NULL;
+  lwgrp_chain_build_from_ring(&comm->ring, &comm->chain);
+  lwgrp_logchain_build_from_logring(
+    &comm->ring, &comm->logring, &comm->logchain
+  );
+
+  /* start in the shared context, collective constructors then
+   * assign one of our own */
+  lwgrp_context_ref(0, 1);
+  lwgrp_comm_set_context(comm, 0);
+  return LWGRP_SUCCESS;
+}
+
+/* returns the radix new comms start with, or 0 if they stay on the
+ * logring */
+static int lwgrp_comm_start_radix(void)
+{
+  lwgrp_comm_tune();
+  if (lwgrp_comm_radix > INT_MAX) {
+    return INT_MAX;
+  }
+  if (lwgrp_comm_radix > 2) {
+    return (int) lwgrp_comm_radix;
+  }
+  return 0;
+}
+
 int lwgrp_comm_build_from_mpicomm(
   MPI_Comm comm,
   lwgrp_comm* newcomm)
 {
-  /* these are both local, so the whole op is local */
+  /* these are all local, so the whole op is local */
   lwgrp_ring_build_from_mpicomm(comm, &newcomm->ring);
   lwgrp_logring_build_from_mpicomm(comm, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
+  int k = lwgrp_comm_start_radix();
+  if (k > 0) {
+    lwgrp_klogring_build_from_mpicomm(comm, k, &newcomm->klogring);
+  }
   return LWGRP_SUCCESS;
 }
 
@@ -22,9 +349,157 @@ int lwgrp_comm_build_from_chain(
 {
   lwgrp_ring_build_from_chain(chain, &newcomm->ring);
   lwgrp_logring_build_from_ring(&newcomm->ring, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
+  lwgrp_comm_set_radix(newcomm, lwgrp_comm_start_radix());
   return LWGRP_SUCCESS;
 }
-  
+
+int lwgrp_comm_build_from_list(
+  MPI_Comm comm,
+  int size,
+  const int ranklist[],
+  lwgrp_comm* newcomm)
+{
+  lwgrp_ring_build_from_list(comm, size, ranklist, &newcomm->ring);
+  lwgrp_logring_build_from_list(comm, size, ranklist, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
+  int k = lwgrp_comm_start_radix();
+  if (k > 0) {
+    lwgrp_klogring_build_from_list(comm, size, ranklist, k, &newcomm->klogring);
+  }
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_build_from_logchain(
+  const lwgrp_ring* ring,
+  const lwgrp_logchain* logchain,
+  lwgrp_comm* newcomm)
+{
+  lwgrp_ring_copy(ring, &newcomm->ring);
+  lwgrp_logring_build_from_logchain(ring, logchain, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
+  lwgrp_comm_set_radix(newcomm, lwgrp_comm_start_radix());
+  return LWGRP_SUCCESS;
+}
+
+enum lwgrp_nb_comm_build_phase {
+  COMM_BUILD_LOGRING,  /* exchange logring entries that wrap */
+  COMM_BUILD_KLOGRING, /* build klogring for the starting radix */
+  COMM_BUILD_CLAIM,    /* take the context the members picked */
+  COMM_BUILD_CHECK,    /* find whether any member already used it */
+  COMM_BUILD_AGREE,    /* pick again from the contexts used now */
+};
+
+void lwgrp_nb_comm_build_init(
+  lwgrp_nb_comm_build* s,
+  const lwgrp_ring* ring,
+  const lwgrp_logchain* logchain,
+  int context,
+  int check,
+  lwgrp_comm* comm)
+{
+  pthread_once(&lwgrp_context_once, lwgrp_context_init);
+
+  s->comm    = comm;
+  s->phase   = COMM_BUILD_LOGRING;
+  s->context = context;
+  s->check   = (check || lwgrp_context_threads);
+  s->taken   = 0;
+  s->retry   = 0;
+
+  lwgrp_ring_copy(ring, &comm->ring);
+  lwgrp_nb_logring_init(&s->logring, &comm->ring, logchain, &comm->logring);
+}
+
+int lwgrp_nb_comm_build_advance(
+  lwgrp_nb_comm_build* s,
+  struct lwgrp_request_struct* req)
+{
+  lwgrp_comm* comm = s->comm;
+
+  while (1) {
+    switch (s->phase) {
+    case COMM_BUILD_LOGRING:
+    {
+      if (! lwgrp_nb_logring_advance(&s->logring, req)) {
+        return 0;
+      }
+      lwgrp_comm_build_chains(comm);
+
+      /* see lwgrp_comm_set_radix */
+      int k = lwgrp_comm_start_radix();
+      s->phase = COMM_BUILD_CLAIM;
+      if (k > 0) {
+        lwgrp_nb_klogring_init(&s->klogring, &comm->ring, k, &comm->klogring);
+        s->phase = COMM_BUILD_KLOGRING;
+      }
+      break;
+    }
+    case COMM_BUILD_KLOGRING:
+      if (! lwgrp_nb_klogring_advance(&s->klogring, req)) {
+        return 0;
+      }
+      s->phase = COMM_BUILD_CLAIM;
+      break;
+    case COMM_BUILD_CLAIM:
+      /* the empty group stays in the shared context */
+      if (comm->ring.group_size == 0) {
+        return 1;
+      }
+
+      /* drop the shared context we were built with */
+      lwgrp_context_ref(comm->context, -1);
+      s->taken = lwgrp_context_claim(s->context);
+      if (! s->check) {
+        lwgrp_comm_set_context(comm, s->context);
+        return 1;
+      }
+
+      /* the bitmaps the members picked from may be out of date,
+       * so find out whether any member used context in the meantime */
+      lwgrp_nb_allreduce_init(
+        &s->allreduce, &s->taken, &s->retry, 1, MPI_INT, MPI_MAX,
+        &comm->chain, &comm->logchain
+      );
+      s->phase = COMM_BUILD_CHECK;
+      break;
+    case COMM_BUILD_CHECK:
+      if (! lwgrp_nb_allreduce_advance(&s->allreduce, req)) {
+        return 0;
+      }
+      if (! s->retry) {
+        lwgrp_comm_set_context(comm, s->context);
+        return 1;
+      }
+
+      /* someone did, so let go of it and combine the contexts we all
+       * use now, see lwgrp_comm_assign_context */
+      if (! s->taken) {
+        lwgrp_context_ref(s->context, -1);
+      }
+      lwgrp_context_mask(s->mine);
+      lwgrp_nb_allreduce_init(
+        &s->allreduce, s->mine, s->used, LWGRP_CONTEXT_WORDS, MPI_INT,
+        MPI_BOR, &comm->chain, &comm->logchain
+      );
+      s->phase = COMM_BUILD_AGREE;
+      break;
+    case COMM_BUILD_AGREE:
+      if (! lwgrp_nb_allreduce_advance(&s->allreduce, req)) {
+        return 0;
+      }
+      s->context = lwgrp_context_pick(s->used);
+      s->taken   = lwgrp_context_claim(s->context);
+      lwgrp_nb_allreduce_init(
+        &s->allreduce, &s->taken, &s->retry, 1, MPI_INT, MPI_MAX,
+        &comm->chain, &comm->logchain
+      );
+      s->phase = COMM_BUILD_CHECK;
+      break;
+    }
+  }
+}
+
 #if 0
 int lwgrp_comm_copy(
   const lwgrp_comm* comm,
@@ -33,6 +508,7 @@ int lwgrp_comm_copy(
   /* this is all local */
   lwgrp_ring_copy(&comm->ring, &newcomm->ring);
   lwgrp_logring_copy(&comm->logring, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
   return LWGRP_SUCCESS;
 }
 #endif
@@ -43,14 +519,53 @@ int lwgrp_comm_split_bin(
   int bin,
   lwgrp_comm* newcomm)
 {
-  /* TODO: if many bins, do this in phases or call bitonic split */
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SPLIT_BIN);
+
+  /* look up our thresholds */
+  lwgrp_comm_tune();
+
+  /* each radix pass scans over a vector of bins and takes O(log N)
+   * steps, with lots of bins the number of passes adds up, so we
+   * switch to a sort-based split which keeps procs of each bin in
+   * rank order since ties in key are broken by rank */
+  if (bins > 0 && (size_t) bins > lwgrp_split_bin_sort_bins) {
+    int color = (bin >= 0) ? bin : MPI_UNDEFINED;
+    int rc = lwgrp_comm_split(comm, color, 0, newcomm);
+    LWGRP_STATS_END();
+    return rc;
+  }
+
+  /* otherwise split in passes over a few bits of the bin at a time */
   lwgrp_ring_split_bin_radix(bins, bin, &comm->ring, &newcomm->ring);
   lwgrp_logring_build_from_ring(&newcomm->ring, &newcomm->logring);
+  lwgrp_comm_build_chains(newcomm);
+  lwgrp_comm_assign_context(newcomm, comm->ring.tag);
+  lwgrp_comm_set_radix(newcomm, lwgrp_comm_start_radix());
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_set_radix(lwgrp_comm* comm, int k)
+{
+  if (k == comm->klogring.k || (k <= 2 && comm->klogring.k == 0)) {
+    return LWGRP_SUCCESS;
+  }
+  lwgrp_klogring_free(&comm->klogring);
+  if (k > 2) {
+    lwgrp_klogring_build_from_ring(&comm->ring, k, &comm->klogring);
+  }
   return LWGRP_SUCCESS;
 }
 
 int lwgrp_comm_free(lwgrp_comm* comm)
 {
+  lwgrp_context_ref(comm->context, -1);
+  lwgrp_klogring_free(&comm->klogring);
+  lwgrp_rma_free(&comm->rma);
+  lwgrp_free(&comm->addr_ranks);
+  lwgrp_free(&comm->addrs);
+  lwgrp_logchain_free(&comm->logchain);
+  lwgrp_chain_free(&comm->chain);
   lwgrp_logring_free(&comm->logring);
   lwgrp_ring_free(&comm->ring);
   return LWGRP_SUCCESS;
@@ -84,7 +599,19 @@ int lwgrp_comm_size(
 
 int lwgrp_comm_barrier(const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_barrier_dissemination(&comm->ring, &comm->logring);
+  LWGRP_STATS_BEGIN(LWGRP_STATS_BARRIER);
+  int rc;
+  int alg = lwgrp_tune_select(
+    LWGRP_STATS_BARRIER, comm->ring.group_size, 0
+  );
+  if (alg == LWGRP_ALG_BARRIER_CHAIN) {
+    rc = lwgrp_chain_barrier_dissemination(&comm->chain);
+  } else if (comm->klogring.k > 2) {
+    rc = lwgrp_klogring_barrier_dissemination(&comm->ring, &comm->klogring);
+  } else {
+    rc = lwgrp_logring_barrier_dissemination(&comm->ring, &comm->logring);
+  }
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -95,12 +622,72 @@ int lwgrp_comm_bcast(
   int root,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_bcast_binomial(
-    buffer, count, datatype, root,
-    &comm->ring, &comm->logring
-  );
+  LWGRP_STATS_BEGIN(LWGRP_STATS_BCAST);
+  int rc;
+
+  /* look up our thresholds */
+  lwgrp_comm_tune();
+
+  /* compute size of the message */
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  size_t bytes = (size_t) count * (size_t) extent;
+  int ranks = comm->ring.group_size;
+
+  /* the binomial tree sends the full buffer at each of log(N) levels,
+   * for large messages we instead either pipeline segments along the
+   * chain, or split the buffer into one block per proc which needs
+   * at least one element per block */
+  int alg = lwgrp_tune_select(LWGRP_STATS_BCAST, ranks, bytes);
+  if (alg == LWGRP_ALG_BCAST_SCATTER_ALLGATHER && count < ranks) {
+    alg = LWGRP_ALG_DEFAULT;
+  }
+  if (alg == LWGRP_ALG_DEFAULT) {
+    if (ranks > 2 && bytes >= lwgrp_bcast_pipeline_bytes) {
+      alg = LWGRP_ALG_BCAST_PIPELINED;
+    } else if (ranks > 2 && count >= ranks &&
+               bytes >= lwgrp_bcast_large_bytes)
+    {
+      alg = LWGRP_ALG_BCAST_SCATTER_ALLGATHER;
+    } else {
+      alg = LWGRP_ALG_BCAST_BINOMIAL;
+    }
+  }
+
+  if (alg == LWGRP_ALG_BCAST_PIPELINED) {
+    int segcount = count;
+    if (extent > 0) {
+      size_t segs = lwgrp_bcast_segment_bytes / (size_t) extent;
+      if (segs < 1) {
+        segs = 1;
+      }
+      if (segs < (size_t) count) {
+        segcount = (int) segs;
+      }
+    }
+    rc = lwgrp_chain_bcast_pipelined(
+      buffer, count, datatype, root, segcount,
+      &comm->chain
+    );
+  } else if (alg == LWGRP_ALG_BCAST_SCATTER_ALLGATHER) {
+    rc = lwgrp_logring_bcast_scatter_allgather(
+      buffer, count, datatype, root,
+      &comm->ring, &comm->logring
+    );
+  } else if (lwgrp_rma_usable(comm->rma, datatype, count)) {
+    rc = lwgrp_logring_bcast_binomial_rma(
+      buffer, count, datatype, root,
+      &comm->ring, &comm->logring, comm->rma
+    );
+  } else {
+    rc = lwgrp_logring_bcast_binomial(
+      buffer, count, datatype, root,
+      &comm->ring, &comm->logring
+    );
+  }
+  LWGRP_STATS_END();
   return rc;
-} 
+}
 
 int lwgrp_comm_gather(
   const void* sendbuf,
@@ -110,10 +697,47 @@ int lwgrp_comm_gather(
   int root,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_gather_brucks(
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GATHER);
+  int rc;
+
+  /* the binomial tree only buffers each subtree, while Bruck's
+   * allgather has every proc collect all items, which takes the same
+   * number of steps but can pay off when messages are tiny */
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  size_t bytes = (size_t) count * (size_t) extent;
+  int alg = lwgrp_tune_select(
+    LWGRP_STATS_GATHER, comm->ring.group_size, bytes
+  );
+  if (alg == LWGRP_ALG_GATHER_BRUCKS) {
+    rc = lwgrp_logring_gather_brucks(
+      sendbuf, recvbuf, count, datatype,
+      root, &comm->ring, &comm->logring
+    );
+  } else {
+    rc = lwgrp_logring_gather_binomial(
+      sendbuf, recvbuf, count, datatype,
+      root, &comm->ring, &comm->logring
+    );
+  }
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_scatter(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SCATTER);
+  int rc = lwgrp_logring_scatter_binomial(
     sendbuf, recvbuf, count, datatype,
     root, &comm->ring, &comm->logring
   );
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -124,10 +748,25 @@ int lwgrp_comm_allgather(
   MPI_Datatype datatype,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_allgather_brucks(
-    sendbuf, recvbuf, count, datatype,
-    &comm->ring, &comm->logring
-  );
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLGATHER);
+  int rc;
+  if (lwgrp_rma_usable(comm->rma, datatype, count)) {
+    rc = lwgrp_logring_allgather_brucks_rma(
+      sendbuf, recvbuf, count, datatype,
+      &comm->ring, &comm->logring, comm->rma
+    );
+  } else if (comm->klogring.k > 2) {
+    rc = lwgrp_klogring_allgather_brucks(
+      sendbuf, recvbuf, count, datatype,
+      &comm->ring, &comm->klogring
+    );
+  } else {
+    rc = lwgrp_logring_allgather_brucks(
+      sendbuf, recvbuf, count, datatype,
+      &comm->ring, &comm->logring
+    );
+  }
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -139,10 +778,12 @@ int lwgrp_comm_allgatherv(
   MPI_Datatype datatype,
   const lwgrp_comm* comm)
 {
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLGATHERV);
   int rc = lwgrp_logring_allgatherv_brucks(
     sendbuf, recvbuf, counts, displs, datatype,
     &comm->ring, &comm->logring
   );
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -153,10 +794,38 @@ int lwgrp_comm_alltoall(
   MPI_Datatype datatype,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_alltoall_brucks(
-    sendbuf, recvbuf, count, datatype,
-    &comm->ring, &comm->logring
-  );
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLTOALL);
+  int rc;
+
+  /* look up our thresholds */
+  lwgrp_comm_tune();
+
+  /* compute size of the message */
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  int ranks = comm->ring.group_size;
+  size_t bytes = (size_t) count * (size_t) extent;
+
+  /* packing blocks costs several copies of our buffer per call, while
+   * building derived types costs a few MPI calls per round, so we only
+   * pack for small messages */
+  int alg = lwgrp_tune_select(LWGRP_STATS_ALLTOALL, ranks, bytes);
+  if (alg == LWGRP_ALG_DEFAULT) {
+    alg = ((size_t) ranks * bytes >= lwgrp_alltoall_indexed_bytes) ?
+      LWGRP_ALG_ALLTOALL_INDEXED : LWGRP_ALG_ALLTOALL_BRUCKS;
+  }
+  if (alg == LWGRP_ALG_ALLTOALL_INDEXED) {
+    rc = lwgrp_logring_alltoall_brucks_indexed(
+      sendbuf, recvbuf, count, datatype,
+      &comm->ring, &comm->logring
+    );
+  } else {
+    rc = lwgrp_logring_alltoall_brucks(
+      sendbuf, recvbuf, count, datatype,
+      &comm->ring, &comm->logring
+    );
+  }
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -170,10 +839,16 @@ int lwgrp_comm_alltoallv(
   MPI_Datatype datatype,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_alltoallv_linear(
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLTOALLV);
+
+  /* look up our window size */
+  lwgrp_comm_tune();
+
+  int rc = lwgrp_logring_alltoallv_windowed(
     sendbuf, sendcounts, senddispls, recvbuf, recvcounts, recvdispls, datatype,
-    &comm->ring, &comm->logring
+    (int) lwgrp_alltoallv_window, &comm->ring, &comm->logring
   );
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -185,10 +860,62 @@ int lwgrp_comm_allreduce(
   MPI_Op op,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_allreduce_recursive(
-    sendbuf, recvbuf, count, datatype, op,
-    &comm->ring, &comm->logring
-  );
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLREDUCE);
+  int rc;
+
+  /* look up our thresholds */
+  lwgrp_comm_tune();
+
+  /* compute size of the message */
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  size_t bytes = (size_t) count * (size_t) extent;
+  int ranks = comm->chain.group_size;
+
+  /* recursive doubling sends the full buffer log(N) times, which is
+   * fine for small messages, for large messages with a commutative
+   * op we split the buffer into blocks so each proc only sends about
+   * twice its data, we need at least one element per block for that */
+  int alg = lwgrp_tune_select(LWGRP_STATS_ALLREDUCE, ranks, bytes);
+  if ((alg == LWGRP_ALG_ALLREDUCE_RABENSEIFNER ||
+       alg == LWGRP_ALG_ALLREDUCE_RING) &&
+      ! (ranks > 1 && count >= ranks && lwgrp_op_commutative(op)))
+  {
+    alg = LWGRP_ALG_DEFAULT;
+  }
+  if (alg == LWGRP_ALG_DEFAULT) {
+    alg = LWGRP_ALG_ALLREDUCE_RECURSIVE;
+    if (ranks > 1 && count >= ranks &&
+        bytes >= lwgrp_allreduce_large_bytes &&
+        lwgrp_op_commutative(op))
+    {
+      /* with large blocks, bandwidth dominates so use the ring,
+       * otherwise save on latency with log(N) steps */
+      if (bytes / (size_t) ranks >= lwgrp_allreduce_ring_block_bytes) {
+        alg = LWGRP_ALG_ALLREDUCE_RING;
+      } else {
+        alg = LWGRP_ALG_ALLREDUCE_RABENSEIFNER;
+      }
+    }
+  }
+
+  if (alg == LWGRP_ALG_ALLREDUCE_RING) {
+    rc = lwgrp_ring_allreduce_pipelined(
+      sendbuf, recvbuf, count, datatype, op,
+      &comm->ring
+    );
+  } else if (alg == LWGRP_ALG_ALLREDUCE_RABENSEIFNER) {
+    rc = lwgrp_logchain_allreduce_rabenseifner(
+      sendbuf, recvbuf, count, datatype, op,
+      &comm->chain, &comm->logchain
+    );
+  } else {
+    rc = lwgrp_logchain_allreduce_recursive(
+      sendbuf, recvbuf, count, datatype, op,
+      &comm->chain, &comm->logchain
+    );
+  }
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -201,10 +928,144 @@ int lwgrp_comm_reduce(
   int root,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_reduce_recursive(
+  LWGRP_STATS_BEGIN(LWGRP_STATS_REDUCE);
+  int rc = lwgrp_logchain_reduce_recursive(
     sendbuf, recvbuf, count, datatype, op, root,
-    &comm->ring, &comm->logring
+    &comm->chain, &comm->logchain
   );
+  LWGRP_STATS_END();
+  return rc;
+}
+
+/* run a reduce-scatter where rank i gets counts[i] elements, bytes
+ * is the average size of a block, which picks the algorithm */
+static int lwgrp_comm_reduce_scatter_counts(
+  const void* sendbuf,
+  void* recvbuf,
+  const int counts[],
+  size_t bytes,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  const lwgrp_comm* comm)
+{
+  int rc;
+
+  /* look up our thresholds */
+  lwgrp_comm_tune();
+
+  /* halving and the ring both reorder contributions, so other ops
+   * reduce the whole buffer and keep their block, with large blocks
+   * bandwidth dominates so use the ring, otherwise save on latency
+   * with log(N) steps */
+  int ranks = comm->chain.group_size;
+  int alg = lwgrp_tune_select(LWGRP_STATS_REDUCE_SCATTER, ranks, bytes);
+  if (! lwgrp_op_commutative(op)) {
+    alg = LWGRP_ALG_REDUCE_SCATTER_ALLREDUCE;
+  }
+  if (alg == LWGRP_ALG_DEFAULT) {
+    alg = LWGRP_ALG_REDUCE_SCATTER_HALVING;
+    if (bytes >= lwgrp_allreduce_ring_block_bytes) {
+      alg = LWGRP_ALG_REDUCE_SCATTER_RING;
+    }
+  }
+
+  if (alg == LWGRP_ALG_REDUCE_SCATTER_RING) {
+    rc = lwgrp_ring_reduce_scatter_pipelined(
+      sendbuf, recvbuf, counts, datatype, op,
+      &comm->ring
+    );
+  } else if (alg == LWGRP_ALG_REDUCE_SCATTER_HALVING) {
+    rc = lwgrp_logchain_reduce_scatter_halving(
+      sendbuf, recvbuf, counts, datatype, op,
+      &comm->chain, &comm->logchain
+    );
+  } else {
+    /* reduce everything, then copy out our block */
+    lwgrp_type_desc dt;
+    lwgrp_type_desc_init(&dt, datatype);
+    int rank = comm->chain.group_rank;
+    int total = 0;
+    int offset = 0;
+    int i;
+    for (i = 0; i < ranks; i++) {
+      if (i == rank) {
+        offset = total;
+      }
+      total += counts[i];
+    }
+    const void* inbuf = (sendbuf == MPI_IN_PLACE) ? recvbuf : sendbuf;
+    void* tempbuf = lwgrp_desc_dtbuf_alloc(total, &dt, __FILE__, __LINE__);
+    rc = lwgrp_comm_allreduce(inbuf, tempbuf, total, datatype, op, comm);
+    if (ranks > 0) {
+      void* result = lwgrp_desc_dtbuf_from_dtbuf(tempbuf, offset, &dt);
+      lwgrp_desc_dtbuf_memcpy(recvbuf, result, counts[rank], &dt);
+    }
+    lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
+  }
+
+  return rc;
+}
+
+int lwgrp_comm_reduce_scatter_block(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_REDUCE_SCATTER);
+
+  /* every rank gets count elements */
+  int ranks = comm->chain.group_size;
+  int* counts = (int*) lwgrp_scratch_alloc(
+    ranks * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < ranks; i++) {
+    counts[i] = count;
+  }
+
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  size_t bytes = (size_t) count * (size_t) extent;
+  int rc = lwgrp_comm_reduce_scatter_counts(
+    sendbuf, recvbuf, counts, bytes, datatype, op, comm
+  );
+
+  lwgrp_scratch_free(&counts);
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_reduce_scatter(
+  const void* sendbuf,
+  void* recvbuf,
+  const int counts[],
+  MPI_Datatype datatype,
+  MPI_Op op,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_REDUCE_SCATTER);
+
+  /* pick the algorithm by the average block */
+  int ranks = comm->chain.group_size;
+  size_t total = 0;
+  int i;
+  for (i = 0; i < ranks; i++) {
+    total += (size_t) counts[i];
+  }
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(datatype, &lb, &extent);
+  size_t bytes = 0;
+  if (ranks > 0) {
+    bytes = total * (size_t) extent / (size_t) ranks;
+  }
+  int rc = lwgrp_comm_reduce_scatter_counts(
+    sendbuf, recvbuf, counts, bytes, datatype, op, comm
+  );
+
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -216,10 +1077,34 @@ int lwgrp_comm_scan(
   MPI_Op op,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_scan_recursive(
-    sendbuf, recvbuf, count, datatype, op,
-    &comm->ring, &comm->logring
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SCAN);
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* with MPI_IN_PLACE, hold on to our input before the exscan
+   * overwrites it */
+  void* inbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(inbuf, sendbuf, count, &dt);
+  } else {
+    lwgrp_desc_dtbuf_memcpy(inbuf, recvbuf, count, &dt);
+  }
+
+  /* run the exscan on our cached chain */
+  int rc = lwgrp_chain_exscan_recursive(
+    inbuf, recvbuf, count, datatype, op,
+    &comm->chain
   );
+
+  /* now add in our own data after the exscan result, which keeps
+   * operand order for non-commutative ops, rank 0 just has its data */
+  if (comm->chain.group_rank > 0) {
+    lwgrp_reduce_local(recvbuf, inbuf, count, datatype, op);
+  }
+  lwgrp_desc_dtbuf_memcpy(recvbuf, inbuf, count, &dt);
+
+  lwgrp_desc_dtbuf_free(&inbuf, &dt, __FILE__, __LINE__);
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -231,10 +1116,70 @@ int lwgrp_comm_exscan(
   MPI_Op op,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_exscan_recursive(
+  LWGRP_STATS_BEGIN(LWGRP_STATS_EXSCAN);
+  int rc = lwgrp_chain_exscan_recursive(
     sendbuf, recvbuf, count, datatype, op,
-    &comm->ring, &comm->logring
+    &comm->chain
   );
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_scan_segmented(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  int flag,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SEGMENTED_SCAN);
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* with MPI_IN_PLACE, hold on to our input before the exscan
+   * overwrites it */
+  void* inbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(inbuf, sendbuf, count, &dt);
+  } else {
+    lwgrp_desc_dtbuf_memcpy(inbuf, recvbuf, count, &dt);
+  }
+
+  /* run the exscan on our cached chain */
+  int rc = lwgrp_chain_exscan_segmented_recursive(
+    inbuf, recvbuf, count, datatype, op, flag,
+    &comm->chain
+  );
+
+  /* now add in our own data after the exscan result, unless we start
+   * a segment, in which case our data is the result */
+  if (comm->chain.group_rank > 0 && ! flag) {
+    lwgrp_reduce_local(recvbuf, inbuf, count, datatype, op);
+  }
+  lwgrp_desc_dtbuf_memcpy(recvbuf, inbuf, count, &dt);
+
+  lwgrp_desc_dtbuf_free(&inbuf, &dt, __FILE__, __LINE__);
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_exscan_segmented(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  int flag,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SEGMENTED_SCAN);
+  int rc = lwgrp_chain_exscan_segmented_recursive(
+    sendbuf, recvbuf, count, datatype, op, flag,
+    &comm->chain
+  );
+  LWGRP_STATS_END();
   return rc;
 }
 
@@ -248,10 +1193,12 @@ int lwgrp_comm_double_exscan(
   MPI_Op op,
   const lwgrp_comm* comm)
 {
-  int rc = lwgrp_logring_double_exscan_recursive(
+  LWGRP_STATS_BEGIN(LWGRP_STATS_DOUBLE_EXSCAN);
+  int rc = lwgrp_chain_double_exscan_recursive(
     sendleft, recvright, sendright, recvleft,
     count, datatype, op,
-    &comm->ring, &comm->logring
+    &comm->chain
   );
+  LWGRP_STATS_END();
   return rc;
 }
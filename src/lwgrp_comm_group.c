@@ -0,0 +1,306 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Group algebra on comms.  MPI groups answer these questions from a
+ * table of all members on every process, which takes O(N) memory.
+ * Here no process records more than its own queries: each member
+ * knows its own rank in every comm it belongs to, so we translate by
+ * routing a query to the member in O(log N) steps and routing the
+ * answer back, and we build new groups with a split, which is a sort
+ * followed by a scan. */
+
+/* non-members hold the empty group */
+static int lwgrp_comm_member(const lwgrp_comm* comm)
+{
+  return (comm->ring.group_size > 0);
+}
+
+int lwgrp_comm_translate_ranks(
+  const lwgrp_comm* comm1,
+  int count,
+  const int ranks1[],
+  const lwgrp_comm* comm2,
+  int ranks2[])
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+  int i;
+
+  /* get ring info */
+  int rank  = comm1->ring.group_rank;
+  int ranks = comm1->ring.group_size;
+  if (ranks == 0) {
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
+
+  /* the answer we give for ourselves */
+  int value = comm1->ring.comm_rank;
+  if (comm2 != NULL) {
+    value = lwgrp_comm_member(comm2) ? comm2->ring.group_rank : MPI_UNDEFINED;
+  }
+
+  /* build a (dest, home, index, value) record for each query */
+  int* recs = (int*) lwgrp_scratch_alloc(
+    count * 4 * sizeof(int), __FILE__, __LINE__
+  );
+  int num = 0;
+  for (i = 0; i < count; i++) {
+    if (ranks1[i] == MPI_PROC_NULL) {
+      ranks2[i] = MPI_PROC_NULL;
+      continue;
+    }
+    int* rec = recs + num * 4;
+    rec[0] = ranks1[i];
+    rec[1] = rank;
+    rec[2] = i;
+    rec[3] = MPI_UNDEFINED;
+    num++;
+  }
+
+  /* send each query to the member it names -- O(log N) communication */
+  void* queries;
+  int query_count;
+  lwgrp_logring_route_brucks(
+    recs, num, 4 * sizeof(int), &queries, &query_count,
+    &comm1->ring, &comm1->logring
+  );
+  lwgrp_scratch_free(&recs);
+
+  /* answer each query and address it back to the proc that asked */
+  for (i = 0; i < query_count; i++) {
+    int* rec = (int*)queries + i * 4;
+    rec[0] = rec[1];
+    rec[3] = value;
+  }
+
+  /* route the answers home -- O(log N) communication */
+  void* answers;
+  int answer_count;
+  lwgrp_logring_route_brucks(
+    queries, query_count, 4 * sizeof(int), &answers, &answer_count,
+    &comm1->ring, &comm1->logring
+  );
+  lwgrp_free(&queries);
+
+  for (i = 0; i < answer_count; i++) {
+    const int* rec = (const int*)answers + i * 4;
+    ranks2[rec[2]] = rec[3];
+  }
+  lwgrp_free(&answers);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_union(
+  const lwgrp_comm* comm,
+  const lwgrp_comm* comm1,
+  const lwgrp_comm* comm2,
+  lwgrp_comm* newcomm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+
+  int in1 = lwgrp_comm_member(comm1);
+  int in2 = lwgrp_comm_member(comm2);
+
+  /* members of comm2 that are not in comm1 come after all of comm1,
+   * so they need the size of comm1 -- O(log N) communication */
+  int size1 = in1 ? comm1->ring.group_size : 0;
+  int max_size1;
+  lwgrp_comm_allreduce(&size1, &max_size1, 1, MPI_INT, MPI_MAX, comm);
+
+  /* order members of comm1 by their rank in comm1,
+   * followed by the rest in order of their rank in comm2 */
+  int color = (in1 || in2) ? 0 : MPI_UNDEFINED;
+  int key = 0;
+  if (in1) {
+    key = comm1->ring.group_rank;
+  } else if (in2) {
+    key = max_size1 + comm2->ring.group_rank;
+  }
+  int rc = lwgrp_comm_split(comm, color, key, newcomm);
+
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_intersection(
+  const lwgrp_comm* comm1,
+  const lwgrp_comm* comm2,
+  lwgrp_comm* newcomm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+
+  /* members of both, ordered by rank in comm1 */
+  int color = lwgrp_comm_member(comm2) ? 0 : MPI_UNDEFINED;
+  int rc = lwgrp_comm_split(comm1, color, comm1->ring.group_rank, newcomm);
+
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_incl(
+  const lwgrp_comm* comm,
+  int count,
+  const int ranks[],
+  lwgrp_comm* newcomm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+
+  /* find our position in the list -- O(count) local */
+  int rank = comm->ring.group_rank;
+  int color = MPI_UNDEFINED;
+  int key = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    if (ranks[i] == rank) {
+      color = 0;
+      key = i;
+      break;
+    }
+  }
+
+  /* members of the list, in list order */
+  int rc = lwgrp_comm_split(comm, color, key, newcomm);
+
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_excl(
+  const lwgrp_comm* comm,
+  int count,
+  const int ranks[],
+  lwgrp_comm* newcomm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+
+  /* drop ourselves if we're in the list -- O(count) local */
+  int rank = comm->ring.group_rank;
+  int color = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    if (ranks[i] == rank) {
+      color = MPI_UNDEFINED;
+      break;
+    }
+  }
+
+  /* everyone else, in order of rank in comm */
+  int rc = lwgrp_comm_split(comm, color, rank, newcomm);
+
+  LWGRP_STATS_END();
+  return rc;
+}
+
+int lwgrp_comm_ranges(
+  const lwgrp_comm* comm,
+  int* count,
+  int** ranges)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_GROUP);
+
+  *count  = 0;
+  *ranges = NULL;
+
+  /* get ring info */
+  int rank  = comm->ring.group_rank;
+  int ranks = comm->ring.group_size;
+  if (ranks == 0) {
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
+  int me    = comm->ring.comm_rank;
+  int left  = comm->ring.comm_left;
+  int right = comm->ring.comm_right;
+
+  /* cut the member list greedily from the left, a range takes the
+   * step from its first member to the next as its stride and runs
+   * while the steps stay the same, so the member after the end of a
+   * range starts the next one, and a member that starts a range ends
+   * it only if it is the last member -- O(1) local */
+  int step_left  = me - left;
+  int step_right = right - me;
+
+  /* we have a change if the step to us differs from the step to our
+   * left neighbor, in a stretch of members with changes each starts a
+   * range exactly when the one before it doesn't, and the member
+   * before the stretch continues a range, so we start one if we are
+   * an odd number of changes into our stretch -- O(log N) communication */
+  int change = 0;
+  if (rank >= 2) {
+    int left2 = comm->logring.left_list[1];
+    change = (step_left != left - left2);
+  }
+  int changes;
+  lwgrp_comm_scan_segmented(
+    &change, &changes, 1, MPI_INT, MPI_SUM, ! change, comm
+  );
+  int start = (rank == 0) || (changes & 0x1);
+
+  /* a range that continues through us ends with us if the step to our
+   * right differs from its stride, which is the step to us */
+  int end = (rank == ranks - 1);
+  if (! start && rank < ranks - 1) {
+    end = (step_right != step_left);
+  }
+
+  /* get our position within our range -- O(log N) communication */
+  int one = 1;
+  int pos;
+  lwgrp_comm_scan_segmented(&one, &pos, 1, MPI_INT, MPI_SUM, start, comm);
+
+  /* get the index of our range and the number of ranges, counting the
+   * range ends on either side of us -- O(log N) communication */
+  int before = 0;
+  int after  = 0;
+  lwgrp_comm_double_exscan(&end, &after, &end, &before, 1, MPI_INT, MPI_SUM, comm);
+  int num = before + end + after;
+
+  /* the last proc in each range fills in its (first, last, stride)
+   * triple, and we sum to give every member the whole list --
+   * O(log N) communication of num triples */
+  int* triples = (int*) lwgrp_scratch_alloc(
+    num * 3 * sizeof(int), __FILE__, __LINE__
+  );
+  memset(triples, 0, num * 3 * sizeof(int));
+  if (end) {
+    int stride = start ? 1 : step_left;
+    int* t = triples + before * 3;
+    t[0] = me - (pos - 1) * stride;
+    t[1] = me;
+    t[2] = stride;
+  }
+
+  int* list = (int*) lwgrp_malloc(
+    num * 3 * sizeof(int), sizeof(int), __FILE__, __LINE__
+  );
+  lwgrp_comm_allreduce(triples, list, num * 3, MPI_INT, MPI_SUM, comm);
+  lwgrp_scratch_free(&triples);
+
+  *count  = num;
+  *ranges = list;
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_ranges_free(int** ranges)
+{
+  lwgrp_free(ranges);
+  return LWGRP_SUCCESS;
+}
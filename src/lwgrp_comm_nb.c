@@ -0,0 +1,579 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Nonblocking versions of the comm collectives.  Each one follows the
+ * same algorithm as its blocking counterpart, but rather than waiting
+ * at the end of each round, it records where it is in the algorithm
+ * and returns, see lwgrp_request.c for how ops are driven. */
+
+/* ---------------------------------
+ * Barrier
+ * --------------------------------- */
+
+typedef struct {
+  const lwgrp_ring* group;
+  const lwgrp_logring* list;
+  int index; /* index into logring for next round */
+  int dist;  /* distance to partners in next round */
+} lwgrp_nb_barrier;
+
+static int lwgrp_nb_barrier_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_barrier* s = (lwgrp_nb_barrier*) req->state;
+
+  /* we're done once we have heard from all distances */
+  int ranks = s->group->group_size;
+  if (s->dist >= ranks) {
+    return 1;
+  }
+
+  /* send empty messages as a signal, see
+   * lwgrp_logring_barrier_dissemination */
+  MPI_Comm comm = s->group->comm;
+  int src = s->list->left_list[s->index];
+  int dst = s->list->right_list[s->index];
+  MPI_Irecv(NULL, 0, MPI_BYTE, src, req->tag, comm, lwgrp_request_next(req));
+  MPI_Isend(NULL, 0, MPI_BYTE, dst, req->tag, comm, lwgrp_request_next(req));
+
+  /* prepare for next round */
+  s->index++;
+  s->dist <<= 1;
+  return 0;
+}
+
+static void lwgrp_nb_release(void* state)
+{
+  lwgrp_scratch_free(&state);
+}
+
+int lwgrp_comm_ibarrier(lwgrp_comm* comm, lwgrp_request* req)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_IBARRIER);
+  lwgrp_nb_barrier* s = (lwgrp_nb_barrier*) lwgrp_scratch_alloc(
+    sizeof(lwgrp_nb_barrier), __FILE__, __LINE__
+  );
+  s->group = &comm->ring;
+  s->list  = &comm->logring;
+  s->index = 0;
+  s->dist  = 1;
+
+  int rc = lwgrp_request_start(
+    comm, lwgrp_nb_barrier_advance, lwgrp_nb_release, s, req
+  );
+  LWGRP_STATS_END();
+  return rc;
+}
+
+/* ---------------------------------
+ * Bcast
+ * --------------------------------- */
+
+typedef struct {
+  void* buffer;
+  int count;
+  MPI_Datatype type;
+  const lwgrp_ring* group;
+  const lwgrp_logring* list;
+  int treerank; /* our rank relative to the root */
+  int pow2;     /* size of current subtree */
+  int log2;     /* log of pow2, index into logring */
+  int parent;   /* tree rank of our potential parent */
+  int received; /* whether we have the data */
+} lwgrp_nb_bcast;
+
+static int lwgrp_nb_bcast_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_bcast* s = (lwgrp_nb_bcast*) req->state;
+
+  MPI_Comm comm = s->group->comm;
+  int ranks     = s->group->group_size;
+
+  /* walk down the binomial tree, see lwgrp_logring_bcast_binomial */
+  while (s->pow2 > 0) {
+    if (! s->received) {
+      /* see if the parent for this step will send to us */
+      int target = s->parent + s->pow2;
+      if (s->treerank == target) {
+        /* we're the target, receive data and return to wait for it */
+        int src = s->list->left_list[s->log2];
+        MPI_Irecv(
+          s->buffer, s->count, s->type, src, req->tag,
+          comm, lwgrp_request_next(req)
+        );
+        s->received = 1;
+        s->log2--;
+        s->pow2 >>= 1;
+        return 0;
+      } else if (s->treerank > target) {
+        /* if we are in the top half of the subtree set our new
+         * potential parent */
+        s->parent = target;
+      }
+      s->log2--;
+      s->pow2 >>= 1;
+    } else {
+      /* we have the data, so send to all children at once */
+      while (s->pow2 > 0) {
+        if (s->treerank + s->pow2 < ranks) {
+          int dst = s->list->right_list[s->log2];
+          MPI_Isend(
+            s->buffer, s->count, s->type, dst, req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        }
+        s->log2--;
+        s->pow2 >>= 1;
+      }
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int lwgrp_comm_ibcast(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  lwgrp_comm* comm,
+  lwgrp_request* req)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_IBCAST);
+  lwgrp_nb_bcast* s = (lwgrp_nb_bcast*) lwgrp_scratch_alloc(
+    sizeof(lwgrp_nb_bcast), __FILE__, __LINE__
+  );
+  s->buffer = buffer;
+  s->count  = count;
+  s->type   = datatype;
+  s->group  = &comm->ring;
+  s->list   = &comm->logring;
+
+  /* adjust our rank by setting the root to be rank 0 */
+  int rank  = comm->ring.group_rank;
+  int ranks = comm->ring.group_size;
+  s->treerank = rank - root;
+  if (s->treerank < 0) {
+    s->treerank += ranks;
+  }
+
+  /* start with largest power-of-two strictly less than ranks */
+  lwgrp_largest_pow2_log2_lessthan(ranks, &s->pow2, &s->log2);
+  s->parent   = 0;
+  s->received = (rank == root) ? 1 : 0;
+
+  int rc = lwgrp_request_start(
+    comm, lwgrp_nb_bcast_advance, lwgrp_nb_release, s, req
+  );
+  LWGRP_STATS_END();
+  return rc;
+}
+
+/* ---------------------------------
+ * Allgather
+ * --------------------------------- */
+
+void lwgrp_nb_allgather_init(
+  lwgrp_nb_allgather* s,
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype type,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  int rank  = group->group_rank;
+  int ranks = group->group_size;
+
+  s->sendbuf = sendbuf;
+  s->recvbuf = recvbuf;
+  s->num     = num;
+  s->type    = type;
+  lwgrp_type_desc_init(&s->dt, type);
+  s->group   = group;
+  s->list    = list;
+  s->index   = 0;
+  s->step    = 1;
+  s->ranks_received = 1;
+  s->ranks_incoming = 0;
+
+  /* allocate temporary buffer and copy our own data into it */
+  s->tmpbuf = lwgrp_desc_dtbuf_alloc(num * ranks, &s->dt, __FILE__, __LINE__);
+  const void* inputbuf = sendbuf;
+#if MPI_VERSION >= 2
+  if (sendbuf == MPI_IN_PLACE) {
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, num * rank, &s->dt
+    );
+  }
+#endif
+  lwgrp_desc_dtbuf_memcpy(s->tmpbuf, inputbuf, num, &s->dt);
+}
+
+int lwgrp_nb_allgather_advance(
+  lwgrp_nb_allgather* s,
+  struct lwgrp_request_struct* req)
+{
+  MPI_Comm comm = s->group->comm;
+  int rank      = s->group->group_rank;
+  int ranks     = s->group->group_size;
+
+  /* account for data received in the previous round */
+  if (s->ranks_incoming > 0) {
+    s->ranks_received += s->ranks_incoming;
+    s->ranks_incoming = 0;
+    s->index++;
+    s->step <<= 1;
+  }
+
+  /* post the next round, see lwgrp_logring_allgather_brucks */
+  if (s->step < ranks) {
+    int src = s->list->right_list[s->index];
+    int dst = s->list->left_list[s->index];
+
+    int ranks_incoming = s->step;
+    if (s->ranks_received + ranks_incoming > ranks) {
+      ranks_incoming = ranks - s->ranks_received;
+    }
+    int num_exchange = s->num * ranks_incoming;
+
+    void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(
+      s->tmpbuf, s->ranks_received * s->num, &s->dt
+    );
+    MPI_Irecv(
+      recv_pos, num_exchange, s->type, src, req->tag,
+      comm, lwgrp_request_next(req)
+    );
+    MPI_Isend(
+      s->tmpbuf, num_exchange, s->type, dst, req->tag,
+      comm, lwgrp_request_next(req)
+    );
+
+    s->ranks_incoming = ranks_incoming;
+    return 0;
+  }
+
+  /* shift our data back to the proper position in receive buffer */
+  int num_pre  = s->num * rank;
+  int num_post = s->num * (ranks - rank);
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(s->recvbuf, num_pre, &s->dt);
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(s->tmpbuf, num_post, &s->dt);
+  lwgrp_desc_dtbuf_memcpy(buf_pre, s->tmpbuf, num_post, &s->dt);
+  lwgrp_desc_dtbuf_memcpy(s->recvbuf, buf_post, num_pre, &s->dt);
+
+  /* free the temporary buffer */
+  lwgrp_desc_dtbuf_free(&s->tmpbuf, &s->dt, __FILE__, __LINE__);
+  s->tmpbuf = NULL;
+
+  return 1;
+}
+
+static int lwgrp_nb_iallgather_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_allgather* s = (lwgrp_nb_allgather*) req->state;
+  return lwgrp_nb_allgather_advance(s, req);
+}
+
+static void lwgrp_nb_allgather_release(void* state)
+{
+  lwgrp_nb_allgather* s = (lwgrp_nb_allgather*) state;
+  if (s->tmpbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&s->tmpbuf, &s->dt, __FILE__, __LINE__);
+  }
+  lwgrp_scratch_free(&s);
+}
+
+int lwgrp_comm_iallgather(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  lwgrp_comm* comm,
+  lwgrp_request* req)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_IALLGATHER);
+  lwgrp_nb_allgather* s = (lwgrp_nb_allgather*) lwgrp_scratch_alloc(
+    sizeof(lwgrp_nb_allgather), __FILE__, __LINE__
+  );
+  lwgrp_nb_allgather_init(
+    s, sendbuf, recvbuf, num, datatype, &comm->ring, &comm->logring
+  );
+
+  int rc = lwgrp_request_start(
+    comm, lwgrp_nb_iallgather_advance, lwgrp_nb_allgather_release, s, req
+  );
+  LWGRP_STATS_END();
+  return rc;
+}
+
+/* ---------------------------------
+ * Allreduce
+ * --------------------------------- */
+
+enum lwgrp_nb_allreduce_phase {
+  ALLREDUCE_START,     /* fold in data from odd ranks out */
+  ALLREDUCE_FOLDED,    /* set up power-of-two group */
+  ALLREDUCE_EXCHANGE,  /* post next recursive doubling exchange */
+  ALLREDUCE_EXCHANGED, /* reduce data from exchange */
+  ALLREDUCE_NEIGHBORS, /* pick up next neighbors in power-of-two group */
+  ALLREDUCE_UNFOLD,    /* send result back to odd ranks out */
+  ALLREDUCE_DONE,
+};
+
+void lwgrp_nb_allreduce_init(
+  lwgrp_nb_allreduce* s,
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list)
+{
+  s->recvbuf  = recvbuf;
+  s->count    = count;
+  s->type     = type;
+  lwgrp_type_desc_init(&s->dt, type);
+  s->op       = op;
+  s->group    = group;
+  s->list     = list;
+  s->phase    = ALLREDUCE_START;
+  s->odd_rank_out = 0;
+  s->use_list = 0;
+
+  /* copy our data into the receive buffer */
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &s->dt);
+  }
+
+  /* allocate buffer to receive partial results */
+  s->tempbuf = lwgrp_desc_dtbuf_alloc(count, &s->dt, __FILE__, __LINE__);
+}
+
+/* follows lwgrp_logchain_allreduce_recursive, which is careful to
+ * preserve operand order for non-commutative ops */
+int lwgrp_nb_allreduce_advance(
+  lwgrp_nb_allreduce* s,
+  struct lwgrp_request_struct* req)
+{
+  MPI_Comm comm = s->group->comm;
+  int rank      = s->group->group_rank;
+  int ranks     = s->group->group_size;
+
+  while (1) {
+    switch (s->phase) {
+    case ALLREDUCE_START:
+    {
+      int log2;
+      lwgrp_largest_pow2_log2_lte(ranks, &s->pow2, &log2);
+      s->mask  = 1;
+      s->index = 0;
+      if (ranks == s->pow2) {
+        /* no odd ranks out, use logchain directly */
+        s->use_list = 1;
+        s->new_rank = rank;
+        s->cutoff   = 0;
+        s->phase    = ALLREDUCE_EXCHANGE;
+        break;
+      }
+
+      /* odd ranks out send their data to their left neighbor */
+      int extra = ranks - s->pow2;
+      s->cutoff = extra * 2;
+      s->phase  = ALLREDUCE_FOLDED;
+      if (rank < s->cutoff) {
+        if (rank & 0x1) {
+          MPI_Isend(
+            s->recvbuf, s->count, s->type, s->list->left_list[0], req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        } else {
+          MPI_Irecv(
+            s->tempbuf, s->count, s->type, s->list->right_list[0], req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        }
+        return 0;
+      }
+      break;
+    }
+    case ALLREDUCE_FOLDED:
+    {
+      /* the higher order data is in tempbuf */
+      if (rank < s->cutoff && !(rank & 0x1)) {
+        lwgrp_reduce_local(s->recvbuf, s->tempbuf, s->count, s->type, s->op);
+        lwgrp_desc_dtbuf_memcpy(s->recvbuf, s->tempbuf, s->count, &s->dt);
+      }
+
+      /* compute our rank and neighbors in the power-of-two group */
+      int extra   = ranks - s->pow2;
+      s->new_rank = rank - extra;
+      s->left     = s->group->comm_left;
+      s->right    = s->group->comm_right;
+      if (rank <= s->cutoff) {
+        if (rank & 0x1) {
+          s->odd_rank_out = 1;
+        }
+        s->new_rank = (rank >> 1);
+        if (rank > 0) {
+          s->left = s->list->left_list[1];
+        }
+        if (rank < s->cutoff) {
+          s->right = s->list->right_list[1];
+        }
+      }
+      s->recv_left  = MPI_PROC_NULL;
+      s->recv_right = MPI_PROC_NULL;
+      s->phase = (s->odd_rank_out) ? ALLREDUCE_UNFOLD : ALLREDUCE_EXCHANGE;
+      break;
+    }
+    case ALLREDUCE_EXCHANGE:
+    {
+      if (s->mask >= s->pow2) {
+        s->phase = ALLREDUCE_UNFOLD;
+        break;
+      }
+
+      /* exchange data with partner */
+      int partner;
+      int exchange_rank = s->new_rank ^ s->mask;
+      if (exchange_rank < s->new_rank) {
+        partner = s->use_list ? s->list->left_list[s->index] : s->left;
+      } else {
+        partner = s->use_list ? s->list->right_list[s->index] : s->right;
+      }
+      MPI_Irecv(
+        s->tempbuf, s->count, s->type, partner, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      MPI_Isend(
+        s->recvbuf, s->count, s->type, partner, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      s->phase = ALLREDUCE_EXCHANGED;
+      return 0;
+    }
+    case ALLREDUCE_EXCHANGED:
+    {
+      /* reduce data (being careful about non-commutative ops) */
+      int exchange_rank = s->new_rank ^ s->mask;
+      if (exchange_rank < s->new_rank) {
+        lwgrp_reduce_local(s->tempbuf, s->recvbuf, s->count, s->type, s->op);
+      } else {
+        lwgrp_reduce_local(s->recvbuf, s->tempbuf, s->count, s->type, s->op);
+        lwgrp_desc_dtbuf_memcpy(s->recvbuf, s->tempbuf, s->count, &s->dt);
+      }
+      s->mask <<= 1;
+      s->index++;
+
+      /* without the logchain, learn partners for the next round
+       * from our current neighbors */
+      s->phase = ALLREDUCE_EXCHANGE;
+      if (! s->use_list && s->mask < s->pow2) {
+        if (s->left != MPI_PROC_NULL) {
+          MPI_Irecv(
+            &s->recv_left, 1, MPI_INT, s->left, req->tag,
+            comm, lwgrp_request_next(req)
+          );
+          MPI_Isend(
+            &s->right, 1, MPI_INT, s->left, req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        }
+        if (s->right != MPI_PROC_NULL) {
+          MPI_Irecv(
+            &s->recv_right, 1, MPI_INT, s->right, req->tag,
+            comm, lwgrp_request_next(req)
+          );
+          MPI_Isend(
+            &s->left, 1, MPI_INT, s->right, req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        }
+        s->phase = ALLREDUCE_NEIGHBORS;
+        return 0;
+      }
+      break;
+    }
+    case ALLREDUCE_NEIGHBORS:
+      s->left  = s->recv_left;
+      s->right = s->recv_right;
+      s->phase = ALLREDUCE_EXCHANGE;
+      break;
+    case ALLREDUCE_UNFOLD:
+      /* send result back to odd ranks out */
+      s->phase = ALLREDUCE_DONE;
+      if (rank < s->cutoff) {
+        if (rank & 0x1) {
+          MPI_Irecv(
+            s->recvbuf, s->count, s->type, s->list->left_list[0], req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        } else {
+          MPI_Isend(
+            s->recvbuf, s->count, s->type, s->list->right_list[0], req->tag,
+            comm, lwgrp_request_next(req)
+          );
+        }
+        return 0;
+      }
+      break;
+    case ALLREDUCE_DONE:
+      /* free the buffer for partial results */
+      lwgrp_desc_dtbuf_free(&s->tempbuf, &s->dt, __FILE__, __LINE__);
+      s->tempbuf = NULL;
+      return 1;
+    }
+  }
+}
+
+static int lwgrp_nb_iallreduce_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_allreduce* s = (lwgrp_nb_allreduce*) req->state;
+  return lwgrp_nb_allreduce_advance(s, req);
+}
+
+static void lwgrp_nb_allreduce_release(void* state)
+{
+  lwgrp_nb_allreduce* s = (lwgrp_nb_allreduce*) state;
+  if (s->tempbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&s->tempbuf, &s->dt, __FILE__, __LINE__);
+  }
+  lwgrp_scratch_free(&s);
+}
+
+int lwgrp_comm_iallreduce(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  lwgrp_comm* comm,
+  lwgrp_request* req)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_IALLREDUCE);
+  lwgrp_nb_allreduce* s = (lwgrp_nb_allreduce*) lwgrp_scratch_alloc(
+    sizeof(lwgrp_nb_allreduce), __FILE__, __LINE__
+  );
+  lwgrp_nb_allreduce_init(
+    s, sendbuf, recvbuf, count, datatype, op, &comm->chain, &comm->logchain
+  );
+
+  int rc = lwgrp_request_start(
+    comm, lwgrp_nb_iallreduce_advance, lwgrp_nb_allreduce_release, s, req
+  );
+  LWGRP_STATS_END();
+  return rc;
+}
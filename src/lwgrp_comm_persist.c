@@ -0,0 +1,516 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Persistent collectives.  The init call builds a schedule of rounds,
+ * each with its partners, counts, and buffer offsets, and allocates
+ * any scratch space, so that each start only has to walk the schedule
+ * and post messages.  The schedules follow the same algorithms as the
+ * nonblocking ops in lwgrp_comm_nb.c. */
+
+/* ---------------------------------
+ * Barrier
+ * --------------------------------- */
+
+typedef struct {
+  int rounds; /* number of rounds */
+  int round;  /* next round to post */
+  int* srcs;  /* address we hear from in each round */
+  int* dsts;  /* address we signal in each round */
+  MPI_Comm comm;
+} lwgrp_persist_barrier;
+
+static int lwgrp_persist_barrier_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_barrier* s = (lwgrp_persist_barrier*) req->state;
+
+  if (s->round >= s->rounds) {
+    return 1;
+  }
+
+  /* dissemination, see lwgrp_logring_barrier_dissemination */
+  int src = s->srcs[s->round];
+  int dst = s->dsts[s->round];
+  MPI_Irecv(NULL, 0, MPI_BYTE, src, req->tag, s->comm, lwgrp_request_next(req));
+  MPI_Isend(NULL, 0, MPI_BYTE, dst, req->tag, s->comm, lwgrp_request_next(req));
+  s->round++;
+  return 0;
+}
+
+static int lwgrp_persist_barrier_start(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_barrier* s = (lwgrp_persist_barrier*) req->state;
+  s->round = 0;
+  return lwgrp_persist_barrier_advance(req);
+}
+
+static void lwgrp_persist_barrier_release(void* state)
+{
+  lwgrp_persist_barrier* s = (lwgrp_persist_barrier*) state;
+  lwgrp_free(&s->srcs);
+  lwgrp_free(&s->dsts);
+  lwgrp_free(&s);
+}
+
+int lwgrp_comm_barrier_init(lwgrp_comm* comm, lwgrp_request* req)
+{
+  const lwgrp_ring* group = &comm->ring;
+  const lwgrp_logring* list = &comm->logring;
+
+  lwgrp_persist_barrier* s = (lwgrp_persist_barrier*) lwgrp_malloc(
+    sizeof(lwgrp_persist_barrier), sizeof(void*), __FILE__, __LINE__
+  );
+  s->comm = group->comm;
+
+  /* one round for each power of two less than the group size */
+  int ranks = group->group_size;
+  int rounds = 0;
+  int dist = 1;
+  while (dist < ranks) {
+    rounds++;
+    dist <<= 1;
+  }
+  s->rounds = rounds;
+  s->round  = 0;
+  s->srcs = (int*) lwgrp_malloc(rounds * sizeof(int), sizeof(int), __FILE__, __LINE__);
+  s->dsts = (int*) lwgrp_malloc(rounds * sizeof(int), sizeof(int), __FILE__, __LINE__);
+
+  int i;
+  for (i = 0; i < rounds; i++) {
+    s->srcs[i] = list->left_list[i];
+    s->dsts[i] = list->right_list[i];
+  }
+
+  int rc = lwgrp_request_persistent(
+    comm, lwgrp_persist_barrier_start, lwgrp_persist_barrier_advance,
+    lwgrp_persist_barrier_release, s, req
+  );
+  return rc;
+}
+
+/* ---------------------------------
+ * Allgather
+ * --------------------------------- */
+
+typedef struct {
+  int src;    /* address we receive from */
+  int dst;    /* address we send to */
+  int offset; /* element offset in tmpbuf where received data goes */
+  int count;  /* number of elements exchanged */
+} lwgrp_persist_allgather_round;
+
+typedef struct {
+  const void* sendbuf;
+  void* recvbuf;
+  void* tmpbuf; /* holds blocks in order starting with our own */
+  int num;
+  int rank;
+  int ranks;
+  MPI_Datatype type;
+  lwgrp_type_desc dt;
+  MPI_Comm comm;
+  int rounds;
+  int round;
+  lwgrp_persist_allgather_round* sched;
+} lwgrp_persist_allgather;
+
+static int lwgrp_persist_allgather_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_allgather* s = (lwgrp_persist_allgather*) req->state;
+
+  /* post the next round of Bruck's algorithm */
+  if (s->round < s->rounds) {
+    lwgrp_persist_allgather_round* r = &s->sched[s->round];
+    void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(s->tmpbuf, r->offset, &s->dt);
+    MPI_Irecv(
+      recv_pos, r->count, s->type, r->src, req->tag,
+      s->comm, lwgrp_request_next(req)
+    );
+    MPI_Isend(
+      s->tmpbuf, r->count, s->type, r->dst, req->tag,
+      s->comm, lwgrp_request_next(req)
+    );
+    s->round++;
+    return 0;
+  }
+
+  /* shift our data back to the proper position in receive buffer */
+  int num_pre  = s->num * s->rank;
+  int num_post = s->num * (s->ranks - s->rank);
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(s->recvbuf, num_pre, &s->dt);
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(s->tmpbuf, num_post, &s->dt);
+  lwgrp_desc_dtbuf_memcpy(buf_pre, s->tmpbuf, num_post, &s->dt);
+  lwgrp_desc_dtbuf_memcpy(s->recvbuf, buf_post, num_pre, &s->dt);
+
+  return 1;
+}
+
+static int lwgrp_persist_allgather_start(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_allgather* s = (lwgrp_persist_allgather*) req->state;
+
+  if (s->ranks == 0) {
+    return 1;
+  }
+
+  /* copy our own data to the front of the temporary buffer */
+  const void* inputbuf = s->sendbuf;
+#if MPI_VERSION >= 2
+  if (s->sendbuf == MPI_IN_PLACE) {
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      s->recvbuf, s->num * s->rank, &s->dt
+    );
+  }
+#endif
+  lwgrp_desc_dtbuf_memcpy(s->tmpbuf, inputbuf, s->num, &s->dt);
+
+  s->round = 0;
+  return lwgrp_persist_allgather_advance(req);
+}
+
+static void lwgrp_persist_allgather_release(void* state)
+{
+  lwgrp_persist_allgather* s = (lwgrp_persist_allgather*) state;
+  lwgrp_desc_dtbuf_free(&s->tmpbuf, &s->dt, __FILE__, __LINE__);
+  lwgrp_free(&s->sched);
+  lwgrp_free(&s);
+}
+
+int lwgrp_comm_allgather_init(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  lwgrp_comm* comm,
+  lwgrp_request* req)
+{
+  const lwgrp_ring* group = &comm->ring;
+  const lwgrp_logring* list = &comm->logring;
+
+  lwgrp_persist_allgather* s = (lwgrp_persist_allgather*) lwgrp_malloc(
+    sizeof(lwgrp_persist_allgather), sizeof(void*), __FILE__, __LINE__
+  );
+  s->sendbuf = sendbuf;
+  s->recvbuf = recvbuf;
+  s->num     = num;
+  s->rank    = group->group_rank;
+  s->ranks   = group->group_size;
+  s->type    = datatype;
+  s->comm    = group->comm;
+  lwgrp_type_desc_init(&s->dt, datatype);
+
+  /* count the rounds, see lwgrp_logring_allgather_brucks */
+  int ranks = s->ranks;
+  int rounds = 0;
+  int step = 1;
+  while (step < ranks) {
+    rounds++;
+    step <<= 1;
+  }
+  s->rounds = rounds;
+  s->round  = 0;
+  s->sched = (lwgrp_persist_allgather_round*) lwgrp_malloc(
+    rounds * sizeof(lwgrp_persist_allgather_round), sizeof(int), __FILE__, __LINE__
+  );
+
+  /* in each round we pull as many blocks as we have from the proc
+   * step ranks to our right, capped at the group size */
+  int received = 1;
+  int i;
+  step = 1;
+  for (i = 0; i < rounds; i++) {
+    int incoming = step;
+    if (received + incoming > ranks) {
+      incoming = ranks - received;
+    }
+    lwgrp_persist_allgather_round* r = &s->sched[i];
+    r->src    = list->right_list[i];
+    r->dst    = list->left_list[i];
+    r->offset = received * num;
+    r->count  = incoming * num;
+    received += incoming;
+    step <<= 1;
+  }
+
+  s->tmpbuf = lwgrp_desc_dtbuf_alloc(num * ranks, &s->dt, __FILE__, __LINE__);
+
+  int rc = lwgrp_request_persistent(
+    comm, lwgrp_persist_allgather_start, lwgrp_persist_allgather_advance,
+    lwgrp_persist_allgather_release, s, req
+  );
+  return rc;
+}
+
+/* ---------------------------------
+ * Allreduce
+ * --------------------------------- */
+
+enum lwgrp_persist_allreduce_phase {
+  PERSIST_ALLREDUCE_FOLD,     /* odd ranks out send data to left neighbor */
+  PERSIST_ALLREDUCE_FOLDED,   /* reduce data from odd rank out */
+  PERSIST_ALLREDUCE_EXCHANGE, /* post next recursive doubling exchange */
+  PERSIST_ALLREDUCE_REDUCE,   /* reduce data from exchange */
+  PERSIST_ALLREDUCE_UNFOLD,   /* send result back to odd ranks out */
+  PERSIST_ALLREDUCE_DONE,
+};
+
+/* our role in folding the group down to a power of two */
+enum lwgrp_persist_allreduce_fold {
+  PERSIST_FOLD_NONE, /* not involved */
+  PERSIST_FOLD_OUT,  /* we hand our data to the left and sit out */
+  PERSIST_FOLD_IN,   /* we take data from the right */
+};
+
+typedef struct {
+  const void* sendbuf;
+  void* recvbuf;
+  void* tempbuf;
+  int count;
+  MPI_Datatype type;
+  lwgrp_type_desc dt;
+  MPI_Op op;
+  MPI_Comm comm;
+  int fold;         /* our lwgrp_persist_allreduce_fold role */
+  int fold_partner; /* address of proc we fold with */
+  int phase;
+  int rounds;       /* number of recursive doubling rounds */
+  int round;        /* current round */
+  int* partners;    /* address of partner in each round */
+  int* lower;       /* whether partner holds lower order data in each round */
+} lwgrp_persist_allreduce;
+
+/* follows lwgrp_nb_allreduce_advance, but with partners known up front */
+static int lwgrp_persist_allreduce_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_allreduce* s = (lwgrp_persist_allreduce*) req->state;
+
+  while (1) {
+    switch (s->phase) {
+    case PERSIST_ALLREDUCE_FOLD:
+      s->phase = PERSIST_ALLREDUCE_FOLDED;
+      if (s->fold == PERSIST_FOLD_OUT) {
+        MPI_Isend(
+          s->recvbuf, s->count, s->type, s->fold_partner, req->tag,
+          s->comm, lwgrp_request_next(req)
+        );
+        s->phase = PERSIST_ALLREDUCE_UNFOLD;
+        return 0;
+      } else if (s->fold == PERSIST_FOLD_IN) {
+        MPI_Irecv(
+          s->tempbuf, s->count, s->type, s->fold_partner, req->tag,
+          s->comm, lwgrp_request_next(req)
+        );
+        return 0;
+      }
+      break;
+    case PERSIST_ALLREDUCE_FOLDED:
+      /* the higher order data is in tempbuf */
+      if (s->fold == PERSIST_FOLD_IN) {
+        lwgrp_reduce_local(s->recvbuf, s->tempbuf, s->count, s->type, s->op);
+        lwgrp_desc_dtbuf_memcpy(s->recvbuf, s->tempbuf, s->count, &s->dt);
+      }
+      s->phase = PERSIST_ALLREDUCE_EXCHANGE;
+      break;
+    case PERSIST_ALLREDUCE_EXCHANGE:
+    {
+      if (s->round >= s->rounds) {
+        s->phase = PERSIST_ALLREDUCE_UNFOLD;
+        break;
+      }
+      int partner = s->partners[s->round];
+      MPI_Irecv(
+        s->tempbuf, s->count, s->type, partner, req->tag,
+        s->comm, lwgrp_request_next(req)
+      );
+      MPI_Isend(
+        s->recvbuf, s->count, s->type, partner, req->tag,
+        s->comm, lwgrp_request_next(req)
+      );
+      s->phase = PERSIST_ALLREDUCE_REDUCE;
+      return 0;
+    }
+    case PERSIST_ALLREDUCE_REDUCE:
+      /* reduce data (being careful about non-commutative ops) */
+      if (s->lower[s->round]) {
+        lwgrp_reduce_local(s->tempbuf, s->recvbuf, s->count, s->type, s->op);
+      } else {
+        lwgrp_reduce_local(s->recvbuf, s->tempbuf, s->count, s->type, s->op);
+        lwgrp_desc_dtbuf_memcpy(s->recvbuf, s->tempbuf, s->count, &s->dt);
+      }
+      s->round++;
+      s->phase = PERSIST_ALLREDUCE_EXCHANGE;
+      break;
+    case PERSIST_ALLREDUCE_UNFOLD:
+      /* send result back to odd ranks out */
+      s->phase = PERSIST_ALLREDUCE_DONE;
+      if (s->fold == PERSIST_FOLD_OUT) {
+        MPI_Irecv(
+          s->recvbuf, s->count, s->type, s->fold_partner, req->tag,
+          s->comm, lwgrp_request_next(req)
+        );
+        return 0;
+      } else if (s->fold == PERSIST_FOLD_IN) {
+        MPI_Isend(
+          s->recvbuf, s->count, s->type, s->fold_partner, req->tag,
+          s->comm, lwgrp_request_next(req)
+        );
+        return 0;
+      }
+      break;
+    case PERSIST_ALLREDUCE_DONE:
+      return 1;
+    }
+  }
+}
+
+static int lwgrp_persist_allreduce_start(struct lwgrp_request_struct* req)
+{
+  lwgrp_persist_allreduce* s = (lwgrp_persist_allreduce*) req->state;
+
+  /* copy our data into the receive buffer */
+  if (s->sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(s->recvbuf, s->sendbuf, s->count, &s->dt);
+  }
+
+  s->phase = PERSIST_ALLREDUCE_FOLD;
+  s->round = 0;
+  return lwgrp_persist_allreduce_advance(req);
+}
+
+static void lwgrp_persist_allreduce_release(void* state)
+{
+  lwgrp_persist_allreduce* s = (lwgrp_persist_allreduce*) state;
+  lwgrp_desc_dtbuf_free(&s->tempbuf, &s->dt, __FILE__, __LINE__);
+  lwgrp_free(&s->partners);
+  lwgrp_free(&s->lower);
+  lwgrp_free(&s);
+}
+
+int lwgrp_comm_allreduce_init(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  lwgrp_comm* comm,
+  lwgrp_request* req)
+{
+  const lwgrp_chain* group = &comm->chain;
+  const lwgrp_logchain* list = &comm->logchain;
+  MPI_Comm mpicomm = group->comm;
+  int rank  = group->group_rank;
+  int ranks = group->group_size;
+
+  lwgrp_persist_allreduce* s = (lwgrp_persist_allreduce*) lwgrp_malloc(
+    sizeof(lwgrp_persist_allreduce), sizeof(void*), __FILE__, __LINE__
+  );
+  s->sendbuf  = sendbuf;
+  s->recvbuf  = recvbuf;
+  s->count    = count;
+  s->type     = datatype;
+  s->op       = op;
+  s->comm     = mpicomm;
+  s->fold     = PERSIST_FOLD_NONE;
+  s->fold_partner = MPI_PROC_NULL;
+  s->phase    = PERSIST_ALLREDUCE_DONE;
+  s->rounds   = 0;
+  s->round    = 0;
+  s->partners = NULL;
+  s->lower    = NULL;
+  lwgrp_type_desc_init(&s->dt, datatype);
+
+  /* take a tag to find partners with, all procs do this so they
+   * stay in step on the comm's tags */
+  int tag = lwgrp_comm_next_tag(comm);
+
+  int pow2 = 0;
+  int log2 = 0;
+  if (ranks > 0) {
+    lwgrp_largest_pow2_log2_lte(ranks, &pow2, &log2);
+  }
+
+  /* fold the odd ranks out into their left neighbors until we have
+   * a power of two, see lwgrp_nb_allreduce_advance */
+  int extra  = ranks - pow2;
+  int cutoff = extra * 2;
+  int new_rank = rank - extra;
+  int left  = group->comm_left;
+  int right = group->comm_right;
+  if (rank < cutoff) {
+    if (rank & 0x1) {
+      s->fold = PERSIST_FOLD_OUT;
+      s->fold_partner = list->left_list[0];
+    } else {
+      s->fold = PERSIST_FOLD_IN;
+      s->fold_partner = list->right_list[0];
+    }
+  }
+  if (ranks != pow2 && rank <= cutoff) {
+    new_rank = (rank >> 1);
+    if (rank > 0) {
+      left = list->left_list[1];
+    }
+    if (rank < cutoff) {
+      right = list->right_list[1];
+    }
+  }
+
+  if (s->fold != PERSIST_FOLD_OUT) {
+    s->rounds   = log2;
+    s->partners = (int*) lwgrp_malloc(log2 * sizeof(int), sizeof(int), __FILE__, __LINE__);
+    s->lower    = (int*) lwgrp_malloc(log2 * sizeof(int), sizeof(int), __FILE__, __LINE__);
+  }
+
+  /* record our partner for each round, when the group is a power of
+   * two the logchain has them, otherwise we learn the partners for
+   * the next round from our current neighbors */
+  int i;
+  int mask = 1;
+  for (i = 0; i < s->rounds; i++) {
+    int exchange_rank = new_rank ^ mask;
+    s->lower[i] = (exchange_rank < new_rank);
+    if (ranks == pow2) {
+      s->partners[i] = s->lower[i] ? list->left_list[i] : list->right_list[i];
+    } else {
+      s->partners[i] = s->lower[i] ? left : right;
+      if (i + 1 < s->rounds) {
+        int recv_left  = MPI_PROC_NULL;
+        int recv_right = MPI_PROC_NULL;
+        MPI_Request request[4];
+        int k = 0;
+        if (left != MPI_PROC_NULL) {
+          MPI_Irecv(&recv_left, 1, MPI_INT, left, tag, mpicomm, &request[k++]);
+          MPI_Isend(&right, 1, MPI_INT, left, tag, mpicomm, &request[k++]);
+        }
+        if (right != MPI_PROC_NULL) {
+          MPI_Irecv(&recv_right, 1, MPI_INT, right, tag, mpicomm, &request[k++]);
+          MPI_Isend(&left, 1, MPI_INT, right, tag, mpicomm, &request[k++]);
+        }
+        MPI_Waitall(k, request, MPI_STATUSES_IGNORE);
+        left  = recv_left;
+        right = recv_right;
+      }
+    }
+    mask <<= 1;
+  }
+
+  s->tempbuf = lwgrp_desc_dtbuf_alloc(count, &s->dt, __FILE__, __LINE__);
+
+  int rc = lwgrp_request_persistent(
+    comm, lwgrp_persist_allreduce_start, lwgrp_persist_allreduce_advance,
+    lwgrp_persist_allreduce_release, s, req
+  );
+  return rc;
+}
@@ -0,0 +1,339 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Sparse exchanges, where each process only talks to a few members of
+ * the group.  To send to an arbitrary group rank, we need its address
+ * in the parent communicator, which takes O(N) memory to store for all
+ * members, so we only build that table the first time a sparse op is
+ * called on a comm and then keep it until the comm is freed.
+ *
+ * The NBX algorithm for exchanges where receivers don't know their
+ * senders is from:
+ * Torsten Hoefler, Christian Siebert, and Andrew Lumsdaine,
+ * "Scalable communication protocols for dynamic sparse data exchange",
+ * PPoPP 2010 */
+
+/* compares (address, rank) pairs by address */
+static int lwgrp_cmp_addr(const void* a, const void* b)
+{
+  int a_addr = *(const int*)a;
+  int b_addr = *(const int*)b;
+  if (a_addr != b_addr) {
+    if (a_addr > b_addr) {
+      return 1;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/* fill in the address table on comm if we don't have it yet,
+ * collective the first time it's called -- O(log N) communication,
+ * O(N) memory */
+static int lwgrp_comm_build_addrs(lwgrp_comm* comm)
+{
+  if (comm->addrs != NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  int ranks = comm->ring.group_size;
+  if (ranks == 0) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* gather address of each member */
+  comm->addrs = (int*) lwgrp_malloc(
+    ranks * sizeof(int), sizeof(int), __FILE__, __LINE__
+  );
+  lwgrp_logring_allgather_brucks(
+    &comm->ring.comm_rank, comm->addrs, 1, MPI_INT,
+    &comm->ring, &comm->logring
+  );
+
+  /* sort group ranks by address for reverse lookups */
+  int* pairs = (int*) lwgrp_scratch_alloc(
+    2 * ranks * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < ranks; i++) {
+    pairs[2 * i + 0] = comm->addrs[i];
+    pairs[2 * i + 1] = i;
+  }
+  qsort(pairs, ranks, 2 * sizeof(int), lwgrp_cmp_addr);
+
+  comm->addr_ranks = (int*) lwgrp_malloc(
+    ranks * sizeof(int), sizeof(int), __FILE__, __LINE__
+  );
+  for (i = 0; i < ranks; i++) {
+    comm->addr_ranks[i] = pairs[2 * i + 1];
+  }
+  lwgrp_scratch_free(&pairs);
+
+  return LWGRP_SUCCESS;
+}
+
+/* given an address in the parent comm, return the group rank of that
+ * process, or -1 if it is not in the group -- O(log N) local */
+static int lwgrp_comm_rank_from_addr(const lwgrp_comm* comm, int addr)
+{
+  int lo = 0;
+  int hi = comm->ring.group_size - 1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    int rank = comm->addr_ranks[mid];
+    int mid_addr = comm->addrs[rank];
+    if (mid_addr == addr) {
+      return rank;
+    } else if (mid_addr < addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -1;
+}
+
+int lwgrp_comm_neighbor_alltoallv(
+  const void* sendbuf,
+  int outdegree,
+  const int dests[],
+  const int sendcounts[],
+  const int senddispls[],
+  void* recvbuf,
+  int indegree,
+  const int sources[],
+  const int recvcounts[],
+  const int recvdispls[],
+  MPI_Datatype datatype,
+  lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_NEIGHBOR);
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* get addresses of group members */
+  lwgrp_comm_build_addrs(comm);
+
+  /* get a tag for this exchange */
+  MPI_Comm mpicomm = comm->ring.comm;
+  int tag = lwgrp_comm_next_tag(comm);
+
+  /* allocate space for requests */
+  int total = indegree + outdegree;
+  MPI_Request* request = (MPI_Request*) lwgrp_scratch_alloc(
+    total * sizeof(MPI_Request), __FILE__, __LINE__
+  );
+
+  /* post our receives, we skip zero-size messages on both sides */
+  int i;
+  int k = 0;
+  for (i = 0; i < indegree; i++) {
+    int count = recvcounts[i];
+    if (count > 0) {
+      void* ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, recvdispls[i], &dt);
+      int src = comm->addrs[sources[i]];
+      MPI_Irecv(ptr, count, datatype, src, tag, mpicomm, &request[k]);
+      k++;
+    }
+  }
+
+  /* post our sends */
+  for (i = 0; i < outdegree; i++) {
+    int count = sendcounts[i];
+    if (count > 0) {
+      void* ptr = lwgrp_desc_dtbuf_from_dtbuf(sendbuf, senddispls[i], &dt);
+      int dst = comm->addrs[dests[i]];
+      MPI_Isend(ptr, count, datatype, dst, tag, mpicomm, &request[k]);
+      k++;
+    }
+  }
+
+  /* wait for everything to complete */
+  if (k > 0) {
+    MPI_Waitall(k, request, MPI_STATUSES_IGNORE);
+  }
+
+  lwgrp_scratch_free(&request);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_sparse_exchange(
+  const void* sendbuf,
+  int outdegree,
+  const int dests[],
+  const int sendcounts[],
+  const int senddispls[],
+  MPI_Datatype datatype,
+  void** recvbuf,
+  int* indegree,
+  int** sources,
+  int** recvcounts,
+  int** recvdispls,
+  lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SPARSE);
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* get addresses of group members */
+  lwgrp_comm_build_addrs(comm);
+
+  /* get a tag for this exchange, we need one that no other exchange
+   * uses since we receive from MPI_ANY_SOURCE, and a fast proc may
+   * move on to its next op while we're still receiving */
+  MPI_Comm mpicomm = comm->ring.comm;
+  int tag = lwgrp_comm_next_tag(comm);
+
+  /* send our messages with synchronous sends, so that once they all
+   * complete we know our data has been matched at the receivers */
+  MPI_Request* request = NULL;
+  if (outdegree > 0) {
+    request = (MPI_Request*) lwgrp_scratch_alloc(
+      outdegree * sizeof(MPI_Request), __FILE__, __LINE__
+    );
+  }
+  int i;
+  for (i = 0; i < outdegree; i++) {
+    void* ptr = lwgrp_desc_dtbuf_from_dtbuf(sendbuf, senddispls[i], &dt);
+    int dst = comm->addrs[dests[i]];
+    MPI_Issend(ptr, sendcounts[i], datatype, dst, tag, mpicomm, &request[i]);
+  }
+
+  /* incoming messages, we grow these arrays as needed */
+  int msgs      = 0;
+  int max_msgs  = 0;
+  int elems     = 0;
+  int max_elems = 0;
+  void* buf   = NULL;
+  int* srcs   = NULL;
+  int* counts = NULL;
+  int* displs = NULL;
+
+  /* receive messages until the barrier completes, we start the
+   * barrier once all of our sends have been matched, and it
+   * completes once all procs have done so */
+  lwgrp_request barrier = LWGRP_REQUEST_NULL;
+  int barrier_started = 0;
+  int done = 0;
+  while (! done) {
+    /* check for an incoming message */
+    int flag;
+    MPI_Status status;
+    MPI_Iprobe(MPI_ANY_SOURCE, tag, mpicomm, &flag, &status);
+    if (flag) {
+      int count;
+      MPI_Get_count(&status, datatype, &count);
+
+      /* make room for another message */
+      if (msgs == max_msgs) {
+        max_msgs = (max_msgs > 0) ? 2 * max_msgs : 8;
+        int* new_srcs   = (int*) lwgrp_malloc(max_msgs * sizeof(int), sizeof(int), __FILE__, __LINE__);
+        int* new_counts = (int*) lwgrp_malloc(max_msgs * sizeof(int), sizeof(int), __FILE__, __LINE__);
+        int* new_displs = (int*) lwgrp_malloc(max_msgs * sizeof(int), sizeof(int), __FILE__, __LINE__);
+        int j;
+        for (j = 0; j < msgs; j++) {
+          new_srcs[j]   = srcs[j];
+          new_counts[j] = counts[j];
+          new_displs[j] = displs[j];
+        }
+        lwgrp_free(&srcs);
+        lwgrp_free(&counts);
+        lwgrp_free(&displs);
+        srcs   = new_srcs;
+        counts = new_counts;
+        displs = new_displs;
+      }
+
+      /* make room for its data */
+      if (elems + count > max_elems) {
+        int new_max = (max_elems > 0) ? 2 * max_elems : 64;
+        while (new_max < elems + count) {
+          new_max *= 2;
+        }
+        void* new_buf = lwgrp_desc_dtbuf_alloc(new_max, &dt, __FILE__, __LINE__);
+        if (elems > 0) {
+          lwgrp_desc_dtbuf_memcpy(new_buf, buf, elems, &dt);
+        }
+        if (buf != NULL) {
+          lwgrp_desc_dtbuf_free(&buf, &dt, __FILE__, __LINE__);
+        }
+        buf = new_buf;
+        max_elems = new_max;
+      }
+
+      /* receive the message */
+      void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buf, elems, &dt);
+      MPI_Recv(
+        ptr, count, datatype, status.MPI_SOURCE, tag, mpicomm,
+        MPI_STATUS_IGNORE
+      );
+      srcs[msgs]   = lwgrp_comm_rank_from_addr(comm, status.MPI_SOURCE);
+      counts[msgs] = count;
+      displs[msgs] = elems;
+      msgs++;
+      elems += count;
+    }
+
+    if (! barrier_started) {
+      /* start the barrier once all of our sends have been matched */
+      int sent = 1;
+      if (outdegree > 0) {
+        MPI_Testall(outdegree, request, &sent, MPI_STATUSES_IGNORE);
+      }
+      if (sent) {
+        lwgrp_comm_ibarrier(comm, &barrier);
+        barrier_started = 1;
+      }
+    } else {
+      /* we're done once everyone has entered the barrier */
+      lwgrp_test(&barrier, &done);
+    }
+  }
+
+  lwgrp_scratch_free(&request);
+
+  /* hand messages back to caller */
+  *recvbuf    = buf;
+  *indegree   = msgs;
+  *sources    = srcs;
+  *recvcounts = counts;
+  *recvdispls = displs;
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_sparse_free(
+  void** recvbuf,
+  MPI_Datatype datatype,
+  int** sources,
+  int** recvcounts,
+  int** recvdispls)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  if (*recvbuf != NULL) {
+    lwgrp_desc_dtbuf_free(recvbuf, &dt, __FILE__, __LINE__);
+    *recvbuf = NULL;
+  }
+  lwgrp_free(sources);
+  lwgrp_free(recvcounts);
+  lwgrp_free(recvdispls);
+  return LWGRP_SUCCESS;
+}
@@ -14,18 +14,24 @@
 #include "mpi.h"
 #include "lwgrp.h"
 #include "lwgrp_internal.h"
+#include "lwgrp_comm_split.h"
 
 /* Based on "Exascale Algorithms for Generalized MPI_Comm_split",
  * EuroMPI 2011, Adam Moody, Dong H. Ahn, and Bronis R. de Supinkski
  *
- * Executes an MPI_Comm_split operation using bitonic sort, a double
- * inclusive scan to find color boundaries and left and right group
- * neighbors, a recv from ANY_SOURCE, and a barrier, returns the
- * output group as a chain. */
+ * Executes an MPI_Comm_split operation using a parallel sort
+ * (see lwgrp_comm_sort), a double inclusive scan to find color
+ * boundaries and left and right group neighbors, and a route of
+ * each result back to its originating rank (or a recv from
+ * ANY_SOURCE with LWGRP_USE_ANYSOURCE).  The scan also collects the
+ * ring wrap addresses and the logchain of each output group, so we
+ * build the output comm without rerunning its ring and logring
+ * construction from scratch, and it ORs together the contexts used
+ * by the members of each output group, so the group picks its
+ * context without another collective. */
 
 /* compares first int,
- *   - used to compare color values after sorting
- *   - used to sort data back to its originating rank */
+ *   - used to compare color values after sorting */
 static int lwgrp_cmp_int(const void* a_void, const void* b_void, size_t offset)
 {
   /* get pointers to the integer array, offset is dummy in this case */
@@ -79,6 +85,27 @@ static int lwgrp_cmp_three_ints(const void* a_void, const void* b_void, size_t o
   return 0;
 }
 
+/* compares a (split,color,key,rank) integer tuple that follows a
+ * leading int, first by split, then color, key, and rank
+ *   - used to sort records of several splits at once */
+static int lwgrp_cmp_four_ints_at_one(const void* a_void, const void* b_void, size_t offset)
+{
+  /* get pointers to the integer array after the leading int,
+   * offset is dummy in this case */
+  const int* a = (const int*) a_void + 1;
+  const int* b = (const int*) b_void + 1;
+
+  /* compare split values first, then (color,key,rank) */
+  if (a[0] != b[0]) {
+    if (a[0] > b[0]) {
+      return 1;
+    }
+    return -1;
+  }
+  int rc = lwgrp_cmp_three_ints(a + 1, b + 1, offset);
+  return rc;
+}
+
 /* compares a string
  *   - used to compare strings after sorting */
 static int lwgrp_cmp_str(const void* a, const void* b, size_t offset)
@@ -128,456 +155,631 @@ static int lwgrp_cmp_str_int(const void* a, const void* b, size_t offset)
   return 0;
 }
 
-static int lwgrp_logchain_sort_bitonic_merge(
-  void* value,
-  void* scratch,
-  MPI_Datatype type,
-  size_t type_size,
-  size_t offset,
-  int (*compare)(const void*, const void*, size_t),
-  int start,
-  int num,
-  int direction,
-  const lwgrp_chain* group,
-  const lwgrp_logchain* list,
-  int tag)
-{
-  if (num > 1) {
-    /* get our group communicator and our rank within the group */
-    MPI_Comm comm = group->comm;
-    int rank = group->group_rank;
-
-    /* determine largest power of two that is smaller than num */
-    int count = 1;
-    int index = 0;
-    while (count < num) {
-      count <<= 1;
-      index++;
-    }
-    count >>= 1;
-    index--;
-
-    /* divide range into two chunks, execute bitonic half-clean step,
-     * then recursively merge each half */
-    MPI_Status status[2];
-    if (rank < start + count) {
-      /* we are in the lower half, find a partner in the upper half */
-      int dst_rank = rank + count;
-      if (dst_rank < start + num) {
-        /* exchange data with our partner rank */
-        int partner = list->right_list[index];
-        MPI_Sendrecv(
-          value,   1, type, partner, tag,
-          scratch, 1, type, partner, tag,
-          comm, status
-        );
-
-        /* select the appropriate value,
-         * depedning on the sort direction */
-        int cmp = (*compare)(scratch, value, offset);
-        if ((direction && cmp < 0) || (!direction && cmp > 0)) {
-          /* we keep the value if
-           *   direction is ascending and new value is smaller,
-           *   direction is descending and new value is greater */
-          memcpy(value, scratch, type_size);
-        }
-      }
-
-      /* recursively merge our half */
-      lwgrp_logchain_sort_bitonic_merge(
-        value, scratch, type, type_size, offset, compare,
-        start, count, direction,
-        group, list, tag
-      );
-    } else {
-      /* we are in the upper half, find a partner in the lower half */
-      int dst_rank = rank - count;
-      if (dst_rank >= start) {
-        /* exchange data with our partner rank */
-        int partner = list->left_list[index];
-        MPI_Sendrecv(
-          value,   1, type, partner, tag,
-          scratch, 1, type, partner, tag,
-          comm, status
-        );
-
-        /* select the appropriate value,
-         * depedning on the sort direction */
-        int cmp = (*compare)(scratch, value, offset);
-        if ((direction && cmp > 0) || (!direction && cmp < 0)) {
-          /* we keep the value if
-           *   direction is ascending and new value is bigger,
-           *   direction is descending and new value is smaller */
-          memcpy(value, scratch, type_size);
-        }
-      }
-
-      /* recursively merge our half */
-      int new_start = start + count;
-      int new_num   = num - count;
-      lwgrp_logchain_sort_bitonic_merge(
-        value, scratch, type, type_size, offset, compare,
-        new_start, new_num, direction,
-        group, list, tag
-      );
-    }
-  }
-
-  return 0;
-}
-
-static int lwgrp_logchain_sort_bitonic_sort(
-  void* value,
-  void* scratch,
-  MPI_Datatype type,
-  size_t type_size,
-  size_t offset,
-  int (*compare)(const void*, const void*, size_t),
-  int start,
-  int num,
-  int direction,
-  const lwgrp_chain* group,
-  const lwgrp_logchain* list,
-  int tag)
-{
-  if (num > 1) {
-    /* get our rank in our group */
-    int rank = group->group_rank;
-
-    /* recursively divide and sort each half */
-    int mid = num / 2;
-    if (rank < start + mid) {
-      /* sort first half in one direction */
-      lwgrp_logchain_sort_bitonic_sort(
-        value, scratch, type, type_size, offset, compare,
-        start, mid, !direction,
-        group, list, tag
-      );
-    } else {
-      /* sort the second half in the other direction */
-      int new_start = start + mid;
-      int new_num   = num - mid;
-      lwgrp_logchain_sort_bitonic_sort(
-        value, scratch, type, type_size, offset, compare,
-        new_start, new_num, direction,
-        group, list, tag
-      );
-    }
-
-    /* merge the two sorted halves */
-    lwgrp_logchain_sort_bitonic_merge(
-      value, scratch, type, type_size, offset, compare,
-      start, num, direction,
-      group, list, tag
-    );
-  }
-
-  return 0;
-}
-
-/* globally sort items across processes in group,
- * each process provides its tuple as item on input,
- * on output item is overwritten with a new item
- * such that if rank_i < rank_j, item_i < item_j for all i and j */
-static int lwgrp_logchain_sort_bitonic(
-  void* value,
-  MPI_Datatype type,
-  size_t type_size,
-  size_t data_offset,
-  int (*compare)(const void*, const void*, size_t),
-  const lwgrp_chain* group,
-  const lwgrp_logchain* list,
-  int tag)
-{
-  /* allocate a scratch buffer to hold received type during sort */
-  void* scratch = malloc(type_size);
-  if (scratch == NULL) {
-    /* TODO: error */
-  }
-
-  /* conduct the bitonic sort on our values */
-  int ranks = group->group_size;
-  int rc = lwgrp_logchain_sort_bitonic_sort(
-    value, scratch, type, type_size, data_offset, compare,
-    0, ranks, 1,
-    group, list, tag
-  );
-
-  /* free the buffer */
-  if (scratch != NULL) {
-    free(scratch);
-    scratch = NULL;
-  }
-
-  return rc;
-}
-
 enum scan_fields {
   SCAN_COLOR = 0, /* running count of number of groups */
   SCAN_FLAG  = 1, /* set flag to 1 when we should stop accumulating */
   SCAN_COUNT = 2, /* running count of ranks within segmented group */
   SCAN_NEXT  = 3, /* address of next process to talk to */
+  SCAN_END   = 4, /* address of first (or last) rank of segmented group */
+  SCAN_ADDR  = 5, /* address of rank that contributed sender's item */
+  SCAN_MASK  = 6, /* contexts used within segmented group, one bit each */
 };
 
+/* number of ints in each scan message */
+#define SCAN_INTS (6 + LWGRP_CONTEXT_WORDS)
+
 enum chain_fields {
-  CHAIN_SRC   = 0, /* address of originating rank */
+  CHAIN_SRC   = 0, /* rank of originating process within input group */
   CHAIN_LEFT  = 1, /* address of left rank */
   CHAIN_RIGHT = 2, /* address of right rank */
   CHAIN_RANK  = 3, /* rank of originating process within its new group */
   CHAIN_SIZE  = 4, /* size of new group */
   CHAIN_ID    = 5, /* id of new group */
   CHAIN_COUNT = 6, /* number of new groups */
+  CHAIN_ADDR  = 7, /* address of originating rank */
+  CHAIN_FIRST = 8, /* address of first rank in new group */
+  CHAIN_LAST  = 9, /* address of last rank in new group */
+  CHAIN_SPLIT = 10, /* index of split with lwgrp_comm_split_multi */
+  CHAIN_CONTEXT = 11, /* context for new group, -1 if none are free */
 };
 
+/* number of ints in the result we send back to the originating rank,
+ * when we collect lists, these are followed by the addresses 2^d hops
+ * to the left for each level d and then those 2^d hops to the right */
+#define CHAIN_INTS (12)
+
+/* number of ints in the (color,key,rank,addr,mask) items we split on,
+ * the mask marks the contexts used by the rank that contributed the
+ * item when the split started */
+#define ITEM_INTS (4 + LWGRP_CONTEXT_WORDS)
+
+/* mask_offset for items that carry no contexts */
+#define SPLIT_NO_MASK ((size_t) -1)
+
+/* returns the number of 2^d levels we record for an input group of
+ * the given size, which covers any output group */
+static int lwgrp_split_levels(int ranks)
+{
+  int levels = 0;
+  int count = 1;
+  while (count < ranks) {
+    levels++;
+    count <<= 1;
+  }
+  return levels;
+}
+
 /* assumes that color/key/rank tuples have been globally sorted
  * across ranks of in chain, computes corresponding group
- * information for val and passes that back to originating rank:
+ * information for val to be passed back to originating rank:
  *   1) determines group boundaries and left and right neighbors
  *      by sending pt2pt msgs to left and right neighbors and
  *      comparing color values
  *   2) executes left-to-right and right-to-left (double) inclusive
  *      segmented scan to compute number of ranks to left and right
- *      sides of host value */
-static int lwgrp_logchain_split_sorted(
+ *      sides of host value, along with the addresses of the first
+ *      and last ranks of the group
+ *   3) if asked, records the originating address of the item held by
+ *      each scan partner, since partners are 2^d items away in the
+ *      sorted order, those within our group are exactly the entries
+ *      of the new group's logchain
+ *   4) if items carry context bitmaps, ORs them within the segments
+ *      of the same scan, so every item of a group sees the contexts
+ *      used by all of its members and picks the same free one
+ * we run this as a nonblocking op so that both lwgrp_comm_split and
+ * lwgrp_comm_isplit can use it */
+
+enum split_sorted_phase {
+  SPLIT_SORTED_START,     /* exchange values with neighbors */
+  SPLIT_SORTED_NEIGHBORS, /* find group boundaries */
+  SPLIT_SORTED_SCAN,      /* post next step of double scan */
+  SPLIT_SORTED_SCANNED,   /* reduce data from scan step */
+};
+
+typedef struct {
+  const void* value;
+  MPI_Datatype type;
+  int count;          /* number of items we hold, one in each split */
+  size_t type_size;
+  size_t data_offset;
+  size_t mask_offset;
+  int (*compare)(const void*, const void*, size_t);
+  const lwgrp_chain* in;
+  int phase;
+  void* left_buf;     /* values of left neighbor */
+  void* right_buf;    /* values of right neighbor */
+  int left_rank;      /* address of left partner in scan */
+  int right_rank;     /* address of right partner in scan */
+  int levels;         /* number of 2^d addresses we record on each side */
+  int round;          /* current step of the scan */
+  int rec_ints;       /* number of ints in the result for each item */
+  int* send_left_ints;  /* left-going scan data for each item */
+  int* send_right_ints; /* right-going scan data for each item */
+  int* recv_left_ints;  /* scan data from left partner for each item */
+  int* recv_right_ints; /* scan data from right partner for each item */
+  int* send_ints;     /* results for originating ranks */
+} lwgrp_split_sorted;
+
+/* we hold count items, where item i is our item in the i-th of count
+ * splits that we run side by side, each split has its own sort order,
+ * but all of them share the same scan partners, so we just send count
+ * times as much data in each message */
+static void lwgrp_split_sorted_init(
+  lwgrp_split_sorted* s,
   const void* value,
+  int count,
   MPI_Datatype type,
   size_t type_size,
+  size_t rank_offset,
   size_t data_offset,
+  size_t mask_offset,
   int (*compare)(const void*, const void*, size_t),
-  const lwgrp_chain* in,
-  const lwgrp_logchain* list,
-  int tag1,
-  int tag2,
-  int recv_ints[7])
+  int levels,
+  const lwgrp_chain* in)
 {
-  int k;
-  MPI_Request request[4];
-  MPI_Status  status[4];
-
-  /* we will fill in 7 integer values (src, left, right, rank, size, groupid, groups)
+  s->value       = value;
+  s->type        = type;
+  s->count       = count;
+  s->type_size   = type_size;
+  s->data_offset = data_offset;
+  s->mask_offset = mask_offset;
+  s->compare     = compare;
+  s->in          = in;
+  s->phase       = SPLIT_SORTED_START;
+  s->levels      = levels;
+  s->round       = 0;
+  s->rec_ints    = CHAIN_INTS + 2 * levels;
+
+  /* for each item, we will fill in 12 integer values (src, left,
+   * right, rank, size, groupid, groups, addr, first, last, split,
+   * context)
    * representing the chain data structure for the the globally
-   * ordered color/key/rank tuple that we hold, which we'll later
-   * send back to the rank that contributed our item */
-  int send_ints[7];
-
-  /* record address of process that contributed this item */
-  int* orig_ptr = (int*)((char*)value + data_offset);
-  send_ints[CHAIN_SRC] = *orig_ptr;
-
-  /* get the communicator to send our messages on */
-  MPI_Comm comm = in->comm;
-
-  /* allocate a scratch buffer to receive value from left neighbor */
-  void* left_buf = malloc(type_size);
-  if (left_buf == NULL) {
-    /* TODO: error */
-  }
-
-  /* allocate a scratch buffer to receive value from right neighbor */
-  void* right_buf = malloc(type_size);
-  if (right_buf == NULL) {
-    /* TODO: error */
-  }
-
-  /* exchange data with left and right neighbors to find
-   * boundaries of group */
-  k = 0;
-  int left_rank  = in->comm_left;
-  int right_rank = in->comm_right;
-  if (left_rank != MPI_PROC_NULL) {
-    MPI_Isend(
-      (void*)value, 1, type, left_rank, tag1, comm, &request[k]
-    );
-    k++;
-
-    MPI_Irecv(
-      left_buf, 1, type, left_rank, tag1, comm, &request[k]
-    );
-    k++;
-  }
-  if (right_rank != MPI_PROC_NULL) {
-    MPI_Isend(
-      (void*)value, 1, type, right_rank, tag1, comm, &request[k]
-    );
-    k++;
-
-    MPI_Irecv(
-      right_buf, 1, type, right_rank, tag1, comm, &request[k]
-    );
-    k++;
-  }
-  if (k > 0) {
-    MPI_Waitall(k, request, status);
-  }
-
-  /* if we have a left neighbor, and if its color value matches ours,
-   * then our element is part of its group, otherwise we are the first
-   * rank of a new group */
-  int first_in_group = 1;
-  send_ints[CHAIN_LEFT] = MPI_PROC_NULL;
-  if (left_rank != MPI_PROC_NULL) {
-    int left_cmp = (*compare)(left_buf, value, 0);
-    if (left_cmp == 0) {
-      /* we are not the first in the group,
-       * record the rank of the item from our left neighbor */
-      first_in_group = 0;
-      int* left_ptr = (int*)((char*)left_buf + data_offset);
-      send_ints[CHAIN_LEFT] = *left_ptr;
-    }
-  }
-
-  /* if we have a right neighbor, and if its color value matches ours,
-   * then our element is part of its group, otherwise we are the last
-   * rank of our group */
-  int last_in_group = 1;
-  send_ints[CHAIN_RIGHT] = MPI_PROC_NULL;
-  if (right_rank != MPI_PROC_NULL) {
-    int right_cmp = (*compare)(right_buf, value, 0);
-    if (right_cmp == 0) {
-      /* we are not the last in our group,
-       * record the rank of the item from our right neighbor */
-      last_in_group = 0;
-      int* right_ptr = (int*)((char*)right_buf + data_offset);
-      send_ints[CHAIN_RIGHT] = *right_ptr;
+   * ordered color/key/rank tuple that we hold, followed by our 2^d
+   * lists, which we'll later send back to the rank that contributed
+   * the item */
+  s->send_ints = (int*) lwgrp_scratch_alloc(
+    count * s->rec_ints * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < count; i++) {
+    int* send_ints = s->send_ints + i * s->rec_ints;
+    int j;
+    for (j = CHAIN_INTS; j < s->rec_ints; j++) {
+      send_ints[j] = MPI_PROC_NULL;
     }
-  }
 
-  /* prepare buffers for our scan operations:
-   * group count, flag, rank count, next proc */
-  int send_left_ints[4]  = {0,0,1,MPI_PROC_NULL};
-  int send_right_ints[4] = {0,0,1,MPI_PROC_NULL};
-  int recv_left_ints[4]  = {0,0,0,MPI_PROC_NULL};
-  int recv_right_ints[4] = {0,0,0,MPI_PROC_NULL};
-  if (first_in_group) {
-    send_right_ints[SCAN_COLOR] = 1;
-    send_right_ints[SCAN_FLAG] = 1;
-  }
-  if (last_in_group) {
-    send_left_ints[SCAN_COLOR] = 1;
-    send_left_ints[SCAN_FLAG] = 1;
+    /* record rank and address of process that contributed this item */
+    const char* item = (const char*)value + i * type_size;
+    send_ints[CHAIN_SRC]   = *(const int*)(item + rank_offset);
+    send_ints[CHAIN_ADDR]  = *(const int*)(item + data_offset);
+    send_ints[CHAIN_SPLIT]   = i;
+    send_ints[CHAIN_CONTEXT] = 0;
   }
 
-  /* execute inclusive scan in both directions to count number of
-   * ranks in our group to our left and right sides */
-  while (left_rank != MPI_PROC_NULL || right_rank != MPI_PROC_NULL) {
-    /* select our left and right partners for this iteration */
-    k = 0;
-
-    /* send and receive data with left partner */
-    if (left_rank != MPI_PROC_NULL) {
-      MPI_Irecv(
-        recv_left_ints, 4, MPI_INT, left_rank, tag1, comm, &request[k]
-      );
-      k++;
+  /* allocate space for our scan data */
+  int* scan_ints = (int*) lwgrp_scratch_alloc(
+    4 * count * SCAN_INTS * sizeof(int), __FILE__, __LINE__
+  );
+  s->send_left_ints  = scan_ints;
+  s->send_right_ints = scan_ints + 1 * count * SCAN_INTS;
+  s->recv_left_ints  = scan_ints + 2 * count * SCAN_INTS;
+  s->recv_right_ints = scan_ints + 3 * count * SCAN_INTS;
+
+  /* allocate scratch buffers to receive values from left and right
+   * neighbors */
+  s->left_buf  = lwgrp_scratch_alloc(count * type_size, __FILE__, __LINE__);
+  s->right_buf = lwgrp_scratch_alloc(count * type_size, __FILE__, __LINE__);
+}
 
-      /* send the rank of our right neighbor to our left,
-       * since it will be its right neighbor in the next step */
-      send_left_ints[SCAN_NEXT] = right_rank;
-      MPI_Isend(
-        send_left_ints, 4, MPI_INT, left_rank, tag1, comm, &request[k]
-      );
-      k++;
-    }
+static void lwgrp_split_sorted_free(lwgrp_split_sorted* s)
+{
+  lwgrp_scratch_free(&s->left_buf);
+  lwgrp_scratch_free(&s->right_buf);
+  lwgrp_scratch_free(&s->send_left_ints);
+  lwgrp_scratch_free(&s->send_ints);
+}
 
-    /* send and receive data with right partner */
-    if (right_rank != MPI_PROC_NULL) {
-      MPI_Irecv(
-        recv_right_ints, 4, MPI_INT, right_rank, tag1, comm, &request[k]
-      );
-      k++;
+/* post the next step into req, returns 1 when send_ints is complete */
+static int lwgrp_split_sorted_advance(
+  lwgrp_split_sorted* s,
+  struct lwgrp_request_struct* req)
+{
+  /* get the communicator to send our messages on */
+  MPI_Comm comm = s->in->comm;
+  int tag = req->tag;
+  int count = s->count;
+  int scan_count = count * SCAN_INTS;
+  int i;
+
+  while (1) {
+    switch (s->phase) {
+    case SPLIT_SORTED_START:
+      /* exchange data with left and right neighbors to find
+       * boundaries of group */
+      s->left_rank  = s->in->comm_left;
+      s->right_rank = s->in->comm_right;
+      if (s->left_rank != MPI_PROC_NULL) {
+        MPI_Isend(
+          (void*)s->value, count, s->type, s->left_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
+        MPI_Irecv(
+          s->left_buf, count, s->type, s->left_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
+      }
+      if (s->right_rank != MPI_PROC_NULL) {
+        MPI_Isend(
+          (void*)s->value, count, s->type, s->right_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
+        MPI_Irecv(
+          s->right_buf, count, s->type, s->right_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
+      }
+      s->phase = SPLIT_SORTED_NEIGHBORS;
+      if (req->nreqs > 0) {
+        return 0;
+      }
+      break;
+    case SPLIT_SORTED_NEIGHBORS:
+      for (i = 0; i < count; i++) {
+        const char* value = (const char*)s->value  + i * s->type_size;
+        const char* left  = (const char*)s->left_buf  + i * s->type_size;
+        const char* right = (const char*)s->right_buf + i * s->type_size;
+        int* send_ints = s->send_ints + i * s->rec_ints;
+
+        /* if we have a left neighbor, and if its color value matches ours,
+         * then our element is part of its group, otherwise we are the first
+         * rank of a new group */
+        int first_in_group = 1;
+        send_ints[CHAIN_LEFT] = MPI_PROC_NULL;
+        if (s->left_rank != MPI_PROC_NULL) {
+          int left_cmp = (*s->compare)(left, value, 0);
+          if (left_cmp == 0) {
+            /* we are not the first in the group,
+             * record the rank of the item from our left neighbor */
+            first_in_group = 0;
+            send_ints[CHAIN_LEFT] = *(const int*)(left + s->data_offset);
+          }
+        }
 
-      /* send the rank of our left neighbor to our right,
-       * since it will be its left neighbor in the next step */
-      send_right_ints[SCAN_NEXT] = left_rank;
-      MPI_Isend(
-        send_right_ints, 4, MPI_INT, right_rank, tag1, comm, &request[k]
-      );
-      k++;
-    }
+        /* if we have a right neighbor, and if its color value matches ours,
+         * then our element is part of its group, otherwise we are the last
+         * rank of our group */
+        int last_in_group = 1;
+        send_ints[CHAIN_RIGHT] = MPI_PROC_NULL;
+        if (s->right_rank != MPI_PROC_NULL) {
+          int right_cmp = (*s->compare)(right, value, 0);
+          if (right_cmp == 0) {
+            /* we are not the last in our group,
+             * record the rank of the item from our right neighbor */
+            last_in_group = 0;
+            send_ints[CHAIN_RIGHT] = *(const int*)(right + s->data_offset);
+          }
+        }
 
-    /* wait for communication to finsih */
-    if (k > 0) {
-      MPI_Waitall(k, request, status);
-    }
+        /* prepare buffers for our scan operations:
+         * group count, flag, rank count, next proc, end, addr, mask */
+        int* send_left  = s->send_left_ints  + i * SCAN_INTS;
+        int* send_right = s->send_right_ints + i * SCAN_INTS;
+        int* recv_left  = s->recv_left_ints  + i * SCAN_INTS;
+        int* recv_right = s->recv_right_ints + i * SCAN_INTS;
+        int j;
+        for (j = 0; j < SCAN_INTS; j++) {
+          send_left[j]  = 0;
+          send_right[j] = 0;
+          recv_left[j]  = 0;
+          recv_right[j] = 0;
+        }
+        send_left[SCAN_COUNT]  = 1;
+        send_right[SCAN_COUNT] = 1;
+        send_left[SCAN_NEXT]   = MPI_PROC_NULL;
+        send_right[SCAN_NEXT]  = MPI_PROC_NULL;
+        recv_left[SCAN_NEXT]   = MPI_PROC_NULL;
+        recv_right[SCAN_NEXT]  = MPI_PROC_NULL;
+        send_left[SCAN_END]    = MPI_PROC_NULL;
+        send_right[SCAN_END]   = MPI_PROC_NULL;
+        send_left[SCAN_ADDR]   = send_ints[CHAIN_ADDR];
+        send_right[SCAN_ADDR]  = send_ints[CHAIN_ADDR];
+        if (s->mask_offset != SPLIT_NO_MASK) {
+          const int* mask = (const int*)(value + s->mask_offset);
+          for (j = 0; j < LWGRP_CONTEXT_WORDS; j++) {
+            send_left[SCAN_MASK + j]  = mask[j];
+            send_right[SCAN_MASK + j] = mask[j];
+          }
+        }
+        if (first_in_group) {
+          send_right[SCAN_COLOR] = 1;
+          send_right[SCAN_FLAG]  = 1;
+          send_right[SCAN_END]   = send_ints[CHAIN_ADDR];
+        }
+        if (last_in_group) {
+          send_left[SCAN_COLOR] = 1;
+          send_left[SCAN_FLAG]  = 1;
+          send_left[SCAN_END]   = send_ints[CHAIN_ADDR];
+        }
+      }
+      s->phase = SPLIT_SORTED_SCAN;
+      break;
+    case SPLIT_SORTED_SCAN:
+      /* execute inclusive scan in both directions to count number of
+       * ranks in our group to our left and right sides */
+      if (s->left_rank == MPI_PROC_NULL && s->right_rank == MPI_PROC_NULL) {
+        /* Now we can set our rank and the number of ranks in our group.
+         * At this point, our right-going count is the number of ranks to our
+         * left including ourself, and the left-going count is the number of
+         * ranks to our right including ourself.
+         * Our rank is the number of ranks to our left (right-going count
+         * minus 1), and the group size is the sum of right-going and
+         * left-going counts minus 1 so we don't double counts ourself. */
+        for (i = 0; i < count; i++) {
+          int* send_ints  = s->send_ints + i * s->rec_ints;
+          int* send_left  = s->send_left_ints  + i * SCAN_INTS;
+          int* send_right = s->send_right_ints + i * SCAN_INTS;
+          send_ints[CHAIN_RANK]  = send_right[SCAN_COUNT] - 1;
+          send_ints[CHAIN_SIZE]  = send_right[SCAN_COUNT] +
+                                   send_left[SCAN_COUNT] - 1;
+          send_ints[CHAIN_ID]    = send_right[SCAN_COLOR] - 1;
+          send_ints[CHAIN_COUNT] = send_right[SCAN_COLOR] +
+                                   send_left[SCAN_COLOR] - 1;
+          send_ints[CHAIN_FIRST] = send_right[SCAN_END];
+          send_ints[CHAIN_LAST]  = send_left[SCAN_END];
+
+          /* the two directions cover the contexts of the members on
+           * either side of us, each including our own */
+          if (s->mask_offset != SPLIT_NO_MASK) {
+            int used[LWGRP_CONTEXT_WORDS];
+            int j;
+            for (j = 0; j < LWGRP_CONTEXT_WORDS; j++) {
+              used[j] = send_right[SCAN_MASK + j] | send_left[SCAN_MASK + j];
+            }
+            send_ints[CHAIN_CONTEXT] = lwgrp_context_pick(used);
+          }
+        }
+        return 1;
+      }
 
-    /* reduce data from left partner */
-    if (left_rank != MPI_PROC_NULL) {
-      /* count the number of groups to our left */
-      send_right_ints[SCAN_COLOR] += recv_left_ints[SCAN_COLOR];
+      /* send and receive data with left partner */
+      if (s->left_rank != MPI_PROC_NULL) {
+        MPI_Irecv(
+          s->recv_left_ints, scan_count, MPI_INT, s->left_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
 
-      /* continue accumulating the count in our right-going data
-       * if our flag has not already been set */
-      if (send_right_ints[SCAN_FLAG] != 1) {
-        send_right_ints[SCAN_FLAG]   = recv_left_ints[SCAN_FLAG];
-        send_right_ints[SCAN_COUNT] += recv_left_ints[SCAN_COUNT];
+        /* send the rank of our right neighbor to our left,
+         * since it will be its right neighbor in the next step,
+         * all items share the same partners so we only use the
+         * value in the first item */
+        s->send_left_ints[SCAN_NEXT] = s->right_rank;
+        MPI_Isend(
+          s->send_left_ints, scan_count, MPI_INT, s->left_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
       }
 
-      /* get the next rank on our left */
-      left_rank = recv_left_ints[SCAN_NEXT];
-    }
+      /* send and receive data with right partner */
+      if (s->right_rank != MPI_PROC_NULL) {
+        MPI_Irecv(
+          s->recv_right_ints, scan_count, MPI_INT, s->right_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
 
-    /* reduce data from right partner */
-    if (right_rank != MPI_PROC_NULL) {
-      /* count the number of groups to our right */
-      send_left_ints[SCAN_COLOR] += recv_right_ints[SCAN_COLOR];
+        /* send the rank of our left neighbor to our right,
+         * since it will be its left neighbor in the next step */
+        s->send_right_ints[SCAN_NEXT] = s->left_rank;
+        MPI_Isend(
+          s->send_right_ints, scan_count, MPI_INT, s->right_rank, tag,
+          comm, lwgrp_request_next(req)
+        );
+      }
+      s->phase = SPLIT_SORTED_SCANNED;
+      return 0;
+    case SPLIT_SORTED_SCANNED:
+      for (i = 0; i < count; i++) {
+        int* send_ints  = s->send_ints + i * s->rec_ints;
+        int* send_left  = s->send_left_ints  + i * SCAN_INTS;
+        int* send_right = s->send_right_ints + i * SCAN_INTS;
+        int* recv_left  = s->recv_left_ints  + i * SCAN_INTS;
+        int* recv_right = s->recv_right_ints + i * SCAN_INTS;
+
+        /* reduce data from left partner */
+        if (s->left_rank != MPI_PROC_NULL) {
+          /* count the number of groups to our left */
+          send_right[SCAN_COLOR] += recv_left[SCAN_COLOR];
+
+          /* continue accumulating the count in our right-going data
+           * if our flag has not already been set */
+          if (send_right[SCAN_FLAG] != 1) {
+            send_right[SCAN_FLAG]   = recv_left[SCAN_FLAG];
+            send_right[SCAN_COUNT] += recv_left[SCAN_COUNT];
+            send_right[SCAN_END]    = recv_left[SCAN_END];
+            int j;
+            for (j = 0; j < LWGRP_CONTEXT_WORDS; j++) {
+              send_right[SCAN_MASK + j] |= recv_left[SCAN_MASK + j];
+            }
+          }
+
+          /* record the address of the item 2^d to our left */
+          if (s->round < s->levels) {
+            send_ints[CHAIN_INTS + s->round] = recv_left[SCAN_ADDR];
+          }
+        }
 
-      /* continue accumulating the count in our left-going data
-       * if our flag has not already been set */
-      if (send_left_ints[SCAN_FLAG] != 1) {
-        send_left_ints[SCAN_FLAG]   = recv_right_ints[SCAN_FLAG];
-        send_left_ints[SCAN_COUNT] += recv_right_ints[SCAN_COUNT];
+        /* reduce data from right partner */
+        if (s->right_rank != MPI_PROC_NULL) {
+          /* count the number of groups to our right */
+          send_left[SCAN_COLOR] += recv_right[SCAN_COLOR];
+
+          /* continue accumulating the count in our left-going data
+           * if our flag has not already been set */
+          if (send_left[SCAN_FLAG] != 1) {
+            send_left[SCAN_FLAG]   = recv_right[SCAN_FLAG];
+            send_left[SCAN_COUNT] += recv_right[SCAN_COUNT];
+            send_left[SCAN_END]    = recv_right[SCAN_END];
+            int j;
+            for (j = 0; j < LWGRP_CONTEXT_WORDS; j++) {
+              send_left[SCAN_MASK + j] |= recv_right[SCAN_MASK + j];
+            }
+          }
+
+          /* record the address of the item 2^d to our right */
+          if (s->round < s->levels) {
+            int index = CHAIN_INTS + s->levels + s->round;
+            send_ints[index] = recv_right[SCAN_ADDR];
+          }
+        }
       }
 
-      /* get the next rank on our right */
-      right_rank = recv_right_ints[SCAN_NEXT];
+      /* get the next ranks on our left and right */
+      if (s->left_rank != MPI_PROC_NULL) {
+        s->left_rank = s->recv_left_ints[SCAN_NEXT];
+      }
+      if (s->right_rank != MPI_PROC_NULL) {
+        s->right_rank = s->recv_right_ints[SCAN_NEXT];
+      }
+      s->round++;
+      s->phase = SPLIT_SORTED_SCAN;
+      break;
     }
   }
+}
 
-  /* Now we can set our rank and the number of ranks in our group.
-   * At this point, our right-going count is the number of ranks to our
-   * left including ourself, and the left-going count is the number of
-   * ranks to our right including ourself.
-   * Our rank is the number of ranks to our left (right-going count
-   * minus 1), and the group size is the sum of right-going and
-   * left-going counts minus 1 so we don't double counts ourself. */
-  send_ints[CHAIN_RANK] = send_right_ints[SCAN_COUNT] - 1;
-  send_ints[CHAIN_SIZE] = send_right_ints[SCAN_COUNT] + 
-                          send_left_ints[SCAN_COUNT] - 1;
-  send_ints[CHAIN_ID]    = send_right_ints[SCAN_COLOR] - 1;
-  send_ints[CHAIN_COUNT] = send_right_ints[SCAN_COLOR] +
-                           send_left_ints[SCAN_COLOR] - 1;
+static int lwgrp_split_sorted_step(struct lwgrp_request_struct* req)
+{
+  lwgrp_split_sorted* s = (lwgrp_split_sorted*) req->state;
+  return lwgrp_split_sorted_advance(s, req);
+}
+
+/* blocking version of the above, also sends the results back to the
+ * originating ranks and receives our own results in recv_ints, which
+ * must hold count records of CHAIN_INTS + 2 * levels ints, ordered
+ * by split */
+static int lwgrp_logchain_split_sorted(
+  const void* value,
+  int count,
+  MPI_Datatype type,
+  size_t type_size,
+  size_t rank_offset,
+  size_t data_offset,
+  size_t mask_offset,
+  int (*compare)(const void*, const void*, size_t),
+  int levels,
+  const lwgrp_comm* comm_in,
+  int tag1,
+  int tag2,
+  int* recv_ints)
+{
+  /* find boundaries and run the double scan to completion */
+  lwgrp_split_sorted s;
+  lwgrp_split_sorted_init(
+    &s, value, count, type, type_size, rank_offset, data_offset,
+    mask_offset, compare, levels, &comm_in->chain
+  );
+  struct lwgrp_request_struct req;
+  lwgrp_request_init(&req, lwgrp_split_sorted_step, &s, tag1);
+  lwgrp_request_complete(&req);
+
+  int* send_ints = s.send_ints;
+  int ints = s.rec_ints;
+  int i;
 
   /* send group info back to originating rank */
 #ifdef LWGRP_USE_ANYSOURCE
   /* send group info back to originating rank,
    * receive our own from someone else
    * (don't know who so use ANY_SOURCE) */
-  MPI_Isend(
-    send_ints, 7, MPI_INT, send_ints[CHAIN_SRC], tag2,
-    comm, &request[0]
+  MPI_Request* request = (MPI_Request*) lwgrp_scratch_alloc(
+    2 * count * sizeof(MPI_Request), __FILE__, __LINE__
   );
-  MPI_Irecv(
-    recv_ints, 7, MPI_INT, MPI_ANY_SOURCE, tag2,
-    comm, &request[1]
+  int* recv_buf = (int*) lwgrp_scratch_alloc(
+    count * ints * sizeof(int), __FILE__, __LINE__
   );
-  MPI_Waitall(2, request, status);
+  MPI_Comm comm = comm_in->chain.comm;
+  for (i = 0; i < count; i++) {
+    int* rec = send_ints + i * ints;
+    MPI_Isend(
+      rec, ints, MPI_INT, rec[CHAIN_ADDR], tag2,
+      comm, &request[i]
+    );
+    MPI_Irecv(
+      recv_buf + i * ints, ints, MPI_INT, MPI_ANY_SOURCE, tag2,
+      comm, &request[count + i]
+    );
+  }
+  MPI_Waitall(2 * count, request, MPI_STATUSES_IGNORE);
+  lwgrp_scratch_free(&request);
+  void* result = recv_buf;
 #else
-  /* if we can't use MPI_ANY_SOURCE, then sort item back to its
-   * destination */
-  MPI_Datatype result_type;
-  MPI_Type_contiguous(7, MPI_INT, &result_type);
-  MPI_Type_commit(&result_type);
-  size_t result_type_size = 7 * sizeof(int);
-
-  lwgrp_logchain_sort_bitonic(
-    send_ints, result_type, result_type_size, 0, lwgrp_cmp_int,
-    in, list, tag1
+  /* otherwise route the result back to the originating rank, which
+   * we record in the first int, every process gets exactly one
+   * result per split, and all messages come from known neighbors */
+  void* result;
+  int result_count;
+  lwgrp_logring_route_brucks(
+    send_ints, count, ints * sizeof(int), &result, &result_count,
+    &comm_in->ring, &comm_in->logring
   );
-  memcpy(recv_ints, send_ints, result_type_size);
+#endif
 
-  MPI_Type_free(&result_type);
+  /* results may arrive in any order, so put them in split order */
+  for (i = 0; i < count; i++) {
+    const int* rec = (const int*)result + i * ints;
+    memcpy(recv_ints + rec[CHAIN_SPLIT] * ints, rec, ints * sizeof(int));
+  }
+#ifdef LWGRP_USE_ANYSOURCE
+  lwgrp_scratch_free(&result);
+#else
+  lwgrp_free(&result);
 #endif
 
+  lwgrp_split_sorted_free(&s);
+
+  return LWGRP_SUCCESS;
+}
+
+/* given the result for our item, fill in the ring and logchain of our
+ * new group, the ring wrap addresses and the logchain came out of the
+ * scan -- O(log N) local */
+static void lwgrp_split_result_group(
+  const lwgrp_chain* chain,
+  int color,
+  int levels,
+  const int* recv_ints,
+  lwgrp_ring* newring,
+  lwgrp_logchain* newlogchain)
+{
+  int rank = recv_ints[CHAIN_RANK];
+  int size = recv_ints[CHAIN_SIZE];
+
+  /* fill in info for our group */
+  newring->comm       = chain->comm;
+  newring->comm_rank  = chain->comm_rank;
+  newring->comm_left  = recv_ints[CHAIN_LEFT];
+  newring->comm_right = recv_ints[CHAIN_RIGHT];
+  newring->group_rank = rank;
+  newring->group_size = size;
+  newring->tag        = chain->tag;
+  if (rank == 0) {
+    newring->comm_left = recv_ints[CHAIN_LAST];
+  }
+  if (rank == size - 1) {
+    newring->comm_right = recv_ints[CHAIN_FIRST];
+  }
+
+  /* if color is undefined, at this point we have the group of
+   * processes that all set color == MPI_UNDEFINED, but we
+   * really want the empty group -- O(1) local */
+  if (color == MPI_UNDEFINED) {
+    lwgrp_ring_set_null(newring);
+  }
+
+  lwgrp_logchain_build_from_vals(
+    newring->group_size, newring->group_rank,
+    recv_ints + CHAIN_INTS, recv_ints + CHAIN_INTS + levels,
+    newlogchain
+  );
+}
+
+static int lwgrp_nb_comm_build_step(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_comm_build* s = (lwgrp_nb_comm_build*) req->state;
+  return lwgrp_nb_comm_build_advance(s, req);
+}
+
+/* given the result for our item, build the new comm, only the logring
+ * entries that wrap around the end of the group take messages, and
+ * those go on tag, the group picked its context in the scan, set check
+ * if we may have claimed that context since the split started */
+static int lwgrp_comm_build_from_split(
+  const lwgrp_chain* chain,
+  int tag,
+  int color,
+  int levels,
+  const int* recv_ints,
+  int check,
+  lwgrp_comm* newcomm)
+{
+  lwgrp_ring newring;
+  lwgrp_logchain newlogchain;
+  lwgrp_split_result_group(
+    chain, color, levels, recv_ints, &newring, &newlogchain
+  );
+
+  /* build comm from newly created ring and logchain */
+  lwgrp_nb_comm_build s;
+  lwgrp_nb_comm_build_init(
+    &s, &newring, &newlogchain, recv_ints[CHAIN_CONTEXT], check, newcomm
+  );
+  struct lwgrp_request_struct req;
+  lwgrp_request_init(&req, lwgrp_nb_comm_build_step, &s, tag);
+  lwgrp_request_complete(&req);
+
+  /* free the ring and logchain representing the new group */
+  lwgrp_logchain_free(&newlogchain);
+  lwgrp_ring_free(&newring);
+
   return LWGRP_SUCCESS;
 }
 
@@ -587,91 +789,383 @@ int lwgrp_comm_split(
   int key,
   lwgrp_comm* newcomm)
 {
-  int tag1 = 0;
-  int tag2 = 1;
-
-  /* TODO: for small groups, fastest to do an allgather and
-   * local sort */
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SPLIT);
+  int tag1 = comm->chain.tag;
+  int tag2 = comm->chain.tag + 1;
 
   /* TODO: allreduce to determine whether keys are already ordered and
    * to compute min and max color values, if already ordered, reduce
    * problem to bin split using min/max colors to set number of bins */
 
-  /* build a group representing our input communicator -- O(1) local */
-  lwgrp_chain chain;
-  lwgrp_chain_build_from_ring(&comm->ring, &chain);
+  /* use the chain cached on our input communicator */
+  const lwgrp_chain* chain = &comm->chain;
 
-  /* build a logchain for our input communicator -- O(log N) local */
-  lwgrp_logchain logchain;
-  lwgrp_logchain_build_from_logring(&comm->ring, &comm->logring, &logchain);
+  /* procs outside of any group get the empty group -- O(1) local */
+  if (chain->group_size == 0) {
+    int null_ints[CHAIN_INTS] = {0};
+    lwgrp_comm_build_from_split(
+      chain, tag1, MPI_UNDEFINED, 0, null_ints, 0, newcomm
+    );
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
 
   /* allocate memory to hold item for sorting (color,key,rank) tuple
-   * and prepare input -- O(1) local */
-  int item[4];
+   * and prepare input along with the contexts we use -- O(1) local */
+  int item[ITEM_INTS];
   item[0] = color;
   item[1] = key;
-  item[2] = chain.group_rank;
-  item[3] = chain.comm_rank;
+  item[2] = chain->group_rank;
+  item[3] = chain->comm_rank;
+  lwgrp_context_mask(item + 4);
 
-  /* build a datatype of 4 integers */
+  /* build a datatype of the item's integers */
   MPI_Datatype type;
-  MPI_Type_contiguous(4, MPI_INT, &type);
+  MPI_Type_contiguous(ITEM_INTS, MPI_INT, &type);
   MPI_Type_commit(&type);
 
-  /* compute type size and offset to original rank */
-  size_t type_size = 4 * sizeof(int);
+  /* compute type size and offsets to original rank, address, and
+   * contexts */
+  size_t type_size = ITEM_INTS * sizeof(int);
+  size_t rank_offset = 2 * sizeof(int);
   size_t data_offset = 3 * sizeof(int);
+  size_t mask_offset = 4 * sizeof(int);
 
-  /* sort our values using bitonic sort algorithm -- 
-   * O(log^2 N) communication */
-  lwgrp_logchain_sort_bitonic(
-    (void*)item, type, type_size, data_offset, lwgrp_cmp_three_ints,
-    &chain, &logchain, tag1
+  /* sort our values -- O(log N) to O(log^2 N) communication
+   * depending on the group size */
+  lwgrp_comm_sort(
+    (void*)item, 1, type, lwgrp_cmp_three_ints, 0, comm
   );
 
   /* now split our sorted values by comparing our value with our
-   * left and right neighbors to determine group boundaries --
+   * left and right neighbors to determine group boundaries, this
+   * also collects the 2^d lists of our new group --
    * O(log N) communication */
-  int recv_ints[7];
+  int levels = lwgrp_split_levels(chain->group_size);
+  int* recv_ints = (int*) lwgrp_scratch_alloc(
+    (CHAIN_INTS + 2 * levels) * sizeof(int), __FILE__, __LINE__
+  );
   lwgrp_logchain_split_sorted(
-    (void*)item, type, type_size, data_offset, lwgrp_cmp_int, 
-    &chain, &logchain, tag1, tag2, recv_ints
+    (void*)item, 1, type, type_size, rank_offset, data_offset, mask_offset,
+    lwgrp_cmp_int, levels, comm, tag1, tag2, recv_ints
   );
 
-  /* fill in info for our group */
-  lwgrp_chain newchain;
-  newchain.comm       = chain.comm;
-  newchain.comm_rank  = chain.comm_rank;
-  newchain.comm_left  = recv_ints[CHAIN_LEFT];
-  newchain.comm_right = recv_ints[CHAIN_RIGHT];
-  newchain.group_rank = recv_ints[CHAIN_RANK];
-  newchain.group_size = recv_ints[CHAIN_SIZE];
-
   /* free the datatype */
   MPI_Type_free(&type);
 
-  /* if color is undefined, at this point we have the group of
-   * processes that all set color == MPI_UNDEFINED, but we
-   * really want the empty group -- O(1) local */
-  if (color == MPI_UNDEFINED) {
-    lwgrp_chain_set_null(&newchain);
+  /* build comm for our group, nothing claimed a context since we took
+   * our bitmap -- O(log N) communication */
+  lwgrp_comm_build_from_split(
+    chain, tag1, color, levels, recv_ints, 0, newcomm
+  );
+
+  lwgrp_scratch_free(&recv_ints);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_split_multi(
+  const lwgrp_comm* comm,
+  int count,
+  const int colors[],
+  const int keys[],
+  lwgrp_comm newcomms[])
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SPLIT);
+  int tag1 = comm->chain.tag;
+  int tag2 = comm->chain.tag + 1;
+
+  /* use the chain cached on our input communicator */
+  const lwgrp_chain* chain = &comm->chain;
+  int rank  = chain->group_rank;
+  int ranks = chain->group_size;
+
+  /* procs outside of any group get empty groups */
+  int i;
+  if (ranks == 0) {
+    for (i = 0; i < count; i++) {
+      lwgrp_comm_split(comm, MPI_UNDEFINED, 0, &newcomms[i]);
+    }
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
+  if (count <= 0) {
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
   }
 
-  /* build comm from newly created chain */
-  lwgrp_comm_build_from_chain(&newchain, newcomm);
+  /* prepare a (dest,split,color,key,rank,addr,mask) record for each
+   * split, we sort on (split,color,key,rank) and fill in dest
+   * afterwards -- O(count) local */
+  int rec_ints = 2 + ITEM_INTS;
+  int* recs = (int*) lwgrp_scratch_alloc(
+    count * rec_ints * sizeof(int), __FILE__, __LINE__
+  );
+  for (i = 0; i < count; i++) {
+    int* rec = recs + i * rec_ints;
+    rec[0] = 0;
+    rec[1] = i;
+    rec[2] = colors[i];
+    rec[3] = keys[i];
+    rec[4] = rank;
+    rec[5] = chain->comm_rank;
+    lwgrp_context_mask(rec + 6);
+  }
 
-  /* free the chain representing the new group -- O(1) local */
-  lwgrp_chain_free(&newchain);
+  /* sort the records of all splits together, since split is the
+   * most significant field, the records of split i land in positions
+   * i*ranks to (i+1)*ranks-1 in the order that split needs --
+   * O(log N) to O(log^2 N) communication depending on the group size */
+  MPI_Datatype rec_type;
+  MPI_Type_contiguous(rec_ints, MPI_INT, &rec_type);
+  MPI_Type_commit(&rec_type);
+  lwgrp_comm_sort(
+    recs, count, rec_type, lwgrp_cmp_four_ints_at_one, 0, comm
+  );
+  MPI_Type_free(&rec_type);
+
+  /* we hold positions rank*count to rank*count+count-1, we send the
+   * record at position j of its split to rank j, so that each proc
+   * holds one record of each split and the records of each split
+   * are spread over the group in sorted order -- O(log N) communication */
+  for (i = 0; i < count; i++) {
+    int* rec = recs + i * rec_ints;
+    rec[0] = (rank * count + i) % ranks;
+  }
+  void* routed;
+  int routed_count;
+  lwgrp_logring_route_brucks(
+    recs, count, rec_ints * sizeof(int), &routed, &routed_count,
+    &comm->ring, &comm->logring
+  );
+  lwgrp_scratch_free(&recs);
 
-  /* free the logchain -- O(1) local */
-  lwgrp_logchain_free(&logchain);
+  /* we get one record of each split, order our
+   * (color,key,rank,addr,mask) items by split */
+  int* items = (int*) lwgrp_scratch_alloc(
+    count * ITEM_INTS * sizeof(int), __FILE__, __LINE__
+  );
+  for (i = 0; i < routed_count; i++) {
+    const int* rec = (const int*)routed + i * rec_ints;
+    memcpy(items + rec[1] * ITEM_INTS, rec + 2, ITEM_INTS * sizeof(int));
+  }
+  lwgrp_free(&routed);
 
-  /* free our group -- O(1) local */
-  lwgrp_chain_free(&chain);
+  /* split the items of all splits side by side -- O(log N) communication */
+  MPI_Datatype type;
+  MPI_Type_contiguous(ITEM_INTS, MPI_INT, &type);
+  MPI_Type_commit(&type);
 
+  int levels = lwgrp_split_levels(ranks);
+  int ints = CHAIN_INTS + 2 * levels;
+  int* recv_ints = (int*) lwgrp_scratch_alloc(
+    count * ints * sizeof(int), __FILE__, __LINE__
+  );
+  lwgrp_logchain_split_sorted(
+    items, count, type, ITEM_INTS * sizeof(int), 2 * sizeof(int),
+    3 * sizeof(int), 4 * sizeof(int), lwgrp_cmp_int, levels, comm,
+    tag1, tag2, recv_ints
+  );
+
+  MPI_Type_free(&type);
+  lwgrp_scratch_free(&items);
+
+  /* build comm for each of our groups, all splits picked from the
+   * bitmaps we took before any of them claimed a context, so the ones
+   * after the first check that an earlier one didn't take theirs --
+   * O(log N) communication each */
+  for (i = 0; i < count; i++) {
+    lwgrp_comm_build_from_split(
+      chain, tag1, colors[i], levels, recv_ints + i * ints, (i > 0),
+      &newcomms[i]
+    );
+  }
+
+  lwgrp_scratch_free(&recv_ints);
+
+  LWGRP_STATS_END();
   return LWGRP_SUCCESS;
 }
 
+enum lwgrp_nb_split_phase {
+  ISPLIT_SORT,   /* sort (color,key,rank) tuples */
+  ISPLIT_SCAN,   /* find group boundaries and ranks */
+  ISPLIT_RETURN, /* send group info back to originating rank */
+  ISPLIT_RESULT, /* set up group from our info */
+  ISPLIT_BUILD,  /* build new comm */
+};
+
+typedef struct {
+  const lwgrp_comm* comm;
+  lwgrp_comm* newcomm;
+  int color;
+  int phase;
+  int result_tag;            /* tag to receive our info from ANY_SOURCE */
+  int item[ITEM_INTS];       /* (color,key,rank,addr,mask) tuple we hold */
+  int levels;                /* number of 2^d levels in results */
+  int* recv_ints;            /* our info in the new group */
+  MPI_Datatype type;         /* type of item */
+  lwgrp_ring ring;           /* ring of new group */
+  lwgrp_logchain logchain;   /* logchain of new group */
+  lwgrp_nb_sort sort;
+  lwgrp_split_sorted scan;
+  lwgrp_nb_route route;      /* returns results to originating ranks */
+  lwgrp_nb_comm_build build; /* builds new comm from ring and logchain */
+} lwgrp_nb_split;
+
+/* every step, including building the new comm, sends on our own tags,
+ * so the op can be interleaved with blocking ops on the input comm */
+static int lwgrp_nb_split_advance(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_split* s = (lwgrp_nb_split*) req->state;
+
+  while (1) {
+    switch (s->phase) {
+    case ISPLIT_SORT:
+      if (! lwgrp_nb_sort_advance(&s->sort, req)) {
+        return 0;
+      }
+      lwgrp_nb_sort_free(&s->sort);
+
+      /* split our sorted values, see lwgrp_comm_split */
+      lwgrp_split_sorted_init(
+        &s->scan, s->item, 1, s->type, ITEM_INTS * sizeof(int),
+        2 * sizeof(int), 3 * sizeof(int), 4 * sizeof(int), lwgrp_cmp_int,
+        s->levels, &s->comm->chain
+      );
+      s->phase = ISPLIT_SCAN;
+      break;
+    case ISPLIT_SCAN:
+    {
+      if (! lwgrp_split_sorted_advance(&s->scan, req)) {
+        return 0;
+      }
+
+      int ints = CHAIN_INTS + 2 * s->levels;
+#ifdef LWGRP_USE_ANYSOURCE
+      /* send group info back to originating rank, receive our own
+       * from someone else, on a tag of its own since members that
+       * have theirs move on to building the comm on the op's tag */
+      MPI_Isend(
+        s->scan.send_ints, ints, MPI_INT,
+        s->scan.send_ints[CHAIN_ADDR], s->result_tag,
+        s->comm->chain.comm, lwgrp_request_next(req)
+      );
+      MPI_Irecv(
+        s->recv_ints, ints, MPI_INT, MPI_ANY_SOURCE, s->result_tag,
+        s->comm->chain.comm, lwgrp_request_next(req)
+      );
+      s->phase = ISPLIT_RESULT;
+      return 0;
+#else
+      /* route results back to their originating rank */
+      lwgrp_nb_route_init(
+        &s->route, s->scan.send_ints, 1, ints * sizeof(int),
+        &s->comm->ring, &s->comm->logring
+      );
+      s->phase = ISPLIT_RETURN;
+      break;
+#endif
+    }
+    case ISPLIT_RETURN:
+    {
+      if (! lwgrp_nb_route_advance(&s->route, req)) {
+        return 0;
+      }
+      void* result;
+      int result_count;
+      lwgrp_nb_route_finish(&s->route, &result, &result_count);
+      memcpy(
+        s->recv_ints, result, (CHAIN_INTS + 2 * s->levels) * sizeof(int)
+      );
+      lwgrp_free(&result);
+      s->phase = ISPLIT_RESULT;
+      break;
+    }
+    case ISPLIT_RESULT:
+      /* our result has arrived, so we're done with the scan state */
+      lwgrp_split_sorted_free(&s->scan);
+
+      /* build comm for our group, see lwgrp_comm_split, our bitmap
+       * may be out of date by now, so the members always check the
+       * context they picked */
+      lwgrp_split_result_group(
+        &s->comm->chain, s->color, s->levels, s->recv_ints,
+        &s->ring, &s->logchain
+      );
+      lwgrp_nb_comm_build_init(
+        &s->build, &s->ring, &s->logchain, s->recv_ints[CHAIN_CONTEXT], 1,
+        s->newcomm
+      );
+      s->phase = ISPLIT_BUILD;
+      break;
+    case ISPLIT_BUILD:
+      if (! lwgrp_nb_comm_build_advance(&s->build, req)) {
+        return 0;
+      }
+      lwgrp_logchain_free(&s->logchain);
+      lwgrp_ring_free(&s->ring);
+      return 1;
+    }
+  }
+}
+
+static void lwgrp_nb_split_release(void* state)
+{
+  lwgrp_nb_split* s = (lwgrp_nb_split*) state;
+  MPI_Type_free(&s->type);
+  lwgrp_scratch_free(&s->recv_ints);
+  lwgrp_scratch_free(&s);
+}
+
+int lwgrp_comm_isplit(
+  lwgrp_comm* comm,
+  int color,
+  int key,
+  lwgrp_comm* newcomm,
+  lwgrp_request* req)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ISPLIT);
+  lwgrp_nb_split* s = (lwgrp_nb_split*) lwgrp_scratch_alloc(
+    sizeof(lwgrp_nb_split), __FILE__, __LINE__
+  );
+  s->comm    = comm;
+  s->newcomm = newcomm;
+  s->color   = color;
+  s->phase   = ISPLIT_SORT;
+  s->result_tag = 0;
+#ifdef LWGRP_USE_ANYSOURCE
+  /* every member takes this tag before the op's own */
+  s->result_tag = lwgrp_comm_next_tag(comm);
+#endif
+
+  /* prepare (color,key,rank,addr,mask) tuple as in lwgrp_comm_split */
+  s->item[0] = color;
+  s->item[1] = key;
+  s->item[2] = comm->chain.group_rank;
+  s->item[3] = comm->chain.comm_rank;
+  lwgrp_context_mask(s->item + 4);
+
+  s->levels = lwgrp_split_levels(comm->chain.group_size);
+  s->recv_ints = (int*) lwgrp_scratch_alloc(
+    (CHAIN_INTS + 2 * s->levels) * sizeof(int), __FILE__, __LINE__
+  );
+
+  MPI_Type_contiguous(ITEM_INTS, MPI_INT, &s->type);
+  MPI_Type_commit(&s->type);
+
+  lwgrp_nb_sort_init(
+    &s->sort, s->item, s->type, lwgrp_cmp_three_ints, 0, comm
+  );
+
+  int rc = lwgrp_request_start(
+    comm, lwgrp_nb_split_advance, lwgrp_nb_split_release, s, req
+  );
+  LWGRP_STATS_END();
+  return rc;
+}
+
 /* int lwgrp_comm_rank_str(MPI_Comm comm, const void* str, int* groups, int* groupid)
  *   IN  comm    - input communicator (handle)
  *   IN  str     - string (NUL-terminated string)
@@ -700,49 +1194,46 @@ int lwgrp_comm_split(
  * This groupid can be used as a color value in MPI_COMM_SPLIT. */
 int lwgrp_comm_rank_str(const lwgrp_comm* comm, const char* str, int* groups, int* groupid)
 {
-  int tag1 = 0;
-  int tag2 = 1;
+  LWGRP_STATS_BEGIN(LWGRP_STATS_RANK_STR);
+  int tag1 = comm->chain.tag;
+  int tag2 = comm->chain.tag + 1;
 
   /* require str not be NULL */
   if (str == NULL) {
     /* TODO: error */
   }
 
-  /* build a group representing our input communicator -- O(1) local */
-  lwgrp_chain chain;
-  lwgrp_chain_build_from_ring(&comm->ring, &chain);
-
-  /* build a logchain for our input communicator -- O(log N) local */
-  lwgrp_logchain logchain;
-  lwgrp_logchain_build_from_logring(&comm->ring, &comm->logring, &logchain);
+  /* use the chain cached on our input communicator */
+  const lwgrp_chain* chain = &comm->chain;
 
   /* get maximum str length */
   int max_len;
   int len = strlen(str) + 1;
   lwgrp_comm_allreduce(&len, &max_len, 1, MPI_INT, MPI_MAX, comm);
 
-  /* allocate space to hold a copy of the string (plus rank) */
-  size_t buf_size = max_len + sizeof(int);
-  void* buf = malloc(buf_size);
-  if (buf == NULL) {
-    /* TODO: error */
-  }
+  /* pad string space so the ints that follow it are aligned */
+  int str_len = (max_len + sizeof(int) - 1) / sizeof(int) * sizeof(int);
 
-  /* TODO: if we want items with equal strings to be ordered by rank
-   * in lwgrp_comm, then we need to include chain.group_rank as second key */
+  /* allocate space to hold a copy of the string (plus rank and address) */
+  size_t buf_size = str_len + 2 * sizeof(int);
+  void* buf = lwgrp_scratch_alloc(buf_size, __FILE__, __LINE__);
 
-  /* Prepare buffer, copy in string and then rank after max_len characters.
-   * This rank serves two purposes. First by sorting on string and then rank,
-   * it ensures that every item is unique since the ranks are distinct.
-   * Second, it is used as a return address to send the result back. */
+  /* Prepare buffer, copy in string and then our rank and address after
+   * str_len characters.  The rank serves two purposes. First by sorting
+   * on string and then rank, it ensures that every item is unique since
+   * the ranks are distinct, and items with equal strings are ordered by
+   * rank in comm.  Second, it is used to send the result back.  The
+   * address is used as a return address when using ANY_SOURCE. */
+  memset(buf, 0, buf_size);
   strcpy((char*)buf, str);
-  int* ptr = (int*) ((char*)buf + max_len);
-  *ptr = chain.comm_rank;
+  int* ptr = (int*) ((char*)buf + str_len);
+  ptr[0] = chain->group_rank;
+  ptr[1] = chain->comm_rank;
 
-  /* create MPI datatype of offset chars followed by one int */
+  /* create MPI datatype of str_len chars followed by two ints */
   MPI_Datatype type;
-  int blocklens[2]      = {max_len, 1};
-  MPI_Aint displs[2]    = {0, max_len};
+  int blocklens[2]      = {str_len, 2};
+  MPI_Aint displs[2]    = {0, str_len};
   MPI_Datatype types[2] = {MPI_CHAR, MPI_INT};
 #if MPI_VERSION >= 2
   MPI_Type_create_struct(2, blocklens, displs, types, &type);
@@ -753,24 +1244,24 @@ int lwgrp_comm_rank_str(const lwgrp_comm* comm, const char* str, int* groups, in
 #endif
   MPI_Type_commit(&type);
 
-  /* compute type size and offset to original rank */
-  size_t type_size = max_len + sizeof(int);
-  size_t data_offset = max_len;
+  /* compute type size and offsets to original rank and address */
+  size_t type_size = buf_size;
+  size_t rank_offset = str_len;
+  size_t data_offset = str_len + sizeof(int);
 
-  /* sort our values using bitonic sort algorithm -- 
-   * O(log^2 N) communication */
-  lwgrp_logchain_sort_bitonic(
-    buf, type, type_size, data_offset, lwgrp_cmp_str_int,
-    &chain, &logchain, tag1
+  /* sort our values -- O(log N) to O(log^2 N) communication
+   * depending on the group size */
+  lwgrp_comm_sort(
+    buf, 1, type, lwgrp_cmp_str_int, rank_offset, comm
   );
 
   /* now split our sorted values by comparing our value with our
    * left and right neighbors to determine group boundaries --
    * O(log N) communication */
-  int recv_ints[7];
+  int recv_ints[CHAIN_INTS];
   lwgrp_logchain_split_sorted(
-    buf, type, type_size, data_offset, lwgrp_cmp_str, 
-    &chain, &logchain, tag1, tag2, recv_ints
+    buf, 1, type, type_size, rank_offset, data_offset, SPLIT_NO_MASK,
+    lwgrp_cmp_str, 0, comm, tag1, tag2, recv_ints
   );
 
   /* fill in group info */
@@ -781,16 +1272,120 @@ int lwgrp_comm_rank_str(const lwgrp_comm* comm, const char* str, int* groups, in
   MPI_Type_free(&type);
 
   /* free memory allocated for buffer */
-  if (buf != NULL) {
-    free(buf);
-    buf = NULL;
+  lwgrp_scratch_free(&buf);
+
+  LWGRP_STATS_END();
+  return 0;
+}
+
+/* split an MPI communicator by building an lwgrp comm over it */
+static int lwgrp_comm_split_mpicomm_ranges(
+  MPI_Comm comm,
+  int color,
+  int key,
+  int* size,
+  int* count,
+  int** ranges)
+{
+  lwgrp_comm group;
+  lwgrp_comm_build_from_mpicomm(comm, &group);
+
+  lwgrp_comm newgroup;
+  lwgrp_comm_split(&group, color, key, &newgroup);
+
+  /* get the size and compressed members of our new group --
+   * O(log N) communication */
+  lwgrp_comm_size(&newgroup, size);
+  lwgrp_comm_ranges(&newgroup, count, ranges);
+
+  lwgrp_comm_free(&newgroup);
+  lwgrp_comm_free(&group);
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_comm_split_members(
+  MPI_Comm comm,
+  int color,
+  int key,
+  int tag1,
+  int tag2,
+  int* size,
+  int members[])
+{
+  (void)tag1;
+  (void)tag2;
+
+  int count;
+  int* ranges;
+  int rc = lwgrp_comm_split_mpicomm_ranges(
+    comm, color, key, size, &count, &ranges
+  );
+
+  /* expand the triples into the caller's array */
+  int n = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    int first  = ranges[i * 3 + 0];
+    int last   = ranges[i * 3 + 1];
+    int stride = ranges[i * 3 + 2];
+    int r;
+    for (r = first; (stride > 0) ? (r <= last) : (r >= last); r += stride) {
+      members[n] = r;
+      n++;
+    }
   }
 
-  /* free the logchain -- O(1) local */
-  lwgrp_logchain_free(&logchain);
+  lwgrp_comm_ranges_free(&ranges);
 
-  /* free our group -- O(1) local */
-  lwgrp_chain_free(&chain);
+  return rc;
+}
 
-  return 0;
+int lwgrp_comm_split_ranges(
+  MPI_Comm comm,
+  int color,
+  int key,
+  int* size,
+  int* count,
+  int** ranges)
+{
+  return lwgrp_comm_split_mpicomm_ranges(
+    comm, color, key, size, count, ranges
+  );
+}
+
+int lwgrp_comm_split_create(
+  MPI_Comm comm,
+  int color,
+  int key,
+  int tag1,
+  int tag2,
+  MPI_Comm* newcomm)
+{
+  (void)tag1;
+  (void)tag2;
+
+  int size, count;
+  int* ranges;
+  int rc = lwgrp_comm_split_mpicomm_ranges(
+    comm, color, key, &size, &count, &ranges
+  );
+
+  /* hand the triples straight to MPI, so we never hold a list of all
+   * members, procs that gave MPI_UNDEFINED pass the empty group */
+  MPI_Group group;
+  MPI_Group newgroup = MPI_GROUP_EMPTY;
+  MPI_Comm_group(comm, &group);
+  if (count > 0) {
+    MPI_Group_range_incl(group, count, (int (*)[3]) ranges, &newgroup);
+  }
+  MPI_Comm_create(comm, newgroup, newcomm);
+  if (newgroup != MPI_GROUP_EMPTY) {
+    MPI_Group_free(&newgroup);
+  }
+  MPI_Group_free(&group);
+
+  lwgrp_comm_ranges_free(&ranges);
+
+  return rc;
 }
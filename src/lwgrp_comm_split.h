@@ -16,6 +16,11 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/* lwgrp_comm_split_members and lwgrp_comm_split_create still take the
+ * two tags they once sent their messages on, so existing callers
+ * build unchanged, but the tags are ignored, since the split runs on
+ * an lwgrp comm that picks its own */
+
 /* lwgrp_comm_split_members(comm, color, key, size, members)
  *
  * IN  comm    - MPI communicator on which to perform split (handle)
@@ -39,9 +44,30 @@ int lwgrp_comm_split_members(
   int members[]
 );
 
+/* lwgrp_comm_split_ranges(comm, color, key, size, count, ranges)
+ *
+ * same as above but returns only our own group, compressed into
+ * (first, last, stride) triples of ranks in comm, as taken by
+ * MPI_Group_range_incl, so a contiguous or evenly strided group takes
+ * a single triple rather than size(comm) integers
+ *
+ * OUT size   - size of output group after split (non-negative integer)
+ * OUT count  - number of triples (non-negative integer)
+ * OUT ranges - array of 3*count integers, free with lwgrp_comm_ranges_free */
+
+int lwgrp_comm_split_ranges(
+  MPI_Comm comm,
+  int color,
+  int key,
+  int* size,
+  int* count,
+  int** ranges
+);
+
 /* same as above but returns a newly created communicator via MPI_Comm_create,
  * can only use in MPI-2.2 and later and still not useful unless MPI_COMM_CREATE
- * is scalable */
+ * is scalable, builds the group from the triples above rather than
+ * from a full member list */
 int lwgrp_comm_split_create(
   MPI_Comm comm,
   int color,
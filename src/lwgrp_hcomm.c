@@ -0,0 +1,414 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Hierarchical comms split each collective into a step within each
+ * node, a step across node leaders, and a final step within each
+ * node.  With P procs per node, this cuts the number of procs that
+ * send through the network by a factor of P.  When the node group
+ * shares a memory segment, the steps within each node go through it,
+ * which avoids matching messages between procs on the node. */
+
+/* ---------------------------------
+ * Constructors / destructors
+ * --------------------------------- */
+
+/* given an hcomm with comm and node filled in, build the leader
+ * group out of rank 0 of each node group, since the leaders keep
+ * their order in comm, this is a single scan and needs no sort */
+static int lwgrp_hcomm_build_leaders(lwgrp_hcomm* comm)
+{
+  int bin = (comm->node.ring.group_rank == 0) ? 0 : -1;
+  int rc = lwgrp_comm_split_bin(&comm->comm, 1, bin, &comm->leaders);
+  return rc;
+}
+
+int lwgrp_hcomm_build_from_mpicomm(
+  MPI_Comm comm,
+  lwgrp_hcomm* newcomm)
+{
+  /* build our view of the full group */
+  lwgrp_comm_build_from_mpicomm(comm, &newcomm->comm);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+#if MPI_VERSION >= 3
+  /* get the set of procs on our node, ordered by rank in comm */
+  MPI_Comm shmcomm;
+  MPI_Comm_split_type(
+    comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shmcomm
+  );
+
+  /* translate ranks of procs on our node to ranks in comm, this
+   * takes memory proportional to the number of procs per node */
+  int size;
+  MPI_Comm_size(shmcomm, &size);
+  int* shmranks = (int*) lwgrp_malloc(
+    size * sizeof(int), sizeof(int), __FILE__, __LINE__
+  );
+  int* ranklist = (int*) lwgrp_malloc(
+    size * sizeof(int), sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < size; i++) {
+    shmranks[i] = i;
+  }
+  MPI_Group group, shmgroup;
+  MPI_Comm_group(comm, &group);
+  MPI_Comm_group(shmcomm, &shmgroup);
+  MPI_Group_translate_ranks(shmgroup, size, shmranks, group, ranklist);
+  MPI_Group_free(&shmgroup);
+  MPI_Group_free(&group);
+
+  /* our node group still sends through comm when it can't use
+   * the segment, which keeps the shared memory comm */
+  lwgrp_comm_build_from_list(comm, size, ranklist, &newcomm->node);
+  lwgrp_shm_create(shmcomm, &newcomm->shm);
+
+  lwgrp_free(&ranklist);
+  lwgrp_free(&shmranks);
+#else
+  /* we can't tell which procs share a node, so each proc is its own
+   * node and all procs are leaders */
+  lwgrp_comm_build_from_list(comm, 1, &rank, &newcomm->node);
+  newcomm->shm = NULL;
+#endif
+
+  /* the node group overlaps the full group, so give it a context
+   * of its own, all procs of comm are here so we can agree on the
+   * full group's tag */
+  lwgrp_comm_assign_context(&newcomm->node, newcomm->comm.ring.tag);
+
+  lwgrp_hcomm_build_leaders(newcomm);
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_hcomm_split(
+  const lwgrp_hcomm* comm,
+  int color,
+  int key,
+  lwgrp_hcomm* newcomm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SPLIT);
+
+  /* split the node group first, this runs entirely within the node,
+   * the node group is ordered by rank in comm, so ordering by key
+   * then node rank matches the ordering in the new comm */
+  lwgrp_comm_split(&comm->node, color, key, &newcomm->node);
+  lwgrp_shm_split(comm->shm, color, key, &newcomm->shm);
+
+  /* split the full group */
+  lwgrp_comm_split(&comm->comm, color, key, &newcomm->comm);
+
+  /* rank 0 of each new node group has the lowest rank of its node
+   * in the new comm, so these are our new leaders */
+  lwgrp_hcomm_build_leaders(newcomm);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_hcomm_free(lwgrp_hcomm* comm)
+{
+  lwgrp_shm_free(&comm->shm);
+  lwgrp_comm_free(&comm->leaders);
+  lwgrp_comm_free(&comm->node);
+  lwgrp_comm_free(&comm->comm);
+  return LWGRP_SUCCESS;
+}
+
+/* ---------------------------------
+ * Steps within a node
+ * --------------------------------- */
+
+/* these use the segment if the node group has one and the type is
+ * plain enough to copy as bytes, and send messages otherwise */
+
+static void lwgrp_hcomm_node_barrier(const lwgrp_hcomm* comm)
+{
+  if (comm->shm != NULL) {
+    lwgrp_shm_barrier(comm->shm);
+  } else {
+    lwgrp_comm_barrier(&comm->node);
+  }
+}
+
+static void lwgrp_hcomm_node_bcast(
+  void* buffer,
+  int count,
+  const lwgrp_type_desc* dt,
+  int root,
+  const lwgrp_hcomm* comm)
+{
+  if (lwgrp_shm_usable(comm->shm, dt)) {
+    lwgrp_shm_bcast(buffer, (size_t) count * dt->size, root, comm->shm);
+  } else {
+    lwgrp_comm_bcast(buffer, count, dt->type, root, &comm->node);
+  }
+}
+
+/* gather count elements from each proc on the node to node rank 0 */
+static void lwgrp_hcomm_node_gather(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  const lwgrp_type_desc* dt,
+  const lwgrp_hcomm* comm)
+{
+  if (lwgrp_shm_usable(comm->shm, dt)) {
+    lwgrp_shm_gather(sendbuf, (size_t) count * dt->size, recvbuf, 0, comm->shm);
+  } else {
+    lwgrp_comm_gather(sendbuf, recvbuf, count, dt->type, 0, &comm->node);
+  }
+}
+
+/* ---------------------------------
+ * Collectives
+ * --------------------------------- */
+
+int lwgrp_hcomm_barrier(const lwgrp_hcomm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_BARRIER);
+
+  /* wait for all procs on our node to enter */
+  lwgrp_hcomm_node_barrier(comm);
+
+  /* wait for all nodes to enter */
+  if (comm->node.ring.group_rank == 0) {
+    lwgrp_comm_barrier(&comm->leaders);
+  }
+
+  /* let procs on our node know that all nodes have entered */
+  lwgrp_hcomm_node_barrier(comm);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_hcomm_bcast(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_hcomm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_BCAST);
+  const lwgrp_comm* node    = &comm->node;
+  const lwgrp_comm* leaders = &comm->leaders;
+  int node_rank = node->ring.group_rank;
+
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  /* rank 0 of comm is always leader rank 0 and rank 0 on its node,
+   * for other roots, find the rank of the root within its node and
+   * the leader rank of its node, node_root is -1 on other nodes */
+  int node_root   = 0;
+  int leader_root = 0;
+  if (root != 0) {
+    int root_rank = (comm->comm.ring.group_rank == root) ? node_rank : -1;
+    lwgrp_comm_allreduce(
+      &root_rank, &node_root, 1, MPI_INT, MPI_MAX, node
+    );
+    if (node_rank == 0) {
+      int root_leader = (node_root >= 0) ? leaders->ring.group_rank : -1;
+      lwgrp_comm_allreduce(
+        &root_leader, &leader_root, 1, MPI_INT, MPI_MAX, leaders
+      );
+    }
+
+    /* if the root is not a leader, send the data to its leader,
+     * this covers all procs on the root's node */
+    if (node_root > 0) {
+      lwgrp_hcomm_node_bcast(buffer, count, &dt, node_root, comm);
+    }
+  }
+
+  /* send data across nodes */
+  if (node_rank == 0) {
+    lwgrp_comm_bcast(buffer, count, datatype, leader_root, leaders);
+  }
+
+  /* send data within each node, skipping the root's node if
+   * we already covered it above */
+  if (node_root <= 0) {
+    lwgrp_hcomm_node_bcast(buffer, count, &dt, 0, comm);
+  }
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_hcomm_allreduce(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  MPI_Op op,
+  const lwgrp_hcomm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLREDUCE);
+
+  /* the procs on one node need not hold consecutive ranks in comm,
+   * and we'd combine their data out of order */
+  if (! lwgrp_op_commutative(op)) {
+    int rc = lwgrp_comm_allreduce(
+      sendbuf, recvbuf, count, datatype, op, &comm->comm
+    );
+    LWGRP_STATS_END();
+    return rc;
+  }
+
+  const lwgrp_comm* node = &comm->node;
+  int node_rank = node->ring.group_rank;
+
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+  if (lwgrp_shm_usable(comm->shm, &dt)) {
+    /* with all procs on one node, every proc gets the result from
+     * the segment, otherwise only the leader needs it */
+    const void* inbuf = (sendbuf == MPI_IN_PLACE) ? recvbuf : sendbuf;
+    int all = (node->ring.group_size == comm->comm.ring.group_size);
+    lwgrp_shm_reduce(inbuf, recvbuf, count, datatype, op, all, comm->shm);
+    if (! all) {
+      if (node_rank == 0) {
+        lwgrp_comm_allreduce(
+          MPI_IN_PLACE, recvbuf, count, datatype, op, &comm->leaders
+        );
+      }
+      lwgrp_shm_bcast(recvbuf, (size_t) count * dt.size, 0, comm->shm);
+    }
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
+
+  /* with MPI_IN_PLACE our input is in recvbuf, which only the node
+   * leader receives into */
+  const void* nodebuf = sendbuf;
+  if (sendbuf == MPI_IN_PLACE && node_rank > 0) {
+    nodebuf = recvbuf;
+  }
+
+  /* combine data on our node into the leader */
+  lwgrp_comm_reduce(nodebuf, recvbuf, count, datatype, op, 0, node);
+
+  /* combine data across leaders */
+  if (node_rank == 0) {
+    lwgrp_comm_allreduce(
+      MPI_IN_PLACE, recvbuf, count, datatype, op, &comm->leaders
+    );
+  }
+
+  /* send the result to procs on our node */
+  lwgrp_comm_bcast(recvbuf, count, datatype, 0, node);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_hcomm_allgather(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype datatype,
+  const lwgrp_hcomm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_ALLGATHER);
+  int i;
+
+  const lwgrp_comm* node    = &comm->node;
+  const lwgrp_comm* leaders = &comm->leaders;
+  int rank       = comm->comm.ring.group_rank;
+  int ranks      = comm->comm.ring.group_size;
+  int node_rank  = node->ring.group_rank;
+  int node_ranks = node->ring.group_size;
+  if (count == 0 || ranks == 0) {
+    LWGRP_STATS_END();
+    return LWGRP_SUCCESS;
+  }
+
+  lwgrp_type_desc dt, int_dt;
+  lwgrp_type_desc_init(&dt, datatype);
+  lwgrp_type_desc_init(&int_dt, MPI_INT);
+
+  /* with MPI_IN_PLACE our input is already at its spot in recvbuf */
+  const void* inbuf = sendbuf;
+  if (sendbuf == MPI_IN_PLACE) {
+    inbuf = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, rank * count, &dt);
+  }
+
+  /* collect the data of procs on our node at the leader, along with
+   * their ranks in comm, since they need not be consecutive */
+  int* node_addrs = NULL;
+  void* nodebuf = NULL;
+  if (node_rank == 0) {
+    node_addrs = (int*) lwgrp_scratch_alloc(
+      node_ranks * sizeof(int), __FILE__, __LINE__
+    );
+    nodebuf = lwgrp_desc_dtbuf_alloc(node_ranks * count, &dt, __FILE__, __LINE__);
+  }
+  lwgrp_hcomm_node_gather(&rank, node_addrs, 1, &int_dt, comm);
+  lwgrp_hcomm_node_gather(inbuf, nodebuf, count, &dt, comm);
+
+  if (node_rank == 0) {
+    /* learn how many procs are on each node */
+    int leader_ranks = leaders->ring.group_size;
+    int* counts = (int*) lwgrp_scratch_alloc(
+      2 * leader_ranks * sizeof(int), __FILE__, __LINE__
+    );
+    int* displs = counts + leader_ranks;
+    lwgrp_comm_allgather(&node_ranks, counts, 1, MPI_INT, leaders);
+    int offset = 0;
+    for (i = 0; i < leader_ranks; i++) {
+      displs[i] = offset;
+      offset += counts[i];
+    }
+
+    /* exchange the ranks and data of all nodes */
+    int* addrs = (int*) lwgrp_scratch_alloc(
+      ranks * sizeof(int), __FILE__, __LINE__
+    );
+    lwgrp_comm_allgatherv(node_addrs, addrs, counts, displs, MPI_INT, leaders);
+    for (i = 0; i < leader_ranks; i++) {
+      counts[i] *= count;
+      displs[i] *= count;
+    }
+    void* allbuf = lwgrp_desc_dtbuf_alloc(ranks * count, &dt, __FILE__, __LINE__);
+    lwgrp_comm_allgatherv(nodebuf, allbuf, counts, displs, datatype, leaders);
+
+    /* put the data of each proc at its rank in comm */
+    for (i = 0; i < ranks; i++) {
+      lwgrp_desc_dtbuf_memcpy(
+        lwgrp_desc_dtbuf_from_dtbuf(recvbuf, addrs[i] * count, &dt),
+        lwgrp_desc_dtbuf_from_dtbuf(allbuf, i * count, &dt),
+        count, &dt
+      );
+    }
+
+    lwgrp_desc_dtbuf_free(&allbuf, &dt, __FILE__, __LINE__);
+    lwgrp_scratch_free(&addrs);
+    lwgrp_scratch_free(&counts);
+    lwgrp_desc_dtbuf_free(&nodebuf, &dt, __FILE__, __LINE__);
+    lwgrp_scratch_free(&node_addrs);
+  }
+
+  /* send the result to procs on our node */
+  lwgrp_hcomm_node_bcast(recvbuf, ranks * count, &dt, 0, comm);
+
+  LWGRP_STATS_END();
+  return LWGRP_SUCCESS;
+}
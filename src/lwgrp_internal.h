@@ -15,6 +15,42 @@
 #include "lwgrp.h"
 #include "../config/config.h"
 
+/* layout of a datatype, looked up once per call so that kernels can
+ * compute element offsets without querying MPI each time */
+typedef struct lwgrp_type_desc {
+  MPI_Datatype type;   /* datatype this describes */
+  MPI_Aint lb;         /* lower bound */
+  MPI_Aint extent;     /* extent, stride between consecutive elements */
+  MPI_Aint true_lb;    /* lower bound of the actual data */
+  MPI_Aint true_extent;/* span of the actual data in one element */
+  size_t size;         /* number of bytes of data in one element */
+  int contig;          /* 1 if consecutive elements form one block of bytes */
+} lwgrp_type_desc;
+
+/* fill in desc for type */
+void lwgrp_type_desc_init(lwgrp_type_desc* desc, MPI_Datatype type);
+
+/* given a pointer to the start of a datatype buffer, return pointer to
+ * datatype buffer for the start of the count-th element */
+static inline void* lwgrp_desc_dtbuf_from_dtbuf(const void* dtbuf, int count, const lwgrp_type_desc* desc)
+{
+  return (char*)dtbuf + (MPI_Aint)count * desc->extent;
+}
+
+/* given a pointer to the start of a memory buffer, return pointer to
+ * be used as a datatype buffer for the start of the count-th element */
+static inline void* lwgrp_desc_dtbuf_from_membuf(const void* membuf, int count, const lwgrp_type_desc* desc)
+{
+  return (char*)membuf - desc->lb + (MPI_Aint)count * desc->extent;
+}
+
+void* lwgrp_desc_dtbuf_alloc(int count, const lwgrp_type_desc* desc, const char* file, int line);
+
+int lwgrp_desc_dtbuf_free(void** dtbuf_ptr, const lwgrp_type_desc* desc, const char* file, int line);
+
+/* copy count elements, uses memcpy for contiguous types */
+void lwgrp_desc_dtbuf_memcpy(void* dst, const void* src, int count, const lwgrp_type_desc* desc);
+
 void* lwgrp_type_dtbuf_from_dtbuf(const void* dtbuf, int count, MPI_Datatype type);
 
 void* lwgrp_type_dtbuf_from_membuf(const void* membuf, int count, MPI_Datatype type);
@@ -29,10 +65,715 @@ void* lwgrp_malloc(size_t size, size_t alignment, const char* file, int line);
 
 void lwgrp_free(void*);
 
+/* allocate size bytes of scratch space aligned to a cache line from
+ * the scratch pool, returns NULL if size is 0 */
+void* lwgrp_scratch_alloc(size_t size, const char* file, int line);
+
+/* return a buffer from lwgrp_scratch_alloc to the pool, takes the
+ * address of the pointer and sets it to NULL */
+void lwgrp_scratch_free(void*);
+
+/* storage class for state each thread keeps for itself, such as its
+ * scratch pool, so that threads working on different groups don't
+ * need to take locks in the common path */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define LWGRP_THREAD_LOCAL _Thread_local
+#else
+#define LWGRP_THREAD_LOCAL __thread
+#endif
+
 /* find largest power of two that fits within ranks */
-int lwgrp_largest_pow2_log2(int ranks, int* outpow2, int* outlog2);
+int lwgrp_largest_pow2_log2_lte(int ranks, int* outpow2, int* outlog2);
 
 /* find largest power strictly less than ranks */
 int lwgrp_largest_pow2_log2_lessthan(int ranks, int* outpow2, int* outlog2);
 
+/* compute offset and size of a block when splitting count elements
+ * into blocks nearly equal pieces */
+void lwgrp_block_range(int count, int blocks, int block, int* offset, int* size);
+
+/* returns 1 if op is commutative, 0 otherwise */
+int lwgrp_op_commutative(MPI_Op op);
+
+/* returns 1 if op on type is exact, so any grouping of the operands
+ * gives the same bits, 0 otherwise */
+int lwgrp_op_exact(MPI_Datatype type, MPI_Op op);
+
+/* computes inoutbuf = inbuf op inoutbuf like MPI_Reduce_local, with
+ * fast loops for common predefined types and ops */
+int lwgrp_reduce_local(const void* inbuf, void* inoutbuf, int count,
+  MPI_Datatype type, MPI_Op op);
+
+/* reduces inbuf into two output buffers at once, as in two calls to
+ * lwgrp_reduce_local, the output buffers must be distinct */
+int lwgrp_reduce_local2(const void* inbuf, void* inoutbuf1, void* inoutbuf2,
+  int count, MPI_Datatype type, MPI_Op op);
+
+/* read a non-negative integer from the environment, returns def if
+ * the variable is not set */
+size_t lwgrp_getenv_size(const char* name, size_t def);
+
+/* route fixed-size records, each starting with an int holding the
+ * group rank of its destination, to their destinations in log(N)
+ * steps, returns a newly allocated buffer of the records that arrived
+ * at the calling process which the caller must free with lwgrp_free */
+int lwgrp_logring_route_brucks(
+  const void* inbuf,
+  int incount,
+  size_t rec_size,
+  void** outbuf,
+  int* outcount,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list
+);
+
+/* stable local sort of count items of size bytes each */
+int lwgrp_sort_local(
+  void* buf,
+  int count,
+  size_t size,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset
+);
+
+/* bitonic sort of count items per process on a logchain */
+int lwgrp_logchain_sort_bitonic(
+  void* value,
+  int count,
+  MPI_Datatype type,
+  size_t type_size,
+  size_t data_offset,
+  int (*compare)(const void*, const void*, size_t),
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list,
+  int tag
+);
+
+/* sort backends used by lwgrp_comm_sort, same semantics */
+int lwgrp_comm_sort_gather(void* buf, int count, MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t), size_t offset,
+  const lwgrp_comm* comm);
+int lwgrp_comm_sort_bitonic(void* buf, int count, MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t), size_t offset,
+  const lwgrp_comm* comm);
+int lwgrp_comm_sort_sample(void* buf, int count, MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t), size_t offset,
+  const lwgrp_comm* comm);
+
+/* ---------------------------------
+ * Nonblocking operations
+ * --------------------------------- */
+
+/* each comm has a context, which owns the block of LWGRP_CONTEXT_TAGS
+ * tags starting at LWGRP_MSG_TAG_0 + context * LWGRP_CONTEXT_TAGS,
+ * blocking ops use the first two tags in the block, and each
+ * nonblocking op started on the comm takes the next of the rest, so
+ * that messages of outstanding ops and of comms with different
+ * contexts on the same parent comm can not match, these must be the
+ * same on all procs */
+#ifndef LWGRP_CONTEXT_TAGS
+#define LWGRP_CONTEXT_TAGS (256)
+#endif
+
+/* largest number of contexts, we use fewer if MPI_TAG_UB is too
+ * small to give each one a full block of tags */
+#ifndef LWGRP_CONTEXTS
+#define LWGRP_CONTEXTS (128)
+#endif
+
+/* offset in a context's block of the first nonblocking tag */
+#define LWGRP_CONTEXT_NB_FIRST (2)
+
+/* number of ints in a bitmap with one bit per context */
+#define LWGRP_CONTEXT_WORDS ((LWGRP_CONTEXTS + 31) / 32)
+
+/* first tag of the block owned by context */
+int lwgrp_context_tag(int context);
+
+/* set the bit in mask of each context used by a comm we belong to,
+ * including the shared context 0 -- O(1) local */
+void lwgrp_context_mask(int mask[LWGRP_CONTEXT_WORDS]);
+
+/* returns the lowest context whose bit is not set in used, members
+ * that compute this from the same bitmap agree on it, returns -1 if
+ * every context is taken */
+int lwgrp_context_pick(const int used[LWGRP_CONTEXT_WORDS]);
+
+/* give a newly built comm a context that no comm any member belongs
+ * to currently uses, tag is a tag the members can use to agree, where
+ * no other messages between them are in flight -- collective over
+ * comm, O(log N) communication */
+int lwgrp_comm_assign_context(lwgrp_comm* comm, int tag);
+
+/* maximum number of MPI requests an op may have outstanding in a step */
+#define LWGRP_REQUEST_MPI_MAX (68)
+
+/* A nonblocking op is a state machine.  Its advance function is called
+ * once when the op starts and then each time all MPI requests posted in
+ * the previous step have completed.  It does any local work for the
+ * step that just finished, then either posts the MPI requests for the
+ * next step and returns 0, or returns 1 when the op is complete. */
+struct lwgrp_request_struct {
+  int (*advance)(struct lwgrp_request_struct* req); /* moves op to next step */
+  void (*release)(void* state); /* frees op state, may be NULL */
+  int (*start)(struct lwgrp_request_struct* req); /* resets state and runs first
+                                                   * step, NULL unless persistent */
+  lwgrp_comm* comm; /* comm to take a tag from on each start */
+  void* state;  /* op-specific state */
+  int tag;      /* tag used for all messages of this op */
+  int done;     /* set to 1 once advance reports completion */
+  int nreqs;    /* number of outstanding MPI requests */
+  int stats_op; /* op whose counters progress on this request adds to */
+  MPI_Request mpireqs[LWGRP_REQUEST_MPI_MAX];
+};
+
+/* take the next nonblocking tag from comm, every member must take
+ * tags in the same order */
+int lwgrp_comm_next_tag(lwgrp_comm* comm);
+
+/* allocate a request for an op on comm, takes the next nonblocking
+ * tag from comm, and runs the first step of the op */
+int lwgrp_request_start(
+  lwgrp_comm* comm,
+  int (*advance)(struct lwgrp_request_struct* req),
+  void (*release)(void* state),
+  void* state,
+  lwgrp_request* req
+);
+
+/* allocate a persistent request for an op on comm, the request is
+ * inactive until lwgrp_start, which takes the next nonblocking tag
+ * from comm and calls start, start must reset state and return the
+ * result of the first advance, release is called once when the
+ * request is freed with lwgrp_request_free */
+int lwgrp_request_persistent(
+  lwgrp_comm* comm,
+  int (*start)(struct lwgrp_request_struct* req),
+  int (*advance)(struct lwgrp_request_struct* req),
+  void (*release)(void* state),
+  void* state,
+  lwgrp_request* req
+);
+
+/* prepare a caller-owned request to run an op with the given tag,
+ * used to drive an op to completion from a blocking call */
+void lwgrp_request_init(
+  struct lwgrp_request_struct* req,
+  int (*advance)(struct lwgrp_request_struct* req),
+  void* state,
+  int tag
+);
+
+/* run op in req to completion, does not free req */
+int lwgrp_request_complete(struct lwgrp_request_struct* req);
+
+/* returns pointer to the next free MPI request slot in req */
+MPI_Request* lwgrp_request_next(struct lwgrp_request_struct* req);
+
+/* state for a Bruck's allgather in progress, shared by ops that
+ * embed an allgather step */
+typedef struct lwgrp_nb_allgather {
+  const void* sendbuf;
+  void* recvbuf;
+  void* tmpbuf;
+  int num;
+  MPI_Datatype type;
+  lwgrp_type_desc dt;
+  const lwgrp_ring* group;
+  const lwgrp_logring* list;
+  int index;
+  int step;
+  int ranks_received;
+  int ranks_incoming;
+} lwgrp_nb_allgather;
+
+/* prepare an allgather, no messages are posted */
+void lwgrp_nb_allgather_init(
+  lwgrp_nb_allgather* s,
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype type,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list
+);
+
+/* post the next step of the allgather into req,
+ * returns 1 when the allgather is complete */
+int lwgrp_nb_allgather_advance(
+  lwgrp_nb_allgather* s,
+  struct lwgrp_request_struct* req
+);
+
+/* one compare-exchange step of a bitonic sort */
+typedef struct lwgrp_sort_step {
+  int partner;  /* address of process to exchange items with */
+  int keep_low; /* whether we keep the smaller of the two items */
+} lwgrp_sort_step;
+
+/* state for a sort of a single item per process in progress,
+ * uses a gather sort or bitonic sort as lwgrp_comm_sort would */
+typedef struct lwgrp_nb_sort {
+  void* value;
+  MPI_Datatype type;
+  size_t type_size;
+  size_t offset;
+  int (*compare)(const void*, const void*, size_t);
+  const lwgrp_comm* comm;
+  int use_gather;               /* whether we allgather and sort locally */
+  lwgrp_nb_allgather allgather; /* allgather state for gather sort */
+  void* all;                    /* all items for gather sort */
+  void* scratch;                /* item received from bitonic partner */
+  lwgrp_sort_step* steps;       /* our steps in the bitonic sort */
+  int nsteps;
+  int step;
+} lwgrp_nb_sort;
+
+/* prepare to sort value across comm, no messages are posted */
+void lwgrp_nb_sort_init(
+  lwgrp_nb_sort* s,
+  void* value,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm
+);
+
+/* post the next step of the sort into req,
+ * returns 1 when value holds its sorted item */
+int lwgrp_nb_sort_advance(
+  lwgrp_nb_sort* s,
+  struct lwgrp_request_struct* req
+);
+
+/* free buffers held by sort */
+void lwgrp_nb_sort_free(lwgrp_nb_sort* s);
+
+/* state for routing records in progress,
+ * see lwgrp_logring_route_brucks */
+typedef struct lwgrp_nb_route {
+  char* buf;             /* records we hold, grows as records arrive */
+  int cap;               /* number of records buf can hold */
+  int num;               /* number of records in buf */
+  char* sendbuf;         /* records we send in the current step */
+  int send_cap;          /* number of records sendbuf can hold */
+  int send_count;        /* number of records we send in this step */
+  int recv_count;        /* number of records we receive in this step */
+  size_t rec_size;
+  MPI_Datatype rec_type;
+  const lwgrp_ring* group;
+  const lwgrp_logring* list;
+  int index;
+  int step;
+  int phase;
+} lwgrp_nb_route;
+
+/* prepare to route incount records from inbuf, no messages are posted */
+void lwgrp_nb_route_init(
+  lwgrp_nb_route* s,
+  const void* inbuf,
+  int incount,
+  size_t rec_size,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list
+);
+
+/* post the next step of the route into req,
+ * returns 1 when all records have arrived */
+int lwgrp_nb_route_advance(
+  lwgrp_nb_route* s,
+  struct lwgrp_request_struct* req
+);
+
+/* free state of a completed route and hand back the records that
+ * arrived, which the caller must free with lwgrp_free */
+void lwgrp_nb_route_finish(
+  lwgrp_nb_route* s,
+  void** outbuf,
+  int* outcount
+);
+
+/* state for an allreduce in progress,
+ * see lwgrp_logchain_allreduce_recursive */
+typedef struct lwgrp_nb_allreduce {
+  void* recvbuf;
+  void* tempbuf;
+  int count;
+  MPI_Datatype type;
+  lwgrp_type_desc dt;
+  MPI_Op op;
+  const lwgrp_chain* group;
+  const lwgrp_logchain* list;
+  int phase;
+  int pow2;         /* size of power-of-two group */
+  int cutoff;       /* ranks below cutoff take part in the fold */
+  int odd_rank_out; /* whether we sit out the power-of-two step */
+  int use_list;     /* group is a power of two, so logchain has our partners */
+  int new_rank;     /* our rank in the power-of-two group */
+  int left;         /* current left partner in power-of-two group */
+  int right;        /* current right partner in power-of-two group */
+  int recv_left;    /* next left partner as received from left */
+  int recv_right;   /* next right partner as received from right */
+  int mask;         /* recursive doubling mask */
+  int index;        /* log of mask */
+} lwgrp_nb_allreduce;
+
+/* prepare an allreduce, copies sendbuf into recvbuf unless it is
+ * MPI_IN_PLACE, no messages are posted */
+void lwgrp_nb_allreduce_init(
+  lwgrp_nb_allreduce* s,
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list
+);
+
+/* post the next step of the allreduce into req,
+ * returns 1 when recvbuf holds the result */
+int lwgrp_nb_allreduce_advance(
+  lwgrp_nb_allreduce* s,
+  struct lwgrp_request_struct* req
+);
+
+/* state for building a logring from a ring and its logchain in
+ * progress, see lwgrp_logring_build_from_logchain */
+typedef struct lwgrp_nb_logring {
+  const lwgrp_ring* group;
+  const lwgrp_logchain* chainlist;
+  lwgrp_logring* list;
+  int index;
+  int dist;
+  int left_rank;       /* our current left entry */
+  int right_rank;      /* our current right entry */
+  int recv_left_rank;  /* our next left entry if it wraps */
+  int recv_right_rank; /* our next right entry if it wraps */
+  int exchanged;       /* whether we are waiting on wrapping entries */
+} lwgrp_nb_logring;
+
+/* allocate list and prepare to fill it in, no messages are posted */
+void lwgrp_nb_logring_init(
+  lwgrp_nb_logring* s,
+  const lwgrp_ring* group,
+  const lwgrp_logchain* chainlist,
+  lwgrp_logring* list
+);
+
+/* post the next step of the build into req,
+ * returns 1 when list is complete */
+int lwgrp_nb_logring_advance(
+  lwgrp_nb_logring* s,
+  struct lwgrp_request_struct* req
+);
+
+/* state for building a klogring from a ring in progress,
+ * see lwgrp_klogring_build_from_ring */
+typedef struct lwgrp_nb_klogring {
+  const lwgrp_ring* group;
+  lwgrp_klogring* list;
+  int d;     /* current power of k */
+  int j;     /* next multiple of k^d */
+  long dist; /* k^d */
+} lwgrp_nb_klogring;
+
+/* allocate list and prepare to fill it in, no messages are posted */
+void lwgrp_nb_klogring_init(
+  lwgrp_nb_klogring* s,
+  const lwgrp_ring* group,
+  int k,
+  lwgrp_klogring* list
+);
+
+/* post the next step of the build into req,
+ * returns 1 when list is complete */
+int lwgrp_nb_klogring_advance(
+  lwgrp_nb_klogring* s,
+  struct lwgrp_request_struct* req
+);
+
+/* state for building a comm from a ring and its logchain in progress,
+ * see lwgrp_comm_build_from_logchain, the members of the new comm
+ * picked context from the contexts they used when they started, so
+ * the comm takes it without agreeing on one, unless some member may
+ * have claimed it since, in which case they check and pick again */
+typedef struct lwgrp_nb_comm_build {
+  lwgrp_comm* comm;
+  int phase;
+  int context;  /* context the members picked */
+  int check;    /* whether members confirm nobody claimed context since */
+  int taken;    /* whether we already use context */
+  int retry;    /* whether any member already uses context */
+  int mine[LWGRP_CONTEXT_WORDS]; /* contexts we use */
+  int used[LWGRP_CONTEXT_WORDS]; /* contexts any member uses */
+  lwgrp_nb_logring logring;
+  lwgrp_nb_klogring klogring;
+  lwgrp_nb_allreduce allreduce;
+} lwgrp_nb_comm_build;
+
+/* copy ring into comm and prepare to build the rest of it, context
+ * is the one the members picked or -1 if they found none free, if
+ * check is set the members always confirm the context, otherwise only
+ * when other threads may be claiming contexts, logchain must stay
+ * valid until the build completes, no messages are posted */
+void lwgrp_nb_comm_build_init(
+  lwgrp_nb_comm_build* s,
+  const lwgrp_ring* ring,
+  const lwgrp_logchain* logchain,
+  int context,
+  int check,
+  lwgrp_comm* comm
+);
+
+/* post the next step of the build into req,
+ * returns 1 when comm is ready to use */
+int lwgrp_nb_comm_build_advance(
+  lwgrp_nb_comm_build* s,
+  struct lwgrp_request_struct* req
+);
+
+/* ---------------------------------
+ * Shared memory
+ * --------------------------------- */
+
+/* we need MPI-3 shared windows, and atomic loads and stores to
+ * synchronize through them */
+#if MPI_VERSION >= 3 && defined(__ATOMIC_ACQUIRE)
+#define LWGRP_HAVE_SHM (1)
+#endif
+
+/* bytes of shared memory each proc on a node contributes as its slot,
+ * larger ops are moved through the slots in pieces, 0 disables the
+ * shared memory path, can be overridden by the environment variable
+ * of the same name, must be the same on all procs */
+#ifndef LWGRP_SHM_SLOT_BYTES
+#define LWGRP_SHM_SLOT_BYTES (128 * 1024)
+#endif
+
+/* a shared memory segment across the procs of one node, each proc
+ * owns a slot of the segment, which starts with a control block
+ * holding its flags, every step of every op takes the next token,
+ * and procs publish their progress by storing tokens in their flags,
+ * since all procs run the same steps in the same order their tokens
+ * agree */
+typedef struct lwgrp_shm_struct {
+  MPI_Comm comm;         /* procs on the node, ordered as the node group */
+  MPI_Win win;           /* window holding the segment */
+  int rank;              /* our rank in comm */
+  int ranks;             /* number of procs in comm */
+  size_t slot_bytes;     /* bytes of data in each slot */
+  char** slots;          /* address of the slot of each proc */
+  unsigned long token;   /* token of the last step we ran */
+} lwgrp_shm;
+
+/* build a segment over the procs of comm, takes ownership of comm,
+ * sets shm to NULL and frees comm if shared memory is disabled or
+ * there is only one proc -- collective over comm */
+int lwgrp_shm_create(MPI_Comm comm, lwgrp_shm** shm);
+
+/* build a segment for each group of procs of the same color, ordered
+ * by key then rank, as in MPI_Comm_split, returns NULL if shm is NULL
+ * or color is MPI_UNDEFINED -- collective over shm */
+int lwgrp_shm_split(const lwgrp_shm* shm, int color, int key, lwgrp_shm** newshm);
+
+/* free the segment and set shm to NULL -- collective over shm */
+int lwgrp_shm_free(lwgrp_shm** shm);
+
+/* returns 1 if ops on elements of this type can go through shm, which
+ * reduces packed elements and so requires a plain contiguous type */
+int lwgrp_shm_usable(const lwgrp_shm* shm, const lwgrp_type_desc* desc);
+
+int lwgrp_shm_barrier(lwgrp_shm* shm);
+
+/* copy bytes at buf of the root to buf of all other procs */
+int lwgrp_shm_bcast(void* buf, size_t bytes, int root, lwgrp_shm* shm);
+
+/* gather bytes from sendbuf of each proc into recvbuf in rank order,
+ * on rank 0, or on all procs if all is set */
+int lwgrp_shm_gather(const void* sendbuf, size_t bytes, void* recvbuf,
+  int all, lwgrp_shm* shm);
+
+/* reduce count elements with a commutative op into recvbuf, on rank 0,
+ * or on all procs if all is set, sendbuf and recvbuf may be the same */
+int lwgrp_shm_reduce(const void* sendbuf, void* recvbuf, int count,
+  MPI_Datatype type, MPI_Op op, int all, lwgrp_shm* shm);
+
+/* ---------------------------------
+ * One-sided transport
+ * --------------------------------- */
+
+/* we need MPI-3 dynamic windows, passive target synchronization, and
+ * atomic accumulates to post flags through them */
+#if MPI_VERSION >= 3
+#define LWGRP_HAVE_RMA (1)
+#endif
+
+/* one slot of a mailbox, written by the partner 2^d hops away on one
+ * side, ready and addr are posted by a partner that wants us to put
+ * data at addr, arrived is posted by a partner once its data has
+ * landed in our buffer, both flags hold the sequence number of the op */
+typedef struct lwgrp_rma_slot {
+  long ready;    /* op in which addr was posted */
+  long arrived;  /* op in which data from the partner landed */
+  MPI_Aint addr; /* window address to put data to */
+} lwgrp_rma_slot;
+
+/* a comm's use of the dynamic window of its parent comm, each member
+ * attaches a mailbox with a slot for each logring partner, slots
+ * 0..rounds-1 are written by left partners and the rest by right
+ * partners, every op on the comm takes the next sequence number, and
+ * flags only grow, so posts from earlier ops are never mistaken for
+ * the current one */
+typedef struct lwgrp_rma_struct {
+  MPI_Win win;           /* dynamic window over the parent comm */
+  int rounds;            /* number of partners on each side */
+  lwgrp_rma_slot* slots; /* our mailbox, attached to win */
+  MPI_Aint* left;        /* mailbox address of each left partner */
+  MPI_Aint* right;       /* mailbox address of each right partner */
+  long seq;              /* sequence number of the last op */
+} lwgrp_rma;
+
+/* attach a mailbox to the window of the parent comm of comm and swap
+ * addresses with the logring partners, sets rma to NULL if the parent
+ * has no window -- collective over comm, O(log N) communication */
+int lwgrp_rma_create(const lwgrp_comm* comm, lwgrp_rma** rma);
+
+/* detach and free the mailbox and set rma to NULL, all posts to our
+ * mailbox land before the op they belong to completes, so this is
+ * local */
+int lwgrp_rma_free(lwgrp_rma** rma);
+
+/* returns 1 if count elements of this type can be put through rma,
+ * which attaches the span of the buffer and so needs a positive
+ * extent */
+int lwgrp_rma_usable(const lwgrp_rma* rma, MPI_Datatype type, int count);
+
+/* lwgrp_logring_allgather_brucks, putting each round into the
+ * temporary buffer of the receiver */
+int lwgrp_logring_allgather_brucks_rma(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma
+);
+
+/* lwgrp_logring_bcast_binomial, putting into the buffer of each child */
+int lwgrp_logring_bcast_binomial_rma(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma
+);
+
+/* ---------------------------------
+ * Algorithm selection
+ * --------------------------------- */
+
+/* algorithms a rule of the selection table can pick, by op */
+enum lwgrp_alg {
+  LWGRP_ALG_DEFAULT,                 /* no rule matched, use the built-in thresholds */
+  LWGRP_ALG_BARRIER_DISSEMINATION,   /* lwgrp_logring_barrier_dissemination */
+  LWGRP_ALG_BARRIER_CHAIN,           /* lwgrp_chain_barrier_dissemination */
+  LWGRP_ALG_BCAST_BINOMIAL,          /* lwgrp_logring_bcast_binomial */
+  LWGRP_ALG_BCAST_SCATTER_ALLGATHER, /* lwgrp_logring_bcast_scatter_allgather */
+  LWGRP_ALG_BCAST_PIPELINED,         /* lwgrp_chain_bcast_pipelined */
+  LWGRP_ALG_GATHER_BINOMIAL,         /* lwgrp_logring_gather_binomial */
+  LWGRP_ALG_GATHER_BRUCKS,           /* lwgrp_logring_gather_brucks */
+  LWGRP_ALG_ALLTOALL_BRUCKS,         /* lwgrp_logring_alltoall_brucks */
+  LWGRP_ALG_ALLTOALL_INDEXED,        /* lwgrp_logring_alltoall_brucks_indexed */
+  LWGRP_ALG_ALLREDUCE_RECURSIVE,     /* lwgrp_logchain_allreduce_recursive */
+  LWGRP_ALG_ALLREDUCE_RABENSEIFNER,  /* lwgrp_logchain_allreduce_rabenseifner */
+  LWGRP_ALG_ALLREDUCE_RING,          /* lwgrp_ring_allreduce_pipelined */
+  LWGRP_ALG_REDUCE_SCATTER_ALLREDUCE, /* lwgrp_comm_allreduce and a copy */
+  LWGRP_ALG_REDUCE_SCATTER_HALVING,  /* lwgrp_logchain_reduce_scatter_halving */
+  LWGRP_ALG_REDUCE_SCATTER_RING,     /* lwgrp_ring_reduce_scatter_pipelined */
+  LWGRP_ALG_SORT_GATHER,             /* lwgrp_comm_sort_gather */
+  LWGRP_ALG_SORT_BITONIC,            /* lwgrp_comm_sort_bitonic */
+  LWGRP_ALG_SORT_SAMPLE,             /* lwgrp_comm_sort_sample */
+};
+
+/* returns the algorithm of the first rule that matches op, a
+ * LWGRP_STATS_* value, a group of ranks procs, and messages of bytes
+ * per proc, or LWGRP_ALG_DEFAULT if none does -- O(rules) local */
+int lwgrp_tune_select(int op, int ranks, size_t bytes);
+
+/* ---------------------------------
+ * Statistics
+ * --------------------------------- */
+
+#ifdef LWGRP_USE_STATS
+
+/* open a frame for op on the calling thread, counting a call if call
+ * is set, frames nest, and counts go to the outermost one */
+void lwgrp_stats_begin(int op, int call);
+
+/* close the frame opened by the matching lwgrp_stats_begin */
+void lwgrp_stats_end(void);
+
+/* the op of the outermost open frame, or LWGRP_STATS_OTHER */
+int lwgrp_stats_current(void);
+
+/* count bytes taken from the scratch pool */
+void lwgrp_stats_scratch(size_t bytes);
+
+#define LWGRP_STATS_BEGIN(op)      lwgrp_stats_begin(op, 1)
+#define LWGRP_STATS_RESUME(op)     lwgrp_stats_begin(op, 0)
+#define LWGRP_STATS_END()          lwgrp_stats_end()
+#define LWGRP_STATS_CURRENT()      lwgrp_stats_current()
+#define LWGRP_STATS_SCRATCH(bytes) lwgrp_stats_scratch(bytes)
+
+/* the kernels make their point-to-point calls through these wrappers,
+ * which count messages, bytes, rounds and wait time before calling
+ * MPI, lwgrp_stats.c defines LWGRP_STATS_NO_WRAP to reach MPI itself */
+int lwgrp_stats_Send(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm);
+int lwgrp_stats_Isend(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm, MPI_Request* request);
+int lwgrp_stats_Issend(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm, MPI_Request* request);
+int lwgrp_stats_Recv(void* buf, int count, MPI_Datatype type,
+  int source, int tag, MPI_Comm comm, MPI_Status* status);
+int lwgrp_stats_Sendrecv(const void* sendbuf, int sendcount,
+  MPI_Datatype sendtype, int dest, int sendtag, void* recvbuf,
+  int recvcount, MPI_Datatype recvtype, int source, int recvtag,
+  MPI_Comm comm, MPI_Status* status);
+int lwgrp_stats_Waitall(int count, MPI_Request requests[],
+  MPI_Status statuses[]);
+int lwgrp_stats_Waitsome(int incount, MPI_Request requests[],
+  int* outcount, int indices[], MPI_Status statuses[]);
+int lwgrp_stats_Testall(int count, MPI_Request requests[], int* flag,
+  MPI_Status statuses[]);
+int lwgrp_stats_Put(const void* buf, int count, MPI_Datatype type,
+  int target, MPI_Aint disp, int target_count, MPI_Datatype target_type,
+  MPI_Win win);
+
+#ifndef LWGRP_STATS_NO_WRAP
+#define MPI_Send     lwgrp_stats_Send
+#define MPI_Isend    lwgrp_stats_Isend
+#define MPI_Issend   lwgrp_stats_Issend
+#define MPI_Recv     lwgrp_stats_Recv
+#define MPI_Sendrecv lwgrp_stats_Sendrecv
+#define MPI_Waitall  lwgrp_stats_Waitall
+#define MPI_Waitsome lwgrp_stats_Waitsome
+#define MPI_Testall  lwgrp_stats_Testall
+#define MPI_Put      lwgrp_stats_Put
+#endif
+
+#else
+
+#define LWGRP_STATS_BEGIN(op)
+#define LWGRP_STATS_RESUME(op)
+#define LWGRP_STATS_END()
+#define LWGRP_STATS_CURRENT()      (LWGRP_STATS_OTHER)
+#define LWGRP_STATS_SCRATCH(bytes)
+
+#endif /* LWGRP_USE_STATS */
+
 #endif /* _LWGRP_INTERNAL_H */
@@ -0,0 +1,193 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* the k-ary form of the dissemination barrier in
+ * Debra Hensgen, Raphael Finkel, Udi Manber,
+ * "Two algorithms for barrier synchronization",
+ * International Journal of Parallel Programming,
+ * 1988-02-01, Vol 17, Issue 1,
+ * in round d, each proc signals the procs j*k^d to its right and
+ * waits on those j*k^d to its left, for j = 1 to k-1, after that
+ * round it has heard from the k^(d+1)-1 procs to its left */
+int lwgrp_klogring_barrier_dissemination(
+  const lwgrp_ring* group,
+  const lwgrp_klogring* list)
+{
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm  = group->comm;
+  int ranks      = group->group_size;
+  int k          = list->k;
+
+  /* allocate requests for k-1 partners on each side */
+  MPI_Request* request = (MPI_Request*) lwgrp_scratch_alloc(
+    2 * (k - 1) * sizeof(MPI_Request), __FILE__, __LINE__
+  );
+  MPI_Status* status = (MPI_Status*) lwgrp_scratch_alloc(
+    2 * (k - 1) * sizeof(MPI_Status), __FILE__, __LINE__
+  );
+
+  /* execute barrier dissemination algorithm */
+  int d;
+  long dist = 1;
+  for (d = 0; d < list->rounds; d++) {
+    /* send empty messages as a signal to all partners of this round */
+    int n = 0;
+    int j;
+    for (j = 1; j < k && j * dist < ranks; j++) {
+      int index = d * (k - 1) + j - 1;
+      MPI_Irecv(
+        NULL, 0, MPI_BYTE, list->left_list[index], group->tag,
+        comm, &request[n]
+      );
+      n++;
+      MPI_Isend(
+        NULL, 0, MPI_BYTE, list->right_list[index], group->tag,
+        comm, &request[n]
+      );
+      n++;
+    }
+    MPI_Waitall(n, request, status);
+
+    /* prepare for next iteration */
+    dist *= k;
+  }
+
+  lwgrp_scratch_free(&status);
+  lwgrp_scratch_free(&request);
+
+  return rc;
+}
+
+/* issue an allgather using Bruck's algorithm with k-1 ports,
+ * Jehoshua Bruck, Ching-Tien Ho, Shlomo Kipnis, Eli Upfal,
+ * Derrick Weathersby, "Efficient algorithms for all-to-all
+ * communications in multiport message-passing systems",
+ * IEEE Transactions on Parallel and Distributed Systems,
+ * 1997-11, Vol 8, Issue 11,
+ * before round d each proc holds the k^d blocks starting at its own,
+ * and it receives that many from each of the procs j*k^d to its
+ * right, for j = 1 to k-1 */
+int lwgrp_klogring_allgather_brucks(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  const lwgrp_ring* group,
+  const lwgrp_klogring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm  = group->comm;
+  int rank       = group->group_rank;
+  int ranks      = group->group_size;
+  int k          = list->k;
+
+  /* allocate temporary buffer */
+  size_t total_elems = num * ranks;
+  void* tmpbuf = lwgrp_desc_dtbuf_alloc(
+    total_elems, &dt, __FILE__, __LINE__
+  );
+
+  /* copy our own data into the temporary buffer */
+  const void* inputbuf = sendbuf;
+#if MPI_VERSION >= 2
+  if (sendbuf == MPI_IN_PLACE) {
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, num * rank, &dt
+    );
+  }
+#endif
+  lwgrp_desc_dtbuf_memcpy(tmpbuf, inputbuf, num, &dt);
+
+  /* allocate requests for k-1 partners on each side */
+  MPI_Request* request = (MPI_Request*) lwgrp_scratch_alloc(
+    2 * (k - 1) * sizeof(MPI_Request), __FILE__, __LINE__
+  );
+  MPI_Status* status = (MPI_Status*) lwgrp_scratch_alloc(
+    2 * (k - 1) * sizeof(MPI_Status), __FILE__, __LINE__
+  );
+
+  /* execute the allgather operation */
+  int d;
+  long dist = 1;
+  for (d = 0; d < list->rounds; d++) {
+    int n = 0;
+    int j;
+    for (j = 1; j < k && j * dist < ranks; j++) {
+      /* get ranks for left and right partners */
+      int index = d * (k - 1) + j - 1;
+      int src = list->right_list[index];
+      int dst = list->left_list[index];
+
+      /* the blocks from j*k^d on, which our source holds from its
+       * own on, we only need those up to the end of the group */
+      int offset = (int) (j * dist);
+      int ranks_incoming = (int) dist;
+      if (offset + ranks_incoming > ranks) {
+        ranks_incoming = ranks - offset;
+      }
+      int num_exchange = num * ranks_incoming;
+
+      /* receive data from source */
+      void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(
+        tmpbuf, offset * num, &dt
+      );
+      MPI_Irecv(
+        recv_pos, num_exchange, datatype, src, group->tag,
+        comm, &request[n]
+      );
+      n++;
+
+      /* send the data to destination */
+      MPI_Isend(
+        tmpbuf, num_exchange, datatype, dst, group->tag,
+        comm, &request[n]
+      );
+      n++;
+    }
+
+    /* wait for communication to complete */
+    MPI_Waitall(n, request, status);
+
+    /* go on to next iteration */
+    dist *= k;
+  }
+
+  /* shift our data back to the proper position in receive buffer */
+  int num_pre  = num * rank;
+  int num_post = num * (ranks - rank);
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(
+    recvbuf, num_pre, &dt
+  );
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(
+    tmpbuf, num_post, &dt
+  );
+  lwgrp_desc_dtbuf_memcpy(buf_pre, tmpbuf,  num_post, &dt);
+  lwgrp_desc_dtbuf_memcpy(recvbuf, buf_post, num_pre, &dt);
+
+  /* free the temporary buffers */
+  lwgrp_scratch_free(&status);
+  lwgrp_scratch_free(&request);
+  lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+
+  return rc;
+}
@@ -13,6 +13,149 @@
 #include "lwgrp.h"
 #include "lwgrp_internal.h"
 
+/* allreduce for a group of any size that needs no fold step, each
+ * process runs a left-to-right and a right-to-left exclusive scan at
+ * once over the cached 2^d neighbors, so all ranks are busy in each
+ * of the ceil(log2(N)) rounds, then combines lower + mine + upper,
+ * which keeps operand order for non-commutative ops, but each rank
+ * groups the operands its own way, so only exact ops give the same
+ * bits on every rank, e.g.,
+ *
+ * For a five-task group, after three rounds rank 2 holds:
+ *   lower = (0+1), upper = (3+4), result = (0+1) + 2 + (3+4) */
+int lwgrp_logchain_allreduce_dissemination(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  MPI_Request request[4];
+  MPI_Status  status[4];
+
+  /* get chain info */
+  MPI_Comm comm = group->comm;
+  int ranks     = group->group_size;
+
+  /* copy our data into the receive buffer */
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &dt);
+  }
+
+  /* toright holds lower + mine and goes to the right,
+   * toleft holds mine + upper and goes to the left */
+  void* toright   = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* toleft    = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* fromleft  = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* fromright = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* lower     = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  void* upper     = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_memcpy(toright, recvbuf, count, &dt);
+  lwgrp_desc_dtbuf_memcpy(toleft,  recvbuf, count, &dt);
+
+  int have_lower = 0;
+  int have_upper = 0;
+
+  int index = 0;
+  int dist  = 1;
+  while (dist < ranks) {
+    /* get our partners dist hops away,
+     * lists end with MPI_PROC_NULL */
+    int left_rank  = MPI_PROC_NULL;
+    int right_rank = MPI_PROC_NULL;
+    if (index < list->left_size) {
+      left_rank = list->left_list[index];
+    }
+    if (index < list->right_size) {
+      right_rank = list->right_list[index];
+    }
+
+    /* exchange partial results with both partners at once */
+    int k = 0;
+    if (left_rank != MPI_PROC_NULL) {
+      MPI_Irecv(
+        fromleft, count, type, left_rank, group->tag,
+        comm, &request[k]
+      );
+      k++;
+      MPI_Isend(
+        toleft, count, type, left_rank, group->tag,
+        comm, &request[k]
+      );
+      k++;
+    }
+    if (right_rank != MPI_PROC_NULL) {
+      MPI_Irecv(
+        fromright, count, type, right_rank, group->tag,
+        comm, &request[k]
+      );
+      k++;
+      MPI_Isend(
+        toright, count, type, right_rank, group->tag,
+        comm, &request[k]
+      );
+      k++;
+    }
+    if (k > 0) {
+      MPI_Waitall(k, request, status);
+    }
+
+    /* data from the left is lower order than ours,
+     * so lower = fromleft + lower and toright = fromleft + toright */
+    if (left_rank != MPI_PROC_NULL) {
+      if (have_lower) {
+        lwgrp_reduce_local2(fromleft, toright, lower, count, type, op);
+      } else {
+        lwgrp_reduce_local(fromleft, toright, count, type, op);
+        void* tmp = lower;
+        lower = fromleft;
+        fromleft = tmp;
+        have_lower = 1;
+      }
+    }
+
+    /* data from the right is higher order than ours,
+     * so upper = upper + fromright and toleft = mine + upper */
+    if (right_rank != MPI_PROC_NULL) {
+      if (have_upper) {
+        lwgrp_reduce_local(upper, fromright, count, type, op);
+      }
+      void* tmp = upper;
+      upper = fromright;
+      fromright = tmp;
+      have_upper = 1;
+
+      lwgrp_desc_dtbuf_memcpy(toleft, upper, count, &dt);
+      lwgrp_reduce_local(recvbuf, toleft, count, type, op);
+    }
+
+    /* prepare for next iteration */
+    dist <<= 1;
+    index++;
+  }
+
+  /* toleft holds mine + upper, so add lower in front of it */
+  if (have_lower) {
+    lwgrp_reduce_local(lower, toleft, count, type, op);
+  }
+  lwgrp_desc_dtbuf_memcpy(recvbuf, toleft, count, &dt);
+
+  /* free our scratch space */
+  lwgrp_desc_dtbuf_free(&upper,     &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&lower,     &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&fromright, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&fromleft,  &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&toleft,    &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&toright,   &dt, __FILE__, __LINE__);
+
+  return LWGRP_SUCCESS;
+}
+
 int lwgrp_logchain_allreduce_recursive(
   const void* sendbuf,
   void* recvbuf,
@@ -22,6 +165,9 @@ int lwgrp_logchain_allreduce_recursive(
   const lwgrp_chain* group,
   const lwgrp_logchain* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we implement a recursive doubling algorithm, but we're careful
    * to do this to support non-commutative ops, basically we find the
    * largest power of two that is <= #ranks, then we assign the initial
@@ -46,17 +192,26 @@ int lwgrp_logchain_allreduce_recursive(
   int rank       = group->group_rank;
   int ranks      = group->group_size;
 
+  /* find largest power of two that fits within group_ranks */
+  int pow2, log2;
+  lwgrp_largest_pow2_log2_lte(ranks, &pow2, &log2);
+
+  /* an exact op gives the same bits in any grouping, so for those
+   * we can skip the fold and let every rank work in every round,
+   * anything else must form one result and hand it to every rank */
+  if (ranks != pow2 && lwgrp_op_exact(type, op)) {
+    return lwgrp_logchain_allreduce_dissemination(
+      sendbuf, recvbuf, count, type, op, group, list
+    );
+  }
+
   /* copy our data into the receive buffer */
   if (sendbuf != MPI_IN_PLACE) {
-    lwgrp_type_dtbuf_memcpy(recvbuf, sendbuf, count, type);
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &dt);
   }
 
   /* allocate buffer to receive partial results */
-  void* tempbuf = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
-
-  /* find largest power of two that fits within group_ranks */
-  int pow2, log2;
-  lwgrp_largest_pow2_log2_lte(ranks, &pow2, &log2);
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
 
   /* invoke power-of-two algorithm directly if we can */
   if (ranks == pow2) {
@@ -64,7 +219,7 @@ int lwgrp_logchain_allreduce_recursive(
     int rc = lwgrp_logchain_allreduce_recursive_pow2(recvbuf, tempbuf, count, type, op, group, list);
 
     /* free our scratch space */
-    lwgrp_type_dtbuf_free(&tempbuf, type, __FILE__, __LINE__);
+    lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
 
     return rc;
   }
@@ -102,17 +257,17 @@ int lwgrp_logchain_allreduce_recursive(
         if (rank & 0x1) {
           /* send reduce result to left */
           int left_rank = list->left_list[0];
-          MPI_Send(recvbuf, count, type, left_rank, LWGRP_MSG_TAG_0, comm);
+          MPI_Send(recvbuf, count, type, left_rank, group->tag, comm);
         } else {
           /* recv data from odd rank out on right */
           int right_rank = list->right_list[0];
-          MPI_Recv(tempbuf, count, type, right_rank, LWGRP_MSG_TAG_0, comm, status);
+          MPI_Recv(tempbuf, count, type, right_rank, group->tag, comm, status);
 
           /* we do things in a particular way here to ensure correct
            * results for non-commutative ops, since out = in + out and
            * the higher order data is in tempbuf */
-          MPI_Reduce_local(recvbuf, tempbuf, count, type, op);
-          lwgrp_type_dtbuf_memcpy(recvbuf, tempbuf, count, type);
+          lwgrp_reduce_local(recvbuf, tempbuf, count, type, op);
+          lwgrp_desc_dtbuf_memcpy(recvbuf, tempbuf, count, &dt);
         }
       }
 
@@ -139,6 +294,7 @@ int lwgrp_logchain_allreduce_recursive(
     new_group.comm_right = new_right;
     new_group.group_rank = new_rank;
     new_group.group_size = pow2;
+    new_group.tag        = group->tag;
     pow2_group = &new_group;
   }
 
@@ -152,16 +308,16 @@ int lwgrp_logchain_allreduce_recursive(
       if (rank & 0x1) {
         /* recv result from left rank */
         int left_rank = list->left_list[0];
-        MPI_Recv(recvbuf, count, type, left_rank, LWGRP_MSG_TAG_0, comm, status);
+        MPI_Recv(recvbuf, count, type, left_rank, group->tag, comm, status);
       } else {
         /* send result to right rank */
         int right_rank = list->right_list[0];
-        MPI_Send(recvbuf, count, type, right_rank, LWGRP_MSG_TAG_0, comm);
+        MPI_Send(recvbuf, count, type, right_rank, group->tag, comm);
       }
   }
 
   /* free our scratch space */
-  lwgrp_type_dtbuf_free(&tempbuf, type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
 
   return LWGRP_SUCCESS;
 }
@@ -178,6 +334,9 @@ int lwgrp_logchain_allreduce_recursive_pow2(
   const lwgrp_chain* group,
   const lwgrp_logchain* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* we use a recurisve doubling algorithm */
   MPI_Request request[4];
   MPI_Status  status[4];
@@ -203,20 +362,20 @@ int lwgrp_logchain_allreduce_recursive_pow2(
 
     /* exchange data with partner */
     MPI_Sendrecv(
-      resultbuf,  count, type, partner, LWGRP_MSG_TAG_0,
-      scratchbuf, count, type, partner, LWGRP_MSG_TAG_0,
+      resultbuf,  count, type, partner, group->tag,
+      scratchbuf, count, type, partner, group->tag,
       comm, status
     );
 
     /* reduce data (being careful about non-commutative ops) */
     if (exchange_rank < rank) {
       /* higher order data is in resultbuf, so resultbuf = scratchbuf + resultbuf */
-      MPI_Reduce_local(scratchbuf, resultbuf, count, type, op);
+      lwgrp_reduce_local(scratchbuf, resultbuf, count, type, op);
     } else {
       /* higher order data is in scratchbuf, so scratchbuf = resultbuf + scratchbuf,
        * then copy result back to resultbuf for sending in next round */
-      MPI_Reduce_local(resultbuf, scratchbuf, count, type, op);
-      lwgrp_type_dtbuf_memcpy(resultbuf, scratchbuf, count, type);
+      lwgrp_reduce_local(resultbuf, scratchbuf, count, type, op);
+      lwgrp_desc_dtbuf_memcpy(resultbuf, scratchbuf, count, &dt);
     }
 
     /* prepare for next iteration */
@@ -227,6 +386,371 @@ int lwgrp_logchain_allreduce_recursive_pow2(
   return LWGRP_SUCCESS;
 }
 
+/* Rabenseifner's allreduce for commutative ops, a recursive-halving
+ * reduce-scatter followed by a recursive-doubling allgather, so that
+ * each process sends and receives about 2*count elements in total
+ * rather than count*log(N), use this for large messages,
+ *
+ * for a non-power-of-two group, each rank r >= pow2 first folds its
+ * data into rank r-pow2, which is exactly pow2 hops to its left, and
+ * gets the result back at the end, this reorders contributions so
+ * the op must be commutative */
+int lwgrp_logchain_allreduce_rabenseifner(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  MPI_Status status[2];
+
+  /* get chain info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* copy our data into the receive buffer */
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &dt);
+  }
+
+  /* nothing to do for a group of one */
+  if (ranks < 2) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* find largest power of two that fits within group */
+  int pow2, log2;
+  lwgrp_largest_pow2_log2_lte(ranks, &pow2, &log2);
+
+  /* ranks beyond pow2 hand their data off to a partner in the
+   * power-of-two group and wait for the result */
+  if (rank >= pow2) {
+    int partner = list->left_list[log2];
+    MPI_Send(recvbuf, count, type, partner, group->tag, comm);
+    MPI_Recv(recvbuf, count, type, partner, group->tag, comm, status);
+    return LWGRP_SUCCESS;
+  }
+
+  /* allocate buffer to receive partial results */
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
+
+  /* fold in data from our partner beyond pow2 if we have one */
+  int extra = ranks - pow2;
+  if (rank < extra) {
+    int partner = list->right_list[log2];
+    MPI_Recv(tempbuf, count, type, partner, group->tag, comm, status);
+    lwgrp_reduce_local(tempbuf, recvbuf, count, type, op);
+  }
+
+  /* reduce-scatter by recursive halving, we split the buffer into pow2
+   * blocks and track the range of blocks [lo,hi) we are responsible
+   * for, each step we exchange half of our range with our partner,
+   * keeping the half on our side of the partner */
+  int lo = 0;
+  int hi = pow2;
+  int mask  = pow2 >> 1;
+  int index = log2 - 1;
+  while (mask > 0) {
+    /* get address of our partner */
+    int partner;
+    int exchange_rank = rank ^ mask;
+    if (exchange_rank < rank) {
+      partner = list->left_list[index];
+    } else {
+      partner = list->right_list[index];
+    }
+
+    /* determine which half of our range we keep and which we send */
+    int mid = lo + (hi - lo) / 2;
+    int keep_lo, keep_hi, send_lo, send_hi;
+    if (rank & mask) {
+      keep_lo = mid; keep_hi = hi;
+      send_lo = lo;  send_hi = mid;
+    } else {
+      keep_lo = lo;  keep_hi = mid;
+      send_lo = mid; send_hi = hi;
+    }
+
+    /* compute offsets and counts in elements, blocks are contiguous */
+    int keep_off, send_off, size, last;
+    lwgrp_block_range(count, pow2, keep_lo, &keep_off, &size);
+    lwgrp_block_range(count, pow2, keep_hi - 1, &last, &size);
+    int keep_count = last + size - keep_off;
+    lwgrp_block_range(count, pow2, send_lo, &send_off, &size);
+    lwgrp_block_range(count, pow2, send_hi - 1, &last, &size);
+    int send_count = last + size - send_off;
+
+    /* exchange halves with partner */
+    void* keep_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, keep_off, &dt);
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, send_off, &dt);
+    MPI_Sendrecv(
+      send_ptr, send_count, type, partner, group->tag,
+      tempbuf,  keep_count, type, partner, group->tag,
+      comm, status
+    );
+
+    /* reduce partner's data into the half we keep */
+    if (keep_count > 0) {
+      lwgrp_reduce_local(tempbuf, keep_ptr, keep_count, type, op);
+    }
+
+    /* prepare for next iteration */
+    lo = keep_lo;
+    hi = keep_hi;
+    mask >>= 1;
+    index--;
+  }
+
+  /* allgather by recursive doubling, reversing the steps above,
+   * each step we send our range and receive our partner's range,
+   * which sits right next to ours */
+  mask  = 1;
+  index = 0;
+  while (mask < pow2) {
+    /* get address of our partner */
+    int partner;
+    int exchange_rank = rank ^ mask;
+    if (exchange_rank < rank) {
+      partner = list->left_list[index];
+    } else {
+      partner = list->right_list[index];
+    }
+
+    /* partner's range has the same number of blocks as ours */
+    int width = hi - lo;
+    int recv_lo = (rank & mask) ? lo - width : hi;
+    int recv_hi = recv_lo + width;
+
+    int my_off, recv_off, size, last;
+    lwgrp_block_range(count, pow2, lo, &my_off, &size);
+    lwgrp_block_range(count, pow2, hi - 1, &last, &size);
+    int my_count = last + size - my_off;
+    lwgrp_block_range(count, pow2, recv_lo, &recv_off, &size);
+    lwgrp_block_range(count, pow2, recv_hi - 1, &last, &size);
+    int recv_count = last + size - recv_off;
+
+    /* exchange ranges with partner directly in the result buffer */
+    void* my_ptr   = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, my_off, &dt);
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, recv_off, &dt);
+    MPI_Sendrecv(
+      my_ptr,   my_count,   type, partner, group->tag,
+      recv_ptr, recv_count, type, partner, group->tag,
+      comm, status
+    );
+
+    /* merge ranges for next step */
+    if (recv_lo < lo) {
+      lo = recv_lo;
+    } else {
+      hi = recv_hi;
+    }
+    mask <<= 1;
+    index++;
+  }
+
+  /* send result to our partner beyond pow2 */
+  if (rank < extra) {
+    int partner = list->right_list[log2];
+    MPI_Send(recvbuf, count, type, partner, group->tag, comm);
+  }
+
+  /* free our scratch space */
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
+
+  return LWGRP_SUCCESS;
+}
+
+/* reduce-scatter by recursive halving for commutative ops, as in the
+ * first half of lwgrp_logchain_allreduce_rabenseifner each step we
+ * exchange half of our range of blocks with our partner, after log(N)
+ * steps the range of rank i in the power-of-two group is block i,
+ *
+ * for a non-power-of-two group, each rank r >= pow2 folds its data
+ * into rank r-pow2 as in rabenseifner and gets back block r at the end,
+ * so rank i < pow2 stands in for blocks i and i+pow2, we first lay the
+ * blocks out in that order so each range of ranks covers a contiguous
+ * range of elements */
+int lwgrp_logchain_reduce_scatter_halving(
+  const void* sendbuf,
+  void* recvbuf,
+  const int counts[],
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  MPI_Status status[2];
+
+  /* get chain info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* with MPI_IN_PLACE, the input is in the receive buffer */
+  const void* inbuf = sendbuf;
+  if (sendbuf == MPI_IN_PLACE) {
+    inbuf = recvbuf;
+  }
+
+  /* nothing to do for a group of one */
+  if (ranks < 2) {
+    if (ranks == 1 && inbuf != recvbuf) {
+      lwgrp_desc_dtbuf_memcpy(recvbuf, inbuf, counts[0], &dt);
+    }
+    return LWGRP_SUCCESS;
+  }
+
+  /* find largest power of two that fits within group */
+  int pow2, log2;
+  lwgrp_largest_pow2_log2_lte(ranks, &pow2, &log2);
+  int extra = ranks - pow2;
+
+  /* compute the offset of each block in the input, and the offset of
+   * each range in our reordered buffer, vdispls[i] for i < pow2 is
+   * where the blocks of rank i start, followed by those of i+pow2 */
+  int* displs  = (int*) lwgrp_scratch_alloc(
+    ranks * sizeof(int), __FILE__, __LINE__
+  );
+  int* vdispls = (int*) lwgrp_scratch_alloc(
+    (pow2 + 1) * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  int total = 0;
+  for (i = 0; i < ranks; i++) {
+    displs[i] = total;
+    total += counts[i];
+  }
+  int voffset = 0;
+  for (i = 0; i < pow2; i++) {
+    vdispls[i] = voffset;
+    voffset += counts[i];
+    if (i < extra) {
+      voffset += counts[i + pow2];
+    }
+  }
+  vdispls[pow2] = voffset;
+
+  /* copy the input blocks in that order */
+  void* workbuf = lwgrp_desc_dtbuf_alloc(total, &dt, __FILE__, __LINE__);
+  for (i = 0; i < pow2; i++) {
+    void* dst = lwgrp_desc_dtbuf_from_dtbuf(workbuf, vdispls[i], &dt);
+    const void* src = lwgrp_desc_dtbuf_from_dtbuf(inbuf, displs[i], &dt);
+    lwgrp_desc_dtbuf_memcpy(dst, src, counts[i], &dt);
+    if (i < extra) {
+      dst = lwgrp_desc_dtbuf_from_dtbuf(workbuf, vdispls[i] + counts[i], &dt);
+      src = lwgrp_desc_dtbuf_from_dtbuf(inbuf, displs[i + pow2], &dt);
+      lwgrp_desc_dtbuf_memcpy(dst, src, counts[i + pow2], &dt);
+    }
+  }
+
+  /* ranks beyond pow2 hand their data off to a partner in the
+   * power-of-two group and wait for their block */
+  if (rank >= pow2) {
+    int partner = list->left_list[log2];
+    MPI_Send(workbuf, total, type, partner, group->tag, comm);
+    MPI_Recv(recvbuf, counts[rank], type, partner, group->tag, comm, status);
+    lwgrp_desc_dtbuf_free(&workbuf, &dt, __FILE__, __LINE__);
+    lwgrp_scratch_free(&vdispls);
+    lwgrp_scratch_free(&displs);
+    return LWGRP_SUCCESS;
+  }
+
+  /* allocate buffer to receive partial results, we receive the whole
+   * buffer from a partner beyond pow2, and at most half of it after */
+  int temp_count = (rank < extra) ? total : total - vdispls[pow2 / 2];
+  if (temp_count < vdispls[pow2 / 2]) {
+    temp_count = vdispls[pow2 / 2];
+  }
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(temp_count, &dt, __FILE__, __LINE__);
+
+  /* fold in data from our partner beyond pow2 if we have one */
+  if (rank < extra) {
+    int partner = list->right_list[log2];
+    MPI_Recv(tempbuf, total, type, partner, group->tag, comm, status);
+    lwgrp_reduce_local(tempbuf, workbuf, total, type, op);
+  }
+
+  /* reduce-scatter by recursive halving over our range [lo,hi) */
+  int lo = 0;
+  int hi = pow2;
+  int mask  = pow2 >> 1;
+  int index = log2 - 1;
+  while (mask > 0) {
+    /* get address of our partner */
+    int partner;
+    int exchange_rank = rank ^ mask;
+    if (exchange_rank < rank) {
+      partner = list->left_list[index];
+    } else {
+      partner = list->right_list[index];
+    }
+
+    /* determine which half of our range we keep and which we send */
+    int mid = lo + (hi - lo) / 2;
+    int keep_lo, keep_hi, send_lo, send_hi;
+    if (rank & mask) {
+      keep_lo = mid; keep_hi = hi;
+      send_lo = lo;  send_hi = mid;
+    } else {
+      keep_lo = lo;  keep_hi = mid;
+      send_lo = mid; send_hi = hi;
+    }
+    int keep_off   = vdispls[keep_lo];
+    int keep_count = vdispls[keep_hi] - keep_off;
+    int send_off   = vdispls[send_lo];
+    int send_count = vdispls[send_hi] - send_off;
+
+    /* exchange halves with partner */
+    void* keep_ptr = lwgrp_desc_dtbuf_from_dtbuf(workbuf, keep_off, &dt);
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(workbuf, send_off, &dt);
+    MPI_Sendrecv(
+      send_ptr, send_count, type, partner, group->tag,
+      tempbuf,  keep_count, type, partner, group->tag,
+      comm, status
+    );
+
+    /* reduce partner's data into the half we keep */
+    if (keep_count > 0) {
+      lwgrp_reduce_local(tempbuf, keep_ptr, keep_count, type, op);
+    }
+
+    /* prepare for next iteration */
+    lo = keep_lo;
+    hi = keep_hi;
+    mask >>= 1;
+    index--;
+  }
+
+  /* our range now holds our block, followed by that of our partner
+   * beyond pow2 if we have one */
+  void* result = lwgrp_desc_dtbuf_from_dtbuf(workbuf, vdispls[rank], &dt);
+  lwgrp_desc_dtbuf_memcpy(recvbuf, result, counts[rank], &dt);
+  if (rank < extra) {
+    int partner = list->right_list[log2];
+    void* extra_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+      workbuf, vdispls[rank] + counts[rank], &dt
+    );
+    MPI_Send(extra_ptr, counts[rank + pow2], type, partner, group->tag, comm);
+  }
+
+  /* free our scratch space */
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&workbuf, &dt, __FILE__, __LINE__);
+  lwgrp_scratch_free(&vdispls);
+  lwgrp_scratch_free(&displs);
+
+  return LWGRP_SUCCESS;
+}
+
 int lwgrp_logchain_reduce_recursive(
   const void* sendbuf,
   void* recvbuf,
@@ -237,10 +761,13 @@ int lwgrp_logchain_reduce_recursive(
   const lwgrp_chain* group,
   const lwgrp_logchain* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   /* TODO: actually implement a reduce rather than borrowing allreduce */
 
   /* allocate buffer to receive partial results */
-  void* buf = lwgrp_type_dtbuf_alloc(count, type, __FILE__, __LINE__);
+  void* buf = lwgrp_desc_dtbuf_alloc(count, &dt, __FILE__, __LINE__);
 
   /* if we're the root, use the recvbuf,
    * otherwise use the temporary buffer */
@@ -258,7 +785,7 @@ int lwgrp_logchain_reduce_recursive(
   );
 
   /* free our scratch space */
-  lwgrp_type_dtbuf_free(&buf, type, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&buf, &dt, __FILE__, __LINE__);
 
   return rc; 
 }
@@ -39,8 +39,8 @@ int lwgrp_logring_barrier_dissemination(
     /* send empty messages as a signal */
     MPI_Status status[2];
     MPI_Sendrecv(
-      NULL, 0, MPI_BYTE, dst, LWGRP_MSG_TAG_0,
-      NULL, 0, MPI_BYTE, src, LWGRP_MSG_TAG_0,
+      NULL, 0, MPI_BYTE, dst, group->tag,
+      NULL, 0, MPI_BYTE, src, group->tag,
       comm, status
     );
 
@@ -92,7 +92,7 @@ int lwgrp_logring_bcast_binomial(
         MPI_Status status;
         int src = list->left_list[log2];
         MPI_Recv(
-          buffer, count, datatype, src, LWGRP_MSG_TAG_0,
+          buffer, count, datatype, src, group->tag,
           comm, &status
         );
         received = 1;
@@ -107,7 +107,7 @@ int lwgrp_logring_bcast_binomial(
       if (treerank + pow2 < ranks) {
         int dst = list->right_list[log2];
         MPI_Send(
-          buffer, count, datatype, dst, LWGRP_MSG_TAG_0, comm
+          buffer, count, datatype, dst, group->tag, comm
         );
       }
     }
@@ -120,6 +120,131 @@ int lwgrp_logring_bcast_binomial(
   return rc;
 }
 
+/* Mike Barnett, Lance Shuler, Robert van de Geijn, Satya Gupta,
+ * David Payne, and Jerrell Watts, "Interprocessor collective
+ * communication library (InterCom)", Proceedings of the Scalable
+ * High Performance Computing Conference, 1994
+ *
+ * splits the buffer into one block per process, scatters the blocks
+ * down the same binomial tree as lwgrp_logring_bcast_binomial, and
+ * then runs a ring allgather to collect all blocks on all procs,
+ * each proc sends about twice the buffer size in total rather than
+ * log(N) times the buffer size, so use this for large messages */
+int lwgrp_logring_bcast_scatter_allgather(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm  = group->comm;
+  int rank       = group->group_rank;
+  int ranks      = group->group_size;
+
+  /* adjust our rank by setting the root to be rank 0,
+   * block i of the buffer belongs to the proc with treerank i */
+  int treerank = rank - root;
+  if (treerank < 0) {
+    treerank += ranks;
+  }
+
+  /* get largest power-of-two strictly less than ranks */
+  int pow2, log2;
+  lwgrp_largest_pow2_log2_lessthan(ranks, &pow2, &log2);
+
+  /* scatter through binomial tree, when we receive at step pow2 we
+   * get blocks for the subtree [treerank, treerank+pow2), and when we
+   * send at step pow2 we send blocks [treerank+pow2, treerank+2*pow2) */
+  int parent = 0;
+  int received = (rank == root) ? 1 : 0;
+  while (pow2 > 0) {
+    if (! received) {
+      /* see if the parent for this step will send to us */
+      int target = parent + pow2;
+      if (treerank == target) {
+        /* we're the target, receive blocks for our subtree */
+        int end = treerank + pow2;
+        if (end > ranks) {
+          end = ranks;
+        }
+        int offset, size, last;
+        lwgrp_block_range(count, ranks, treerank, &offset, &size);
+        lwgrp_block_range(count, ranks, end - 1, &last, &size);
+        int num = last + size - offset;
+
+        MPI_Status status;
+        int src = list->left_list[log2];
+        void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buffer, offset, &dt);
+        MPI_Recv(
+          ptr, num, datatype, src, group->tag,
+          comm, &status
+        );
+        received = 1;
+      } else if (treerank > target) {
+        /* if we are in the top half of the subtree set our new
+         * potential parent */
+        parent = target;
+      }
+    } else {
+      /* we have our blocks, so if we have a child, send its blocks */
+      int child = treerank + pow2;
+      if (child < ranks) {
+        int end = child + pow2;
+        if (end > ranks) {
+          end = ranks;
+        }
+        int offset, size, last;
+        lwgrp_block_range(count, ranks, child, &offset, &size);
+        lwgrp_block_range(count, ranks, end - 1, &last, &size);
+        int num = last + size - offset;
+
+        int dst = list->right_list[log2];
+        void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buffer, offset, &dt);
+        MPI_Send(
+          ptr, num, datatype, dst, group->tag, comm
+        );
+      }
+    }
+
+    /* cut the step size in half and keep going */
+    log2--;
+    pow2 >>= 1;
+  }
+
+  /* ring allgather, our left neighbor has treerank one less than ours,
+   * so in step i we send block (treerank - i) to the right and receive
+   * block (treerank - i - 1) from the left */
+  int left  = group->comm_left;
+  int right = group->comm_right;
+  int i;
+  for (i = 0; i < ranks - 1; i++) {
+    int send_block = (treerank - i + ranks) % ranks;
+    int recv_block = (treerank - i - 1 + ranks) % ranks;
+
+    int send_offset, send_count, recv_offset, recv_count;
+    lwgrp_block_range(count, ranks, send_block, &send_offset, &send_count);
+    lwgrp_block_range(count, ranks, recv_block, &recv_offset, &recv_count);
+
+    MPI_Status status[2];
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(buffer, send_offset, &dt);
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(buffer, recv_offset, &dt);
+    MPI_Sendrecv(
+      send_ptr, send_count, datatype, right, group->tag,
+      recv_ptr, recv_count, datatype, left,  group->tag,
+      comm, status
+    );
+  }
+
+  return rc;
+}
+
 /* Jehoshua Bruck, Ching-Tien Ho, Shlomo Kipnis, Eli Upfal,
  * and Derrick Weathersby, "Efficient algorithms for
  * all-to-all communications in multiport message-passing systems",
@@ -134,27 +259,30 @@ int lwgrp_logring_gather_brucks(
   const lwgrp_ring* group,
   const lwgrp_logring* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
   int rc = LWGRP_SUCCESS;
 
   /* get ring info */
   int rank  = group->group_rank;
   int ranks = group->group_size;
 
-  /* TODO: need to allocate for true extent here since the
-   * datatype may not be tileable on the non-root procs */
+  /* the temporary buffer is sized by true extent, so a type
+   * whose extent is smaller than its data still fits */
 
-  /* allocate a temporary receive buffer */
-  size_t total_elems = num * ranks;
-  void* tmpbuf = lwgrp_type_dtbuf_alloc(
-    total_elems, datatype, __FILE__, __LINE__
-  );
-
-  /* if we're the root, use recvbuf, otherwise use temporary */
+  /* if we're the root, use recvbuf, otherwise use a temporary
+   * receive buffer */
+  void* tmpbuf = NULL;
   char* buf;
   if (rank == root) {
-    buf = tmpbuf;
-  } else {
     buf = recvbuf;
+  } else {
+    size_t total_elems = num * ranks;
+    tmpbuf = lwgrp_desc_dtbuf_alloc(
+      total_elems, &dt, __FILE__, __LINE__
+    );
+    buf = tmpbuf;
   }
 
   /* delegate work to allgather */
@@ -164,7 +292,275 @@ int lwgrp_logring_gather_brucks(
   );
 
   /* free temporary memory */
-  lwgrp_type_dtbuf_free(&tmpbuf, datatype, __FILE__, __LINE__);
+  if (tmpbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+  }
+
+  return rc;
+}
+
+/* binomial tree gather, we number procs by their distance to the
+ * right of the root (treerank), so that the subtree of the proc with
+ * treerank t is [t, t + lowbit(t)), where lowbit(t) is the lowest set
+ * bit of t, a proc receives the subtrees of its children in order of
+ * size, which it stores next to its own item, and then sends its
+ * whole subtree to its parent at t - lowbit(t),
+ *
+ * each proc only buffers items for its own subtree, leaves send
+ * straight from sendbuf, and a root of rank 0 receives directly into
+ * recvbuf, any other root needs a temporary buffer to rotate items
+ * from treerank order to group rank order */
+int lwgrp_logring_gather_binomial(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* adjust our rank by setting the root to be rank 0 */
+  int treerank = rank - root;
+  if (treerank < 0) {
+    treerank += ranks;
+  }
+
+  /* find the size of our subtree, and the distance to our parent */
+  int lowbit = 1;
+  int lowlog = 0;
+  if (treerank == 0) {
+    while (lowbit < ranks) {
+      lowbit <<= 1;
+      lowlog++;
+    }
+  } else {
+    while (! (treerank & lowbit)) {
+      lowbit <<= 1;
+      lowlog++;
+    }
+  }
+  int subtree = ranks - treerank;
+  if (subtree > lowbit) {
+    subtree = lowbit;
+  }
+
+  /* get the address of our input data */
+  const void* inbuf = sendbuf;
+#if MPI_VERSION >= 2
+  if (sendbuf == MPI_IN_PLACE) {
+    inbuf = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, num * rank, &dt);
+  }
+#endif
+
+  /* if we have no children, just send our data to our parent */
+  if (subtree == 1) {
+    if (treerank > 0) {
+      int parent = list->left_list[lowlog];
+      MPI_Send(
+        (void*)inbuf, num, datatype, parent, group->tag, comm
+      );
+    } else if (inbuf != recvbuf) {
+      /* we're the root of a group of one */
+      lwgrp_desc_dtbuf_memcpy(recvbuf, inbuf, num, &dt);
+    }
+    return rc;
+  }
+
+  /* pick a buffer to collect our subtree into */
+  void* tmpbuf = NULL;
+  void* buf = recvbuf;
+  if (treerank != 0 || root != 0) {
+    tmpbuf = lwgrp_desc_dtbuf_alloc(num * subtree, &dt, __FILE__, __LINE__);
+    buf = tmpbuf;
+  }
+
+  /* copy our own item to the front */
+  if (inbuf != buf) {
+    lwgrp_desc_dtbuf_memcpy(buf, inbuf, num, &dt);
+  }
+
+  /* receive subtrees from our children, smallest first */
+  int mask  = 1;
+  int index = 0;
+  while (mask < subtree) {
+    /* our child at treerank + mask has a subtree of at most mask items */
+    int count = subtree - mask;
+    if (count > mask) {
+      count = mask;
+    }
+    MPI_Status status;
+    int child = list->right_list[index];
+    void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buf, num * mask, &dt);
+    MPI_Recv(
+      ptr, num * count, datatype, child, group->tag, comm, &status
+    );
+
+    mask <<= 1;
+    index++;
+  }
+
+  if (treerank > 0) {
+    /* forward our subtree to our parent */
+    int parent = list->left_list[lowlog];
+    MPI_Send(
+      buf, num * subtree, datatype, parent, group->tag, comm
+    );
+  } else if (buf != recvbuf) {
+    /* we're the root, item for treerank t belongs to rank root + t,
+     * so rotate items into rank order */
+    int num_post = num * (ranks - root);
+    int num_pre  = num * root;
+    void* recv_post = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, num_pre, &dt);
+    void* buf_pre   = lwgrp_desc_dtbuf_from_dtbuf(buf, num_post, &dt);
+    lwgrp_desc_dtbuf_memcpy(recv_post, buf, num_post, &dt);
+    lwgrp_desc_dtbuf_memcpy(recvbuf, buf_pre, num_pre, &dt);
+  }
+
+  /* free temporary memory */
+  if (tmpbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+  }
+
+  return rc;
+}
+
+/* binomial tree scatter, the reverse of lwgrp_logring_gather_binomial,
+ * each proc receives the items for its subtree from its parent and
+ * forwards the items of each child subtree, largest first, leaves
+ * receive straight into recvbuf, and a root of rank 0 sends directly
+ * from sendbuf */
+int lwgrp_logring_scatter_binomial(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* adjust our rank by setting the root to be rank 0 */
+  int treerank = rank - root;
+  if (treerank < 0) {
+    treerank += ranks;
+  }
+
+  /* find the size of our subtree, and the distance to our parent */
+  int lowbit = 1;
+  int lowlog = 0;
+  if (treerank == 0) {
+    while (lowbit < ranks) {
+      lowbit <<= 1;
+      lowlog++;
+    }
+  } else {
+    while (! (treerank & lowbit)) {
+      lowbit <<= 1;
+      lowlog++;
+    }
+  }
+  int subtree = ranks - treerank;
+  if (subtree > lowbit) {
+    subtree = lowbit;
+  }
+
+  /* get the address of our output buffer, with MPI_IN_PLACE the
+   * root leaves its own item in sendbuf */
+  void* outbuf = recvbuf;
+#if MPI_VERSION >= 2
+  if (recvbuf == MPI_IN_PLACE) {
+    outbuf = lwgrp_desc_dtbuf_from_dtbuf(sendbuf, num * rank, &dt);
+  }
+#endif
+
+  /* if we have no children, just receive our data from our parent */
+  if (subtree == 1) {
+    if (treerank > 0) {
+      MPI_Status status;
+      int parent = list->left_list[lowlog];
+      MPI_Recv(
+        outbuf, num, datatype, parent, group->tag, comm, &status
+      );
+    } else if (outbuf != sendbuf) {
+      /* we're the root of a group of one */
+      lwgrp_desc_dtbuf_memcpy(outbuf, sendbuf, num, &dt);
+    }
+    return rc;
+  }
+
+  /* get the items for our subtree in treerank order */
+  void* tmpbuf = NULL;
+  const void* buf = sendbuf;
+  if (treerank > 0) {
+    /* receive our subtree from our parent */
+    tmpbuf = lwgrp_desc_dtbuf_alloc(num * subtree, &dt, __FILE__, __LINE__);
+    MPI_Status status;
+    int parent = list->left_list[lowlog];
+    MPI_Recv(
+      tmpbuf, num * subtree, datatype, parent, group->tag, comm, &status
+    );
+    buf = tmpbuf;
+  } else if (root != 0) {
+    /* we're the root, rotate items into treerank order */
+    tmpbuf = lwgrp_desc_dtbuf_alloc(num * ranks, &dt, __FILE__, __LINE__);
+    int num_post = num * (ranks - root);
+    int num_pre  = num * root;
+    void* send_post = lwgrp_desc_dtbuf_from_dtbuf(sendbuf, num_pre, &dt);
+    void* tmp_pre   = lwgrp_desc_dtbuf_from_dtbuf(tmpbuf, num_post, &dt);
+    lwgrp_desc_dtbuf_memcpy(tmpbuf, send_post, num_post, &dt);
+    lwgrp_desc_dtbuf_memcpy(tmp_pre, sendbuf, num_pre, &dt);
+    buf = tmpbuf;
+  }
+
+  /* send subtrees to our children, largest first */
+  int mask  = lowbit >> 1;
+  int index = lowlog - 1;
+  while (mask > 0) {
+    /* our child at treerank + mask has a subtree of at most mask items */
+    int count = subtree - mask;
+    if (count > mask) {
+      count = mask;
+    }
+    if (count > 0) {
+      int child = list->right_list[index];
+      void* ptr = lwgrp_desc_dtbuf_from_dtbuf(buf, num * mask, &dt);
+      MPI_Send(
+        ptr, num * count, datatype, child, group->tag, comm
+      );
+    }
+
+    mask >>= 1;
+    index--;
+  }
+
+  /* copy out our own item */
+  if (outbuf != buf) {
+    lwgrp_desc_dtbuf_memcpy(outbuf, buf, num, &dt);
+  }
+
+  /* free temporary memory */
+  if (tmpbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+  }
 
   return rc;
 }
@@ -178,6 +574,9 @@ int lwgrp_logring_allgather_brucks(
   const lwgrp_ring* group,
   const lwgrp_logring* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
   int rc = LWGRP_SUCCESS;
 
   /* get ring info */
@@ -187,20 +586,20 @@ int lwgrp_logring_allgather_brucks(
 
   /* allocate temporary buffer */
   size_t total_elems = num * ranks;
-  void* tmpbuf = lwgrp_type_dtbuf_alloc(
-    total_elems, datatype, __FILE__, __LINE__
+  void* tmpbuf = lwgrp_desc_dtbuf_alloc(
+    total_elems, &dt, __FILE__, __LINE__
   );
 
   /* copy our own data into the temporary buffer */
   const void* inputbuf = sendbuf;
 #if MPI_VERSION >= 2
   if (sendbuf == MPI_IN_PLACE) {
-    inputbuf = (const void*) lwgrp_type_dtbuf_from_dtbuf(
-      recvbuf, num * rank, datatype
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, num * rank, &dt
     );
   }
 #endif
-  lwgrp_type_dtbuf_memcpy(tmpbuf, inputbuf, num, datatype);
+  lwgrp_desc_dtbuf_memcpy(tmpbuf, inputbuf, num, &dt);
 
   /* execute the allgather operation */
   MPI_Request request[2];
@@ -222,17 +621,17 @@ int lwgrp_logring_allgather_brucks(
     int num_exchange = num * ranks_incoming;
 
     /* receive data from source */
-    void* recv_pos = lwgrp_type_dtbuf_from_dtbuf(
-      tmpbuf, ranks_received * num, datatype
+    void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(
+      tmpbuf, ranks_received * num, &dt
     );
     MPI_Irecv(
-      recv_pos, num_exchange, datatype, src, LWGRP_MSG_TAG_0,
+      recv_pos, num_exchange, datatype, src, group->tag,
       comm, &request[0]
     ); 
 
     /* send the data to destination */
     MPI_Isend(
-      tmpbuf, num_exchange, datatype, dst, LWGRP_MSG_TAG_0,
+      tmpbuf, num_exchange, datatype, dst, group->tag,
       comm, &request[1]
     );
 
@@ -250,17 +649,17 @@ int lwgrp_logring_allgather_brucks(
   /* shift our data back to the proper position in receive buffer */
   int num_pre  = num * rank;
   int num_post = num * (ranks - rank);
-  void* buf_pre  = lwgrp_type_dtbuf_from_dtbuf(
-    recvbuf, num_pre, datatype
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(
+    recvbuf, num_pre, &dt
   );
-  void* buf_post = lwgrp_type_dtbuf_from_dtbuf(
-    tmpbuf, num_post, datatype
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(
+    tmpbuf, num_post, &dt
   );
-  lwgrp_type_dtbuf_memcpy(buf_pre, tmpbuf,  num_post, datatype);
-  lwgrp_type_dtbuf_memcpy(recvbuf, buf_post, num_pre, datatype);
+  lwgrp_desc_dtbuf_memcpy(buf_pre, tmpbuf,  num_post, &dt);
+  lwgrp_desc_dtbuf_memcpy(recvbuf, buf_post, num_pre, &dt);
 
   /* free the temporary buffer */
-  lwgrp_type_dtbuf_free(&tmpbuf, datatype, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
 
   return rc;
 }
@@ -274,6 +673,9 @@ int lwgrp_logring_allgatherv_brucks(
   const lwgrp_ring* group,
   const lwgrp_logring* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
   int i;
   int rc = LWGRP_SUCCESS;
 
@@ -285,30 +687,27 @@ int lwgrp_logring_allgatherv_brucks(
 
   /* total up number of items */
   int sum = 0;
-  int prefix_sum = 0;
   for (i = 0; i < ranks; i++) {
     sum += counts[i];
-    if (i < rank) {
-      prefix_sum += counts[i];
-    }
   }
 
   /* free some temporary space to work with */
-  void* tmpbuf = lwgrp_type_dtbuf_alloc(
-    sum, datatype, __FILE__, __LINE__
+  void* tmpbuf = lwgrp_desc_dtbuf_alloc(
+    sum, &dt, __FILE__, __LINE__
   );
 
-  /* copy our own data into the temporary buffer */
+  /* copy our own data into the temporary buffer, which holds the
+   * data of ranks rank, rank+1, ... in order, wrapping at the end */
   int num = counts[rank];
   const void* inputbuf = sendbuf;
 #if MPI_VERSION >= 2
   if (sendbuf == MPI_IN_PLACE) {
-    inputbuf = (const void*) lwgrp_type_dtbuf_from_dtbuf(
-      recvbuf, prefix_sum, datatype
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, displs[rank], &dt
     );
   }
 #endif
-  lwgrp_type_dtbuf_memcpy(tmpbuf, inputbuf, num, datatype);
+  lwgrp_desc_dtbuf_memcpy(tmpbuf, inputbuf, num, &dt);
 
   /* execute the allgather operation */
   MPI_Request request[2];
@@ -323,32 +722,31 @@ int lwgrp_logring_allgatherv_brucks(
     int dst = list->left_list[index];
 
     /* determine number of elements we'll be sending and receiving in
-     * this round */
+     * this round, we send the data of the first ranks_incoming ranks
+     * we hold, and receive that of the ranks that follow them */
     int ranks_incoming = step;
     if (ranks_received + ranks_incoming > ranks) {
       ranks_incoming = ranks - ranks_received;
     }
+    int num_outgoing = 0;
     int num_incoming = 0;
-    for (i = rank + 1; i < rank + 1 + step; i++) {
-      int index = i;
-      if (i >= ranks) {
-        index -= ranks;
-      }
-      num_incoming += counts[index];
+    for (i = 0; i < ranks_incoming; i++) {
+      num_outgoing += counts[(rank + i) % ranks];
+      num_incoming += counts[(rank + ranks_received + i) % ranks];
     }
 
     /* receive data from source */
-    void* recv_pos = lwgrp_type_dtbuf_from_dtbuf(
-      tmpbuf, num_received, datatype
+    void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(
+      tmpbuf, num_received, &dt
     );
     MPI_Irecv(
-      recv_pos, num_incoming, datatype, src, LWGRP_MSG_TAG_0,
+      recv_pos, num_incoming, datatype, src, group->tag,
       comm, &request[0]
     ); 
 
     /* send the data to destination */
     MPI_Isend(
-      tmpbuf, num_received, datatype, dst, LWGRP_MSG_TAG_0,
+      tmpbuf, num_outgoing, datatype, dst, group->tag,
       comm, &request[1]
     );
 
@@ -364,20 +762,20 @@ int lwgrp_logring_allgatherv_brucks(
     step <<= 1;
   }
 
-  /* shift our data back to the proper position in receive buffer */
-  int num_pre  = prefix_sum;
-  int num_post = sum - num_pre;
-  void* buf_pre  = lwgrp_type_dtbuf_from_dtbuf(
-    recvbuf, num_pre, datatype
-  );
-  void* buf_post = lwgrp_type_dtbuf_from_dtbuf(
-    tmpbuf, num_post, datatype
-  );
-  lwgrp_type_dtbuf_memcpy(buf_pre, tmpbuf,  num_post, datatype);
-  lwgrp_type_dtbuf_memcpy(recvbuf, buf_post, num_pre, datatype);
+  /* copy the data of each rank to its place in the receive buffer */
+  int offset = 0;
+  for (i = 0; i < ranks; i++) {
+    int j = (rank + i) % ranks;
+    lwgrp_desc_dtbuf_memcpy(
+      lwgrp_desc_dtbuf_from_dtbuf(recvbuf, displs[j], &dt),
+      lwgrp_desc_dtbuf_from_dtbuf(tmpbuf, offset, &dt),
+      counts[j], &dt
+    );
+    offset += counts[j];
+  }
 
   /* free the temporary buffer */
-  lwgrp_type_dtbuf_free(&tmpbuf, datatype, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
 
   return rc;
 }
@@ -391,6 +789,9 @@ int lwgrp_logring_alltoall_brucks(
   const lwgrp_ring* group,
   const lwgrp_logring* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
   int i;
   int rc = LWGRP_SUCCESS;
 
@@ -399,11 +800,13 @@ int lwgrp_logring_alltoall_brucks(
   int rank       = group->group_rank;
   int ranks      = group->group_size;
 
-  /* TODO: feels like some of these memory copies could be avoided */
+  /* see lwgrp_logring_alltoall_brucks_indexed for a version that
+   * avoids these memory copies */
 
-  void* send_data = lwgrp_type_dtbuf_alloc(ranks, datatype, __FILE__, __LINE__);
-  void* recv_data = lwgrp_type_dtbuf_alloc(ranks, datatype, __FILE__, __LINE__);
-  void* tmp_data  = lwgrp_type_dtbuf_alloc(ranks, datatype, __FILE__, __LINE__);
+  int elements = ranks * num;
+  void* send_data = lwgrp_desc_dtbuf_alloc(elements, &dt, __FILE__, __LINE__);
+  void* recv_data = lwgrp_desc_dtbuf_alloc(elements, &dt, __FILE__, __LINE__);
+  void* tmp_data  = lwgrp_desc_dtbuf_alloc(elements, &dt, __FILE__, __LINE__);
 
   /* copy our send data to our receive buffer, and rotate it so our own
    * rank is at the top */
@@ -415,10 +818,10 @@ int lwgrp_logring_alltoall_brucks(
 #endif
   int num_pre  = num * rank;
   int num_post = num * (ranks - rank);
-  void* buf_pre  = lwgrp_type_dtbuf_from_dtbuf(inputbuf, num_pre, datatype);
-  void* buf_post = lwgrp_type_dtbuf_from_dtbuf(tmp_data, num_post, datatype);
-  lwgrp_type_dtbuf_memcpy(tmp_data, buf_pre, num_post, datatype);
-  lwgrp_type_dtbuf_memcpy(buf_post, inputbuf, num_pre, datatype);
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(inputbuf, num_pre, &dt);
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(tmp_data, num_post, &dt);
+  lwgrp_desc_dtbuf_memcpy(tmp_data, buf_pre, num_post, &dt);
+  lwgrp_desc_dtbuf_memcpy(buf_post, inputbuf, num_pre, &dt);
 
   /* now run through Bruck's index algorithm to exchange data */
   MPI_Request request[2];
@@ -435,20 +838,20 @@ int lwgrp_logring_alltoall_brucks(
     for (i = 0; i < ranks; i++) {
       int mask = (i & step);
       if (mask) {
-        void* send_ptr = lwgrp_type_dtbuf_from_dtbuf(send_data, send_count, datatype);
-        void* tmp_ptr  = lwgrp_type_dtbuf_from_dtbuf(tmp_data,  i * num,    datatype);
-        lwgrp_type_dtbuf_memcpy(send_ptr, tmp_ptr, num, datatype);
+        void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(send_data, send_count, &dt);
+        void* tmp_ptr  = lwgrp_desc_dtbuf_from_dtbuf(tmp_data,  i * num,    &dt);
+        lwgrp_desc_dtbuf_memcpy(send_ptr, tmp_ptr, num, &dt);
         send_count += num;
       }
     }
 
     /* exchange messages */
     MPI_Irecv(
-      recv_data, send_count, datatype, src, LWGRP_MSG_TAG_0,
+      recv_data, send_count, datatype, src, group->tag,
       comm, &request[0]
     );
     MPI_Isend(
-      send_data, send_count, datatype, dst, LWGRP_MSG_TAG_0,
+      send_data, send_count, datatype, dst, group->tag,
       comm, &request[1]
     );
     MPI_Waitall(2, request, status);
@@ -458,9 +861,9 @@ int lwgrp_logring_alltoall_brucks(
     for (i = 0; i < ranks; i++) {
       int mask = (i & step);
       if (mask) {
-        void* recv_ptr = lwgrp_type_dtbuf_from_dtbuf(recv_data, recv_count, datatype);
-        void* tmp_ptr  = lwgrp_type_dtbuf_from_dtbuf(tmp_data,  i * num,    datatype);
-        lwgrp_type_dtbuf_memcpy(tmp_ptr, recv_ptr, num, datatype);
+        void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(recv_data, recv_count, &dt);
+        void* tmp_ptr  = lwgrp_desc_dtbuf_from_dtbuf(tmp_data,  i * num,    &dt);
+        lwgrp_desc_dtbuf_memcpy(tmp_ptr, recv_ptr, num, &dt);
         recv_count += num;
       }
     }
@@ -474,22 +877,174 @@ int lwgrp_logring_alltoall_brucks(
    * rank is in its proper position */
   int num_pre2  = num * (rank + 1);
   int num_post2 = num * (ranks - rank - 1);
-  void* buf_pre2  = lwgrp_type_dtbuf_from_dtbuf(tmp_data,  num_pre2, datatype);
-  void* buf_post2 = lwgrp_type_dtbuf_from_dtbuf(send_data, num_post2, datatype);
-  lwgrp_type_dtbuf_memcpy(send_data, buf_pre2, num_post2, datatype);
-  lwgrp_type_dtbuf_memcpy(buf_post2, tmp_data, num_pre2,  datatype);
+  void* buf_pre2  = lwgrp_desc_dtbuf_from_dtbuf(tmp_data,  num_pre2, &dt);
+  void* buf_post2 = lwgrp_desc_dtbuf_from_dtbuf(send_data, num_post2, &dt);
+  lwgrp_desc_dtbuf_memcpy(send_data, buf_pre2, num_post2, &dt);
+  lwgrp_desc_dtbuf_memcpy(buf_post2, tmp_data, num_pre2,  &dt);
 
   /* elements are in reverse order, so flip them around */
   for (i = 0; i < ranks; i++) {
-    void* buf_dst = lwgrp_type_dtbuf_from_dtbuf(recvbuf, i * num, datatype);
-    void* buf_src = lwgrp_type_dtbuf_from_dtbuf(send_data, (ranks - i - 1) * num, datatype);
-    lwgrp_type_dtbuf_memcpy(buf_dst, buf_src, num, datatype);
+    void* buf_dst = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, i * num, &dt);
+    void* buf_src = lwgrp_desc_dtbuf_from_dtbuf(send_data, (ranks - i - 1) * num, &dt);
+    lwgrp_desc_dtbuf_memcpy(buf_dst, buf_src, num, &dt);
   }
 
   /* free off our internal data structures */
-  lwgrp_type_dtbuf_free(&tmp_data,  datatype, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&recv_data, datatype, __FILE__, __LINE__);
-  lwgrp_type_dtbuf_free(&send_data, datatype, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&tmp_data,  &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&recv_data, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&send_data, &dt, __FILE__, __LINE__);
+
+  return rc;
+}
+
+/* count number of bits set in value */
+static int lwgrp_popcount(int value)
+{
+  int count = 0;
+  while (value != 0) {
+    value &= value - 1;
+    count++;
+  }
+  return count;
+}
+
+/* execute an alltoall using Bruck's algorithm, but rather than packing
+ * and unpacking blocks in each round and rotating the data before and
+ * after, we describe the blocks of each round with an hindexed type of
+ * absolute addresses so MPI moves them straight from where they are.
+ *
+ * Block j is the one that moves j ranks to the right, which starts in
+ * sendbuf at (rank + j) % ranks and must end in recvbuf at
+ * (rank - j) % ranks, so we skip both rotations by just computing
+ * addresses.  Block j is received once for each bit set in j, we
+ * receive the last copy directly into its final slot in recvbuf and
+ * alternate earlier copies between a scratch buffer and that same slot
+ * so that no block is ever received where it's being sent from. */
+int lwgrp_logring_alltoall_brucks_indexed(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int j;
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+  int elements  = ranks * num;
+
+  /* with MPI_IN_PLACE, our input is also our output, so take a copy
+   * of it to send from */
+  void* inbuf = NULL;
+  const void* srcbuf = sendbuf;
+#if MPI_VERSION >= 2
+  if (sendbuf == MPI_IN_PLACE) {
+    inbuf = lwgrp_desc_dtbuf_alloc(elements, &dt, __FILE__, __LINE__);
+    lwgrp_desc_dtbuf_memcpy(inbuf, recvbuf, elements, &dt);
+    srcbuf = inbuf;
+  }
+#endif
+
+  /* copy our own block into place */
+  if (srcbuf != recvbuf) {
+    const void* src = lwgrp_desc_dtbuf_from_dtbuf(srcbuf,  rank * num, &dt);
+    void* dst       = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, rank * num, &dt);
+    lwgrp_desc_dtbuf_memcpy(dst, src, num, &dt);
+  }
+
+  /* scratch space for blocks between rounds, indexed by block */
+  void* tmpbuf = lwgrp_desc_dtbuf_alloc(elements, &dt, __FILE__, __LINE__);
+
+  /* arrays to define the block addresses of each round */
+  int* blocklens      = (int*) lwgrp_scratch_alloc(ranks * sizeof(int), __FILE__, __LINE__);
+  MPI_Aint* senddisps = (MPI_Aint*) lwgrp_scratch_alloc(ranks * sizeof(MPI_Aint), __FILE__, __LINE__);
+  MPI_Aint* recvdisps = (MPI_Aint*) lwgrp_scratch_alloc(ranks * sizeof(MPI_Aint), __FILE__, __LINE__);
+
+  MPI_Request request[2];
+  MPI_Status  status[2];
+  int index = 0;
+  int step = 1;
+  while (step < ranks) {
+    /* determine our source and destination ranks for this step */
+    int dst = list->right_list[index];
+    int src = list->left_list[index];
+
+    /* list the blocks that move this round */
+    int blocks = 0;
+    for (j = 1; j < ranks; j++) {
+      if (! (j & step)) {
+        continue;
+      }
+
+      /* number of times this block will be received after this one,
+       * we receive into the final slot when it's even, and into our
+       * scratch buffer when it's odd */
+      int remaining = lwgrp_popcount(j & ~(2 * step - 1));
+      int first = ((j & (step - 1)) == 0);
+
+      int final_index = (rank - j + ranks) % ranks;
+      void* final_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, final_index * num, &dt);
+      void* tmp_ptr   = lwgrp_desc_dtbuf_from_dtbuf(tmpbuf,  j * num, &dt);
+
+      /* get address of the block's current location */
+      const void* from;
+      if (first) {
+        int send_index = (rank + j) % ranks;
+        from = lwgrp_desc_dtbuf_from_dtbuf(srcbuf, send_index * num, &dt);
+      } else if (remaining % 2 == 0) {
+        from = tmp_ptr;
+      } else {
+        from = final_ptr;
+      }
+      void* to = (remaining % 2 == 0) ? final_ptr : tmp_ptr;
+
+      blocklens[blocks] = num;
+      MPI_Get_address((void*) from, &senddisps[blocks]);
+      MPI_Get_address(to, &recvdisps[blocks]);
+      blocks++;
+    }
+
+    /* build types for this round */
+    MPI_Datatype sendtype, recvtype;
+    MPI_Type_create_hindexed(blocks, blocklens, senddisps, datatype, &sendtype);
+    MPI_Type_create_hindexed(blocks, blocklens, recvdisps, datatype, &recvtype);
+    MPI_Type_commit(&sendtype);
+    MPI_Type_commit(&recvtype);
+
+    /* exchange messages */
+    MPI_Irecv(
+      MPI_BOTTOM, 1, recvtype, src, group->tag,
+      comm, &request[0]
+    );
+    MPI_Isend(
+      MPI_BOTTOM, 1, sendtype, dst, group->tag,
+      comm, &request[1]
+    );
+    MPI_Waitall(2, request, status);
+
+    MPI_Type_free(&recvtype);
+    MPI_Type_free(&sendtype);
+
+    /* go on to the next phase of the exchange */
+    index++;
+    step <<= 1;
+  }
+
+  /* free off our internal data structures */
+  lwgrp_scratch_free(&recvdisps);
+  lwgrp_scratch_free(&senddisps);
+  lwgrp_scratch_free(&blocklens);
+  lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+  if (inbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&inbuf, &dt, __FILE__, __LINE__);
+  }
 
   return rc;
 }
@@ -508,6 +1063,171 @@ int lwgrp_logring_alltoallv_linear(
   return rc;
 }
 
+/* alltoallv that keeps up to window receives and window sends in
+ * flight at once, we first allgather the address of each process in
+ * the group so we can talk to any peer directly, then we work through
+ * peers in ring order, receiving from rank-i and sending to rank+i at
+ * step i, as in lwgrp_ring_alltoallv_linear, and we skip peers with a
+ * zero count so that sparse exchanges only cost O(nnz) messages after
+ * the O(log N) allgather, since every process walks its peers in the
+ * same order, the oldest outstanding receive always has a matching
+ * send posted on the other side, so the windows can't deadlock */
+int lwgrp_logring_alltoallv_windowed(
+  const void* sendbuf,
+  const int sendcounts[],
+  const int senddispls[],
+  void* recvbuf,
+  const int recvcounts[],
+  const int recvdispls[],
+  MPI_Datatype datatype,
+  int window,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  MPI_Comm comm = group->comm;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  if (ranks == 0) {
+    return rc;
+  }
+
+  /* need room for at least one pair */
+  if (window < 1) {
+    window = 1;
+  }
+
+  /* copy data to ourself */
+  if (sendcounts[rank] > 0) {
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+      sendbuf, senddispls[rank], &dt
+    );
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, recvdispls[rank], &dt
+    );
+    lwgrp_desc_dtbuf_memcpy(recv_ptr, send_ptr, sendcounts[rank], &dt);
+  }
+
+  if (ranks == 1) {
+    return rc;
+  }
+
+  /* learn the address of each process in the group */
+  int* addrs = (int*) lwgrp_scratch_alloc(
+    ranks * sizeof(int), __FILE__, __LINE__
+  );
+  lwgrp_logring_allgather_brucks(
+    &group->comm_rank, addrs, 1, MPI_INT, group, list
+  );
+
+  /* allocate request slots, we track whether each slot holds a send
+   * or a receive, and keep a stack of free slots */
+  int slots = 2 * window;
+  MPI_Request* request = (MPI_Request*) lwgrp_scratch_alloc(
+    slots * sizeof(MPI_Request), __FILE__, __LINE__
+  );
+  int* is_send = (int*) lwgrp_scratch_alloc(
+    slots * sizeof(int), __FILE__, __LINE__
+  );
+  int* free_slots = (int*) lwgrp_scratch_alloc(
+    slots * sizeof(int), __FILE__, __LINE__
+  );
+  int* done = (int*) lwgrp_scratch_alloc(
+    slots * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < slots; i++) {
+    request[i] = MPI_REQUEST_NULL;
+    free_slots[i] = slots - 1 - i;
+  }
+  int nfree = slots;
+
+  /* walk the peers in ring order */
+  int recv_step  = 1;
+  int send_step  = 1;
+  int recv_count = 0;
+  int send_count = 0;
+  while (recv_step < ranks || send_step < ranks ||
+         recv_count > 0 || send_count > 0)
+  {
+    /* post receives until our receive window is full */
+    while (recv_step < ranks && recv_count < window) {
+      int src = rank - recv_step;
+      if (src < 0) {
+        src += ranks;
+      }
+      recv_step++;
+
+      int count = recvcounts[src];
+      if (count > 0) {
+        int slot = free_slots[--nfree];
+        void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+          recvbuf, recvdispls[src], &dt
+        );
+        MPI_Irecv(
+          recv_ptr, count, datatype, addrs[src], group->tag,
+          comm, &request[slot]
+        );
+        is_send[slot] = 0;
+        recv_count++;
+      }
+    }
+
+    /* post sends until our send window is full */
+    while (send_step < ranks && send_count < window) {
+      int dst = rank + send_step;
+      if (dst >= ranks) {
+        dst -= ranks;
+      }
+      send_step++;
+
+      int count = sendcounts[dst];
+      if (count > 0) {
+        int slot = free_slots[--nfree];
+        void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+          sendbuf, senddispls[dst], &dt
+        );
+        MPI_Isend(
+          send_ptr, count, datatype, addrs[dst], group->tag,
+          comm, &request[slot]
+        );
+        is_send[slot] = 1;
+        send_count++;
+      }
+    }
+
+    /* wait for some requests to finish and free their slots */
+    if (recv_count > 0 || send_count > 0) {
+      int outcount;
+      MPI_Waitsome(slots, request, &outcount, done, MPI_STATUSES_IGNORE);
+      for (i = 0; i < outcount; i++) {
+        int slot = done[i];
+        if (is_send[slot]) {
+          send_count--;
+        } else {
+          recv_count--;
+        }
+        free_slots[nfree++] = slot;
+      }
+    }
+  }
+
+  /* free memory */
+  lwgrp_scratch_free(&done);
+  lwgrp_scratch_free(&free_slots);
+  lwgrp_scratch_free(&is_send);
+  lwgrp_scratch_free(&request);
+  lwgrp_scratch_free(&addrs);
+
+  return rc;
+}
+
 int lwgrp_logring_reduce_recursive(
   const void* sendbuf,
   void* recvbuf,
@@ -583,6 +1303,9 @@ int lwgrp_logring_scan_recursive(
   const lwgrp_ring* group,
   const lwgrp_logring* list)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
   int rc = LWGRP_SUCCESS;
 
   /* delegate work to exscan */
@@ -593,10 +1316,10 @@ int lwgrp_logring_scan_recursive(
   /* now add in our own result */
   if (group->group_rank > 0) {
     /* reduce our data into result */
-    MPI_Reduce_local((void*)inbuf, outbuf, count, type, op);
+    lwgrp_reduce_local((void*)inbuf, outbuf, count, type, op);
   } else {
     /* for rank 0, just copy data over */
-    lwgrp_type_dtbuf_memcpy(outbuf, inbuf, count, type);
+    lwgrp_desc_dtbuf_memcpy(outbuf, inbuf, count, &dt);
   }
 
   return rc;
@@ -659,3 +1382,230 @@ int lwgrp_logring_double_exscan_recursive(
 
   return rc;
 }
+
+/* Route a set of fixed-size records to arbitrary destinations in
+ * log(N) steps using Bruck's index pattern.  Each record is rec_size
+ * bytes and starts with an int holding the group rank of its
+ * destination.  In step d, we forward every record whose remaining
+ * distance to its destination has bit d set to the process 2^d hops
+ * to our right, so after ceiling(log N) steps all records have
+ * arrived.  Since we only ever talk to our 2^d neighbors, every
+ * receive names its source.  The input buffer is not modified. */
+
+enum lwgrp_nb_route_phase {
+  ROUTE_COUNTS,  /* pick records to move and exchange counts */
+  ROUTE_RECORDS, /* exchange records */
+  ROUTE_ARRIVED, /* records of this step have arrived */
+};
+
+void lwgrp_nb_route_init(
+  lwgrp_nb_route* s,
+  const void* inbuf,
+  int incount,
+  size_t rec_size,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  s->rec_size = rec_size;
+  s->group    = group;
+  s->list     = list;
+  s->index    = 0;
+  s->step     = 1;
+  s->phase    = ROUTE_COUNTS;
+
+  /* build a datatype to transfer whole records */
+  MPI_Type_contiguous((int)rec_size, MPI_BYTE, &s->rec_type);
+  MPI_Type_commit(&s->rec_type);
+
+  /* copy records into a working buffer which we grow as records
+   * arrive, records that are still in flight or have reached their
+   * destination are all held contiguously in this buffer */
+  s->cap = (incount > 0) ? incount : 1;
+  s->num = incount;
+  s->buf = (char*) lwgrp_malloc(s->cap * rec_size, sizeof(int), __FILE__, __LINE__);
+  if (incount > 0) {
+    memcpy(s->buf, inbuf, incount * rec_size);
+  }
+
+  /* scratch buffer to hold records we send in each step */
+  s->send_cap = 0;
+  s->sendbuf  = NULL;
+}
+
+int lwgrp_nb_route_advance(
+  lwgrp_nb_route* s,
+  struct lwgrp_request_struct* req)
+{
+  int i;
+
+  /* get ring info */
+  MPI_Comm comm     = s->group->comm;
+  int rank          = s->group->group_rank;
+  int ranks         = s->group->group_size;
+  size_t rec_size   = s->rec_size;
+
+  while (1) {
+    /* get ranks of our partners for this step */
+    int dst = MPI_PROC_NULL;
+    int src = MPI_PROC_NULL;
+    if (s->step < ranks) {
+      dst = s->list->right_list[s->index];
+      src = s->list->left_list[s->index];
+    }
+
+    switch (s->phase) {
+    case ROUTE_COUNTS:
+    {
+      if (s->step >= ranks) {
+        return 1;
+      }
+
+      /* count the records that move in this step */
+      int send_count = 0;
+      for (i = 0; i < s->num; i++) {
+        int dest = *(int*)(s->buf + i * rec_size);
+        int dist = dest - rank;
+        if (dist < 0) {
+          dist += ranks;
+        }
+        if (dist & s->step) {
+          send_count++;
+        }
+      }
+
+      /* pull records that move out of our working buffer,
+       * and compact the ones we keep */
+      if (send_count > s->send_cap) {
+        lwgrp_scratch_free(&s->sendbuf);
+        s->send_cap = send_count;
+        s->sendbuf = (char*) lwgrp_scratch_alloc(
+          s->send_cap * rec_size, __FILE__, __LINE__
+        );
+      }
+      int keep  = 0;
+      int moved = 0;
+      for (i = 0; i < s->num; i++) {
+        char* rec = s->buf + i * rec_size;
+        int dest = *(int*)rec;
+        int dist = dest - rank;
+        if (dist < 0) {
+          dist += ranks;
+        }
+        if (dist & s->step) {
+          memcpy(s->sendbuf + moved * rec_size, rec, rec_size);
+          moved++;
+        } else {
+          if (keep != i) {
+            memcpy(s->buf + keep * rec_size, rec, rec_size);
+          }
+          keep++;
+        }
+      }
+      s->num = keep;
+      s->send_count = send_count;
+
+      /* exchange counts so we know how much to receive */
+      MPI_Irecv(
+        &s->recv_count, 1, MPI_INT, src, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      MPI_Isend(
+        &s->send_count, 1, MPI_INT, dst, req->tag,
+        comm, lwgrp_request_next(req)
+      );
+      s->phase = ROUTE_RECORDS;
+      return 0;
+    }
+    case ROUTE_RECORDS:
+    {
+      /* grow our working buffer to hold incoming records */
+      int total = s->num + s->recv_count;
+      if (total > s->cap) {
+        int newcap = s->cap * 2;
+        if (newcap < total) {
+          newcap = total;
+        }
+        char* newbuf = (char*) lwgrp_malloc(newcap * rec_size, sizeof(int), __FILE__, __LINE__);
+        memcpy(newbuf, s->buf, s->num * rec_size);
+        lwgrp_free(&s->buf);
+        s->buf = newbuf;
+        s->cap = newcap;
+      }
+
+      /* exchange records */
+      int posted = 0;
+      if (s->recv_count > 0) {
+        MPI_Irecv(
+          s->buf + s->num * rec_size, s->recv_count, s->rec_type, src, req->tag,
+          comm, lwgrp_request_next(req)
+        );
+        posted = 1;
+      }
+      if (s->send_count > 0) {
+        MPI_Isend(
+          s->sendbuf, s->send_count, s->rec_type, dst, req->tag,
+          comm, lwgrp_request_next(req)
+        );
+        posted = 1;
+      }
+      s->phase = ROUTE_ARRIVED;
+      if (posted) {
+        return 0;
+      }
+      break;
+    }
+    case ROUTE_ARRIVED:
+      /* go on to next step */
+      s->num += s->recv_count;
+      s->index++;
+      s->step <<= 1;
+      s->phase = ROUTE_COUNTS;
+      break;
+    }
+  }
+}
+
+void lwgrp_nb_route_finish(
+  lwgrp_nb_route* s,
+  void** outbuf,
+  int* outcount)
+{
+  /* free our scratch space and the datatype */
+  lwgrp_scratch_free(&s->sendbuf);
+  MPI_Type_free(&s->rec_type);
+
+  /* hand working buffer back to caller */
+  *outbuf   = s->buf;
+  *outcount = s->num;
+  s->buf = NULL;
+}
+
+static int lwgrp_nb_route_step(struct lwgrp_request_struct* req)
+{
+  lwgrp_nb_route* s = (lwgrp_nb_route*) req->state;
+  return lwgrp_nb_route_advance(s, req);
+}
+
+/* On return, *outbuf points to a newly allocated buffer holding the
+ * *outcount records destined for the calling process, in no
+ * particular order, and it must be freed with lwgrp_free. */
+int lwgrp_logring_route_brucks(
+  const void* inbuf,
+  int incount,
+  size_t rec_size,
+  void** outbuf,
+  int* outcount,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list)
+{
+  lwgrp_nb_route s;
+  lwgrp_nb_route_init(&s, inbuf, incount, rec_size, group, list);
+
+  struct lwgrp_request_struct req;
+  lwgrp_request_init(&req, lwgrp_nb_route_step, &s, group->tag);
+  lwgrp_request_complete(&req);
+
+  lwgrp_nb_route_finish(&s, outbuf, outcount);
+
+  return LWGRP_SUCCESS;
+}
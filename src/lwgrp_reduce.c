@@ -0,0 +1,170 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Local reductions.  Our collectives mostly reduce short vectors,
+ * where the cost of dispatching through MPI_Reduce_local can exceed
+ * the arithmetic, so we handle the common predefined (type, op)
+ * pairs with simple loops the compiler can vectorize, and hand
+ * everything else to MPI_Reduce_local. */
+
+/* a kernel computes inout[i] = in[i] op inout[i] for count elements */
+typedef void (*lwgrp_reduce_fn)(const void* in, void* inout, int count);
+
+/* a fused kernel does the same for two output buffers at once */
+typedef void (*lwgrp_reduce2_fn)(const void* in, void* inout1, void* inout2, int count);
+
+#define LWGRP_OP_SUM(a, b) ((a) + (b))
+#define LWGRP_OP_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define LWGRP_OP_MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define LWGRP_OP_BAND(a, b) ((a) & (b))
+#define LWGRP_OP_BOR(a, b) ((a) | (b))
+
+/* MPI requires the input and output buffers of a local reduction to
+ * be distinct, so we can tell the compiler they don't overlap */
+#define LWGRP_REDUCE_KERNELS(NAME, TYPE, OP) \
+static void NAME(const void* in_void, void* inout_void, int count) \
+{ \
+  const TYPE* restrict in = (const TYPE*) in_void; \
+  TYPE* restrict inout = (TYPE*) inout_void; \
+  int i; \
+  for (i = 0; i < count; i++) { \
+    inout[i] = OP(in[i], inout[i]); \
+  } \
+} \
+static void NAME##2(const void* in_void, void* inout1_void, void* inout2_void, int count) \
+{ \
+  const TYPE* restrict in = (const TYPE*) in_void; \
+  TYPE* restrict inout1 = (TYPE*) inout1_void; \
+  TYPE* restrict inout2 = (TYPE*) inout2_void; \
+  int i; \
+  for (i = 0; i < count; i++) { \
+    TYPE val = in[i]; \
+    inout1[i] = OP(val, inout1[i]); \
+    inout2[i] = OP(val, inout2[i]); \
+  } \
+}
+
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_int_sum,  int, LWGRP_OP_SUM)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_int_min,  int, LWGRP_OP_MIN)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_int_max,  int, LWGRP_OP_MAX)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_int_band, int, LWGRP_OP_BAND)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_int_bor,  int, LWGRP_OP_BOR)
+
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_long_sum,  long, LWGRP_OP_SUM)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_long_min,  long, LWGRP_OP_MIN)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_long_max,  long, LWGRP_OP_MAX)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_long_band, long, LWGRP_OP_BAND)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_long_bor,  long, LWGRP_OP_BOR)
+
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_float_sum, float, LWGRP_OP_SUM)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_float_min, float, LWGRP_OP_MIN)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_float_max, float, LWGRP_OP_MAX)
+
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_double_sum, double, LWGRP_OP_SUM)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_double_min, double, LWGRP_OP_MIN)
+LWGRP_REDUCE_KERNELS(lwgrp_reduce_double_max, double, LWGRP_OP_MAX)
+
+/* look up kernels for (type, op), returns 0 if we don't have one,
+ * in which case the caller should use MPI_Reduce_local, the min and
+ * max kernels use plain comparisons, which means we leave NaN
+ * handling to MPI for floating point types */
+static int lwgrp_reduce_lookup(
+  MPI_Datatype type,
+  MPI_Op op,
+  lwgrp_reduce_fn* fn,
+  lwgrp_reduce2_fn* fn2)
+{
+  if (type == MPI_INT) {
+    if (op == MPI_SUM) {
+      *fn = lwgrp_reduce_int_sum;  *fn2 = lwgrp_reduce_int_sum2;  return 1;
+    } else if (op == MPI_MIN) {
+      *fn = lwgrp_reduce_int_min;  *fn2 = lwgrp_reduce_int_min2;  return 1;
+    } else if (op == MPI_MAX) {
+      *fn = lwgrp_reduce_int_max;  *fn2 = lwgrp_reduce_int_max2;  return 1;
+    } else if (op == MPI_BAND) {
+      *fn = lwgrp_reduce_int_band; *fn2 = lwgrp_reduce_int_band2; return 1;
+    } else if (op == MPI_BOR) {
+      *fn = lwgrp_reduce_int_bor;  *fn2 = lwgrp_reduce_int_bor2;  return 1;
+    }
+  } else if (type == MPI_LONG) {
+    if (op == MPI_SUM) {
+      *fn = lwgrp_reduce_long_sum;  *fn2 = lwgrp_reduce_long_sum2;  return 1;
+    } else if (op == MPI_MIN) {
+      *fn = lwgrp_reduce_long_min;  *fn2 = lwgrp_reduce_long_min2;  return 1;
+    } else if (op == MPI_MAX) {
+      *fn = lwgrp_reduce_long_max;  *fn2 = lwgrp_reduce_long_max2;  return 1;
+    } else if (op == MPI_BAND) {
+      *fn = lwgrp_reduce_long_band; *fn2 = lwgrp_reduce_long_band2; return 1;
+    } else if (op == MPI_BOR) {
+      *fn = lwgrp_reduce_long_bor;  *fn2 = lwgrp_reduce_long_bor2;  return 1;
+    }
+  } else if (type == MPI_DOUBLE) {
+    if (op == MPI_SUM) {
+      *fn = lwgrp_reduce_double_sum; *fn2 = lwgrp_reduce_double_sum2; return 1;
+    } else if (op == MPI_MIN) {
+      *fn = lwgrp_reduce_double_min; *fn2 = lwgrp_reduce_double_min2; return 1;
+    } else if (op == MPI_MAX) {
+      *fn = lwgrp_reduce_double_max; *fn2 = lwgrp_reduce_double_max2; return 1;
+    }
+  } else if (type == MPI_FLOAT) {
+    if (op == MPI_SUM) {
+      *fn = lwgrp_reduce_float_sum; *fn2 = lwgrp_reduce_float_sum2; return 1;
+    } else if (op == MPI_MIN) {
+      *fn = lwgrp_reduce_float_min; *fn2 = lwgrp_reduce_float_min2; return 1;
+    } else if (op == MPI_MAX) {
+      *fn = lwgrp_reduce_float_max; *fn2 = lwgrp_reduce_float_max2; return 1;
+    }
+  }
+  return 0;
+}
+
+int lwgrp_reduce_local(
+  const void* inbuf,
+  void* inoutbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op)
+{
+  lwgrp_reduce_fn fn;
+  lwgrp_reduce2_fn fn2;
+  if (lwgrp_reduce_lookup(type, op, &fn, &fn2)) {
+    (*fn)(inbuf, inoutbuf, count);
+    return LWGRP_SUCCESS;
+  }
+
+  MPI_Reduce_local((void*)inbuf, inoutbuf, count, type, op);
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_reduce_local2(
+  const void* inbuf,
+  void* inoutbuf1,
+  void* inoutbuf2,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op)
+{
+  lwgrp_reduce_fn fn;
+  lwgrp_reduce2_fn fn2;
+  if (lwgrp_reduce_lookup(type, op, &fn, &fn2)) {
+    (*fn2)(inbuf, inoutbuf1, inoutbuf2, count);
+    return LWGRP_SUCCESS;
+  }
+
+  MPI_Reduce_local((void*)inbuf, inoutbuf1, count, type, op);
+  MPI_Reduce_local((void*)inbuf, inoutbuf2, count, type, op);
+  return LWGRP_SUCCESS;
+}
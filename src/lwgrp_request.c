@@ -0,0 +1,241 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* returns pointer to the next free MPI request slot in req */
+MPI_Request* lwgrp_request_next(struct lwgrp_request_struct* req)
+{
+  if (req->nreqs >= LWGRP_REQUEST_MPI_MAX) {
+    printf("ERROR: Too many outstanding requests in nonblocking op @ %s:%d\n",
+      __FILE__, __LINE__
+    );
+    exit(1);
+  }
+  MPI_Request* ptr = &req->mpireqs[req->nreqs];
+  req->nreqs++;
+  return ptr;
+}
+
+/* drive the op forward, if blocking is set, wait for each step to
+ * complete, otherwise return as soon as a step is still in flight,
+ * sets done to 1 if the op has completed */
+static int lwgrp_request_progress(struct lwgrp_request_struct* req, int blocking)
+{
+  /* count this work toward the op that started the request */
+  LWGRP_STATS_RESUME(req->stats_op);
+  while (! req->done) {
+    /* check whether messages of the current step have completed */
+    if (req->nreqs > 0) {
+      if (blocking) {
+        MPI_Waitall(req->nreqs, req->mpireqs, MPI_STATUSES_IGNORE);
+      } else {
+        int flag;
+        MPI_Testall(req->nreqs, req->mpireqs, &flag, MPI_STATUSES_IGNORE);
+        if (! flag) {
+          LWGRP_STATS_END();
+          return LWGRP_SUCCESS;
+        }
+      }
+      req->nreqs = 0;
+    }
+
+    /* move on to the next step */
+    req->done = (*req->advance)(req);
+  }
+  LWGRP_STATS_END();
+
+  return LWGRP_SUCCESS;
+}
+
+void lwgrp_request_init(
+  struct lwgrp_request_struct* req,
+  int (*advance)(struct lwgrp_request_struct* req),
+  void* state,
+  int tag)
+{
+  req->advance = advance;
+  req->release = NULL;
+  req->start   = NULL;
+  req->comm    = NULL;
+  req->state   = state;
+  req->tag     = tag;
+  req->done    = 0;
+  req->nreqs   = 0;
+  req->stats_op = LWGRP_STATS_CURRENT();
+}
+
+int lwgrp_request_complete(struct lwgrp_request_struct* req)
+{
+  return lwgrp_request_progress(req, 1);
+}
+
+/* free the request and op state and set the handle to NULL,
+ * persistent requests live outside the scratch pool since they
+ * may be kept for the life of the program */
+static void lwgrp_request_release(lwgrp_request* req)
+{
+  struct lwgrp_request_struct* r = *req;
+  if (r->release != NULL) {
+    (*r->release)(r->state);
+  }
+  if (r->start != NULL) {
+    lwgrp_free(req);
+  } else {
+    lwgrp_scratch_free(req);
+  }
+}
+
+int lwgrp_comm_next_tag(lwgrp_comm* comm)
+{
+  /* every member starts ops in the same order,
+   * so they all agree on the tag */
+  int count = LWGRP_CONTEXT_TAGS - LWGRP_CONTEXT_NB_FIRST;
+  int tag = lwgrp_context_tag(comm->context) +
+    LWGRP_CONTEXT_NB_FIRST + (comm->seq % count);
+  comm->seq++;
+  return tag;
+}
+
+int lwgrp_request_start(
+  lwgrp_comm* comm,
+  int (*advance)(struct lwgrp_request_struct* req),
+  void (*release)(void* state),
+  void* state,
+  lwgrp_request* req)
+{
+  struct lwgrp_request_struct* r = (struct lwgrp_request_struct*) lwgrp_scratch_alloc(
+    sizeof(struct lwgrp_request_struct), __FILE__, __LINE__
+  );
+  r->advance = advance;
+  r->release = release;
+  r->start   = NULL;
+  r->comm    = comm;
+  r->state   = state;
+  r->done    = 0;
+  r->nreqs   = 0;
+  r->stats_op = LWGRP_STATS_CURRENT();
+
+  /* take the next tag for this comm */
+  r->tag = lwgrp_comm_next_tag(comm);
+
+  /* run the first step */
+  r->done = (*advance)(r);
+
+  *req = r;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_request_persistent(
+  lwgrp_comm* comm,
+  int (*start)(struct lwgrp_request_struct* req),
+  int (*advance)(struct lwgrp_request_struct* req),
+  void (*release)(void* state),
+  void* state,
+  lwgrp_request* req)
+{
+  struct lwgrp_request_struct* r = (struct lwgrp_request_struct*) lwgrp_malloc(
+    sizeof(struct lwgrp_request_struct), sizeof(void*), __FILE__, __LINE__
+  );
+  r->advance = advance;
+  r->release = release;
+  r->start   = start;
+  r->comm    = comm;
+  r->state   = state;
+  r->tag     = comm->ring.tag;
+  r->nreqs   = 0;
+  r->stats_op = LWGRP_STATS_PERSISTENT;
+
+  /* an inactive request looks like a completed one */
+  r->done    = 1;
+
+  *req = r;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_start(lwgrp_request* req)
+{
+  struct lwgrp_request_struct* r = *req;
+  if (r == LWGRP_REQUEST_NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  if (r->start == NULL || ! r->done) {
+    printf("ERROR: Starting a request that is not an inactive persistent request @ %s:%d\n",
+      __FILE__, __LINE__
+    );
+    exit(1);
+  }
+
+  /* take a fresh tag each time, since other ops on the comm
+   * may have run since the last start */
+  LWGRP_STATS_BEGIN(r->stats_op);
+  r->tag   = lwgrp_comm_next_tag(r->comm);
+  r->done  = 0;
+  r->nreqs = 0;
+  r->done  = (*r->start)(r);
+  LWGRP_STATS_END();
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_request_free(lwgrp_request* req)
+{
+  if (*req == LWGRP_REQUEST_NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* finish any op that is still in flight before freeing its state */
+  int rc = lwgrp_request_progress(*req, 1);
+  lwgrp_request_release(req);
+
+  return rc;
+}
+
+int lwgrp_test(lwgrp_request* req, int* flag)
+{
+  /* a null request is complete */
+  if (*req == LWGRP_REQUEST_NULL) {
+    *flag = 1;
+    return LWGRP_SUCCESS;
+  }
+
+  int rc = lwgrp_request_progress(*req, 0);
+  if ((*req)->done) {
+    /* persistent requests stay allocated for the next start */
+    if ((*req)->start == NULL) {
+      lwgrp_request_release(req);
+    }
+    *flag = 1;
+  } else {
+    *flag = 0;
+  }
+
+  return rc;
+}
+
+int lwgrp_wait(lwgrp_request* req)
+{
+  /* a null request is complete */
+  if (*req == LWGRP_REQUEST_NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  int rc = lwgrp_request_progress(*req, 1);
+  if ((*req)->start == NULL) {
+    lwgrp_request_release(req);
+  }
+
+  return rc;
+}
@@ -59,8 +59,8 @@ int lwgrp_ring_split_bin_scan(
 
   /* allocate space for our send and receive buffers */
   int elements = 2 * num_bins + 1;
-  int* bins = (int*) lwgrp_malloc(
-    4 * elements * sizeof(int), sizeof(int), __FILE__, __LINE__
+  int* bins = (int*) lwgrp_scratch_alloc(
+    4 * elements * sizeof(int), __FILE__, __LINE__
   );
   if (bins == NULL) {
     /* TODO: fail */
@@ -108,11 +108,11 @@ int lwgrp_ring_split_bin_scan(
      * recv data from left and send data to the right */
     send_right_bins[rank_index] = left_rank;
     MPI_Irecv(
-      recv_left_bins,  elements, MPI_INT, left_rank,  LWGRP_MSG_TAG_0,
+      recv_left_bins,  elements, MPI_INT, left_rank,  in->tag,
       comm, &request[0]
     );
     MPI_Isend(
-      send_right_bins, elements, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+      send_right_bins, elements, MPI_INT, right_rank, in->tag,
       comm, &request[1]
     );
 
@@ -121,11 +121,11 @@ int lwgrp_ring_split_bin_scan(
      * recv data from right and send data to the left */
     send_left_bins[rank_index] = right_rank;
     MPI_Irecv(
-      recv_right_bins, elements, MPI_INT, right_rank, LWGRP_MSG_TAG_0,
+      recv_right_bins, elements, MPI_INT, right_rank, in->tag,
       comm, &request[2]
     );
     MPI_Isend(
-      send_left_bins,  elements, MPI_INT, left_rank,  LWGRP_MSG_TAG_0,
+      send_left_bins,  elements, MPI_INT, left_rank,  in->tag,
       comm, &request[3]
     );
 
@@ -198,19 +198,30 @@ int lwgrp_ring_split_bin_scan(
     out->comm_right = my_right;
     out->group_rank = count_left;
     out->group_size = count_left + count_right + 1;
+    out->tag        = in->tag;
+
+    /* if we're alone in our bin, we are our own neighbor, as in a
+     * ring built from a single-rank chain */
+    if (out->group_size == 1) {
+      out->comm_left  = comm_rank;
+      out->comm_right = comm_rank;
+    }
   } else {
     /* create an empty group */
     lwgrp_ring_set_null(out);
   }
 
   /* free memory */
-  lwgrp_free(&bins);
+  lwgrp_scratch_free(&bins);
 
   return LWGRP_SUCCESS; 
 }
 
 /* if there are lots of bins, we mask off portions of the bin number
- * at little bit at a time to keep the scan vector to a limited size */
+ * a few bits at a time to keep the scan vector to a limited size,
+ * we use as few passes as we can with at most LWGRP_SPLIT_BIN_BITS
+ * bits per pass, spread the bits evenly over the passes, and limit
+ * the bins in each pass to the values that can actually occur */
 int lwgrp_ring_split_bin_radix(
   int num_colors,
   int color,
@@ -226,90 +237,79 @@ int lwgrp_ring_split_bin_radix(
   /* TODO: if num_colors < 0, color out of range, or bin_bits <= 0
    * then abort */
 
-  /* number of bits to bite off at one time, optimal value will depend
-   * on the system architecture */
-  int bin_bits = LWGRP_SPLIT_BIN_BITS;
-
-  /* set to 1 to split by lowest-order bits first, set to
-   * 0 to split by highest-order bits */
-  int low = 1;
-
-  /* copy the input group */
-  lwgrp_ring tmp;
-  lwgrp_ring_copy(in, &tmp);
-
-  /* compute number of bins */
-  int num_bins = (1 << bin_bits);
+  /* if we can cover all colors in one pass, do it directly */
+  if (num_colors <= (1 << LWGRP_SPLIT_BIN_BITS)) {
+    lwgrp_ring_split_bin_scan(num_colors, color, in, out);
+    return LWGRP_SUCCESS;
+  }
 
   /* determine number of bits needed to cover all color values */
   /* since we number colors starting from 0 instead of 1, subtract
    * one before computing number of bits needed to represent all
    * colors */
+  unsigned int max_color = (unsigned int) (num_colors - 1);
   int color_bits = 0;
-  num_colors--;
+  unsigned int tmp_colors = max_color;
   do {
-    num_colors >>= 1;
+    tmp_colors >>= 1;
     color_bits++;
-  } while (num_colors > 0);
+  } while (tmp_colors > 0);
+
+  /* determine the number of passes, and the number of bits for each
+   * pass, the first (color_bits % num_steps) passes take one extra */
+  int num_steps = color_bits / LWGRP_SPLIT_BIN_BITS;
+  if (num_steps * LWGRP_SPLIT_BIN_BITS < color_bits) {
+    num_steps++;
+  }
+  int base_bits  = color_bits / num_steps;
+  int extra_bits = color_bits % num_steps;
 
   /* convert color to unsigned value */
-  int ucolor_bits = color_bits;
   unsigned int ucolor = 0;
   if (color >= 0) {
     ucolor = (unsigned int) color;
   }
 
-  /* determine the number of masking steps */
-  int num_steps = ucolor_bits / bin_bits;
-  if (num_steps * bin_bits < ucolor_bits) {
-    num_steps++;
-  }
+  /* we split back and forth between two rings rather than copying
+   * the output of each pass into the input of the next */
+  lwgrp_ring rings[2];
+  const lwgrp_ring* cur = in;
+  int next = 0;
+
+  /* split by lowest-order bits first */
+  int shift = 0;
+  int step;
+  for (step = 0; step < num_steps; step++) {
+    /* determine the number of bits in this pass */
+    int bits = base_bits;
+    if (step < extra_bits) {
+      bits++;
+    }
+
+    /* the number of bins is limited by the largest color value */
+    unsigned int mask = (1u << bits) - 1;
+    int num_bins = (int) (1u << bits);
+    if ((max_color >> shift) < mask) {
+      num_bins = (int) (max_color >> shift) + 1;
+    }
 
-  /* start splitting the ring into pieces */
-  int step = 0;
-  while (step < num_steps) {
-    /* determine our bin for this round */
+    /* mask bits from color value to determine bin */
     int my_bin = -1;
     if (color >= 0) {
-      /* determine the number of bits and direction to shift the mask */
-      int shift = 0;
-      if (low) {
-        /* work from lowest-order bits up */
-        shift = step * bin_bits;
-      } else {
-        /* work from highest-order bits down */
-        shift = (ucolor_bits - bin_bits) - step * bin_bits;
-      }
-
-      /* shift the mask */
-      unsigned int mask = (num_bins - 1);
-      if (shift >= 0) {
-        mask <<= shift;
-      } else {
-        mask >>= (0 - shift);
-        shift = 0;
-      }
-
-      /* mask bits from color value to determine bin */
-      my_bin = (ucolor & mask) >> shift;
+      my_bin = (int) ((ucolor >> shift) & mask);
     }
 
-    /* split group based on our bin */
-    lwgrp_ring_split_bin_scan(num_bins, my_bin, &tmp, out);
-
-    /* set output group to input group for next iteration */
-    lwgrp_ring_free(&tmp);
-    lwgrp_ring_copy(out, &tmp);
-    lwgrp_ring_free(out);
+    /* split group based on our bin, writing the final pass directly
+     * into the output group */
+    lwgrp_ring* dst = (step == num_steps - 1) ? out : &rings[next];
+    lwgrp_ring_split_bin_scan(num_bins, my_bin, cur, dst);
 
-    /* increase step count and split agian */
-    step++;
+    /* the output of this pass is the input of the next */
+    cur = dst;
+    next ^= 1;
+    shift += bits;
   }
 
-  /* copy final group into the output group */
-  lwgrp_ring_copy(&tmp, out);
-  lwgrp_ring_free(&tmp);
-
   return LWGRP_SUCCESS;
 }
 
@@ -326,6 +326,9 @@ int lwgrp_ring_alltoallv_linear(
   MPI_Datatype datatype,
   const lwgrp_ring* group)
 {
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
   /* TODO: we could just fire off a bunch of issends */
 
   /* get group info */
@@ -349,33 +352,38 @@ int lwgrp_ring_alltoallv_linear(
   while (dist < ranks) {
     int k = 0;
 
+    /* get group ranks of src and dst, which are dist+1 hops away,
+     * counts and displacements are indexed by group rank */
+    int src_rank = (rank - 1 - dist + 2 * ranks) % ranks;
+    int dst_rank = (rank + 1 + dist) % ranks;
+
     /* receive data from src */
-    int recv_count = recvcounts[src];
+    int recv_count = recvcounts[src_rank];
     if (recv_count > 0) {
-      void* recv_ptr = lwgrp_type_dtbuf_from_dtbuf(
-        recvbuf, recvdispls[src], datatype
+      void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+        recvbuf, recvdispls[src_rank], &dt
       );
       MPI_Irecv(
-        recv_ptr, recv_count, datatype, src, LWGRP_MSG_TAG_0, comm, &request[k++]
+        recv_ptr, recv_count, datatype, src, group->tag, comm, &request[k++]
       );
     }
 
     /* send data to dst */
-    int send_count = sendcounts[dst];
+    int send_count = sendcounts[dst_rank];
     if (send_count > 0) {
-      void* send_ptr = lwgrp_type_dtbuf_from_dtbuf(
-        sendbuf, senddispls[dst], datatype
+      void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(
+        sendbuf, senddispls[dst_rank], &dt
       );
       MPI_Isend(
-        send_ptr, send_count, datatype, dst, LWGRP_MSG_TAG_0, comm, &request[k++]
+        send_ptr, send_count, datatype, dst, group->tag, comm, &request[k++]
       );
     }
 
     /* exchange addresses, send our current src to our current dst, etc */
-    MPI_Irecv(&src_next, 1, MPI_INT, src, LWGRP_MSG_TAG_0, comm, &request[k++]);
-    MPI_Irecv(&dst_next, 1, MPI_INT, dst, LWGRP_MSG_TAG_0, comm, &request[k++]);
-    MPI_Isend(&left,     1, MPI_INT, dst, LWGRP_MSG_TAG_0, comm, &request[k++]);
-    MPI_Isend(&right,    1, MPI_INT, src, LWGRP_MSG_TAG_0, comm, &request[k++]);
+    MPI_Irecv(&src_next, 1, MPI_INT, src, group->tag, comm, &request[k++]);
+    MPI_Irecv(&dst_next, 1, MPI_INT, dst, group->tag, comm, &request[k++]);
+    MPI_Isend(&left,     1, MPI_INT, dst, group->tag, comm, &request[k++]);
+    MPI_Isend(&right,    1, MPI_INT, src, group->tag, comm, &request[k++]);
 
     /* wait for communication to complete */
     if (k > 0) {
@@ -392,3 +400,186 @@ int lwgrp_ring_alltoallv_linear(
     
   return 0;
 }
+
+/* pipelined allreduce for commutative ops, we split the buffer into
+ * one block per process and pass blocks around the ring, first in a
+ * reduce-scatter of N-1 steps, after which each process holds one
+ * fully reduced block, and then in an allgather of N-1 steps, each
+ * process only talks to its left and right neighbors and sends about
+ * 2*count elements in total, this is best for large messages on
+ * small groups */
+int lwgrp_ring_allreduce_pipelined(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_ring* group)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  MPI_Status status[2];
+
+  /* get group info */
+  MPI_Comm comm = group->comm;
+  int left      = group->comm_left;
+  int right     = group->comm_right;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* copy our data into the receive buffer */
+  if (sendbuf != MPI_IN_PLACE) {
+    lwgrp_desc_dtbuf_memcpy(recvbuf, sendbuf, count, &dt);
+  }
+
+  /* nothing to do for a group of one */
+  if (ranks < 2) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* allocate buffer to receive the largest block */
+  int max_offset, max_count;
+  lwgrp_block_range(count, ranks, 0, &max_offset, &max_count);
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(max_count, &dt, __FILE__, __LINE__);
+
+  /* reduce-scatter, in step i we send block (rank - i) to our right
+   * and receive block (rank - i - 1) from our left, which we reduce
+   * with our own data for that block */
+  int i;
+  for (i = 0; i < ranks - 1; i++) {
+    int send_block = (rank - i + ranks) % ranks;
+    int recv_block = (rank - i - 1 + ranks) % ranks;
+
+    int send_offset, send_count, recv_offset, recv_count;
+    lwgrp_block_range(count, ranks, send_block, &send_offset, &send_count);
+    lwgrp_block_range(count, ranks, recv_block, &recv_offset, &recv_count);
+
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, send_offset, &dt);
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, recv_offset, &dt);
+    MPI_Sendrecv(
+      send_ptr, send_count, type, right, group->tag,
+      tempbuf,  recv_count, type, left,  group->tag,
+      comm, status
+    );
+
+    if (recv_count > 0) {
+      lwgrp_reduce_local(tempbuf, recv_ptr, recv_count, type, op);
+    }
+  }
+
+  /* allgather, we now hold the result for block (rank + 1), in step i
+   * we forward block (rank + 1 - i) to our right and receive block
+   * (rank - i) from our left directly into the result buffer */
+  for (i = 0; i < ranks - 1; i++) {
+    int send_block = (rank + 1 - i + ranks) % ranks;
+    int recv_block = (rank - i + ranks) % ranks;
+
+    int send_offset, send_count, recv_offset, recv_count;
+    lwgrp_block_range(count, ranks, send_block, &send_offset, &send_count);
+    lwgrp_block_range(count, ranks, recv_block, &recv_offset, &recv_count);
+
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, send_offset, &dt);
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(recvbuf, recv_offset, &dt);
+    MPI_Sendrecv(
+      send_ptr, send_count, type, right, group->tag,
+      recv_ptr, recv_count, type, left,  group->tag,
+      comm, status
+    );
+  }
+
+  /* free our scratch space */
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
+
+  return LWGRP_SUCCESS;
+}
+
+/* pipelined reduce-scatter for commutative ops, this is the first
+ * half of lwgrp_ring_allreduce_pipelined with the blocks shifted so
+ * that each rank ends up holding its own block, in step i we send
+ * block (rank - i - 1) to our right and receive block (rank - i - 2)
+ * from our left, which we reduce with our own data for that block */
+int lwgrp_ring_reduce_scatter_pipelined(
+  const void* sendbuf,
+  void* recvbuf,
+  const int counts[],
+  MPI_Datatype type,
+  MPI_Op op,
+  const lwgrp_ring* group)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, type);
+
+  MPI_Status status[2];
+
+  /* get group info */
+  MPI_Comm comm = group->comm;
+  int left      = group->comm_left;
+  int right     = group->comm_right;
+  int rank      = group->group_rank;
+  int ranks     = group->group_size;
+
+  /* with MPI_IN_PLACE, the input is in the receive buffer */
+  const void* inbuf = sendbuf;
+  if (sendbuf == MPI_IN_PLACE) {
+    inbuf = recvbuf;
+  }
+
+  /* compute the offset of each block and the size of the largest */
+  int* displs = (int*) lwgrp_scratch_alloc(
+    ranks * sizeof(int), __FILE__, __LINE__
+  );
+  int i;
+  int total = 0;
+  int max_count = 0;
+  for (i = 0; i < ranks; i++) {
+    displs[i] = total;
+    total += counts[i];
+    if (counts[i] > max_count) {
+      max_count = counts[i];
+    }
+  }
+
+  /* nothing to do for a group of one */
+  if (ranks < 2) {
+    if (ranks == 1 && inbuf != recvbuf) {
+      lwgrp_desc_dtbuf_memcpy(recvbuf, inbuf, counts[0], &dt);
+    }
+    lwgrp_scratch_free(&displs);
+    return LWGRP_SUCCESS;
+  }
+
+  /* we reduce into a copy of the input, since our own block of the
+   * receive buffer may be too small to hold it */
+  void* workbuf = lwgrp_desc_dtbuf_alloc(total, &dt, __FILE__, __LINE__);
+  void* tempbuf = lwgrp_desc_dtbuf_alloc(max_count, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_memcpy(workbuf, inbuf, total, &dt);
+
+  for (i = 0; i < ranks - 1; i++) {
+    int send_block = (rank - i - 1 + 2 * ranks) % ranks;
+    int recv_block = (rank - i - 2 + 2 * ranks) % ranks;
+
+    void* send_ptr = lwgrp_desc_dtbuf_from_dtbuf(workbuf, displs[send_block], &dt);
+    void* recv_ptr = lwgrp_desc_dtbuf_from_dtbuf(workbuf, displs[recv_block], &dt);
+    MPI_Sendrecv(
+      send_ptr, counts[send_block], type, right, group->tag,
+      tempbuf,  counts[recv_block], type, left,  group->tag,
+      comm, status
+    );
+
+    if (counts[recv_block] > 0) {
+      lwgrp_reduce_local(tempbuf, recv_ptr, counts[recv_block], type, op);
+    }
+  }
+
+  /* the last block we received was our own */
+  void* result = lwgrp_desc_dtbuf_from_dtbuf(workbuf, displs[rank], &dt);
+  lwgrp_desc_dtbuf_memcpy(recvbuf, result, counts[rank], &dt);
+
+  /* free our scratch space */
+  lwgrp_desc_dtbuf_free(&tempbuf, &dt, __FILE__, __LINE__);
+  lwgrp_desc_dtbuf_free(&workbuf, &dt, __FILE__, __LINE__);
+  lwgrp_scratch_free(&displs);
+
+  return LWGRP_SUCCESS;
+}
@@ -0,0 +1,591 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* One-sided versions of the logring allgather and bcast.  The window
+ * of a parent comm is created once with MPI_Win_create_dynamic and
+ * locked for all targets for its whole life, so an op only attaches
+ * the buffer it receives into, which is local.  In each op, a receiver
+ * posts the address of its buffer together with the sequence number
+ * of the op in the mailbox of the partner that will send to it, the
+ * sender waits for that post, puts its data, flushes, and then posts
+ * the sequence number in the mailbox of the receiver.  Flags are set
+ * with MPI_Accumulate and read with MPI_Fetch_and_op, so they are
+ * atomic with respect to each other, and the flush before each post
+ * orders it after the data it announces. */
+
+/* number of times we poll a flag before yielding the cpu to other
+ * procs, which matters when the node is oversubscribed */
+#define LWGRP_RMA_SPINS (1000)
+
+/* window address of a field of a slot in the mailbox at base */
+#define LWGRP_RMA_DISP(base, index, field) \
+  ((base) + (MPI_Aint) ((size_t) (index) * sizeof(lwgrp_rma_slot) + \
+    offsetof(lwgrp_rma_slot, field)))
+
+int lwgrp_rma_usable(const lwgrp_rma* rma, MPI_Datatype type, int count)
+{
+  if (rma == NULL || rma->rounds == 0 || count <= 0) {
+    return 0;
+  }
+
+  /* we attach the span from the true lower bound of the first element
+   * to the true upper bound of the last */
+  lwgrp_type_desc desc;
+  lwgrp_type_desc_init(&desc, type);
+  return (desc.extent > 0 && desc.true_extent > 0 && desc.size > 0);
+}
+
+#ifdef LWGRP_HAVE_RMA
+
+/* key under which each parent comm caches its window */
+static pthread_once_t lwgrp_rma_once = PTHREAD_ONCE_INIT;
+static int lwgrp_rma_keyval = MPI_KEYVAL_INVALID;
+
+/* free the window when the attribute is deleted, which happens in
+ * lwgrp_rma_finalize or when the parent comm is freed */
+static int lwgrp_rma_delete(MPI_Comm comm, int keyval, void* value, void* extra)
+{
+  (void)comm;
+  (void)keyval;
+  (void)extra;
+
+  MPI_Win* win = (MPI_Win*) value;
+  MPI_Win_unlock_all(*win);
+  MPI_Win_free(win);
+  lwgrp_free(&win);
+  return MPI_SUCCESS;
+}
+
+static void lwgrp_rma_init_keyval(void)
+{
+  MPI_Comm_create_keyval(
+    MPI_COMM_NULL_COPY_FN, lwgrp_rma_delete, &lwgrp_rma_keyval, NULL
+  );
+}
+
+/* returns the window of comm, or NULL if it has none */
+static MPI_Win* lwgrp_rma_lookup(MPI_Comm comm)
+{
+  pthread_once(&lwgrp_rma_once, lwgrp_rma_init_keyval);
+
+  MPI_Win* win = NULL;
+  int flag = 0;
+  MPI_Comm_get_attr(comm, lwgrp_rma_keyval, &win, &flag);
+  return flag ? win : NULL;
+}
+
+int lwgrp_rma_init(MPI_Comm comm)
+{
+  if (lwgrp_rma_lookup(comm) != NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* all flags are set with MPI_REPLACE and read with MPI_NO_OP, and no
+   * op relies on two accumulates landing in order */
+  MPI_Info info;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "accumulate_ops", "same_op_no_op");
+  MPI_Info_set(info, "accumulate_ordering", "none");
+
+  MPI_Win* win = (MPI_Win*) lwgrp_malloc(
+    sizeof(MPI_Win), sizeof(void*), __FILE__, __LINE__
+  );
+
+  /* some MPI libraries can't build a dynamic window on every comm,
+   * for example one with a single proc, in which case comms built on
+   * it keep sending messages, so all procs must agree on the outcome */
+  MPI_Errhandler errhandler;
+  MPI_Comm_get_errhandler(comm, &errhandler);
+  MPI_Comm_set_errhandler(comm, MPI_ERRORS_RETURN);
+  int failed = (MPI_Win_create_dynamic(info, comm, win) != MPI_SUCCESS);
+  MPI_Comm_set_errhandler(comm, errhandler);
+  MPI_Errhandler_free(&errhandler);
+  MPI_Info_free(&info);
+
+  int any_failed;
+  MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, comm);
+  if (any_failed) {
+    if (! failed) {
+      MPI_Win_free(win);
+    }
+    lwgrp_free(&win);
+    return LWGRP_SUCCESS;
+  }
+
+  /* stay in a passive target epoch to every proc, so ops never
+   * synchronize the window as a whole */
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+  MPI_Comm_set_attr(comm, lwgrp_rma_keyval, win);
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_finalize(MPI_Comm comm)
+{
+  if (lwgrp_rma_lookup(comm) != NULL) {
+    MPI_Comm_delete_attr(comm, lwgrp_rma_keyval);
+  }
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_create(const lwgrp_comm* comm, lwgrp_rma** rma)
+{
+  const lwgrp_ring* ring = &comm->ring;
+  const lwgrp_logring* list = &comm->logring;
+
+  *rma = NULL;
+  if (ring->group_size == 0) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* every member shares the parent comm, so either all of us find a
+   * window or none of us do */
+  MPI_Win* win = lwgrp_rma_lookup(ring->comm);
+  if (win == NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  lwgrp_rma* r = (lwgrp_rma*) lwgrp_malloc(
+    sizeof(lwgrp_rma), sizeof(void*), __FILE__, __LINE__
+  );
+  r->win    = *win;
+  r->rounds = list->left_size;
+  r->seq    = 0;
+
+  /* clear and attach our mailbox before anyone learns its address */
+  int rounds = r->rounds;
+  size_t bytes = 2 * (size_t) rounds * sizeof(lwgrp_rma_slot);
+  r->slots = (lwgrp_rma_slot*) lwgrp_malloc(
+    bytes, sizeof(MPI_Aint), __FILE__, __LINE__
+  );
+  r->left = (MPI_Aint*) lwgrp_malloc(
+    rounds * sizeof(MPI_Aint), sizeof(MPI_Aint), __FILE__, __LINE__
+  );
+  r->right = (MPI_Aint*) lwgrp_malloc(
+    rounds * sizeof(MPI_Aint), sizeof(MPI_Aint), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < 2 * rounds; i++) {
+    r->slots[i].ready   = 0;
+    r->slots[i].arrived = 0;
+    r->slots[i].addr    = 0;
+  }
+  if (rounds > 0) {
+    MPI_Win_attach(r->win, r->slots, (MPI_Aint) bytes);
+  }
+  MPI_Win_sync(r->win);
+
+  /* swap mailbox addresses with each partner, both sides post sends
+   * and receives in the same order of round, so messages between two
+   * procs that are partners more than once still match up --
+   * O(log N) communication */
+  MPI_Aint mine;
+  MPI_Get_address(r->slots, &mine);
+  MPI_Request* req = (MPI_Request*) lwgrp_scratch_alloc(
+    4 * rounds * sizeof(MPI_Request), __FILE__, __LINE__
+  );
+  for (i = 0; i < rounds; i++) {
+    int left  = list->left_list[i];
+    int right = list->right_list[i];
+    MPI_Irecv(
+      &r->right[i], 1, MPI_AINT, right, ring->tag, ring->comm, &req[4 * i + 0]
+    );
+    MPI_Irecv(
+      &r->left[i], 1, MPI_AINT, left, ring->tag, ring->comm, &req[4 * i + 1]
+    );
+    MPI_Isend(
+      &mine, 1, MPI_AINT, left, ring->tag, ring->comm, &req[4 * i + 2]
+    );
+    MPI_Isend(
+      &mine, 1, MPI_AINT, right, ring->tag, ring->comm, &req[4 * i + 3]
+    );
+  }
+  MPI_Waitall(4 * rounds, req, MPI_STATUSES_IGNORE);
+  lwgrp_scratch_free(&req);
+
+  *rma = r;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_free(lwgrp_rma** rma)
+{
+  lwgrp_rma* r = *rma;
+  if (r == NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  if (r->rounds > 0) {
+    MPI_Win_detach(r->win, r->slots);
+  }
+  lwgrp_free(&r->right);
+  lwgrp_free(&r->left);
+  lwgrp_free(&r->slots);
+  lwgrp_free(rma);
+  return LWGRP_SUCCESS;
+}
+
+/* attach the span of count elements at buf */
+static void lwgrp_rma_attach(lwgrp_rma* rma, void* buf, int count, const lwgrp_type_desc* desc)
+{
+  char* start = (char*) buf + desc->true_lb;
+  MPI_Aint bytes = (MPI_Aint) ((size_t) (count - 1) * desc->extent + desc->true_extent);
+  MPI_Win_attach(rma->win, start, bytes);
+}
+
+static void lwgrp_rma_detach(lwgrp_rma* rma, void* buf, const lwgrp_type_desc* desc)
+{
+  MPI_Win_detach(rma->win, (char*) buf + desc->true_lb);
+}
+
+/* post seq to a flag of target at disp, the caller flushes */
+static void lwgrp_rma_post(lwgrp_rma* rma, int target, MPI_Aint disp, const long* seq)
+{
+  MPI_Accumulate(
+    (void*) seq, 1, MPI_LONG, target, disp, 1, MPI_LONG, MPI_REPLACE, rma->win
+  );
+}
+
+/* put the window address of buf to a slot of target, addr must stay
+ * valid until the caller flushes, after which it posts seq to ready */
+static void lwgrp_rma_post_addr(
+  lwgrp_rma* rma, int target, MPI_Aint base, int index,
+  void* buf, MPI_Aint* addr)
+{
+  MPI_Get_address(buf, addr);
+  MPI_Put(
+    addr, 1, MPI_AINT, target, LWGRP_RMA_DISP(base, index, addr),
+    1, MPI_AINT, rma->win
+  );
+}
+
+/* wait until a flag in our own mailbox reaches seq, after which our
+ * loads see whatever the partner put before posting it */
+static void lwgrp_rma_wait(lwgrp_rma* rma, int self, long* flag, long seq)
+{
+  MPI_Aint disp;
+  MPI_Get_address(flag, &disp);
+
+  long value = 0;
+  int spins = 0;
+  while (1) {
+    MPI_Fetch_and_op(
+      NULL, &value, MPI_LONG, self, disp, MPI_NO_OP, rma->win
+    );
+    MPI_Win_flush(self, rma->win);
+    if (value >= seq) {
+      break;
+    }
+    spins++;
+    if (spins == LWGRP_RMA_SPINS) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+  MPI_Win_sync(rma->win);
+}
+
+/* put count elements from buf to the address dst posted in our slot
+ * index, then post seq to its slot post_index in the mailbox at base */
+static void lwgrp_rma_put(
+  lwgrp_rma* rma, int self, const void* buf, int count, MPI_Datatype type,
+  int dst, int index, MPI_Aint base, int post_index, const long* seq)
+{
+  lwgrp_rma_wait(rma, self, &rma->slots[index].ready, *seq);
+  MPI_Aint addr = rma->slots[index].addr;
+  MPI_Put(
+    (void*) buf, count, type, dst, addr, count, type, rma->win
+  );
+  MPI_Win_flush(dst, rma->win);
+  lwgrp_rma_post(rma, dst, LWGRP_RMA_DISP(base, post_index, arrived), seq);
+  MPI_Win_flush(dst, rma->win);
+}
+
+int lwgrp_logring_allgather_brucks_rma(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  int self   = group->comm_rank;
+  int rank   = group->group_rank;
+  int ranks  = group->group_size;
+  int rounds = rma->rounds;
+  long seq   = ++rma->seq;
+
+  /* allocate temporary buffer, which is where our partners put */
+  size_t total_elems = num * ranks;
+  void* tmpbuf = lwgrp_desc_dtbuf_alloc(
+    total_elems, &dt, __FILE__, __LINE__
+  );
+  lwgrp_rma_attach(rma, tmpbuf, (int) total_elems, &dt);
+
+  /* tell the source of each round where its data goes, the position
+   * of each round only depends on the group size, we are the left
+   * partner of our source in each round, and we post all addresses
+   * before any flags so the whole exchange takes two flushes */
+  MPI_Aint* addrs = (MPI_Aint*) lwgrp_scratch_alloc(
+    rounds * sizeof(MPI_Aint), __FILE__, __LINE__
+  );
+  int index = 0;
+  int step  = 1;
+  int ranks_received = 1;
+  while (step < ranks) {
+    int ranks_incoming = step;
+    if (ranks_received + ranks_incoming > ranks) {
+      ranks_incoming = ranks - ranks_received;
+    }
+    void* recv_pos = lwgrp_desc_dtbuf_from_dtbuf(
+      tmpbuf, ranks_received * num, &dt
+    );
+    lwgrp_rma_post_addr(
+      rma, list->right_list[index], rma->right[index], index,
+      recv_pos, &addrs[index]
+    );
+    ranks_received += ranks_incoming;
+    index++;
+    step <<= 1;
+  }
+  MPI_Win_flush_all(rma->win);
+  for (index = 0; index < rounds; index++) {
+    lwgrp_rma_post(
+      rma, list->right_list[index],
+      LWGRP_RMA_DISP(rma->right[index], index, ready), &seq
+    );
+  }
+  MPI_Win_flush_all(rma->win);
+  lwgrp_scratch_free(&addrs);
+
+  /* copy our own data into the temporary buffer */
+  const void* inputbuf = sendbuf;
+  if (sendbuf == MPI_IN_PLACE) {
+    inputbuf = (const void*) lwgrp_desc_dtbuf_from_dtbuf(
+      recvbuf, num * rank, &dt
+    );
+  }
+  lwgrp_desc_dtbuf_memcpy(tmpbuf, inputbuf, num, &dt);
+
+  /* execute the allgather operation */
+  index = 0;
+  step  = 1;
+  ranks_received = 1;
+  while (step < ranks) {
+    /* get ranks for left and right partners */
+    int dst = list->left_list[index];
+
+    /* determine number of elements we'll be sending and receiving in
+     * this round */
+    int ranks_incoming = step;
+    if (ranks_received + ranks_incoming > ranks) {
+      ranks_incoming = ranks - ranks_received;
+    }
+    int num_exchange = num * ranks_incoming;
+
+    /* put our data to the destination, we are its right partner */
+    lwgrp_rma_put(
+      rma, self, tmpbuf, num_exchange, datatype, dst,
+      index, rma->left[index], rounds + index, &seq
+    );
+
+    /* wait for the data from our right partner to land */
+    lwgrp_rma_wait(rma, self, &rma->slots[rounds + index].arrived, seq);
+
+    /* add the count to the total number we've received */
+    ranks_received += ranks_incoming;
+
+    /* go on to next iteration */
+    index++;
+    step <<= 1;
+  }
+  lwgrp_rma_detach(rma, tmpbuf, &dt);
+
+  /* shift our data back to the proper position in receive buffer */
+  int num_pre  = num * rank;
+  int num_post = num * (ranks - rank);
+  void* buf_pre  = lwgrp_desc_dtbuf_from_dtbuf(
+    recvbuf, num_pre, &dt
+  );
+  void* buf_post = lwgrp_desc_dtbuf_from_dtbuf(
+    tmpbuf, num_post, &dt
+  );
+  lwgrp_desc_dtbuf_memcpy(buf_pre, tmpbuf,  num_post, &dt);
+  lwgrp_desc_dtbuf_memcpy(recvbuf, buf_post, num_pre, &dt);
+
+  /* free the temporary buffer */
+  lwgrp_desc_dtbuf_free(&tmpbuf, &dt, __FILE__, __LINE__);
+
+  return rc;
+}
+
+int lwgrp_logring_bcast_binomial_rma(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma)
+{
+  lwgrp_type_desc dt;
+  lwgrp_type_desc_init(&dt, datatype);
+
+  int rc = LWGRP_SUCCESS;
+
+  /* get ring info */
+  int self   = group->comm_rank;
+  int rank   = group->group_rank;
+  int ranks  = group->group_size;
+  int rounds = rma->rounds;
+  long seq   = ++rma->seq;
+
+  /* adjust our rank by setting the root to be rank 0 */
+  int treerank = rank - root;
+  if (treerank < 0) {
+    treerank += ranks;
+  }
+
+  /* we receive from the parent 2^k hops to our left, where bit k is
+   * the lowest bit set in treerank, we are its right partner, so
+   * attach our buffer and tell it where to put */
+  int k = -1;
+  if (treerank > 0) {
+    k = 0;
+    while (! (treerank & (1 << k))) {
+      k++;
+    }
+    int parent = list->left_list[k];
+    MPI_Aint base = rma->left[k];
+    MPI_Aint addr;
+    lwgrp_rma_attach(rma, buffer, count, &dt);
+    lwgrp_rma_post_addr(rma, parent, base, rounds + k, buffer, &addr);
+    MPI_Win_flush(parent, rma->win);
+    lwgrp_rma_post(
+      rma, parent, LWGRP_RMA_DISP(base, rounds + k, ready), &seq
+    );
+    MPI_Win_flush(parent, rma->win);
+  }
+
+  /* get largest power-of-two strictly less than ranks */
+  int pow2, log2;
+  lwgrp_largest_pow2_log2_lessthan(ranks, &pow2, &log2);
+
+  /* run through binomial tree */
+  int received = (rank == root) ? 1 : 0;
+  while (pow2 > 0) {
+    /* check whether we need to receive or send data */
+    if (! received) {
+      /* wait for the data from our parent as its step comes up */
+      if (log2 == k) {
+        lwgrp_rma_wait(rma, self, &rma->slots[k].arrived, seq);
+        lwgrp_rma_detach(rma, buffer, &dt);
+        received = 1;
+      }
+    } else {
+      /* we have received the data, so if we have a child,
+       * put data, we are its left partner */
+      if (treerank + pow2 < ranks) {
+        int dst = list->right_list[log2];
+        lwgrp_rma_put(
+          rma, self, buffer, count, datatype, dst,
+          rounds + log2, rma->right[log2], log2, &seq
+        );
+      }
+    }
+
+    /* cut the step size in half and keep going */
+    log2--;
+    pow2 >>= 1;
+  }
+
+  return rc;
+}
+
+#else /* LWGRP_HAVE_RMA */
+
+/* without MPI-3 there are no windows, so comms keep sending messages */
+
+int lwgrp_rma_init(MPI_Comm comm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_finalize(MPI_Comm comm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_create(const lwgrp_comm* comm, lwgrp_rma** rma)
+{
+  *rma = NULL;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_rma_free(lwgrp_rma** rma)
+{
+  *rma = NULL;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_logring_allgather_brucks_rma(
+  const void* sendbuf,
+  void* recvbuf,
+  int num,
+  MPI_Datatype datatype,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma)
+{
+  return lwgrp_logring_allgather_brucks(
+    sendbuf, recvbuf, num, datatype, group, list
+  );
+}
+
+int lwgrp_logring_bcast_binomial_rma(
+  void* buffer,
+  int count,
+  MPI_Datatype datatype,
+  int root,
+  const lwgrp_ring* group,
+  const lwgrp_logring* list,
+  lwgrp_rma* rma)
+{
+  return lwgrp_logring_bcast_binomial(
+    buffer, count, datatype, root, group, list
+  );
+}
+
+#endif /* LWGRP_HAVE_RMA */
+
+int lwgrp_comm_set_transport(lwgrp_comm* comm, int transport)
+{
+  if (transport == LWGRP_TRANSPORT_RMA) {
+    if (comm->rma == NULL) {
+      return lwgrp_rma_create(comm, &comm->rma);
+    }
+    return LWGRP_SUCCESS;
+  }
+  return lwgrp_rma_free(&comm->rma);
+}
@@ -0,0 +1,402 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Collectives among procs of one node through an MPI-3 shared memory
+ * window rather than messages.  Each proc owns a slot of the window.
+ * In every step, procs copy data into their own slot and store the
+ * step's token in their ready flag, wait for the ready flags of the
+ * slots they need, load from those slots, and then store the token in
+ * their done flag.  Before a proc writes its slot in a step, it waits
+ * for every done flag to reach the previous token, so nobody is still
+ * reading what it is about to overwrite.  Flags only grow, so a proc
+ * may run ahead into the next step before the others see the last. */
+
+/* bytes of the control block at the start of each slot, the ready
+ * and done flags live on separate cache lines */
+#define LWGRP_SHM_CTL_BYTES (128)
+#define LWGRP_SHM_DONE (64)
+
+/* number of times we poll a flag before yielding the cpu to other
+ * procs, which matters when the node is oversubscribed */
+#define LWGRP_SHM_SPINS (1000)
+
+/* slot size, read from the environment on first use */
+static pthread_once_t lwgrp_shm_tune_once = PTHREAD_ONCE_INIT;
+static size_t lwgrp_shm_slot_bytes;
+
+static void lwgrp_shm_tune_init(void)
+{
+  lwgrp_shm_slot_bytes = lwgrp_getenv_size(
+    "LWGRP_SHM_SLOT_BYTES", LWGRP_SHM_SLOT_BYTES
+  );
+}
+
+int lwgrp_shm_usable(const lwgrp_shm* shm, const lwgrp_type_desc* desc)
+{
+  if (shm == NULL) {
+    return 0;
+  }
+
+  /* we copy elements as plain bytes starting at the buffer address,
+   * and a slot must hold at least one element */
+  return (desc->contig && desc->lb == 0 && desc->true_lb == 0 &&
+    desc->size > 0 && desc->size <= shm->slot_bytes);
+}
+
+#ifdef LWGRP_HAVE_SHM
+
+static volatile unsigned long* lwgrp_shm_ready(const lwgrp_shm* shm, int rank)
+{
+  return (volatile unsigned long*) (shm->slots[rank] - LWGRP_SHM_CTL_BYTES);
+}
+
+static volatile unsigned long* lwgrp_shm_done(const lwgrp_shm* shm, int rank)
+{
+  return (volatile unsigned long*) (shm->slots[rank] - LWGRP_SHM_CTL_BYTES + LWGRP_SHM_DONE);
+}
+
+/* publish token in flag, after all of our stores to the segment */
+static void lwgrp_shm_post(volatile unsigned long* flag, unsigned long token)
+{
+  __atomic_store_n(flag, token, __ATOMIC_RELEASE);
+}
+
+/* wait until flag reaches token, our loads that follow see all
+ * stores the owner made before posting it */
+static void lwgrp_shm_wait(volatile unsigned long* flag, unsigned long token)
+{
+  int spins = 0;
+  while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) < token) {
+    spins++;
+    if (spins == LWGRP_SHM_SPINS) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+}
+
+/* wait until all procs have finished the step of token, so we may
+ * overwrite our slot */
+static void lwgrp_shm_wait_done(const lwgrp_shm* shm, unsigned long token)
+{
+  int i;
+  for (i = 0; i < shm->ranks; i++) {
+    if (i != shm->rank) {
+      lwgrp_shm_wait(lwgrp_shm_done(shm, i), token);
+    }
+  }
+}
+
+/* wait until all procs have posted the step of token */
+static void lwgrp_shm_wait_ready(const lwgrp_shm* shm, unsigned long token)
+{
+  int i;
+  for (i = 0; i < shm->ranks; i++) {
+    if (i != shm->rank) {
+      lwgrp_shm_wait(lwgrp_shm_ready(shm, i), token);
+    }
+  }
+}
+
+int lwgrp_shm_create(MPI_Comm comm, lwgrp_shm** shm)
+{
+  pthread_once(&lwgrp_shm_tune_once, lwgrp_shm_tune_init);
+
+  int rank, ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &ranks);
+
+  /* with one proc there's nobody to share with */
+  *shm = NULL;
+  if (lwgrp_shm_slot_bytes == 0 || ranks < 2) {
+    MPI_Comm_free(&comm);
+    return LWGRP_SUCCESS;
+  }
+
+  lwgrp_shm* s = (lwgrp_shm*) lwgrp_malloc(
+    sizeof(lwgrp_shm), sizeof(void*), __FILE__, __LINE__
+  );
+  s->comm       = comm;
+  s->rank       = rank;
+  s->ranks      = ranks;
+  s->slot_bytes = lwgrp_shm_slot_bytes;
+  s->token      = 0;
+
+  /* let MPI place each slot near its owner */
+  MPI_Info info;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+
+  char* base;
+  MPI_Win_allocate_shared(
+    (MPI_Aint) (LWGRP_SHM_CTL_BYTES + s->slot_bytes), 1, info, comm,
+    &base, &s->win
+  );
+  MPI_Info_free(&info);
+
+  /* look up where each slot is mapped in our address space */
+  s->slots = (char**) lwgrp_malloc(
+    ranks * sizeof(char*), sizeof(char*), __FILE__, __LINE__
+  );
+  int i;
+  for (i = 0; i < ranks; i++) {
+    MPI_Aint size;
+    int disp;
+    char* ptr;
+    MPI_Win_shared_query(s->win, i, &size, &disp, &ptr);
+    s->slots[i] = ptr + LWGRP_SHM_CTL_BYTES;
+  }
+
+  /* we synchronize with our own flags, so open one passive epoch
+   * for the life of the window */
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, s->win);
+
+  /* clear our flags before anyone waits on them */
+  lwgrp_shm_post(lwgrp_shm_ready(s, rank), 0);
+  lwgrp_shm_post(lwgrp_shm_done(s, rank), 0);
+  MPI_Win_sync(s->win);
+  MPI_Barrier(comm);
+
+  *shm = s;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_free(lwgrp_shm** shm)
+{
+  lwgrp_shm* s = *shm;
+  if (s == NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  MPI_Win_unlock_all(s->win);
+  MPI_Win_free(&s->win);
+  MPI_Comm_free(&s->comm);
+  lwgrp_free(&s->slots);
+  lwgrp_free(shm);
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_barrier(lwgrp_shm* shm)
+{
+  /* post that we've arrived and wait on everyone else */
+  unsigned long token = ++shm->token;
+  lwgrp_shm_post(lwgrp_shm_ready(shm, shm->rank), token);
+  lwgrp_shm_wait_ready(shm, token);
+  lwgrp_shm_post(lwgrp_shm_done(shm, shm->rank), token);
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_bcast(void* buf, size_t bytes, int root, lwgrp_shm* shm)
+{
+  int rank = shm->rank;
+  char* slot = shm->slots[root];
+
+  /* move the buffer through the root's slot a piece at a time */
+  size_t offset = 0;
+  while (offset < bytes) {
+    size_t len = bytes - offset;
+    if (len > shm->slot_bytes) {
+      len = shm->slot_bytes;
+    }
+
+    unsigned long token = ++shm->token;
+    if (rank == root) {
+      lwgrp_shm_wait_done(shm, token - 1);
+      memcpy(slot, (char*)buf + offset, len);
+      lwgrp_shm_post(lwgrp_shm_ready(shm, root), token);
+    } else {
+      lwgrp_shm_wait(lwgrp_shm_ready(shm, root), token);
+      memcpy((char*)buf + offset, slot, len);
+    }
+    lwgrp_shm_post(lwgrp_shm_done(shm, rank), token);
+
+    offset += len;
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_gather(
+  const void* sendbuf,
+  size_t bytes,
+  void* recvbuf,
+  int all,
+  lwgrp_shm* shm)
+{
+  int rank  = shm->rank;
+  int ranks = shm->ranks;
+  int recv  = (all || rank == 0);
+
+  /* each proc moves a piece of its data through its own slot
+   * in each step */
+  size_t offset = 0;
+  while (offset < bytes) {
+    size_t len = bytes - offset;
+    if (len > shm->slot_bytes) {
+      len = shm->slot_bytes;
+    }
+
+    unsigned long token = ++shm->token;
+    lwgrp_shm_wait_done(shm, token - 1);
+    memcpy(shm->slots[rank], (const char*)sendbuf + offset, len);
+    lwgrp_shm_post(lwgrp_shm_ready(shm, rank), token);
+
+    if (recv) {
+      int i;
+      for (i = 0; i < ranks; i++) {
+        if (i != rank) {
+          lwgrp_shm_wait(lwgrp_shm_ready(shm, i), token);
+        }
+        memcpy((char*)recvbuf + i * bytes + offset, shm->slots[i], len);
+      }
+    }
+    lwgrp_shm_post(lwgrp_shm_done(shm, rank), token);
+
+    offset += len;
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_reduce(
+  const void* sendbuf,
+  void* recvbuf,
+  int count,
+  MPI_Datatype type,
+  MPI_Op op,
+  int all,
+  lwgrp_shm* shm)
+{
+  int rank  = shm->rank;
+  int ranks = shm->ranks;
+
+  int size;
+  MPI_Type_size(type, &size);
+  int slot_count = (int) (shm->slot_bytes / (size_t) size);
+
+  /* in each step, every proc copies a piece of its data into its own
+   * slot, then each proc reduces one block of that piece across all
+   * slots into slot 0, so all procs share the work, and finally we
+   * copy the result out of slot 0 */
+  char* result = shm->slots[0];
+  int offset = 0;
+  while (offset < count) {
+    int chunk = count - offset;
+    if (chunk > slot_count) {
+      chunk = slot_count;
+    }
+    size_t chunk_offset = (size_t) offset * (size_t) size;
+
+    unsigned long token = ++shm->token;
+    lwgrp_shm_wait_done(shm, token - 1);
+    memcpy(shm->slots[rank], (const char*)sendbuf + chunk_offset, (size_t) chunk * size);
+    lwgrp_shm_post(lwgrp_shm_ready(shm, rank), token);
+    lwgrp_shm_wait_ready(shm, token);
+
+    int block_offset, block_count;
+    lwgrp_block_range(chunk, ranks, rank, &block_offset, &block_count);
+    if (block_count > 0) {
+      size_t block = (size_t) block_offset * (size_t) size;
+      int i;
+      for (i = 1; i < ranks; i++) {
+        lwgrp_reduce_local(
+          shm->slots[i] + block, result + block, block_count, type, op
+        );
+      }
+    }
+
+    /* wait for all blocks of the result */
+    token = ++shm->token;
+    lwgrp_shm_post(lwgrp_shm_ready(shm, rank), token);
+    lwgrp_shm_wait_ready(shm, token);
+    if (all || rank == 0) {
+      memcpy((char*)recvbuf + chunk_offset, result, (size_t) chunk * size);
+    }
+    lwgrp_shm_post(lwgrp_shm_done(shm, rank), token);
+
+    offset += chunk;
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+#else /* LWGRP_HAVE_SHM */
+
+/* without shared windows we never build a segment, so the ops
+ * below are never called */
+
+int lwgrp_shm_create(MPI_Comm comm, lwgrp_shm** shm)
+{
+  MPI_Comm_free(&comm);
+  *shm = NULL;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_free(lwgrp_shm** shm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_barrier(lwgrp_shm* shm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_bcast(void* buf, size_t bytes, int root, lwgrp_shm* shm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_gather(const void* sendbuf, size_t bytes, void* recvbuf,
+  int all, lwgrp_shm* shm)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_shm_reduce(const void* sendbuf, void* recvbuf, int count,
+  MPI_Datatype type, MPI_Op op, int all, lwgrp_shm* shm)
+{
+  return LWGRP_SUCCESS;
+}
+
+#endif /* LWGRP_HAVE_SHM */
+
+int lwgrp_shm_split(
+  const lwgrp_shm* shm,
+  int color,
+  int key,
+  lwgrp_shm** newshm)
+{
+  *newshm = NULL;
+  if (shm == NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* this only talks to procs on our node */
+  MPI_Comm comm;
+  MPI_Comm_split(shm->comm, color, key, &comm);
+  if (comm == MPI_COMM_NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  int rc = lwgrp_shm_create(comm, newshm);
+  return rc;
+}
@@ -0,0 +1,1200 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* Parallel sort of count items per process, where every process
+ * provides the same count.  On output, the items are globally sorted
+ * such that process i holds items [i*count, (i+1)*count) of the sorted
+ * sequence, with each process' items in ascending order.
+ *
+ * We have three backends:
+ *   gather  - allgather all items and sort locally, log N steps but
+ *             O(N*count) memory, used when total data is small
+ *   bitonic - bitonic sort with a merge-split of count items at each
+ *             compare-exchange step, O(log^2 N) steps
+ *   sample  - regular sample sort, gather a bounded set of samples to
+ *             pick splitters, route items to their bucket, repeat
+ *             within each bucket until a bucket is a single proc,
+ *             then route items to their final position, O(log N)
+ *             steps per round and log_B N rounds for B buckets
+ *
+ * Items are moved with memcpy as blocks of extent bytes, so the
+ * datatype must describe a contiguous item whose lower bound is 0. */
+
+/* use gather sort if the total number of bytes across all processes
+ * is at most this size */
+#ifndef LWGRP_SORT_GATHER_BYTES
+#define LWGRP_SORT_GATHER_BYTES (64 * 1024)
+#endif
+
+/* use sample sort instead of bitonic sort for groups having at least
+ * this many processes, unless a LWGRP_TUNE rule for sort says otherwise */
+#ifndef LWGRP_SORT_SAMPLE_RANKS
+#define LWGRP_SORT_SAMPLE_RANKS (512)
+#endif
+
+/* maximum number of buckets a sample sort splits a range of procs into
+ * in one round */
+#ifndef LWGRP_SORT_BUCKETS
+#define LWGRP_SORT_BUCKETS (64)
+#endif
+
+/* number of samples per bucket a process keeps while picking splitters */
+#ifndef LWGRP_SORT_SAMPLES
+#define LWGRP_SORT_SAMPLES (4)
+#endif
+
+/* ---------------------------------
+ * Local sort
+ * --------------------------------- */
+
+/* bottom-up merge sort of count items of size bytes each, we use our
+ * own rather than qsort since our comparison functions take an offset
+ * argument, this sort is stable */
+int lwgrp_sort_local(
+  void* buf,
+  int count,
+  size_t size,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset)
+{
+  if (count < 2) {
+    return LWGRP_SUCCESS;
+  }
+
+  /* allocate a scratch buffer to merge into */
+  char* scratch = (char*) lwgrp_scratch_alloc(count * size, __FILE__, __LINE__);
+
+  char* src = (char*) buf;
+  char* dst = scratch;
+  int width;
+  for (width = 1; width < count; width <<= 1) {
+    int start;
+    for (start = 0; start < count; start += 2 * width) {
+      /* merge [start, mid) with [mid, end) */
+      int mid = start + width;
+      int end = start + 2 * width;
+      if (mid > count) {
+        mid = count;
+      }
+      if (end > count) {
+        end = count;
+      }
+
+      int i = start;
+      int j = mid;
+      int n = start;
+      while (i < mid && j < end) {
+        /* take from the left run on ties to keep the sort stable */
+        if ((*compare)(src + j * size, src + i * size, offset) < 0) {
+          memcpy(dst + n * size, src + j * size, size);
+          j++;
+        } else {
+          memcpy(dst + n * size, src + i * size, size);
+          i++;
+        }
+        n++;
+      }
+      if (i < mid) {
+        memcpy(dst + n * size, src + i * size, (mid - i) * size);
+      }
+      if (j < end) {
+        memcpy(dst + n * size, src + j * size, (end - j) * size);
+      }
+    }
+
+    /* swap source and destination buffers for next pass */
+    char* tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  /* copy result back to caller's buffer if needed */
+  if (src != (char*) buf) {
+    memcpy(buf, src, count * size);
+  }
+
+  lwgrp_scratch_free(&scratch);
+
+  return LWGRP_SUCCESS;
+}
+
+/* ---------------------------------
+ * Bitonic sort
+ * --------------------------------- */
+
+/* given two ascending lists of count items in value and recv, merge
+ * them and keep either the lowest or highest count items in value */
+static void lwgrp_sort_merge_split(
+  void* value,
+  const void* recv,
+  void* tmp,
+  int count,
+  size_t size,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  int keep_low)
+{
+  /* with a single item, we just need one comparison */
+  if (count == 1) {
+    int cmp = (*compare)(recv, value, offset);
+    if ((keep_low && cmp < 0) || (!keep_low && cmp > 0)) {
+      memcpy(value, recv, size);
+    }
+    return;
+  }
+
+  const char* a = (const char*) value;
+  const char* b = (const char*) recv;
+  char* out = (char*) tmp;
+  int i, j, n;
+  if (keep_low) {
+    /* walk both lists from the front taking the smaller item */
+    i = 0;
+    j = 0;
+    for (n = 0; n < count; n++) {
+      if ((*compare)(b + j * size, a + i * size, offset) < 0) {
+        memcpy(out + n * size, b + j * size, size);
+        j++;
+      } else {
+        memcpy(out + n * size, a + i * size, size);
+        i++;
+      }
+    }
+  } else {
+    /* walk both lists from the back taking the larger item */
+    i = count - 1;
+    j = count - 1;
+    for (n = count - 1; n >= 0; n--) {
+      if ((*compare)(b + j * size, a + i * size, offset) > 0) {
+        memcpy(out + n * size, b + j * size, size);
+        j--;
+      } else {
+        memcpy(out + n * size, a + i * size, size);
+        i--;
+      }
+    }
+  }
+  memcpy(value, tmp, count * size);
+}
+
+static int lwgrp_logchain_sort_bitonic_merge(
+  void* value,
+  void* scratch,
+  void* tmp,
+  int items,
+  MPI_Datatype type,
+  size_t type_size,
+  size_t offset,
+  int (*compare)(const void*, const void*, size_t),
+  int start,
+  int num,
+  int direction,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list,
+  int tag)
+{
+  if (num > 1) {
+    /* get our group communicator and our rank within the group */
+    MPI_Comm comm = group->comm;
+    int rank = group->group_rank;
+
+    /* determine largest power of two that is smaller than num */
+    int count = 1;
+    int index = 0;
+    while (count < num) {
+      count <<= 1;
+      index++;
+    }
+    count >>= 1;
+    index--;
+
+    /* divide range into two chunks, execute bitonic half-clean step,
+     * then recursively merge each half */
+    MPI_Status status[2];
+    if (rank < start + count) {
+      /* we are in the lower half, find a partner in the upper half */
+      int dst_rank = rank + count;
+      if (dst_rank < start + num) {
+        /* exchange data with our partner rank */
+        int partner = list->right_list[index];
+        MPI_Sendrecv(
+          value,   items, type, partner, tag,
+          scratch, items, type, partner, tag,
+          comm, status
+        );
+
+        /* keep the smaller items if direction is ascending,
+         * and the larger items if direction is descending */
+        lwgrp_sort_merge_split(
+          value, scratch, tmp, items, type_size, compare, offset,
+          direction
+        );
+      }
+
+      /* recursively merge our half */
+      lwgrp_logchain_sort_bitonic_merge(
+        value, scratch, tmp, items, type, type_size, offset, compare,
+        start, count, direction,
+        group, list, tag
+      );
+    } else {
+      /* we are in the upper half, find a partner in the lower half */
+      int dst_rank = rank - count;
+      if (dst_rank >= start) {
+        /* exchange data with our partner rank */
+        int partner = list->left_list[index];
+        MPI_Sendrecv(
+          value,   items, type, partner, tag,
+          scratch, items, type, partner, tag,
+          comm, status
+        );
+
+        /* keep the larger items if direction is ascending,
+         * and the smaller items if direction is descending */
+        lwgrp_sort_merge_split(
+          value, scratch, tmp, items, type_size, compare, offset,
+          !direction
+        );
+      }
+
+      /* recursively merge our half */
+      int new_start = start + count;
+      int new_num   = num - count;
+      lwgrp_logchain_sort_bitonic_merge(
+        value, scratch, tmp, items, type, type_size, offset, compare,
+        new_start, new_num, direction,
+        group, list, tag
+      );
+    }
+  }
+
+  return 0;
+}
+
+static int lwgrp_logchain_sort_bitonic_sort(
+  void* value,
+  void* scratch,
+  void* tmp,
+  int items,
+  MPI_Datatype type,
+  size_t type_size,
+  size_t offset,
+  int (*compare)(const void*, const void*, size_t),
+  int start,
+  int num,
+  int direction,
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list,
+  int tag)
+{
+  if (num > 1) {
+    /* get our rank in our group */
+    int rank = group->group_rank;
+
+    /* recursively divide and sort each half */
+    int mid = num / 2;
+    if (rank < start + mid) {
+      /* sort first half in one direction */
+      lwgrp_logchain_sort_bitonic_sort(
+        value, scratch, tmp, items, type, type_size, offset, compare,
+        start, mid, !direction,
+        group, list, tag
+      );
+    } else {
+      /* sort the second half in the other direction */
+      int new_start = start + mid;
+      int new_num   = num - mid;
+      lwgrp_logchain_sort_bitonic_sort(
+        value, scratch, tmp, items, type, type_size, offset, compare,
+        new_start, new_num, direction,
+        group, list, tag
+      );
+    }
+
+    /* merge the two sorted halves */
+    lwgrp_logchain_sort_bitonic_merge(
+      value, scratch, tmp, items, type, type_size, offset, compare,
+      start, num, direction,
+      group, list, tag
+    );
+  }
+
+  return 0;
+}
+
+/* globally sort items across processes in group,
+ * each process provides count items in value on input,
+ * on output value is overwritten with new items such that
+ * if rank_i < rank_j, item_i < item_j for all i and j,
+ * the items on each process are in ascending order */
+int lwgrp_logchain_sort_bitonic(
+  void* value,
+  int count,
+  MPI_Datatype type,
+  size_t type_size,
+  size_t data_offset,
+  int (*compare)(const void*, const void*, size_t),
+  const lwgrp_chain* group,
+  const lwgrp_logchain* list,
+  int tag)
+{
+  /* merge-split steps expect each process' items to be in order */
+  lwgrp_sort_local(value, count, type_size, compare, data_offset);
+
+  /* allocate scratch buffers to hold received items during sort
+   * and to merge into */
+  void* scratch = lwgrp_scratch_alloc(count * type_size, __FILE__, __LINE__);
+  void* tmp     = NULL;
+  if (count > 1) {
+    tmp = lwgrp_scratch_alloc(count * type_size, __FILE__, __LINE__);
+  }
+
+  /* conduct the bitonic sort on our values */
+  int ranks = group->group_size;
+  int rc = lwgrp_logchain_sort_bitonic_sort(
+    value, scratch, tmp, count, type, type_size, data_offset, compare,
+    0, ranks, 1,
+    group, list, tag
+  );
+
+  /* free the buffers */
+  lwgrp_scratch_free(&tmp);
+  lwgrp_scratch_free(&scratch);
+
+  return rc;
+}
+
+/* ---------------------------------
+ * Gather sort
+ * --------------------------------- */
+
+/* allgather all items, sort them locally, and keep our slice */
+int lwgrp_comm_sort_gather(
+  void* buf,
+  int count,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  int rc = LWGRP_SUCCESS;
+
+  int rank  = comm->ring.group_rank;
+  int ranks = comm->ring.group_size;
+
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(type, &lb, &extent);
+  size_t size = (size_t) extent;
+
+  /* gather all items to all procs */
+  int total = count * ranks;
+  char* all = (char*) lwgrp_scratch_alloc(total * size, __FILE__, __LINE__);
+  rc = lwgrp_logring_allgather_brucks(
+    buf, all, count, type, &comm->ring, &comm->logring
+  );
+
+  /* sort everything and copy out our part */
+  lwgrp_sort_local(all, total, size, compare, offset);
+  memcpy(buf, all + rank * count * size, count * size);
+
+  lwgrp_scratch_free(&all);
+
+  return rc;
+}
+
+/* ---------------------------------
+ * Sample sort
+ * --------------------------------- */
+
+/* Each round splits a range of procs into at most LWGRP_SORT_BUCKETS
+ * buckets, each bucket owning a contiguous slice of the range.  Procs
+ * of a range pick splitters from a bounded set of samples, send each
+ * item to a proc in the slice of its bucket, and the next round then
+ * sorts within each slice, until every slice holds a single proc.
+ * Items travel in records that carry a destination, a final slot, and
+ * the rank and index the item started from, which breaks ties so that
+ * many equal keys still spread evenly over the procs. */
+
+/* records start with this many ints ahead of the item */
+#define LWGRP_SORT_REC_INTS (4)
+
+/* full order of two records, by key first and then by origin */
+static int lwgrp_sort_rec_compare(
+  const char* a,
+  const char* b,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset)
+{
+  size_t hdr = LWGRP_SORT_REC_INTS * sizeof(int);
+  int rc = (*compare)(a + hdr, b + hdr, offset);
+  if (rc != 0) {
+    return rc;
+  }
+
+  const int* x = (const int*) a;
+  const int* y = (const int*) b;
+  if (x[2] != y[2]) {
+    return (x[2] < y[2]) ? -1 : 1;
+  }
+  if (x[3] != y[3]) {
+    return (x[3] < y[3]) ? -1 : 1;
+  }
+  return 0;
+}
+
+/* merge the sorted records in a and b into out */
+static void lwgrp_sort_rec_merge(
+  const char* a,
+  int acount,
+  const char* b,
+  int bcount,
+  char* out,
+  size_t rec_size,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset)
+{
+  int i = 0;
+  int j = 0;
+  int n = 0;
+  while (i < acount && j < bcount) {
+    if (lwgrp_sort_rec_compare(b + j * rec_size, a + i * rec_size, compare, offset) < 0) {
+      memcpy(out + n * rec_size, b + j * rec_size, rec_size);
+      j++;
+    } else {
+      memcpy(out + n * rec_size, a + i * rec_size, rec_size);
+      i++;
+    }
+    n++;
+  }
+  if (i < acount) {
+    memcpy(out + n * rec_size, a + i * rec_size, (acount - i) * rec_size);
+  }
+  if (j < bcount) {
+    memcpy(out + n * rec_size, b + j * rec_size, (bcount - j) * rec_size);
+  }
+}
+
+/* bottom-up merge sort of count records in full order */
+static void lwgrp_sort_rec_local(
+  char* recs,
+  int count,
+  size_t rec_size,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset)
+{
+  if (count < 2) {
+    return;
+  }
+
+  char* scratch = (char*) lwgrp_scratch_alloc(count * rec_size, __FILE__, __LINE__);
+
+  char* src = recs;
+  char* dst = scratch;
+  int width;
+  for (width = 1; width < count; width <<= 1) {
+    int start;
+    for (start = 0; start < count; start += 2 * width) {
+      int mid = start + width;
+      int end = start + 2 * width;
+      if (mid > count) {
+        mid = count;
+      }
+      if (end > count) {
+        end = count;
+      }
+      lwgrp_sort_rec_merge(
+        src + start * rec_size, mid - start,
+        src + mid * rec_size, end - mid,
+        dst + start * rec_size, rec_size, compare, offset
+      );
+    }
+
+    char* tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != recs) {
+    memcpy(recs, src, count * rec_size);
+  }
+
+  lwgrp_scratch_free(&scratch);
+}
+
+/* Samples are records whose first int is a weight, the number of
+ * items a sample stands for, which are those above the sample before
+ * it up to and including itself.  Given count sorted samples of total
+ * weight, copy at most max of them into out at regular steps of
+ * weight, merging the weights of those we drop into the next one we
+ * keep, returns the number kept */
+static int lwgrp_sort_subsample(
+  const char* samples,
+  int count,
+  int max,
+  size_t rec_size,
+  char* out)
+{
+  int i;
+
+  if (count <= max) {
+    memcpy(out, samples, count * rec_size);
+    return count;
+  }
+
+  size_t total = 0;
+  for (i = 0; i < count; i++) {
+    total += (size_t) ((const int*) (samples + i * rec_size))[0];
+  }
+
+  int kept = 0;
+  size_t sum = 0;
+  size_t last = 0;
+  int next = 1;
+  for (i = 0; i < count && next <= max; i++) {
+    sum += (size_t) ((const int*) (samples + i * rec_size))[0];
+    if (sum * (size_t) max >= (size_t) next * total) {
+      char* rec = out + kept * rec_size;
+      memcpy(rec, samples + i * rec_size, rec_size);
+      ((int*) rec)[0] = (int) (sum - last);
+      last = sum;
+      kept++;
+
+      /* skip steps this sample also covers */
+      while (next <= max && sum * (size_t) max >= (size_t) next * total) {
+        next++;
+      }
+    }
+  }
+
+  return kept;
+}
+
+/* Pick buckets-1 splitters from count sorted records on each proc of
+ * the range in chain and list, splitter b is the highest record of
+ * bucket b.  Procs send regularly spaced samples up a binomial tree
+ * to rank 0 of the range, each keeping at most
+ * LWGRP_SORT_SAMPLES * buckets of the samples it holds, and rank 0
+ * picks splitters at regular steps of weight and sends them back
+ * down the tree, so no proc handles more than a bounded number of
+ * samples however many procs there are. */
+static void lwgrp_sort_splitters(
+  const char* recs,
+  int count,
+  size_t rec_size,
+  int buckets,
+  char* splitters,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_chain* chain,
+  const lwgrp_logchain* list)
+{
+  int i;
+
+  MPI_Comm comm = chain->comm;
+  int tag   = chain->tag;
+  int rank  = chain->group_rank;
+  int ranks = chain->group_size;
+
+  /* take regularly spaced samples of our own records */
+  int max = LWGRP_SORT_SAMPLES * buckets;
+  int num = (count < max) ? count : max;
+  char* samples = (char*) lwgrp_scratch_alloc(max * rec_size, __FILE__, __LINE__);
+  char* recvbuf = (char*) lwgrp_scratch_alloc(max * rec_size, __FILE__, __LINE__);
+  char* merged  = (char*) lwgrp_scratch_alloc(2 * max * rec_size, __FILE__, __LINE__);
+  int prev = -1;
+  for (i = 0; i < num; i++) {
+    int idx = (int) (((size_t) (i + 1) * (size_t) count) / (size_t) num) - 1;
+    char* rec = samples + i * rec_size;
+    memcpy(rec, recs + idx * rec_size, rec_size);
+    ((int*) rec)[0] = idx - prev;
+    prev = idx;
+  }
+
+  /* gather samples to rank 0, merging and thinning them at each step */
+  int index = 0;
+  int dist  = 1;
+  while (dist < ranks) {
+    if (rank & dist) {
+      MPI_Send(
+        samples, (int) (num * rec_size), MPI_BYTE,
+        list->left_list[index], tag, comm
+      );
+      break;
+    }
+    if (rank + dist < ranks) {
+      MPI_Status status;
+      int bytes;
+      MPI_Recv(
+        recvbuf, (int) (max * rec_size), MPI_BYTE,
+        list->right_list[index], tag, comm, &status
+      );
+      MPI_Get_count(&status, MPI_BYTE, &bytes);
+      int recv_num = (int) ((size_t) bytes / rec_size);
+
+      lwgrp_sort_rec_merge(
+        samples, num, recvbuf, recv_num, merged, rec_size, compare, offset
+      );
+      num = lwgrp_sort_subsample(merged, num + recv_num, max, rec_size, samples);
+    }
+    index++;
+    dist <<= 1;
+  }
+
+  /* rank 0 picks the splitters, splitter b is the first sample whose
+   * running weight reaches (b+1)/buckets of the total, a range with
+   * no items gets zeroed splitters that are never compared */
+  size_t split_bytes = (buckets - 1) * rec_size;
+  if (rank == 0) {
+    memset(splitters, 0, split_bytes);
+    size_t total = 0;
+    for (i = 0; i < num; i++) {
+      total += (size_t) ((int*) (samples + i * rec_size))[0];
+    }
+    size_t sum = 0;
+    int b = 0;
+    for (i = 0; i < num && b < buckets - 1; i++) {
+      sum += (size_t) ((int*) (samples + i * rec_size))[0];
+      while (b < buckets - 1 && sum * (size_t) buckets >= (size_t) (b + 1) * total) {
+        memcpy(splitters + b * rec_size, samples + i * rec_size, rec_size);
+        b++;
+      }
+    }
+  }
+
+  /* send splitters back down the tree we gathered on */
+  int top = 1;
+  while (top < ranks) {
+    top <<= 1;
+  }
+  if (rank != 0) {
+    int low = rank & -rank;
+    index = 0;
+    while ((1 << index) < low) {
+      index++;
+    }
+    MPI_Recv(
+      splitters, (int) split_bytes, MPI_BYTE,
+      list->left_list[index], tag, comm, MPI_STATUS_IGNORE
+    );
+    top = low;
+  }
+  index = 0;
+  while ((2 << index) < top) {
+    index++;
+  }
+  for (dist = top >> 1; dist > 0; dist >>= 1) {
+    if (rank + dist < ranks) {
+      MPI_Send(
+        splitters, (int) split_bytes, MPI_BYTE,
+        list->right_list[index], tag, comm
+      );
+    }
+    index--;
+  }
+
+  lwgrp_scratch_free(&merged);
+  lwgrp_scratch_free(&recvbuf);
+  lwgrp_scratch_free(&samples);
+}
+
+/* slice of a range of ranks procs that bucket b of buckets owns,
+ * as an offset and a width */
+static void lwgrp_sort_slice(int ranks, int buckets, int b, int* start, int* width)
+{
+  int lo = (int) (((size_t) b * (size_t) ranks) / (size_t) buckets);
+  int hi = (int) (((size_t) (b + 1) * (size_t) ranks) / (size_t) buckets);
+  *start = lo;
+  *width = hi - lo;
+}
+
+/* Set the destination of each of count records on a proc in the range
+ * of procs lo to hi-1, the records are sorted on return, and return
+ * the bounds of the slice the proc belongs to in the next round */
+static void lwgrp_sort_sample_round(
+  char* recs,
+  int count,
+  size_t rec_size,
+  int* lo,
+  int* hi,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  int i;
+
+  int rank     = comm->chain.group_rank;
+  int ranks    = *hi - *lo;
+  int sub_rank = rank - *lo;
+
+  /* a range of one proc is done, we keep our records */
+  if (ranks == 1) {
+    for (i = 0; i < count; i++) {
+      ((int*) (recs + i * rec_size))[0] = rank;
+    }
+    return;
+  }
+
+  lwgrp_sort_rec_local(recs, count, rec_size, compare, offset);
+
+  /* build a chain and logchain of the range from those of comm */
+  lwgrp_chain chain;
+  lwgrp_chain_build_from_vals(
+    comm->chain.comm,
+    (sub_rank > 0)         ? comm->chain.comm_left  : MPI_PROC_NULL,
+    (sub_rank < ranks - 1) ? comm->chain.comm_right : MPI_PROC_NULL,
+    ranks, sub_rank, &chain
+  );
+  chain.tag = comm->chain.tag;
+  lwgrp_logchain list;
+  lwgrp_logchain_build_from_vals(
+    ranks, sub_rank, comm->logchain.left_list, comm->logchain.right_list, &list
+  );
+
+  int buckets = (ranks < LWGRP_SORT_BUCKETS) ? ranks : LWGRP_SORT_BUCKETS;
+  char* splitters = (char*) lwgrp_scratch_alloc((buckets - 1) * rec_size, __FILE__, __LINE__);
+  lwgrp_sort_splitters(
+    recs, count, rec_size, buckets, splitters, compare, offset, &chain, &list
+  );
+
+  /* count our records in each bucket, they are sorted so we just walk
+   * through the splitters as we go */
+  int* counts = (int*) lwgrp_scratch_alloc(4 * buckets * sizeof(int), __FILE__, __LINE__);
+  int* left   = counts + buckets;
+  int* right  = counts + 2 * buckets;
+  int* index  = counts + 3 * buckets;
+  memset(counts, 0, 4 * buckets * sizeof(int));
+  int b = 0;
+  for (i = 0; i < count; i++) {
+    char* rec = recs + i * rec_size;
+    while (b < buckets - 1 &&
+           lwgrp_sort_rec_compare(rec, splitters + b * rec_size, compare, offset) > 0)
+    {
+      b++;
+    }
+    ((int*) rec)[1] = b;
+    counts[b]++;
+  }
+
+  /* get the number of records of each bucket to our left and right */
+  lwgrp_chain_double_exscan_recursive(
+    counts, right, counts, left, buckets, MPI_INT, MPI_SUM, &chain
+  );
+
+  /* spread the records of each bucket evenly over its slice */
+  for (i = 0; i < count; i++) {
+    char* rec = recs + i * rec_size;
+    int* hdr = (int*) rec;
+    b = hdr[1];
+    size_t total = (size_t) left[b] + (size_t) counts[b] + (size_t) right[b];
+    size_t pos   = (size_t) left[b] + (size_t) index[b];
+    int start, width;
+    lwgrp_sort_slice(ranks, buckets, b, &start, &width);
+    hdr[0] = *lo + start + (int) ((pos * (size_t) width) / total);
+    index[b]++;
+  }
+
+  /* find the slice we belong to */
+  for (b = 0; b < buckets; b++) {
+    int start, width;
+    lwgrp_sort_slice(ranks, buckets, b, &start, &width);
+    if (sub_rank >= start && sub_rank < start + width) {
+      *hi = *lo + start + width;
+      *lo = *lo + start;
+      break;
+    }
+  }
+
+  lwgrp_scratch_free(&counts);
+  lwgrp_scratch_free(&splitters);
+  lwgrp_logchain_free(&list);
+  lwgrp_chain_free(&chain);
+}
+
+int lwgrp_comm_sort_sample(
+  void* buf,
+  int count,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  int i;
+  int rc = LWGRP_SUCCESS;
+
+  int rank  = comm->ring.group_rank;
+  int ranks = comm->ring.group_size;
+
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(type, &lb, &extent);
+  size_t size = (size_t) extent;
+
+  /* records for routing carry a destination, a slot, the origin rank
+   * and index, and the item, round up to keep the header int aligned */
+  size_t hdr_size = LWGRP_SORT_REC_INTS * sizeof(int);
+  size_t rec_size = hdr_size + size;
+  rec_size = (rec_size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+
+  char* items = (char*) buf;
+  char* recs = (char*) lwgrp_malloc(count * rec_size, sizeof(int), __FILE__, __LINE__);
+  for (i = 0; i < count; i++) {
+    char* rec = recs + i * rec_size;
+    int* hdr = (int*) rec;
+    hdr[0] = 0;
+    hdr[1] = 0;
+    hdr[2] = rank;
+    hdr[3] = i;
+    memcpy(rec + hdr_size, items + i * size, size);
+  }
+  int num = count;
+
+  /* each round shrinks the widest range by the number of buckets,
+   * all procs run the same number of rounds since each one routes
+   * over the whole group */
+  int rounds = 0;
+  int width = ranks;
+  while (width > 1) {
+    width = (width + LWGRP_SORT_BUCKETS - 1) / LWGRP_SORT_BUCKETS;
+    rounds++;
+  }
+
+  int lo = 0;
+  int hi = ranks;
+  int round;
+  for (round = 0; round < rounds; round++) {
+    lwgrp_sort_sample_round(recs, num, rec_size, &lo, &hi, compare, offset, comm);
+
+    char* newrecs;
+    int newnum;
+    lwgrp_logring_route_brucks(
+      recs, num, rec_size, (void**) &newrecs, &newnum,
+      &comm->ring, &comm->logring
+    );
+    lwgrp_free(&recs);
+    recs = newrecs;
+    num  = newnum;
+  }
+
+  /* we now hold a contiguous run of the sorted sequence */
+  lwgrp_sort_rec_local(recs, num, rec_size, compare, offset);
+
+  /* compute global position of our first item */
+  int position = 0;
+  lwgrp_chain_exscan_recursive(
+    &num, &position, 1, MPI_INT, MPI_SUM, &comm->chain
+  );
+  if (rank == 0) {
+    position = 0;
+  }
+
+  /* route each item to the process and slot of its global position */
+  for (i = 0; i < num; i++) {
+    int* hdr = (int*) (recs + i * rec_size);
+    int pos = position + i;
+    hdr[0] = pos / count;
+    hdr[1] = pos % count;
+  }
+
+  char* finalrecs;
+  int final_count;
+  lwgrp_logring_route_brucks(
+    recs, num, rec_size, (void**) &finalrecs, &final_count,
+    &comm->ring, &comm->logring
+  );
+  lwgrp_free(&recs);
+
+  /* we should get exactly count items, copy them into place */
+  for (i = 0; i < final_count; i++) {
+    char* rec = finalrecs + i * rec_size;
+    int slot = ((int*) rec)[1];
+    memcpy(items + slot * size, rec + hdr_size, size);
+  }
+  lwgrp_free(&finalrecs);
+
+  return rc;
+}
+
+
+/* ---------------------------------
+ * Sort dispatch
+ * --------------------------------- */
+
+int lwgrp_comm_sort_bitonic(
+  void* buf,
+  int count,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(type, &lb, &extent);
+
+  int rc = lwgrp_logchain_sort_bitonic(
+    buf, count, type, (size_t) extent, offset, compare,
+    &comm->chain, &comm->logchain, comm->chain.tag
+  );
+  return rc;
+}
+
+int lwgrp_comm_sort(
+  void* buf,
+  int count,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  LWGRP_STATS_BEGIN(LWGRP_STATS_SORT);
+  int rc = LWGRP_SUCCESS;
+
+  /* nothing to do for an empty group or no items */
+  int ranks = comm->ring.group_size;
+  if (ranks == 0 || count <= 0) {
+    LWGRP_STATS_END();
+    return rc;
+  }
+
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(type, &lb, &extent);
+
+  /* pick a backend based on total data and group size */
+  size_t bytes = (size_t) count * (size_t) extent;
+  int alg = lwgrp_tune_select(LWGRP_STATS_SORT, ranks, bytes);
+  if (alg == LWGRP_ALG_DEFAULT) {
+    if ((size_t) ranks * bytes <= LWGRP_SORT_GATHER_BYTES) {
+      alg = LWGRP_ALG_SORT_GATHER;
+    } else if (ranks < LWGRP_SORT_SAMPLE_RANKS) {
+      alg = LWGRP_ALG_SORT_BITONIC;
+    } else {
+      alg = LWGRP_ALG_SORT_SAMPLE;
+    }
+  }
+
+  if (ranks == 1) {
+    lwgrp_sort_local(buf, count, (size_t) extent, compare, offset);
+  } else if (alg == LWGRP_ALG_SORT_GATHER) {
+    rc = lwgrp_comm_sort_gather(buf, count, type, compare, offset, comm);
+  } else if (alg == LWGRP_ALG_SORT_BITONIC) {
+    rc = lwgrp_comm_sort_bitonic(buf, count, type, compare, offset, comm);
+  } else {
+    rc = lwgrp_comm_sort_sample(buf, count, type, compare, offset, comm);
+  }
+
+  LWGRP_STATS_END();
+  return rc;
+}
+
+/* ---------------------------------
+ * Nonblocking sort of a single item
+ * --------------------------------- */
+
+/* record the compare-exchange steps we take part in during a bitonic
+ * merge, follows lwgrp_logchain_sort_bitonic_merge,
+ * returns the new number of steps */
+static int lwgrp_sort_bitonic_merge_steps(
+  int rank,
+  int start,
+  int num,
+  int direction,
+  const lwgrp_logchain* list,
+  lwgrp_sort_step* steps,
+  int n)
+{
+  while (num > 1) {
+    /* determine largest power of two that is smaller than num */
+    int count = 1;
+    int index = 0;
+    while (count < num) {
+      count <<= 1;
+      index++;
+    }
+    count >>= 1;
+    index--;
+
+    if (rank < start + count) {
+      /* we are in the lower half, exchange with partner in upper half */
+      if (rank + count < start + num) {
+        if (steps != NULL) {
+          steps[n].partner  = list->right_list[index];
+          steps[n].keep_low = direction;
+        }
+        n++;
+      }
+      num = count;
+    } else {
+      /* we are in the upper half, exchange with partner in lower half */
+      if (rank - count >= start) {
+        if (steps != NULL) {
+          steps[n].partner  = list->left_list[index];
+          steps[n].keep_low = !direction;
+        }
+        n++;
+      }
+      start += count;
+      num   -= count;
+    }
+  }
+
+  return n;
+}
+
+/* record the compare-exchange steps we take part in during a bitonic
+ * sort, follows lwgrp_logchain_sort_bitonic_sort,
+ * returns the new number of steps */
+static int lwgrp_sort_bitonic_sort_steps(
+  int rank,
+  int start,
+  int num,
+  int direction,
+  const lwgrp_logchain* list,
+  lwgrp_sort_step* steps,
+  int n)
+{
+  if (num > 1) {
+    /* recursively divide and sort each half */
+    int mid = num / 2;
+    if (rank < start + mid) {
+      n = lwgrp_sort_bitonic_sort_steps(
+        rank, start, mid, !direction, list, steps, n
+      );
+    } else {
+      n = lwgrp_sort_bitonic_sort_steps(
+        rank, start + mid, num - mid, direction, list, steps, n
+      );
+    }
+
+    /* merge the two sorted halves */
+    n = lwgrp_sort_bitonic_merge_steps(
+      rank, start, num, direction, list, steps, n
+    );
+  }
+
+  return n;
+}
+
+void lwgrp_nb_sort_init(
+  lwgrp_nb_sort* s,
+  void* value,
+  MPI_Datatype type,
+  int (*compare)(const void*, const void*, size_t),
+  size_t offset,
+  const lwgrp_comm* comm)
+{
+  MPI_Aint lb, extent;
+  MPI_Type_get_extent(type, &lb, &extent);
+
+  s->value      = value;
+  s->type       = type;
+  s->type_size  = (size_t) extent;
+  s->offset     = offset;
+  s->compare    = compare;
+  s->comm       = comm;
+  s->all        = NULL;
+  s->scratch    = NULL;
+  s->steps      = NULL;
+  s->nsteps     = 0;
+  s->step       = 0;
+  s->use_gather = 0;
+  s->allgather.tmpbuf = NULL;
+
+  /* nothing to do for an empty group */
+  int ranks = comm->ring.group_size;
+  if (ranks == 0) {
+    return;
+  }
+
+  /* pick a backend as lwgrp_comm_sort does, though we always use a
+   * bitonic sort for large groups since a sample sort would need to
+   * route a variable number of items */
+  size_t bytes = (size_t) ranks * s->type_size;
+  if (bytes <= LWGRP_SORT_GATHER_BYTES) {
+    s->use_gather = 1;
+    s->all = lwgrp_scratch_alloc(bytes, __FILE__, __LINE__);
+    lwgrp_nb_allgather_init(
+      &s->allgather, value, s->all, 1, type, &comm->ring, &comm->logring
+    );
+    return;
+  }
+
+  /* list the compare-exchange steps we'll execute */
+  int rank = comm->chain.group_rank;
+  s->nsteps = lwgrp_sort_bitonic_sort_steps(
+    rank, 0, ranks, 1, &comm->logchain, NULL, 0
+  );
+  s->steps = (lwgrp_sort_step*) lwgrp_scratch_alloc(
+    s->nsteps * sizeof(lwgrp_sort_step), __FILE__, __LINE__
+  );
+  lwgrp_sort_bitonic_sort_steps(
+    rank, 0, ranks, 1, &comm->logchain, s->steps, 0
+  );
+  s->scratch = lwgrp_scratch_alloc(s->type_size, __FILE__, __LINE__);
+}
+
+int lwgrp_nb_sort_advance(
+  lwgrp_nb_sort* s,
+  struct lwgrp_request_struct* req)
+{
+  if (s->use_gather) {
+    /* wait until we have all items */
+    if (! lwgrp_nb_allgather_advance(&s->allgather, req)) {
+      return 0;
+    }
+
+    /* sort everything and copy out our item */
+    int rank  = s->comm->ring.group_rank;
+    int ranks = s->comm->ring.group_size;
+    lwgrp_sort_local(s->all, ranks, s->type_size, s->compare, s->offset);
+    memcpy(s->value, (char*)s->all + rank * s->type_size, s->type_size);
+    return 1;
+  }
+
+  /* compare our item with the one from our partner in the last step */
+  if (s->step > 0) {
+    lwgrp_sort_merge_split(
+      s->value, s->scratch, NULL, 1, s->type_size, s->compare, s->offset,
+      s->steps[s->step - 1].keep_low
+    );
+  }
+
+  if (s->step == s->nsteps) {
+    return 1;
+  }
+
+  /* exchange items with our next partner */
+  int partner = s->steps[s->step].partner;
+  MPI_Comm comm = s->comm->chain.comm;
+  MPI_Irecv(
+    s->scratch, 1, s->type, partner, req->tag,
+    comm, lwgrp_request_next(req)
+  );
+  MPI_Isend(
+    s->value, 1, s->type, partner, req->tag,
+    comm, lwgrp_request_next(req)
+  );
+  s->step++;
+  return 0;
+}
+
+void lwgrp_nb_sort_free(lwgrp_nb_sort* s)
+{
+  if (s->allgather.tmpbuf != NULL) {
+    lwgrp_desc_dtbuf_free(&s->allgather.tmpbuf, &s->allgather.dt, __FILE__, __LINE__);
+    s->allgather.tmpbuf = NULL;
+  }
+  lwgrp_scratch_free(&s->all);
+  lwgrp_scratch_free(&s->scratch);
+  lwgrp_scratch_free(&s->steps);
+}
@@ -0,0 +1,394 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+
+/* we call MPI ourselves below */
+#define LWGRP_STATS_NO_WRAP
+#include "lwgrp_internal.h"
+
+/* Per-operation counters.  Public entry points open a frame with
+ * LWGRP_STATS_BEGIN and close it with LWGRP_STATS_END, and the kernels
+ * reach MPI through the wrappers at the end of this file, which add
+ * what they send and how long they wait to the outermost open frame,
+ * or to LWGRP_STATS_OTHER if there is none.  When a frame closes, its
+ * counts are added to the totals of its op.  All of this state is per
+ * thread, so counting takes no locks. */
+
+static const char* lwgrp_stats_names[LWGRP_STATS_OPS] = {
+  "barrier",
+  "bcast",
+  "gather",
+  "scatter",
+  "allgather",
+  "allgatherv",
+  "alltoall",
+  "alltoallv",
+  "reduce",
+  "allreduce",
+  "scan",
+  "exscan",
+  "double_exscan",
+  "reduce_scatter",
+  "segmented_scan",
+  "split",
+  "split_bin",
+  "rank_str",
+  "sort",
+  "ibarrier",
+  "ibcast",
+  "iallgather",
+  "iallreduce",
+  "isplit",
+  "persistent",
+  "neighbor_alltoallv",
+  "sparse_exchange",
+  "group",
+  "other",
+};
+
+const char* lwgrp_stats_name(int op)
+{
+  if (op < 0 || op >= LWGRP_STATS_OPS) {
+    return "unknown";
+  }
+  return lwgrp_stats_names[op];
+}
+
+#ifdef LWGRP_USE_STATS
+
+/* whether we count, read from LWGRP_STATS on first use */
+static pthread_once_t lwgrp_stats_once = PTHREAD_ONCE_INIT;
+static int lwgrp_stats_enabled = 0;
+
+/* hook called as outermost ops begin and end */
+static lwgrp_stats_hook lwgrp_stats_hook_fn = NULL;
+static void* lwgrp_stats_hook_arg = NULL;
+
+/* totals of each op, and the counts of the open frame */
+static LWGRP_THREAD_LOCAL lwgrp_stats_counters lwgrp_stats_totals[LWGRP_STATS_OPS];
+static LWGRP_THREAD_LOCAL lwgrp_stats_counters lwgrp_stats_frame;
+static LWGRP_THREAD_LOCAL int lwgrp_stats_depth  = 0; /* number of open frames */
+static LWGRP_THREAD_LOCAL int lwgrp_stats_op     = LWGRP_STATS_OTHER;
+static LWGRP_THREAD_LOCAL int lwgrp_stats_active = 0; /* set if the outermost frame counts */
+static LWGRP_THREAD_LOCAL double lwgrp_stats_start;
+
+static void lwgrp_stats_init(void)
+{
+  lwgrp_stats_enabled = (lwgrp_getenv_size("LWGRP_STATS", 0) != 0);
+}
+
+static int lwgrp_stats_on(void)
+{
+  pthread_once(&lwgrp_stats_once, lwgrp_stats_init);
+  return lwgrp_stats_enabled;
+}
+
+/* add counts in src to dst */
+static void lwgrp_stats_add(lwgrp_stats_counters* dst, const lwgrp_stats_counters* src)
+{
+  dst->calls         += src->calls;
+  dst->rounds        += src->rounds;
+  dst->messages      += src->messages;
+  dst->bytes         += src->bytes;
+  dst->scratch_bytes += src->scratch_bytes;
+  dst->time          += src->time;
+  dst->wait_time     += src->wait_time;
+}
+
+/* the counters that work done now should go to, NULL if we're
+ * not counting */
+static lwgrp_stats_counters* lwgrp_stats_target(void)
+{
+  if (lwgrp_stats_depth > 0) {
+    return lwgrp_stats_active ? &lwgrp_stats_frame : NULL;
+  }
+  if (lwgrp_stats_on()) {
+    return &lwgrp_stats_totals[LWGRP_STATS_OTHER];
+  }
+  return NULL;
+}
+
+void lwgrp_stats_begin(int op, int call)
+{
+  /* inner frames just track depth, so begin and end always pair */
+  lwgrp_stats_depth++;
+  if (lwgrp_stats_depth > 1) {
+    return;
+  }
+
+  lwgrp_stats_active = lwgrp_stats_on();
+  if (! lwgrp_stats_active) {
+    return;
+  }
+
+  lwgrp_stats_op = op;
+  memset(&lwgrp_stats_frame, 0, sizeof(lwgrp_stats_frame));
+  lwgrp_stats_frame.calls = call ? 1 : 0;
+
+  lwgrp_stats_hook hook = lwgrp_stats_hook_fn;
+  if (hook != NULL) {
+    (*hook)(op, LWGRP_STATS_EVENT_BEGIN, NULL, lwgrp_stats_hook_arg);
+  }
+
+  lwgrp_stats_start = MPI_Wtime();
+}
+
+void lwgrp_stats_end(void)
+{
+  lwgrp_stats_depth--;
+  if (lwgrp_stats_depth > 0 || ! lwgrp_stats_active) {
+    return;
+  }
+
+  lwgrp_stats_frame.time = MPI_Wtime() - lwgrp_stats_start;
+  lwgrp_stats_add(&lwgrp_stats_totals[lwgrp_stats_op], &lwgrp_stats_frame);
+  lwgrp_stats_active = 0;
+
+  lwgrp_stats_hook hook = lwgrp_stats_hook_fn;
+  if (hook != NULL) {
+    (*hook)(
+      lwgrp_stats_op, LWGRP_STATS_EVENT_END, &lwgrp_stats_frame,
+      lwgrp_stats_hook_arg
+    );
+  }
+}
+
+int lwgrp_stats_current(void)
+{
+  if (lwgrp_stats_depth > 0) {
+    return lwgrp_stats_op;
+  }
+  return LWGRP_STATS_OTHER;
+}
+
+void lwgrp_stats_scratch(size_t bytes)
+{
+  lwgrp_stats_counters* c = lwgrp_stats_target();
+  if (c != NULL) {
+    c->scratch_bytes += (unsigned long) bytes;
+  }
+}
+
+/* count a message of count elements of type */
+static void lwgrp_stats_send(int count, MPI_Datatype type, int dest)
+{
+  lwgrp_stats_counters* c = lwgrp_stats_target();
+  if (c != NULL && dest != MPI_PROC_NULL) {
+    int size;
+    MPI_Type_size(type, &size);
+    c->messages++;
+    c->bytes += (unsigned long) count * (unsigned long) size;
+  }
+}
+
+/* count a blocking step that started at start */
+static void lwgrp_stats_wait(double start)
+{
+  lwgrp_stats_counters* c = lwgrp_stats_target();
+  if (c != NULL) {
+    c->rounds++;
+    c->wait_time += MPI_Wtime() - start;
+  }
+}
+
+/* only read the clock when someone will use it */
+static double lwgrp_stats_now(void)
+{
+  if (lwgrp_stats_target() != NULL) {
+    return MPI_Wtime();
+  }
+  return 0.0;
+}
+
+int lwgrp_stats_Send(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm)
+{
+  lwgrp_stats_send(count, type, dest);
+  double start = lwgrp_stats_now();
+  int rc = MPI_Send((void*)buf, count, type, dest, tag, comm);
+  lwgrp_stats_wait(start);
+  return rc;
+}
+
+int lwgrp_stats_Isend(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm, MPI_Request* request)
+{
+  lwgrp_stats_send(count, type, dest);
+  return MPI_Isend((void*)buf, count, type, dest, tag, comm, request);
+}
+
+int lwgrp_stats_Issend(const void* buf, int count, MPI_Datatype type,
+  int dest, int tag, MPI_Comm comm, MPI_Request* request)
+{
+  lwgrp_stats_send(count, type, dest);
+  return MPI_Issend((void*)buf, count, type, dest, tag, comm, request);
+}
+
+int lwgrp_stats_Recv(void* buf, int count, MPI_Datatype type,
+  int source, int tag, MPI_Comm comm, MPI_Status* status)
+{
+  double start = lwgrp_stats_now();
+  int rc = MPI_Recv(buf, count, type, source, tag, comm, status);
+  lwgrp_stats_wait(start);
+  return rc;
+}
+
+int lwgrp_stats_Sendrecv(const void* sendbuf, int sendcount,
+  MPI_Datatype sendtype, int dest, int sendtag, void* recvbuf,
+  int recvcount, MPI_Datatype recvtype, int source, int recvtag,
+  MPI_Comm comm, MPI_Status* status)
+{
+  lwgrp_stats_send(sendcount, sendtype, dest);
+  double start = lwgrp_stats_now();
+  int rc = MPI_Sendrecv(
+    (void*)sendbuf, sendcount, sendtype, dest, sendtag,
+    recvbuf, recvcount, recvtype, source, recvtag, comm, status
+  );
+  lwgrp_stats_wait(start);
+  return rc;
+}
+
+int lwgrp_stats_Waitall(int count, MPI_Request requests[],
+  MPI_Status statuses[])
+{
+  double start = lwgrp_stats_now();
+  int rc = MPI_Waitall(count, requests, statuses);
+  lwgrp_stats_wait(start);
+  return rc;
+}
+
+int lwgrp_stats_Waitsome(int incount, MPI_Request requests[],
+  int* outcount, int indices[], MPI_Status statuses[])
+{
+  double start = lwgrp_stats_now();
+  int rc = MPI_Waitsome(incount, requests, outcount, indices, statuses);
+  lwgrp_stats_wait(start);
+  return rc;
+}
+
+/* testing doesn't block, but a step of a nonblocking op that
+ * completes is still a round */
+int lwgrp_stats_Testall(int count, MPI_Request requests[], int* flag,
+  MPI_Status statuses[])
+{
+  int rc = MPI_Testall(count, requests, flag, statuses);
+  if (*flag) {
+    lwgrp_stats_counters* c = lwgrp_stats_target();
+    if (c != NULL) {
+      c->rounds++;
+    }
+  }
+  return rc;
+}
+
+/* a put moves data like a message, so count it as one */
+int lwgrp_stats_Put(const void* buf, int count, MPI_Datatype type,
+  int target, MPI_Aint disp, int target_count, MPI_Datatype target_type,
+  MPI_Win win)
+{
+  lwgrp_stats_send(count, type, target);
+  return MPI_Put((void*)buf, count, type, target, disp, target_count,
+    target_type, win);
+}
+
+int lwgrp_stats_enable(int flag)
+{
+  pthread_once(&lwgrp_stats_once, lwgrp_stats_init);
+  lwgrp_stats_enabled = flag;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_reset(void)
+{
+  memset(lwgrp_stats_totals, 0, sizeof(lwgrp_stats_totals));
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_get(int op, lwgrp_stats_counters* counters)
+{
+  if (op < 0 || op >= LWGRP_STATS_OPS) {
+    memset(counters, 0, sizeof(*counters));
+    return LWGRP_SUCCESS;
+  }
+  *counters = lwgrp_stats_totals[op];
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_set_hook(lwgrp_stats_hook hook, void* arg)
+{
+  lwgrp_stats_hook_arg = arg;
+  lwgrp_stats_hook_fn  = hook;
+  return LWGRP_SUCCESS;
+}
+
+#else /* LWGRP_USE_STATS */
+
+/* without stats, counting can't be turned on and all counters are zero */
+
+int lwgrp_stats_enable(int flag)
+{
+  (void)flag;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_reset(void)
+{
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_get(int op, lwgrp_stats_counters* counters)
+{
+  (void)op;
+  memset(counters, 0, sizeof(*counters));
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_stats_set_hook(lwgrp_stats_hook hook, void* arg)
+{
+  (void)hook;
+  (void)arg;
+  return LWGRP_SUCCESS;
+}
+
+#endif /* LWGRP_USE_STATS */
+
+int lwgrp_stats_dump(FILE* stream)
+{
+  if (stream == NULL) {
+    stream = stdout;
+  }
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  int op;
+  for (op = 0; op < LWGRP_STATS_OPS; op++) {
+    lwgrp_stats_counters c;
+    lwgrp_stats_get(op, &c);
+    if (c.calls == 0 && c.messages == 0) {
+      continue;
+    }
+    fprintf(stream,
+      "LWGRP STATS rank=%d op=%s calls=%lu rounds=%lu messages=%lu "
+      "bytes=%lu scratch_bytes=%lu time=%.6f wait_time=%.6f\n",
+      rank, lwgrp_stats_name(op), c.calls, c.rounds, c.messages,
+      c.bytes, c.scratch_bytes, c.time, c.wait_time
+    );
+  }
+  fflush(stream);
+
+  return LWGRP_SUCCESS;
+}
@@ -0,0 +1,374 @@
+/* Copyright (c) 2012, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by Adam Moody <moody20@llnl.gov>.
+ * LLNL-CODE-568372.
+ * All rights reserved.
+ * This file is part of the LWGRP library.
+ * For details, see https://github.com/hpc/lwgrp
+ * Please also read this file: LICENSE.TXT. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+#include "lwgrp_internal.h"
+
+/* The selection table is a list of rules, checked in order, so the
+ * usual table lists a few rules per op, each covering a range of
+ * message sizes for a range of group sizes.  We read the environment
+ * on first use, and lwgrp_tune_set and lwgrp_tune_load swap in a new
+ * list later on. */
+
+/* longest rule we parse, longer lines are ignored */
+#define LWGRP_TUNE_LINE (1024)
+
+typedef struct lwgrp_tune_rule {
+  int op;           /* LWGRP_STATS_* value of the op */
+  size_t min_ranks; /* smallest group size the rule covers */
+  size_t max_ranks; /* largest group size the rule covers */
+  size_t min_bytes; /* smallest message the rule covers */
+  size_t max_bytes; /* largest message the rule covers */
+  int pow2;         /* 1 for power-of-two groups only, 0 for others
+                     * only, -1 for both */
+  int alg;          /* LWGRP_ALG_* value to run */
+} lwgrp_tune_rule;
+
+/* names of the algorithms of each op, as used in rules */
+static const struct {
+  int op;
+  const char* op_name;
+  int alg;
+  const char* alg_name;
+} lwgrp_tune_algs[] = {
+  { LWGRP_STATS_BARRIER,   "barrier",   LWGRP_ALG_BARRIER_DISSEMINATION,    "dissemination" },
+  { LWGRP_STATS_BARRIER,   "barrier",   LWGRP_ALG_BARRIER_CHAIN,            "chain" },
+  { LWGRP_STATS_BCAST,     "bcast",     LWGRP_ALG_BCAST_BINOMIAL,           "binomial" },
+  { LWGRP_STATS_BCAST,     "bcast",     LWGRP_ALG_BCAST_SCATTER_ALLGATHER,  "scatter_allgather" },
+  { LWGRP_STATS_BCAST,     "bcast",     LWGRP_ALG_BCAST_PIPELINED,          "pipelined" },
+  { LWGRP_STATS_GATHER,    "gather",    LWGRP_ALG_GATHER_BINOMIAL,          "binomial" },
+  { LWGRP_STATS_GATHER,    "gather",    LWGRP_ALG_GATHER_BRUCKS,            "brucks" },
+  { LWGRP_STATS_ALLTOALL,  "alltoall",  LWGRP_ALG_ALLTOALL_BRUCKS,          "brucks" },
+  { LWGRP_STATS_ALLTOALL,  "alltoall",  LWGRP_ALG_ALLTOALL_INDEXED,         "indexed" },
+  { LWGRP_STATS_ALLREDUCE, "allreduce", LWGRP_ALG_ALLREDUCE_RECURSIVE,      "recursive" },
+  { LWGRP_STATS_ALLREDUCE, "allreduce", LWGRP_ALG_ALLREDUCE_RABENSEIFNER,   "rabenseifner" },
+  { LWGRP_STATS_ALLREDUCE, "allreduce", LWGRP_ALG_ALLREDUCE_RING,           "ring" },
+  { LWGRP_STATS_REDUCE_SCATTER, "reduce_scatter", LWGRP_ALG_REDUCE_SCATTER_ALLREDUCE, "allreduce" },
+  { LWGRP_STATS_REDUCE_SCATTER, "reduce_scatter", LWGRP_ALG_REDUCE_SCATTER_HALVING,   "halving" },
+  { LWGRP_STATS_REDUCE_SCATTER, "reduce_scatter", LWGRP_ALG_REDUCE_SCATTER_RING,      "ring" },
+  { LWGRP_STATS_SORT,      "sort",      LWGRP_ALG_SORT_GATHER,              "gather" },
+  { LWGRP_STATS_SORT,      "sort",      LWGRP_ALG_SORT_BITONIC,             "bitonic" },
+  { LWGRP_STATS_SORT,      "sort",      LWGRP_ALG_SORT_SAMPLE,              "sample" },
+};
+
+#define LWGRP_TUNE_ALGS ((int) (sizeof(lwgrp_tune_algs) / sizeof(lwgrp_tune_algs[0])))
+
+/* the current table */
+static pthread_once_t lwgrp_tune_once = PTHREAD_ONCE_INIT;
+static lwgrp_tune_rule* lwgrp_tune_rules = NULL;
+static int lwgrp_tune_count = 0;
+
+/* parse a size with an optional K, M or G suffix, returns 0 on success */
+static int lwgrp_tune_parse_size(const char* str, size_t len, size_t* value)
+{
+  if (len == 0 || ! isdigit((unsigned char) str[0])) {
+    return 1;
+  }
+
+  size_t val = 0;
+  size_t i = 0;
+  while (i < len && isdigit((unsigned char) str[i])) {
+    val = val * 10 + (size_t) (str[i] - '0');
+    i++;
+  }
+  if (i < len) {
+    size_t scale;
+    switch (str[i]) {
+    case 'k':
+    case 'K':
+      scale = 1024;
+      break;
+    case 'm':
+    case 'M':
+      scale = 1024 * 1024;
+      break;
+    case 'g':
+    case 'G':
+      scale = 1024 * 1024 * 1024;
+      break;
+    default:
+      return 1;
+    }
+    val *= scale;
+    i++;
+  }
+  if (i != len) {
+    return 1;
+  }
+
+  *value = val;
+  return 0;
+}
+
+/* parse "*", "n", "lo-hi", or "lo-*", returns 0 on success */
+static int lwgrp_tune_parse_range(const char* str, size_t* lo, size_t* hi)
+{
+  if (strcmp(str, "*") == 0) {
+    *lo = 0;
+    *hi = (size_t) -1;
+    return 0;
+  }
+
+  const char* dash = strchr(str, '-');
+  if (dash == NULL) {
+    if (lwgrp_tune_parse_size(str, strlen(str), lo)) {
+      return 1;
+    }
+    *hi = *lo;
+    return 0;
+  }
+
+  if (lwgrp_tune_parse_size(str, (size_t) (dash - str), lo)) {
+    return 1;
+  }
+  if (strcmp(dash + 1, "*") == 0) {
+    *hi = (size_t) -1;
+    return 0;
+  }
+  if (lwgrp_tune_parse_size(dash + 1, strlen(dash + 1), hi)) {
+    return 1;
+  }
+  return (*hi < *lo);
+}
+
+/* parse one rule, with comments already stripped, returns 0 on
+ * success, 1 on error, and -1 if the line is blank */
+static int lwgrp_tune_parse_rule(char* line, lwgrp_tune_rule* rule)
+{
+  /* split into whitespace separated fields */
+  char* fields[6];
+  int count = 0;
+  char* save;
+  char* tok = strtok_r(line, " \t\r\n", &save);
+  while (tok != NULL && count < 6) {
+    fields[count++] = tok;
+    tok = strtok_r(NULL, " \t\r\n", &save);
+  }
+  if (count == 0) {
+    return -1;
+  }
+  if (count != 5) {
+    return 1;
+  }
+
+  /* look up the op and algorithm by name */
+  int i;
+  rule->alg = LWGRP_ALG_DEFAULT;
+  for (i = 0; i < LWGRP_TUNE_ALGS; i++) {
+    if (strcmp(fields[0], lwgrp_tune_algs[i].op_name) == 0 &&
+        strcmp(fields[4], lwgrp_tune_algs[i].alg_name) == 0)
+    {
+      rule->op  = lwgrp_tune_algs[i].op;
+      rule->alg = lwgrp_tune_algs[i].alg;
+      break;
+    }
+  }
+  if (rule->alg == LWGRP_ALG_DEFAULT) {
+    return 1;
+  }
+
+  if (lwgrp_tune_parse_range(fields[1], &rule->min_ranks, &rule->max_ranks) ||
+      lwgrp_tune_parse_range(fields[2], &rule->min_bytes, &rule->max_bytes))
+  {
+    return 1;
+  }
+
+  if (strcmp(fields[3], "*") == 0) {
+    rule->pow2 = -1;
+  } else if (strcmp(fields[3], "1") == 0) {
+    rule->pow2 = 1;
+  } else if (strcmp(fields[3], "0") == 0) {
+    rule->pow2 = 0;
+  } else {
+    return 1;
+  }
+
+  return 0;
+}
+
+/* parse rules separated by newlines or ';' and append them to the
+ * list, where is named in messages about rules we skip */
+static void lwgrp_tune_parse(
+  const char* rules, const char* where,
+  lwgrp_tune_rule** list, int* count, int* size)
+{
+  int lineno = 0;
+  const char* p = rules;
+  while (*p != '\0') {
+    /* copy out the next line */
+    size_t len = strcspn(p, "\n;");
+    lineno++;
+    if (len < LWGRP_TUNE_LINE) {
+      char line[LWGRP_TUNE_LINE];
+      memcpy(line, p, len);
+      line[len] = '\0';
+
+      /* drop comments */
+      char* hash = strchr(line, '#');
+      if (hash != NULL) {
+        *hash = '\0';
+      }
+
+      lwgrp_tune_rule rule;
+      int rc = lwgrp_tune_parse_rule(line, &rule);
+      if (rc == 0) {
+        if (*count == *size) {
+          *size = (*size > 0) ? 2 * *size : 16;
+          lwgrp_tune_rule* bigger = (lwgrp_tune_rule*) lwgrp_malloc(
+            *size * sizeof(lwgrp_tune_rule), sizeof(size_t), __FILE__, __LINE__
+          );
+          if (*count > 0) {
+            memcpy(bigger, *list, *count * sizeof(lwgrp_tune_rule));
+          }
+          lwgrp_free(list);
+          *list = bigger;
+        }
+        (*list)[*count] = rule;
+        (*count)++;
+      } else if (rc == 1) {
+        printf("ERROR: Ignoring invalid tuning rule %d in %s @ %s:%d\n",
+          lineno, where, __FILE__, __LINE__
+        );
+      }
+    } else {
+      printf("ERROR: Ignoring tuning rule %d in %s longer than %d bytes @ %s:%d\n",
+        lineno, where, LWGRP_TUNE_LINE - 1, __FILE__, __LINE__
+      );
+    }
+
+    p += len;
+    if (*p != '\0') {
+      p++;
+    }
+  }
+}
+
+/* read the whole file at path, returns NULL if we can't */
+static char* lwgrp_tune_read(const char* path)
+{
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open tuning file %s @ %s:%d\n",
+      path, __FILE__, __LINE__
+    );
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < 0) {
+    size = 0;
+  }
+
+  char* buf = (char*) lwgrp_malloc(size + 1, 0, __FILE__, __LINE__);
+  size_t len = fread(buf, 1, (size_t) size, fp);
+  buf[len] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+/* swap in a new table, and free the old one */
+static void lwgrp_tune_replace(lwgrp_tune_rule* list, int count)
+{
+  lwgrp_free(&lwgrp_tune_rules);
+  lwgrp_tune_rules = list;
+  lwgrp_tune_count = count;
+}
+
+/* build a table from LWGRP_TUNE followed by LWGRP_TUNE_FILE */
+static void lwgrp_tune_from_env(void)
+{
+  lwgrp_tune_rule* list = NULL;
+  int count = 0;
+  int size = 0;
+
+  const char* rules = getenv("LWGRP_TUNE");
+  if (rules != NULL) {
+    lwgrp_tune_parse(rules, "LWGRP_TUNE", &list, &count, &size);
+  }
+
+  const char* path = getenv("LWGRP_TUNE_FILE");
+  if (path != NULL && *path != '\0') {
+    char* file = lwgrp_tune_read(path);
+    if (file != NULL) {
+      lwgrp_tune_parse(file, path, &list, &count, &size);
+      lwgrp_free(&file);
+    }
+  }
+
+  lwgrp_tune_replace(list, count);
+}
+
+static void lwgrp_tune_init(void)
+{
+  lwgrp_tune_from_env();
+}
+
+int lwgrp_tune_select(int op, int ranks, size_t bytes)
+{
+  pthread_once(&lwgrp_tune_once, lwgrp_tune_init);
+
+  int pow2 = (ranks > 0 && (ranks & (ranks - 1)) == 0);
+  int i;
+  for (i = 0; i < lwgrp_tune_count; i++) {
+    const lwgrp_tune_rule* r = &lwgrp_tune_rules[i];
+    if (r->op == op &&
+        (size_t) ranks >= r->min_ranks && (size_t) ranks <= r->max_ranks &&
+        bytes >= r->min_bytes && bytes <= r->max_bytes &&
+        (r->pow2 < 0 || r->pow2 == pow2))
+    {
+      return r->alg;
+    }
+  }
+  return LWGRP_ALG_DEFAULT;
+}
+
+int lwgrp_tune_set(const char* rules)
+{
+  pthread_once(&lwgrp_tune_once, lwgrp_tune_init);
+
+  if (rules == NULL) {
+    lwgrp_tune_from_env();
+    return LWGRP_SUCCESS;
+  }
+
+  lwgrp_tune_rule* list = NULL;
+  int count = 0;
+  int size = 0;
+  lwgrp_tune_parse(rules, "lwgrp_tune_set", &list, &count, &size);
+  lwgrp_tune_replace(list, count);
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_tune_load(const char* path)
+{
+  pthread_once(&lwgrp_tune_once, lwgrp_tune_init);
+
+  /* keep the current table if we can't read the file */
+  char* file = lwgrp_tune_read(path);
+  if (file == NULL) {
+    return LWGRP_SUCCESS;
+  }
+
+  lwgrp_tune_rule* list = NULL;
+  int count = 0;
+  int size = 0;
+  lwgrp_tune_parse(file, path, &list, &count, &size);
+  lwgrp_free(&file);
+  lwgrp_tune_replace(list, count);
+  return LWGRP_SUCCESS;
+}
@@ -9,12 +9,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "mpi.h"
 #include "lwgrp.h"
 #include "lwgrp_internal.h"
 
-static MPI_Comm lwgrp_comm_self = MPI_COMM_NULL;
-
 /* return lower bound and extent of given datatype */
 static inline void lwgrp_type_get_lb_extent(MPI_Datatype type, MPI_Aint* lb, MPI_Aint* extent)
 {
@@ -26,6 +26,102 @@ static inline void lwgrp_type_get_lb_extent(MPI_Datatype type, MPI_Aint* lb, MPI
 #endif
 }
 
+/* look up the layout of type once, so that kernels which step
+ * through a buffer element by element don't have to ask MPI for the
+ * extent at every offset */
+void lwgrp_type_desc_init(lwgrp_type_desc* desc, MPI_Datatype type)
+{
+  desc->type = type;
+  lwgrp_type_get_lb_extent(type, &desc->lb, &desc->extent);
+#if MPI_VERSION >= 2
+  MPI_Type_get_true_extent(type, &desc->true_lb, &desc->true_extent);
+#else
+  desc->true_lb     = desc->lb;
+  desc->true_extent = desc->extent;
+#endif
+
+  int size;
+  MPI_Type_size(type, &size);
+  desc->size = (size_t) size;
+
+  /* if the bytes of one element fill its extent with no gaps, then
+   * consecutive elements tile a single block of memory, and since
+   * we always copy between buffers of the same type, we can move
+   * that block with memcpy */
+  desc->contig = (
+    (MPI_Aint) size == desc->extent &&
+    desc->true_extent == desc->extent &&
+    desc->true_lb == desc->lb
+  );
+}
+
+/* allocate a buffer large enough to hold count consecutive items,
+ * the last item only needs its true extent, which matters for types
+ * whose extent has been resized to be smaller than the data, the
+ * buffer comes from the scratch pool */
+void* lwgrp_desc_dtbuf_alloc(int count, const lwgrp_type_desc* desc, const char* file, int line)
+{
+  if (count <= 0) {
+    return NULL;
+  }
+
+  size_t size = (size_t)(count - 1) * desc->extent + desc->true_extent;
+  char* ptr = (char*) lwgrp_scratch_alloc(size, file, line);
+  ptr -= desc->true_lb;
+  return ptr;
+}
+
+/* free buffer allocated with lwgrp_desc_dtbuf_alloc */
+int lwgrp_desc_dtbuf_free(void** dtbuf_ptr, const lwgrp_type_desc* desc, const char* file, int line)
+{
+  if (dtbuf_ptr != NULL) {
+    void* dtbuf = *dtbuf_ptr;
+    if (dtbuf != NULL) {
+      char* ptr = (char*)dtbuf + desc->true_lb;
+      lwgrp_scratch_free(&ptr);
+      *dtbuf_ptr = NULL;
+    } else {
+      /* OK: user can pass a pointer whose value is NULL, ignore it */
+    }
+  } else {
+    /* ERROR: user passed in a NULL value as the address of their pointer */
+  }
+
+  return LWGRP_SUCCESS;
+}
+
+void lwgrp_desc_dtbuf_memcpy(void* dst, const void* src, int count, const lwgrp_type_desc* desc)
+{
+  if (count <= 0) {
+    return;
+  }
+
+  /* contiguous types are a single block of bytes */
+  if (desc->contig) {
+    memcpy(
+      (char*)dst + desc->true_lb, (const char*)src + desc->true_lb,
+      (size_t) count * desc->extent
+    );
+    return;
+  }
+
+  /* pack the elements and unpack them at the destination, this is
+   * purely local, so unlike a self sendrecv it needs no communicator
+   * shared between threads */
+  int size;
+  MPI_Pack_size(count, desc->type, MPI_COMM_SELF, &size);
+  void* buf = lwgrp_scratch_alloc((size_t) size, __FILE__, __LINE__);
+  int position = 0;
+  MPI_Pack((void*)src, count, desc->type, buf, size, &position, MPI_COMM_SELF);
+  position = 0;
+  MPI_Unpack(buf, size, &position, dst, count, desc->type, MPI_COMM_SELF);
+  lwgrp_scratch_free(&buf);
+}
+
+/* the functions below take a datatype handle and look up its layout
+ * on each call, they're fine for one-off use, but loops should build
+ * a descriptor once and use the lwgrp_desc_dtbuf versions */
+
 /* given a pointer to the start of a datatype buffer, return pointer to
  * datatype buffer for the start of the count-th element */
 void* lwgrp_type_dtbuf_from_dtbuf(const void* dtbuf, int count, MPI_Datatype type)
@@ -51,81 +147,46 @@ void* lwgrp_type_dtbuf_from_membuf(const void* membuf, int count, MPI_Datatype t
 }
 
 /* allocate a buffer large enough to hold count consecutive items,
- * and align buf to type */
+ * and align buf to type, the buffer comes from the scratch pool */
 void* lwgrp_type_dtbuf_alloc(int count, MPI_Datatype type, const char* file, int line)
 {
-  /* get lower bounds and extent of datatype */
-  MPI_Aint lb, extent;
-  lwgrp_type_get_lb_extent(type, &lb, &extent);
-
-  size_t size  = count * extent;
-  size_t align = 0;
-  char* ptr = (char*) lwgrp_malloc(size, align, file, line);
-  ptr -= lb;
-  return ptr;
+  lwgrp_type_desc desc;
+  lwgrp_type_desc_init(&desc, type);
+  return lwgrp_desc_dtbuf_alloc(count, &desc, file, line);
 }
 
 /* free buffer allocated with lwgrp_type_dtbuf_alloc */
 int lwgrp_type_dtbuf_free(void** dtbuf_ptr, MPI_Datatype type, const char* file, int line)
 {
-  if (dtbuf_ptr != NULL) {
-    void* dtbuf = *dtbuf_ptr;
-    if (dtbuf != NULL) {
-      /* get lower bounds and extent of datatype */
-      MPI_Aint lb, extent;
-      lwgrp_type_get_lb_extent(type, &lb, &extent);
-
-      char* ptr = (char*)dtbuf + lb;
-      if (ptr != NULL) {
-        free(ptr);
-      } else {
-        /* ERROR: dtbuf should be NULL in this case */
-      }
-    } else {
-      /* OK: user can pass a pointer whose value is NULL, ignore it */
-    }
-  } else {
-    /* ERROR: user passed in a NULL value as the address of their pointer */
-  }
-
-  return LWGRP_SUCCESS;
+  lwgrp_type_desc desc;
+  lwgrp_type_desc_init(&desc, type);
+  return lwgrp_desc_dtbuf_free(dtbuf_ptr, &desc, file, line);
 }
 
 void lwgrp_type_dtbuf_memcpy(void* dst, const void* src, int count, MPI_Datatype type)
 {
-    /* TODO: need to free this somehow */
-
-    /* dup MPI_COMM_SELF which we need to do the self-sendrecv */
-    if (lwgrp_comm_self == MPI_COMM_NULL) {
-      MPI_Comm_dup(MPI_COMM_SELF, &lwgrp_comm_self);
-    }
-
-    /* do the memcpy with a self sendrecv, MPI please provide a memcpy */
-    MPI_Status status[2];
-    MPI_Sendrecv(
-      (void*)src, count, type, 0, LWGRP_MSG_TAG_0,
-             dst, count, type, 0, LWGRP_MSG_TAG_0,
-      lwgrp_comm_self, status
-    );
+  lwgrp_type_desc desc;
+  lwgrp_type_desc_init(&desc, type);
+  lwgrp_desc_dtbuf_memcpy(dst, src, count, &desc);
 }
 
 
-/* malloc with some checks on size and the returned pointer, along with
- * future support for alignment, if size <= 0, malloc is not called and
- * NULL pointer is returned, error is printed with file name and line
- * number if size > 0 and malloc returns NULL pointer */
+/* malloc with some checks on size and the returned pointer, aligned
+ * to align bytes, which must be 0 or a power of two, if size <= 0,
+ * malloc is not called and NULL pointer is returned, error is printed
+ * with file name and line number if size > 0 and malloc returns NULL
+ * pointer */
 void* lwgrp_malloc(size_t size, size_t align, const char* file, int line)
 {
   void* ptr = NULL;
   if (size > 0) {
-/*
-    if (align == 0) {
+    /* malloc already aligns to any basic type, so we only need
+     * posix_memalign for larger alignments */
+    if (align <= 2 * sizeof(void*)) {
       ptr = malloc(size);
-    } else {
-      posix_memalign(&ptr, size, align);
+    } else if (posix_memalign(&ptr, align, size) != 0) {
+      ptr = NULL;
     }
-*/
-    ptr = malloc(size);
     if (ptr == NULL) {
       printf("ERROR: Failed to allocate memory %lu bytes @ %s:%d\n", size, file, line);
       exit(1);
@@ -153,6 +214,194 @@ void lwgrp_free(void* p)
   }
 }
 
+/* ---------------------------------
+ * Scratch pool
+ * --------------------------------- */
+
+/* Collectives allocate temporary buffers on every call, so rather
+ * than returning those to the allocator we keep freed blocks on a
+ * free list for each power-of-two size class and hand them out again
+ * on the next call.  Each block starts with a header that records its
+ * size class, padded to LWGRP_SCRATCH_ALIGN so that the buffer we
+ * return keeps the alignment of the block.  Each thread has a pool
+ * of its own, which it frees when it exits. */
+
+/* maximum number of bytes kept on the free lists, beyond this freed
+ * blocks go back to the allocator, can be overridden by the
+ * environment variable of the same name */
+#ifndef LWGRP_SCRATCH_POOL_BYTES
+#define LWGRP_SCRATCH_POOL_BYTES (64 * 1024 * 1024)
+#endif
+
+/* alignment of scratch buffers, a cache line */
+#define LWGRP_SCRATCH_ALIGN (64)
+
+/* size classes run from 2^MIN to 2^MAX bytes, larger buffers are
+ * allocated exactly and never cached */
+#define LWGRP_SCRATCH_MIN_LOG2 (6)
+#define LWGRP_SCRATCH_MAX_LOG2 (26)
+#define LWGRP_SCRATCH_CLASSES (LWGRP_SCRATCH_MAX_LOG2 - LWGRP_SCRATCH_MIN_LOG2 + 1)
+
+typedef struct lwgrp_scratch_block {
+  struct lwgrp_scratch_block* next; /* next block on free list */
+  size_t size;                      /* bytes available after the header */
+  int index;                        /* size class, or -1 if not pooled */
+} lwgrp_scratch_block;
+
+static LWGRP_THREAD_LOCAL int lwgrp_scratch_tuned = 0;
+static LWGRP_THREAD_LOCAL size_t lwgrp_scratch_limit;  /* max bytes on free lists */
+static LWGRP_THREAD_LOCAL size_t lwgrp_scratch_inuse;  /* bytes currently handed out */
+static LWGRP_THREAD_LOCAL size_t lwgrp_scratch_hwm;    /* most bytes ever handed out at once */
+static LWGRP_THREAD_LOCAL size_t lwgrp_scratch_cached; /* bytes currently on free lists */
+static LWGRP_THREAD_LOCAL lwgrp_scratch_block* lwgrp_scratch_lists[LWGRP_SCRATCH_CLASSES];
+
+/* key whose destructor empties the pool of an exiting thread */
+static pthread_once_t lwgrp_scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lwgrp_scratch_key;
+
+static void lwgrp_scratch_trim(size_t limit);
+
+/* called at thread exit, the value is just a marker */
+static void lwgrp_scratch_thread_exit(void* value)
+{
+  (void)value;
+  lwgrp_scratch_trim(0);
+}
+
+static void lwgrp_scratch_key_create(void)
+{
+  pthread_key_create(&lwgrp_scratch_key, lwgrp_scratch_thread_exit);
+}
+
+/* look up the pool limit the first time a thread uses its pool */
+static void lwgrp_scratch_tune(void)
+{
+  if (lwgrp_scratch_tuned) {
+    return;
+  }
+  lwgrp_scratch_limit = lwgrp_getenv_size(
+    "LWGRP_SCRATCH_POOL_BYTES", LWGRP_SCRATCH_POOL_BYTES
+  );
+
+  /* set a non-NULL value so the destructor runs for this thread */
+  pthread_once(&lwgrp_scratch_once, lwgrp_scratch_key_create);
+  pthread_setspecific(lwgrp_scratch_key, &lwgrp_scratch_tuned);
+
+  lwgrp_scratch_tuned = 1;
+}
+
+/* free cached blocks until the free lists hold at most limit bytes,
+ * starting with the largest blocks */
+static void lwgrp_scratch_trim(size_t limit)
+{
+  int i;
+  for (i = LWGRP_SCRATCH_CLASSES - 1; i >= 0; i--) {
+    while (lwgrp_scratch_cached > limit && lwgrp_scratch_lists[i] != NULL) {
+      lwgrp_scratch_block* block = lwgrp_scratch_lists[i];
+      lwgrp_scratch_lists[i] = block->next;
+      lwgrp_scratch_cached -= block->size;
+      lwgrp_free(&block);
+    }
+  }
+}
+
+/* allocate size bytes of scratch space aligned to a cache line,
+ * returns NULL if size is 0, must be freed with lwgrp_scratch_free */
+void* lwgrp_scratch_alloc(size_t size, const char* file, int line)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  lwgrp_scratch_tune();
+
+  /* find the smallest size class that fits */
+  int index = 0;
+  size_t class_size = (size_t)1 << LWGRP_SCRATCH_MIN_LOG2;
+  while (class_size < size && index < LWGRP_SCRATCH_CLASSES) {
+    class_size <<= 1;
+    index++;
+  }
+  if (index == LWGRP_SCRATCH_CLASSES) {
+    /* too big to pool */
+    index = -1;
+    class_size = size;
+  }
+
+  /* take a block from the free list if we have one,
+   * otherwise allocate a new one */
+  lwgrp_scratch_block* block = NULL;
+  if (index >= 0 && lwgrp_scratch_lists[index] != NULL) {
+    block = lwgrp_scratch_lists[index];
+    lwgrp_scratch_lists[index] = block->next;
+    lwgrp_scratch_cached -= class_size;
+  } else {
+    block = (lwgrp_scratch_block*) lwgrp_malloc(
+      LWGRP_SCRATCH_ALIGN + class_size, LWGRP_SCRATCH_ALIGN, file, line
+    );
+    block->size  = class_size;
+    block->index = index;
+  }
+
+  /* track how much scratch space is out */
+  lwgrp_scratch_inuse += class_size;
+  if (lwgrp_scratch_inuse > lwgrp_scratch_hwm) {
+    lwgrp_scratch_hwm = lwgrp_scratch_inuse;
+  }
+  LWGRP_STATS_SCRATCH(class_size);
+
+  return (char*)block + LWGRP_SCRATCH_ALIGN;
+}
+
+/* return a buffer from lwgrp_scratch_alloc to the pool, we receive a
+ * pointer to the pointer as in lwgrp_free, and set it to NULL */
+void lwgrp_scratch_free(void* p)
+{
+  void** ptr = (void**) p;
+  if (ptr == NULL) {
+    printf("ERROR: Expected address of pointer value, but got NULL instead @ %s:%d\n",
+      __FILE__, __LINE__
+    );
+    return;
+  }
+  if (*ptr == NULL) {
+    return;
+  }
+
+  lwgrp_scratch_block* block = (lwgrp_scratch_block*)
+    ((char*)*ptr - LWGRP_SCRATCH_ALIGN);
+  *ptr = NULL;
+
+  lwgrp_scratch_inuse -= block->size;
+
+  /* keep the block if it's pooled and we have room */
+  if (block->index >= 0 &&
+      lwgrp_scratch_cached + block->size <= lwgrp_scratch_limit)
+  {
+    block->next = lwgrp_scratch_lists[block->index];
+    lwgrp_scratch_lists[block->index] = block;
+    lwgrp_scratch_cached += block->size;
+  } else {
+    lwgrp_free(&block);
+  }
+}
+
+int lwgrp_scratch_query(size_t* inuse, size_t* highwater, size_t* cached)
+{
+  *inuse     = lwgrp_scratch_inuse;
+  *highwater = lwgrp_scratch_hwm;
+  *cached    = lwgrp_scratch_cached;
+  return LWGRP_SUCCESS;
+}
+
+int lwgrp_scratch_set_limit(size_t bytes)
+{
+  lwgrp_scratch_tune();
+  lwgrp_scratch_limit = bytes;
+  lwgrp_scratch_trim(bytes);
+  return LWGRP_SUCCESS;
+}
+
 /* find largest power of two that fits within group_ranks */
 int lwgrp_largest_pow2_log2_lte(int ranks, int* outpow2, int* outlog2)
 {
@@ -186,3 +435,95 @@ int lwgrp_largest_pow2_log2_lessthan(int ranks, int* outpow2, int* outlog2)
 
   return LWGRP_SUCCESS;
 }
+
+/* divide count elements into blocks pieces as evenly as possible,
+ * with the first count % blocks pieces taking one extra element,
+ * and return the offset and size of the given block */
+void lwgrp_block_range(int count, int blocks, int block, int* offset, int* size)
+{
+  int base = count / blocks;
+  int rem  = count % blocks;
+  if (block < rem) {
+    *offset = block * (base + 1);
+    *size   = base + 1;
+  } else {
+    *offset = block * base + rem;
+    *size   = base;
+  }
+}
+
+/* return the value of the named environment variable as a
+ * non-negative integer, or def if it is not set or not a number */
+size_t lwgrp_getenv_size(const char* name, size_t def)
+{
+  const char* value = getenv(name);
+  if (value == NULL || *value == '\0') {
+    return def;
+  }
+
+  char* end;
+  unsigned long long val = strtoull(value, &end, 10);
+  if (end == value || *end != '\0') {
+    return def;
+  }
+
+  return (size_t) val;
+}
+
+/* returns 1 if op is known to be commutative, 0 otherwise */
+int lwgrp_op_commutative(MPI_Op op)
+{
+#if MPI_VERSION > 2 || (MPI_VERSION == 2 && MPI_SUBVERSION >= 2)
+  int commute;
+  MPI_Op_commutative(op, &commute);
+  return commute;
+#else
+  /* without MPI_Op_commutative, only trust the predefined ops,
+   * all of which are commutative */
+  if (op == MPI_MAX  || op == MPI_MIN  || op == MPI_SUM  ||
+      op == MPI_PROD || op == MPI_LAND || op == MPI_BAND ||
+      op == MPI_LOR  || op == MPI_BOR  || op == MPI_LXOR ||
+      op == MPI_BXOR || op == MPI_MAXLOC || op == MPI_MINLOC)
+  {
+    return 1;
+  }
+  return 0;
+#endif
+}
+
+/* returns 1 if op on type gives the same bits however the operands
+ * are grouped, 0 otherwise */
+int lwgrp_op_exact(MPI_Datatype type, MPI_Op op)
+{
+  /* pairs only make sense with the loc ops, which just select */
+  if (type == MPI_2INT) {
+    return (op == MPI_MAXLOC || op == MPI_MINLOC);
+  }
+
+  /* predefined integer types, floating point sums and products
+   * round differently depending on grouping */
+  int integer = (
+    type == MPI_CHAR           || type == MPI_UNSIGNED_CHAR  ||
+    type == MPI_BYTE           || type == MPI_SHORT          ||
+    type == MPI_UNSIGNED_SHORT || type == MPI_INT            ||
+    type == MPI_UNSIGNED       || type == MPI_LONG           ||
+    type == MPI_UNSIGNED_LONG  || type == MPI_LONG_LONG_INT
+#if MPI_VERSION >= 2
+    || type == MPI_SIGNED_CHAR || type == MPI_UNSIGNED_LONG_LONG
+#endif
+  );
+  if (! integer) {
+    return 0;
+  }
+
+  /* integer arithmetic and the logical and bitwise ops are
+   * associative, user ops give no such promise */
+  if (op == MPI_MAX  || op == MPI_MIN  || op == MPI_SUM  ||
+      op == MPI_PROD || op == MPI_LAND || op == MPI_BAND ||
+      op == MPI_LOR  || op == MPI_BOR  || op == MPI_LXOR ||
+      op == MPI_BXOR)
+  {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,893 @@
+/* Benchmarks lwgrp collectives and splits against their MPI
+ * counterparts.
+ *
+ *   mpirun -np N ./lwgrp_bench [-r reps] [-w warmup] [-m maxbytes] [-o ops]
+ *                              [-t tunefile]
+ *
+ * The world is cut into groups of 2, 4, 8, ... procs and the full world,
+ * and every group runs the same operation at the same time, once with
+ * an lwgrp comm and once with an MPI communicator over the same procs.
+ * Each repetition is timed as the slowest proc over all groups, and we
+ * print the min, median and 99th percentile over the repetitions as one
+ * CSV line per (op, impl, pattern, group size, bytes).  Message sizes
+ * are bytes of MPI_INT per process, from 4 up to maxbytes by factors of
+ * 8.  The -o option takes a comma separated list of op names to run.
+ *
+ * With -t, we instead time every algorithm the selection table can
+ * pick for each op, forcing one at a time with lwgrp_tune_set, print
+ * them with impl set to lwgrp:<alg>, and write rules picking the
+ * fastest by median for each group size and message size to
+ * tunefile, which can then be given to LWGRP_TUNE_FILE. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+
+/* skip sizes whose buffers would take more than this many bytes */
+#define BENCH_MAX_BUFFER (64 * 1024 * 1024)
+
+enum bench_impl {
+  IMPL_LWGRP,
+  IMPL_MPI,
+};
+
+static const char* impl_names[] = { "lwgrp", "mpi" };
+
+typedef enum {
+  OP_BARRIER,
+  OP_BCAST,
+  OP_GATHER,
+  OP_SCATTER,
+  OP_ALLGATHER,
+  OP_ALLGATHERV,
+  OP_ALLTOALL,
+  OP_ALLTOALLV,
+  OP_REDUCE,
+  OP_ALLREDUCE,
+  OP_SCAN,
+  OP_EXSCAN,
+  OP_DOUBLE_EXSCAN,
+  OP_REDUCE_SCATTER,
+  OP_SCAN_SEGMENTED,
+  OP_IBARRIER,
+  OP_IBCAST,
+  OP_IALLGATHER,
+  OP_IALLREDUCE,
+  OP_COUNT
+} bench_op;
+
+static const char* op_names[] = {
+  "barrier", "bcast", "gather", "scatter", "allgather", "allgatherv",
+  "alltoall", "alltoallv", "reduce", "allreduce", "scan", "exscan",
+  "double_exscan", "reduce_scatter", "scan_segmented", "ibarrier", "ibcast", "iallgather", "iallreduce",
+};
+
+/* split patterns, each assigns a color and key to every proc given
+ * its rank and the size of the parent group */
+typedef enum {
+  PAT_RANDOM,  /* random colors and keys, about 8 procs per color */
+  PAT_FEW,     /* 4 colors */
+  PAT_MANY,    /* 2 procs per color */
+  PAT_HALVING, /* split in halves until each proc is alone */
+  PAT_COUNT
+} bench_pattern;
+
+static const char* pattern_names[] = { "random", "few", "many", "halving" };
+
+/* algorithms the selection table can pick for each op, as named in
+ * rules, see lwgrp_tune_set */
+#define TUNE_MAX_ALGS (4)
+static const struct {
+  bench_op op;
+  int count;
+  const char* algs[TUNE_MAX_ALGS];
+} tune_ops[] = {
+  { OP_BARRIER,   2, { "dissemination", "chain" } },
+  { OP_BCAST,     3, { "binomial", "scatter_allgather", "pipelined" } },
+  { OP_GATHER,    2, { "binomial", "brucks" } },
+  { OP_ALLTOALL,  2, { "brucks", "indexed" } },
+  { OP_ALLREDUCE, 3, { "recursive", "rabenseifner", "ring" } },
+  { OP_REDUCE_SCATTER, 3, { "allreduce", "halving", "ring" } },
+};
+
+#define TUNE_OPS ((int) (sizeof(tune_ops) / sizeof(tune_ops[0])))
+
+/* fastest algorithm measured for one op, group size and message size,
+ * recorded on rank 0 */
+typedef struct {
+  int tune_op;      /* index into tune_ops */
+  int group_size;
+  size_t bytes;
+  int alg;          /* index into tune_ops[tune_op].algs */
+} tune_result;
+
+/* state shared by all benchmarks */
+static int world_rank, world_ranks;
+static int reps   = 20;
+static int warmup = 3;
+static size_t max_bytes = 1024 * 1024;
+static const char* only_ops = NULL;
+static const char* tune_file = NULL;
+static double* times = NULL;
+static tune_result* tune_results = NULL;
+static int tune_count = 0;
+static int tune_size = 0;
+
+/* returns 1 if name is in the list given by -o, or if there's no list */
+static int bench_selected(const char* name)
+{
+  if (only_ops == NULL) {
+    return 1;
+  }
+  size_t len = strlen(name);
+  const char* p = only_ops;
+  while (*p != '\0') {
+    const char* end = strchr(p, ',');
+    size_t n = (end != NULL) ? (size_t)(end - p) : strlen(p);
+    if (n == len && strncmp(p, name, n) == 0) {
+      return 1;
+    }
+    if (end == NULL) {
+      break;
+    }
+    p = end + 1;
+  }
+  return 0;
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  if (x < y) {
+    return -1;
+  } else if (x > y) {
+    return 1;
+  }
+  return 0;
+}
+
+/* reduce per-rep times to the slowest proc and print one CSV line,
+ * returns the median on rank 0 */
+static double bench_report(
+  const char* op, const char* impl, const char* pattern,
+  int group_size, size_t bytes)
+{
+  double* slowest = (double*) malloc(reps * sizeof(double));
+  MPI_Reduce(times, slowest, reps, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  if (world_rank == 0) {
+    qsort(slowest, reps, sizeof(double), cmp_double);
+    double min    = slowest[0];
+    double median = (reps % 2 == 1) ? slowest[reps / 2] :
+      (slowest[reps / 2 - 1] + slowest[reps / 2]) / 2.0;
+    int p99_index = (99 * reps + 99) / 100 - 1;
+    double p99 = slowest[p99_index];
+    printf("%s,%s,%s,%d,%lu,%d,%.3f,%.3f,%.3f\n",
+      op, impl, pattern, group_size, (unsigned long) bytes, reps,
+      min * 1.0e6, median * 1.0e6, p99 * 1.0e6
+    );
+    fflush(stdout);
+    free(slowest);
+    return median;
+  }
+  free(slowest);
+  return 0.0;
+}
+
+/* buffers and arguments for one collective at one size */
+typedef struct {
+  int count;       /* ints per process */
+  int ranks;       /* size of group */
+  int rank;        /* our rank in group */
+  int* sendbuf;
+  int* recvbuf;
+  int* sendbuf2;
+  int* recvbuf2;
+  int* counts;     /* count for every rank */
+  int* displs;     /* displacement of each rank */
+} bench_args;
+
+/* returns 1 if op exists for impl in this build */
+static int bench_supported(bench_op op, enum bench_impl impl)
+{
+  if (impl == IMPL_MPI) {
+    if (op == OP_DOUBLE_EXSCAN || op == OP_SCAN_SEGMENTED) {
+      return 0;
+    }
+#if MPI_VERSION < 2 || (MPI_VERSION == 2 && MPI_SUBVERSION < 2)
+    if (op == OP_REDUCE_SCATTER) {
+      return 0;
+    }
+#endif
+#if MPI_VERSION < 3
+    if (op >= OP_IBARRIER) {
+      return 0;
+    }
+#endif
+  }
+  return 1;
+}
+
+/* run op once */
+static void bench_run_op(
+  bench_op op, enum bench_impl impl, const bench_args* a,
+  const lwgrp_comm* lcomm, MPI_Comm mcomm)
+{
+  int count = a->count;
+  int root  = 0;
+  lwgrp_request lreq = LWGRP_REQUEST_NULL;
+#if MPI_VERSION >= 3
+  MPI_Request mreq;
+#endif
+
+  if (impl == IMPL_LWGRP) {
+    lwgrp_comm* comm = (lwgrp_comm*) lcomm;
+    switch (op) {
+    case OP_BARRIER:
+      lwgrp_comm_barrier(comm);
+      break;
+    case OP_BCAST:
+      lwgrp_comm_bcast(a->sendbuf, count, MPI_INT, root, comm);
+      break;
+    case OP_GATHER:
+      lwgrp_comm_gather(a->sendbuf, a->recvbuf, count, MPI_INT, root, comm);
+      break;
+    case OP_SCATTER:
+      lwgrp_comm_scatter(a->sendbuf, a->recvbuf, count, MPI_INT, root, comm);
+      break;
+    case OP_ALLGATHER:
+      lwgrp_comm_allgather(a->sendbuf, a->recvbuf, count, MPI_INT, comm);
+      break;
+    case OP_ALLGATHERV:
+      lwgrp_comm_allgatherv(a->sendbuf, a->recvbuf, a->counts, a->displs, MPI_INT, comm);
+      break;
+    case OP_ALLTOALL:
+      lwgrp_comm_alltoall(a->sendbuf, a->recvbuf, count, MPI_INT, comm);
+      break;
+    case OP_ALLTOALLV:
+      lwgrp_comm_alltoallv(
+        a->sendbuf, a->counts, a->displs,
+        a->recvbuf, a->counts, a->displs, MPI_INT, comm
+      );
+      break;
+    case OP_REDUCE:
+      lwgrp_comm_reduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, root, comm);
+      break;
+    case OP_ALLREDUCE:
+      lwgrp_comm_allreduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, comm);
+      break;
+    case OP_SCAN:
+      lwgrp_comm_scan(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, comm);
+      break;
+    case OP_EXSCAN:
+      lwgrp_comm_exscan(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, comm);
+      break;
+    case OP_DOUBLE_EXSCAN:
+      lwgrp_comm_double_exscan(
+        a->sendbuf, a->recvbuf, a->sendbuf2, a->recvbuf2,
+        count, MPI_INT, MPI_SUM, comm
+      );
+      break;
+    case OP_REDUCE_SCATTER:
+      lwgrp_comm_reduce_scatter_block(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, comm);
+      break;
+    case OP_SCAN_SEGMENTED:
+      /* segments of 4 procs */
+      lwgrp_comm_scan_segmented(
+        a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, a->rank % 4 == 0, comm
+      );
+      break;
+    case OP_IBARRIER:
+      lwgrp_comm_ibarrier(comm, &lreq);
+      lwgrp_wait(&lreq);
+      break;
+    case OP_IBCAST:
+      lwgrp_comm_ibcast(a->sendbuf, count, MPI_INT, root, comm, &lreq);
+      lwgrp_wait(&lreq);
+      break;
+    case OP_IALLGATHER:
+      lwgrp_comm_iallgather(a->sendbuf, a->recvbuf, count, MPI_INT, comm, &lreq);
+      lwgrp_wait(&lreq);
+      break;
+    case OP_IALLREDUCE:
+      lwgrp_comm_iallreduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, comm, &lreq);
+      lwgrp_wait(&lreq);
+      break;
+    default:
+      break;
+    }
+    return;
+  }
+
+  switch (op) {
+  case OP_BARRIER:
+    MPI_Barrier(mcomm);
+    break;
+  case OP_BCAST:
+    MPI_Bcast(a->sendbuf, count, MPI_INT, root, mcomm);
+    break;
+  case OP_GATHER:
+    MPI_Gather(a->sendbuf, count, MPI_INT, a->recvbuf, count, MPI_INT, root, mcomm);
+    break;
+  case OP_SCATTER:
+    MPI_Scatter(a->sendbuf, count, MPI_INT, a->recvbuf, count, MPI_INT, root, mcomm);
+    break;
+  case OP_ALLGATHER:
+    MPI_Allgather(a->sendbuf, count, MPI_INT, a->recvbuf, count, MPI_INT, mcomm);
+    break;
+  case OP_ALLGATHERV:
+    MPI_Allgatherv(
+      a->sendbuf, a->counts[a->rank], MPI_INT,
+      a->recvbuf, a->counts, a->displs, MPI_INT, mcomm
+    );
+    break;
+  case OP_ALLTOALL:
+    MPI_Alltoall(a->sendbuf, count, MPI_INT, a->recvbuf, count, MPI_INT, mcomm);
+    break;
+  case OP_ALLTOALLV:
+    MPI_Alltoallv(
+      a->sendbuf, a->counts, a->displs, MPI_INT,
+      a->recvbuf, a->counts, a->displs, MPI_INT, mcomm
+    );
+    break;
+  case OP_REDUCE:
+    MPI_Reduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, root, mcomm);
+    break;
+  case OP_ALLREDUCE:
+    MPI_Allreduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, mcomm);
+    break;
+  case OP_SCAN:
+    MPI_Scan(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, mcomm);
+    break;
+  case OP_EXSCAN:
+    MPI_Exscan(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, mcomm);
+    break;
+#if MPI_VERSION > 2 || (MPI_VERSION == 2 && MPI_SUBVERSION >= 2)
+  case OP_REDUCE_SCATTER:
+    MPI_Reduce_scatter_block(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, mcomm);
+    break;
+#endif
+#if MPI_VERSION >= 3
+  case OP_IBARRIER:
+    MPI_Ibarrier(mcomm, &mreq);
+    MPI_Wait(&mreq, MPI_STATUS_IGNORE);
+    break;
+  case OP_IBCAST:
+    MPI_Ibcast(a->sendbuf, count, MPI_INT, root, mcomm, &mreq);
+    MPI_Wait(&mreq, MPI_STATUS_IGNORE);
+    break;
+  case OP_IALLGATHER:
+    MPI_Iallgather(a->sendbuf, count, MPI_INT, a->recvbuf, count, MPI_INT, mcomm, &mreq);
+    MPI_Wait(&mreq, MPI_STATUS_IGNORE);
+    break;
+  case OP_IALLREDUCE:
+    MPI_Iallreduce(a->sendbuf, a->recvbuf, count, MPI_INT, MPI_SUM, mcomm, &mreq);
+    MPI_Wait(&mreq, MPI_STATUS_IGNORE);
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+/* time op over warmup+reps runs and report it under label,
+ * returns the median on rank 0 */
+static double bench_time_op(
+  bench_op op, enum bench_impl impl, const char* label,
+  const bench_args* a, const lwgrp_comm* lcomm, MPI_Comm mcomm)
+{
+  int i;
+  for (i = 0; i < warmup; i++) {
+    bench_run_op(op, impl, a, lcomm, mcomm);
+  }
+  for (i = 0; i < reps; i++) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    bench_run_op(op, impl, a, lcomm, mcomm);
+    times[i] = MPI_Wtime() - start;
+  }
+
+  size_t bytes = (op == OP_BARRIER || op == OP_IBARRIER) ?
+    0 : (size_t) a->count * sizeof(int);
+  return bench_report(op_names[op], label, "", a->ranks, bytes);
+}
+
+/* time each algorithm of tune_ops[t] and record the fastest on rank 0 */
+static void bench_tune_op(
+  int t, int group_size, const bench_args* a,
+  const lwgrp_comm* lcomm, MPI_Comm mcomm)
+{
+  bench_op op = tune_ops[t].op;
+  int best = 0;
+  double best_time = 0.0;
+  int i;
+  for (i = 0; i < tune_ops[t].count; i++) {
+    char rule[128];
+    char label[64];
+    snprintf(rule, sizeof(rule), "%s * * * %s", op_names[op], tune_ops[t].algs[i]);
+    snprintf(label, sizeof(label), "lwgrp:%s", tune_ops[t].algs[i]);
+    lwgrp_tune_set(rule);
+    double median = bench_time_op(op, IMPL_LWGRP, label, a, lcomm, mcomm);
+    if (i == 0 || median < best_time) {
+      best = i;
+      best_time = median;
+    }
+  }
+  lwgrp_tune_set("");
+
+  if (world_rank == 0) {
+    if (tune_count == tune_size) {
+      tune_size = (tune_size > 0) ? 2 * tune_size : 64;
+      tune_results = (tune_result*) realloc(
+        tune_results, tune_size * sizeof(tune_result)
+      );
+    }
+    tune_result* r = &tune_results[tune_count++];
+    r->tune_op    = t;
+    r->group_size = group_size;
+    r->bytes      = (op == OP_BARRIER) ? 0 : (size_t) a->count * sizeof(int);
+    r->alg        = best;
+  }
+}
+
+/* print a range for a rule, hi of 0 means no limit */
+static void bench_tune_range(FILE* fp, size_t lo, size_t hi)
+{
+  if (hi == 0) {
+    fprintf(fp, " %lu-*", (unsigned long) lo);
+  } else {
+    fprintf(fp, " %lu-%lu", (unsigned long) lo, (unsigned long) hi);
+  }
+}
+
+/* write rules for the fastest algorithm of each op, each group size
+ * we measured covers the sizes above the one before it, and each
+ * message size covers the sizes up to the next one we measured,
+ * group sizes and message sizes were measured in increasing order */
+static void bench_tune_write(void)
+{
+  FILE* fp = fopen(tune_file, "w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s\n", tune_file);
+    return;
+  }
+  fprintf(fp, "# written by lwgrp_bench -t on %d procs\n", world_ranks);
+  fprintf(fp, "# op ranks bytes pow2 alg\n");
+
+  /* indices of the results for one op and group size */
+  int* idx = (int*) malloc((tune_count + 1) * sizeof(int));
+
+  int t;
+  for (t = 0; t < TUNE_OPS; t++) {
+    int prev_size = 0;
+    while (1) {
+      /* find the next group size we measured for this op */
+      int size = 0;
+      int i;
+      for (i = 0; i < tune_count; i++) {
+        const tune_result* r = &tune_results[i];
+        if (r->tune_op == t && r->group_size > prev_size &&
+            (size == 0 || r->group_size < size))
+        {
+          size = r->group_size;
+        }
+      }
+      if (size == 0) {
+        break;
+      }
+
+      int n = 0;
+      for (i = 0; i < tune_count; i++) {
+        if (tune_results[i].tune_op == t && tune_results[i].group_size == size) {
+          idx[n++] = i;
+        }
+      }
+
+      /* the largest group size we measured covers all larger ones */
+      size_t ranks_hi = (size == world_ranks) ? 0 : (size_t) size;
+
+      /* merge neighboring message sizes with the same winner */
+      int j = 0;
+      while (j < n) {
+        int alg = tune_results[idx[j]].alg;
+        int k = j;
+        while (k + 1 < n && tune_results[idx[k + 1]].alg == alg) {
+          k++;
+        }
+        size_t lo = (j == 0) ? 0 : tune_results[idx[j]].bytes;
+        size_t hi = (k + 1 == n) ? 0 : tune_results[idx[k + 1]].bytes - 1;
+        fprintf(fp, "%s", op_names[tune_ops[t].op]);
+        bench_tune_range(fp, (size_t) prev_size + 1, ranks_hi);
+        bench_tune_range(fp, lo, hi);
+        fprintf(fp, " * %s\n", tune_ops[t].algs[alg]);
+        j = k + 1;
+      }
+
+      prev_size = size;
+    }
+  }
+
+  free(idx);
+  fclose(fp);
+}
+
+/* run all selected collectives on groups of group_size procs */
+static void bench_collectives(int group_size)
+{
+  /* cut the world into groups, the last one may be short */
+  int color = world_rank / group_size;
+  lwgrp_comm world, lcomm;
+  lwgrp_comm_build_from_mpicomm(MPI_COMM_WORLD, &world);
+  lwgrp_comm_split(&world, color, world_rank, &lcomm);
+  MPI_Comm mcomm;
+  MPI_Comm_split(MPI_COMM_WORLD, color, world_rank, &mcomm);
+
+  bench_args a;
+  lwgrp_comm_rank(&lcomm, &a.rank);
+  lwgrp_comm_size(&lcomm, &a.ranks);
+
+  /* the largest group's size, which the report names */
+  int ranks = (group_size < world_ranks) ? group_size : world_ranks;
+
+  size_t bytes;
+  for (bytes = sizeof(int); bytes <= max_bytes; bytes *= 8) {
+    int count = (int)(bytes / sizeof(int));
+    size_t buf_bytes = (size_t) count * ranks * sizeof(int);
+    if (buf_bytes > BENCH_MAX_BUFFER) {
+      break;
+    }
+
+    a.count    = count;
+    a.sendbuf  = (int*) malloc(buf_bytes);
+    a.recvbuf  = (int*) malloc(buf_bytes);
+    a.sendbuf2 = (int*) malloc(bytes);
+    a.recvbuf2 = (int*) malloc(bytes);
+    a.counts   = (int*) malloc(ranks * sizeof(int));
+    a.displs   = (int*) malloc(ranks * sizeof(int));
+
+    int i;
+    for (i = 0; i < count * ranks; i++) {
+      a.sendbuf[i] = world_rank + i;
+      a.recvbuf[i] = 0;
+    }
+    for (i = 0; i < count; i++) {
+      a.sendbuf2[i] = world_rank - i;
+      a.recvbuf2[i] = 0;
+    }
+    for (i = 0; i < a.ranks; i++) {
+      a.counts[i] = count;
+      a.displs[i] = i * count;
+    }
+
+    if (tune_file != NULL) {
+      int t;
+      for (t = 0; t < TUNE_OPS; t++) {
+        bench_op op = tune_ops[t].op;
+        if (! bench_selected(op_names[op])) {
+          continue;
+        }
+        if (op == OP_BARRIER && bytes != sizeof(int)) {
+          continue;
+        }
+        bench_tune_op(t, ranks, &a, &lcomm, mcomm);
+      }
+    }
+
+    int op;
+    for (op = 0; op < OP_COUNT && tune_file == NULL; op++) {
+      if (! bench_selected(op_names[op])) {
+        continue;
+      }
+
+      /* barriers don't depend on size */
+      if ((op == OP_BARRIER || op == OP_IBARRIER) && bytes != sizeof(int)) {
+        continue;
+      }
+
+      int impl;
+      for (impl = IMPL_LWGRP; impl <= IMPL_MPI; impl++) {
+        if (bench_supported((bench_op) op, (enum bench_impl) impl)) {
+          bench_time_op(
+            (bench_op) op, (enum bench_impl) impl, impl_names[impl],
+            &a, &lcomm, mcomm
+          );
+        }
+      }
+    }
+
+    free(a.displs);
+    free(a.counts);
+    free(a.recvbuf2);
+    free(a.sendbuf2);
+    free(a.recvbuf);
+    free(a.sendbuf);
+  }
+
+  MPI_Comm_free(&mcomm);
+  lwgrp_comm_free(&lcomm);
+  lwgrp_comm_free(&world);
+}
+
+/* a simple hash so that random colors are the same in every run */
+static unsigned int bench_hash(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+/* color, key and number of colors for pattern on a group of ranks procs */
+static void bench_pattern_color(
+  bench_pattern pat, int rank, int ranks, int* color, int* key, int* colors)
+{
+  switch (pat) {
+  case PAT_RANDOM:
+    *colors = (ranks + 7) / 8;
+    *color  = (int)(bench_hash((unsigned int) rank + 1) % (unsigned int) *colors);
+    *key    = (int)(bench_hash((unsigned int) rank + 12345) % (unsigned int) ranks);
+    break;
+  case PAT_FEW:
+    *colors = (ranks < 4) ? ranks : 4;
+    *color  = rank % *colors;
+    *key    = rank;
+    break;
+  case PAT_MANY:
+  default:
+    *colors = (ranks + 1) / 2;
+    *color  = rank / 2;
+    *key    = rank;
+    break;
+  }
+}
+
+typedef enum {
+  SPLIT_LWGRP,     /* lwgrp_comm_split */
+  SPLIT_LWGRP_BIN, /* lwgrp_comm_split_bin */
+  SPLIT_RANK_STR,  /* lwgrp_comm_rank_str */
+  SPLIT_MPI,       /* MPI_Comm_split */
+  SPLIT_COUNT
+} bench_split;
+
+static const char* split_names[] = {
+  "split", "split_bin", "rank_str", "split"
+};
+
+static const enum bench_impl split_impls[] = {
+  IMPL_LWGRP, IMPL_LWGRP, IMPL_LWGRP, IMPL_MPI
+};
+
+/* split lcomm or mcomm in halves until every proc is alone */
+static void bench_halving(bench_split s, const lwgrp_comm* lcomm, MPI_Comm mcomm)
+{
+  /* the group we split next, we own it after the first split */
+  const lwgrp_comm* lparent = lcomm;
+  MPI_Comm mparent = mcomm;
+  lwgrp_comm lcur;
+  MPI_Comm mcur;
+  int owned = 0;
+
+  while (1) {
+    int rank, ranks;
+    if (s == SPLIT_MPI) {
+      MPI_Comm_rank(mparent, &rank);
+      MPI_Comm_size(mparent, &ranks);
+    } else {
+      lwgrp_comm_rank(lparent, &rank);
+      lwgrp_comm_size(lparent, &ranks);
+    }
+    if (ranks <= 1) {
+      break;
+    }
+
+    int half = (rank < ranks / 2) ? 0 : 1;
+    if (s == SPLIT_MPI) {
+      MPI_Comm next;
+      MPI_Comm_split(mparent, half, rank, &next);
+      if (owned) {
+        MPI_Comm_free(&mcur);
+      }
+      mcur = next;
+      mparent = mcur;
+    } else {
+      lwgrp_comm next;
+      if (s == SPLIT_LWGRP_BIN) {
+        lwgrp_comm_split_bin(lparent, 2, half, &next);
+      } else {
+        lwgrp_comm_split(lparent, half, rank, &next);
+      }
+      if (owned) {
+        lwgrp_comm_free(&lcur);
+      }
+      lcur = next;
+      lparent = &lcur;
+    }
+    owned = 1;
+  }
+
+  if (owned) {
+    if (s == SPLIT_MPI) {
+      MPI_Comm_free(&mcur);
+    } else {
+      lwgrp_comm_free(&lcur);
+    }
+  }
+}
+
+/* run one split of lcomm or mcomm with pattern, split comms are freed
+ * outside of the timed region */
+static void bench_run_split(
+  bench_split s, bench_pattern pat, const lwgrp_comm* lcomm, MPI_Comm mcomm,
+  lwgrp_comm* lnew, MPI_Comm* mnew)
+{
+  int rank, ranks;
+  lwgrp_comm_rank(lcomm, &rank);
+  lwgrp_comm_size(lcomm, &ranks);
+
+  int color, key, colors;
+  bench_pattern_color(pat, rank, ranks, &color, &key, &colors);
+
+  char str[32];
+  int groups, groupid;
+  switch (s) {
+  case SPLIT_LWGRP:
+    lwgrp_comm_split(lcomm, color, key, lnew);
+    break;
+  case SPLIT_LWGRP_BIN:
+    lwgrp_comm_split_bin(lcomm, colors, color, lnew);
+    break;
+  case SPLIT_RANK_STR:
+    snprintf(str, sizeof(str), "color%d", color);
+    lwgrp_comm_rank_str(lcomm, str, &groups, &groupid);
+    break;
+  case SPLIT_MPI:
+  default:
+    MPI_Comm_split(mcomm, color, key, mnew);
+    break;
+  }
+}
+
+static void bench_splits(int group_size)
+{
+  int color = world_rank / group_size;
+  lwgrp_comm world, lcomm;
+  lwgrp_comm_build_from_mpicomm(MPI_COMM_WORLD, &world);
+  lwgrp_comm_split(&world, color, world_rank, &lcomm);
+  MPI_Comm mcomm;
+  MPI_Comm_split(MPI_COMM_WORLD, color, world_rank, &mcomm);
+
+  int ranks = (group_size < world_ranks) ? group_size : world_ranks;
+
+  int pat;
+  for (pat = 0; pat < PAT_COUNT; pat++) {
+    int s;
+    for (s = 0; s < SPLIT_COUNT; s++) {
+      if (! bench_selected(split_names[s])) {
+        continue;
+      }
+
+      /* halving splits the same halves however we rank strings */
+      if (pat == PAT_HALVING && s == SPLIT_RANK_STR) {
+        continue;
+      }
+
+      int i;
+      for (i = -warmup; i < reps; i++) {
+        lwgrp_comm lnew;
+        MPI_Comm mnew = MPI_COMM_NULL;
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start = MPI_Wtime();
+        if (pat == PAT_HALVING) {
+          bench_halving((bench_split) s, &lcomm, mcomm);
+        } else {
+          bench_run_split(
+            (bench_split) s, (bench_pattern) pat, &lcomm, mcomm, &lnew, &mnew
+          );
+        }
+        double elapsed = MPI_Wtime() - start;
+        if (i >= 0) {
+          times[i] = elapsed;
+        }
+
+        if (pat != PAT_HALVING) {
+          if (s == SPLIT_MPI) {
+            if (mnew != MPI_COMM_NULL) {
+              MPI_Comm_free(&mnew);
+            }
+          } else if (s != SPLIT_RANK_STR) {
+            lwgrp_comm_free(&lnew);
+          }
+        }
+      }
+
+      bench_report(
+        split_names[s], impl_names[split_impls[s]], pattern_names[pat],
+        ranks, 0
+      );
+    }
+  }
+
+  MPI_Comm_free(&mcomm);
+  lwgrp_comm_free(&lcomm);
+  lwgrp_comm_free(&world);
+}
+
+static void bench_usage(void)
+{
+  if (world_rank == 0) {
+    printf("Usage: lwgrp_bench [-r reps] [-w warmup] [-m maxbytes] [-o op1,op2,...] [-t tunefile]\n");
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_ranks);
+
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+      reps = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+      warmup = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+      max_bytes = (size_t) atol(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+      only_ops = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+      tune_file = argv[++i];
+    } else {
+      bench_usage();
+      MPI_Finalize();
+      return 1;
+    }
+  }
+  if (reps < 1) {
+    reps = 1;
+  }
+  if (warmup < 0) {
+    warmup = 0;
+  }
+  times = (double*) malloc(reps * sizeof(double));
+
+  if (world_rank == 0) {
+    printf("op,impl,pattern,group_size,bytes,reps,min_us,median_us,p99_us\n");
+    fflush(stdout);
+  }
+
+  /* groups of 2, 4, 8, ... procs, then the full world */
+  int group_size = 2;
+  while (1) {
+    if (group_size > world_ranks) {
+      group_size = world_ranks;
+    }
+    bench_collectives(group_size);
+    if (tune_file == NULL) {
+      bench_splits(group_size);
+    }
+    if (group_size == world_ranks) {
+      break;
+    }
+    group_size *= 2;
+  }
+
+  if (tune_file != NULL) {
+    /* go back to the rules from the environment */
+    lwgrp_tune_set(NULL);
+    if (world_rank == 0) {
+      bench_tune_write();
+    }
+    free(tune_results);
+  }
+
+  free(times);
+
+  MPI_Finalize();
+  return 0;
+}
@@ -1,9 +1,458 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "mpi.h"
 #include "lwgrp.h"
 
+/* compress the members of comm into ranges and compare with the
+ * ranges we get by cutting the full member list greedily, errors if
+ * the ranges differ, returns the number of errors */
+static int check_ranges(const lwgrp_comm* comm, int size, const int members[])
+{
+  int errors = 0;
+
+  int count;
+  int* ranges;
+  lwgrp_comm_ranges(comm, &count, &ranges);
+
+  /* each range takes the step to its second member as its stride */
+  int expect = 0;
+  int i = 0;
+  while (i < size) {
+    int stride = 1;
+    int last = i;
+    if (i + 1 < size) {
+      stride = members[i + 1] - members[i];
+      last = i + 1;
+      while (last + 1 < size && members[last + 1] - members[last] == stride) {
+        last++;
+      }
+    }
+    if (expect >= count ||
+        ranges[expect * 3 + 0] != members[i] ||
+        ranges[expect * 3 + 1] != members[last] ||
+        ranges[expect * 3 + 2] != stride)
+    {
+      errors++;
+    }
+    expect++;
+    i = last + 1;
+  }
+  if (count != expect) {
+    errors++;
+  }
+
+  lwgrp_comm_ranges_free(&ranges);
+  return errors;
+}
+
+/* split comm into several disjoint blocks of ranks and a few other
+ * patterns, and check their ranges, returns the number of errors */
+static int test_ranges(lwgrp_comm* comm)
+{
+  int errors = 0;
+
+  int rank, ranks;
+  lwgrp_comm_rank(comm, &rank);
+  lwgrp_comm_size(comm, &ranks);
+
+  int* members = (int*) malloc(ranks * sizeof(int));
+
+  int pattern;
+  for (pattern = 0; pattern < 4; pattern++) {
+    /* disjoint blocks of 4, growing gaps, every third rank,
+     * and a reversed group */
+    int color = 0;
+    int key = rank;
+    switch (pattern) {
+    case 0:
+      color = (rank % 8 < 4);
+      break;
+    case 1:
+      color = (rank == 0 || rank == 1 || rank == 3 || rank == 6 || rank == 10);
+      break;
+    case 2:
+      color = (rank % 3 == 0);
+      break;
+    case 3:
+      key = -rank;
+      break;
+    }
+
+    lwgrp_comm newcomm;
+    lwgrp_comm_split(comm, color, key, &newcomm);
+
+    /* list our members in order using MPI */
+    MPI_Comm mpicomm;
+    MPI_Comm_split(MPI_COMM_WORLD, color, key, &mpicomm);
+    int size;
+    MPI_Comm_size(mpicomm, &size);
+    MPI_Allgather(&rank, 1, MPI_INT, members, 1, MPI_INT, mpicomm);
+    MPI_Comm_free(&mpicomm);
+
+    errors += check_ranges(&newcomm, size, members);
+    lwgrp_comm_free(&newcomm);
+  }
+
+  free(members);
+  return errors;
+}
+
+#define ISPLIT_ITERS (200)
+
+/* split comm in the background while running blocking collectives on
+ * comm, some procs lag behind so that the steps of the split overlap
+ * with messages of the blocking ops, returns the number of errors */
+static int test_isplit_interleave(lwgrp_comm* comm)
+{
+  int errors = 0;
+
+  int rank, ranks;
+  lwgrp_comm_rank(comm, &rank);
+  lwgrp_comm_size(comm, &ranks);
+
+  int color = rank % 2;
+  lwgrp_comm half;
+  lwgrp_request req;
+  lwgrp_comm_isplit(comm, color, -rank, &half, &req);
+
+  int flag = 0;
+  int iter;
+  for (iter = 0; iter < ISPLIT_ITERS; iter++) {
+    if (! flag) {
+      lwgrp_test(&req, &flag);
+    }
+    if (rank % 3 == 0) {
+      usleep(100);
+    }
+    int val = rank + iter;
+    int sum = -1;
+    lwgrp_comm_allreduce(&val, &sum, 1, MPI_INT, MPI_SUM, comm);
+    if (sum != ranks * (ranks - 1) / 2 + ranks * iter) {
+      errors++;
+    }
+  }
+  if (! flag) {
+    lwgrp_wait(&req);
+  }
+
+  /* compare the new comm with the one MPI builds */
+  MPI_Comm mpihalf;
+  MPI_Comm_split(MPI_COMM_WORLD, color, -rank, &mpihalf);
+  int half_rank, half_ranks, mpi_rank, mpi_ranks;
+  lwgrp_comm_rank(&half, &half_rank);
+  lwgrp_comm_size(&half, &half_ranks);
+  MPI_Comm_rank(mpihalf, &mpi_rank);
+  MPI_Comm_size(mpihalf, &mpi_ranks);
+  if (half_rank != mpi_rank || half_ranks != mpi_ranks) {
+    errors++;
+  }
+  int sum = -1;
+  int mpisum = -2;
+  lwgrp_comm_allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, &half);
+  MPI_Allreduce(&rank, &mpisum, 1, MPI_INT, MPI_SUM, mpihalf);
+  if (sum != mpisum) {
+    errors++;
+  }
+  MPI_Comm_free(&mpihalf);
+
+  lwgrp_comm_free(&half);
+  return errors;
+}
+
+#define NB_COUNT (5)
+
+/* run the nonblocking collectives, several at once, and compare each
+ * result with the one MPI gets, returns the number of errors */
+static int test_nonblocking(lwgrp_comm* comm)
+{
+  int errors = 0;
+  int i;
+
+  int rank, ranks;
+  lwgrp_comm_rank(comm, &rank);
+  lwgrp_comm_size(comm, &ranks);
+
+  int root = ranks / 2;
+  int bcastbuf[NB_COUNT];
+  int vals[NB_COUNT];
+  int sums[NB_COUNT];
+  int mpisums[NB_COUNT];
+  for (i = 0; i < NB_COUNT; i++) {
+    bcastbuf[i] = (rank == root) ? 100 + i : -1;
+    vals[i]     = rank * NB_COUNT + i;
+    sums[i]     = -1;
+  }
+  int* members = (int*) malloc(ranks * sizeof(int));
+  int* mpimembers = (int*) malloc(ranks * sizeof(int));
+  for (i = 0; i < ranks; i++) {
+    members[i] = -1;
+  }
+
+  /* start all ops before we wait on any of them, and wait in the
+   * opposite order */
+  lwgrp_request reqs[4];
+  lwgrp_comm_ibarrier(comm, &reqs[0]);
+  lwgrp_comm_ibcast(bcastbuf, NB_COUNT, MPI_INT, root, comm, &reqs[1]);
+  lwgrp_comm_iallgather(&rank, members, 1, MPI_INT, comm, &reqs[2]);
+  lwgrp_comm_iallreduce(vals, sums, NB_COUNT, MPI_INT, MPI_SUM, comm, &reqs[3]);
+  for (i = 3; i >= 0; i--) {
+    lwgrp_wait(&reqs[i]);
+    if (reqs[i] != LWGRP_REQUEST_NULL) {
+      errors++;
+    }
+  }
+
+  MPI_Allgather(&rank, 1, MPI_INT, mpimembers, 1, MPI_INT, MPI_COMM_WORLD);
+  MPI_Allreduce(vals, mpisums, NB_COUNT, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  for (i = 0; i < NB_COUNT; i++) {
+    if (bcastbuf[i] != 100 + i || sums[i] != mpisums[i]) {
+      errors++;
+    }
+  }
+  for (i = 0; i < ranks; i++) {
+    if (members[i] != mpimembers[i]) {
+      errors++;
+    }
+  }
+
+  /* drive a max reduction with lwgrp_test */
+  for (i = 0; i < NB_COUNT; i++) {
+    vals[i] = (rank * 7 + i * 3) % (ranks + 2);
+    sums[i] = -1;
+  }
+  lwgrp_request req;
+  lwgrp_comm_iallreduce(vals, sums, NB_COUNT, MPI_INT, MPI_MAX, comm, &req);
+  int flag = 0;
+  while (! flag) {
+    lwgrp_test(&req, &flag);
+  }
+  MPI_Allreduce(vals, mpisums, NB_COUNT, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  for (i = 0; i < NB_COUNT; i++) {
+    if (sums[i] != mpisums[i]) {
+      errors++;
+    }
+  }
+
+  free(mpimembers);
+  free(members);
+  return errors;
+}
+
+#define PERSIST_ITERS (4)
+
+/* set up persistent collectives once and start them several times
+ * with new data each time, comparing each run with MPI, returns the
+ * number of errors */
+static int test_persistent(lwgrp_comm* comm)
+{
+  int errors = 0;
+  int i;
+
+  int rank, ranks;
+  lwgrp_comm_rank(comm, &rank);
+  lwgrp_comm_size(comm, &ranks);
+
+  int val;
+  int vals[NB_COUNT];
+  int sums[NB_COUNT];
+  int mpisums[NB_COUNT];
+  int* members = (int*) malloc(ranks * sizeof(int));
+  int* mpimembers = (int*) malloc(ranks * sizeof(int));
+
+  lwgrp_request barrier, allgather, allreduce;
+  lwgrp_comm_barrier_init(comm, &barrier);
+  lwgrp_comm_allgather_init(&val, members, 1, MPI_INT, comm, &allgather);
+  lwgrp_comm_allreduce_init(vals, sums, NB_COUNT, MPI_INT, MPI_SUM, comm, &allreduce);
+
+  int iter;
+  for (iter = 0; iter < PERSIST_ITERS; iter++) {
+    val = rank * 10 + iter;
+    for (i = 0; i < NB_COUNT; i++) {
+      vals[i] = rank + i * iter;
+      sums[i] = -1;
+    }
+    for (i = 0; i < ranks; i++) {
+      members[i] = -1;
+    }
+
+    lwgrp_start(&barrier);
+    lwgrp_start(&allgather);
+    lwgrp_start(&allreduce);
+    lwgrp_wait(&allreduce);
+    lwgrp_wait(&allgather);
+    lwgrp_wait(&barrier);
+
+    /* the requests stay allocated for the next run */
+    if (barrier == LWGRP_REQUEST_NULL ||
+        allgather == LWGRP_REQUEST_NULL ||
+        allreduce == LWGRP_REQUEST_NULL)
+    {
+      errors++;
+      break;
+    }
+
+    MPI_Allgather(&val, 1, MPI_INT, mpimembers, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allreduce(vals, mpisums, NB_COUNT, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    for (i = 0; i < ranks; i++) {
+      if (members[i] != mpimembers[i]) {
+        errors++;
+      }
+    }
+    for (i = 0; i < NB_COUNT; i++) {
+      if (sums[i] != mpisums[i]) {
+        errors++;
+      }
+    }
+  }
+
+  lwgrp_request_free(&allreduce);
+  lwgrp_request_free(&allgather);
+  lwgrp_request_free(&barrier);
+
+  free(mpimembers);
+  free(members);
+  return errors;
+}
+
+/* number of ints rank src sends to rank dst in the sparse tests */
+static int sparse_count(int src, int dst)
+{
+  return 1 + (src + dst) % 3;
+}
+
+/* each proc sends to the procs 1 and 3 ranks to its right, exchange
+ * data with the sparse ops and compare what arrives with what an
+ * MPI_Alltoallv delivers, returns the number of errors */
+static int test_sparse(lwgrp_comm* comm)
+{
+  int errors = 0;
+  int i, j;
+
+  int rank, ranks;
+  lwgrp_comm_rank(comm, &rank);
+  lwgrp_comm_size(comm, &ranks);
+
+  /* list distinct neighbors other than ourself */
+  int steps[2] = {1, 3};
+  int dests[2], sources[2];
+  int outdegree = 0;
+  int indegree = 0;
+  for (i = 0; i < 2; i++) {
+    int dst = (rank + steps[i]) % ranks;
+    int src = (rank - steps[i] % ranks + ranks) % ranks;
+    if (dst != rank && (outdegree == 0 || dests[0] != dst)) {
+      dests[outdegree++] = dst;
+    }
+    if (src != rank && (indegree == 0 || sources[0] != src)) {
+      sources[indegree++] = src;
+    }
+  }
+
+  /* fill in counts for the sparse ops and for MPI_Alltoallv */
+  int sendcounts[2], senddispls[2], recvcounts[2], recvdispls[2];
+  int* mpisendcounts = (int*) calloc(ranks, sizeof(int));
+  int* mpisenddispls = (int*) calloc(ranks, sizeof(int));
+  int* mpirecvcounts = (int*) calloc(ranks, sizeof(int));
+  int* mpirecvdispls = (int*) calloc(ranks, sizeof(int));
+  int sendtotal = 0;
+  for (i = 0; i < outdegree; i++) {
+    sendcounts[i] = sparse_count(rank, dests[i]);
+    senddispls[i] = sendtotal;
+    sendtotal += sendcounts[i];
+  }
+  int recvtotal = 0;
+  for (i = 0; i < indegree; i++) {
+    recvcounts[i] = sparse_count(sources[i], rank);
+    recvdispls[i] = recvtotal;
+    recvtotal += recvcounts[i];
+  }
+  for (i = 0; i < outdegree; i++) {
+    mpisendcounts[dests[i]] = sendcounts[i];
+  }
+  for (i = 0; i < indegree; i++) {
+    mpirecvcounts[sources[i]] = recvcounts[i];
+  }
+  for (i = 1; i < ranks; i++) {
+    mpisenddispls[i] = mpisenddispls[i - 1] + mpisendcounts[i - 1];
+    mpirecvdispls[i] = mpirecvdispls[i - 1] + mpirecvcounts[i - 1];
+  }
+
+  /* the sparse ops and MPI take the same data laid out by dest */
+  int* sendbuf    = (int*) malloc((sendtotal + 1) * sizeof(int));
+  int* mpisendbuf = (int*) malloc((sendtotal + 1) * sizeof(int));
+  for (i = 0; i < outdegree; i++) {
+    for (j = 0; j < sendcounts[i]; j++) {
+      int v = rank * 1000 + dests[i] * 10 + j;
+      sendbuf[senddispls[i] + j] = v;
+      mpisendbuf[mpisenddispls[dests[i]] + j] = v;
+    }
+  }
+  int* mpirecvbuf = (int*) malloc((recvtotal + 1) * sizeof(int));
+  MPI_Alltoallv(
+    mpisendbuf, mpisendcounts, mpisenddispls, MPI_INT,
+    mpirecvbuf, mpirecvcounts, mpirecvdispls, MPI_INT,
+    MPI_COMM_WORLD
+  );
+
+  /* neighbor exchange */
+  int* recvbuf = (int*) malloc((recvtotal + 1) * sizeof(int));
+  for (i = 0; i < recvtotal; i++) {
+    recvbuf[i] = -1;
+  }
+  lwgrp_comm_neighbor_alltoallv(
+    sendbuf, outdegree, dests, sendcounts, senddispls,
+    recvbuf, indegree, sources, recvcounts, recvdispls,
+    MPI_INT, comm
+  );
+  for (i = 0; i < indegree; i++) {
+    for (j = 0; j < recvcounts[i]; j++) {
+      if (recvbuf[recvdispls[i] + j] != mpirecvbuf[mpirecvdispls[sources[i]] + j]) {
+        errors++;
+      }
+    }
+  }
+
+  /* sparse exchange, where we learn who sent to us */
+  void* buf;
+  int num;
+  int* srcs;
+  int* counts;
+  int* displs;
+  lwgrp_comm_sparse_exchange(
+    sendbuf, outdegree, dests, sendcounts, senddispls, MPI_INT,
+    &buf, &num, &srcs, &counts, &displs, comm
+  );
+  if (num != indegree) {
+    errors++;
+  }
+  for (i = 0; i < num; i++) {
+    int src = srcs[i];
+    if (src < 0 || src >= ranks || counts[i] != mpirecvcounts[src]) {
+      errors++;
+      continue;
+    }
+    const int* data = (const int*) buf + displs[i];
+    for (j = 0; j < counts[i]; j++) {
+      if (data[j] != mpirecvbuf[mpirecvdispls[src] + j]) {
+        errors++;
+      }
+    }
+  }
+  lwgrp_comm_sparse_free(&buf, MPI_INT, &srcs, &counts, &displs);
+
+  free(recvbuf);
+  free(mpirecvbuf);
+  free(mpisendbuf);
+  free(sendbuf);
+  free(mpirecvdispls);
+  free(mpirecvcounts);
+  free(mpisenddispls);
+  free(mpisendcounts);
+  return errors;
+}
+
 int main (int argc, char* argv[])
 {
   int color, key;
@@ -28,23 +477,47 @@ int main (int argc, char* argv[])
     outbuf[i] = -1;
   }
 
+  int errors = 0;
+
   lwgrp_comm_barrier(&comm);
 
   int bcastbuf = rank;
   lwgrp_comm_bcast(&bcastbuf, 1, MPI_INT, ranks-1, &comm);
+  if (bcastbuf != ranks - 1) {
+    errors++;
+  }
 
   lwgrp_comm_allgather(&rank, members, 1, MPI_INT, &comm);
+  for (i = 0; i < ranks; i++) {
+    if (members[i] != i) {
+      errors++;
+    }
+  }
 
   lwgrp_comm_alltoall(inbuf, outbuf, 1, MPI_INT, &comm);
+  for (i = 0; i < ranks; i++) {
+    if (outbuf[i] != i * ranks + rank) {
+      errors++;
+    }
+  }
 
   int sum = -1;
 #if MPI_VERSION >= 2 && MPI_SUBVERSION >= 2
   sum = -1;
   lwgrp_comm_allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, &comm);
+  if (sum != ranks * (ranks - 1) / 2) {
+    errors++;
+  }
   sum = -1;
   lwgrp_comm_scan(&rank, &sum, 1, MPI_INT, MPI_SUM, &comm);
+  if (sum != rank * (rank + 1) / 2) {
+    errors++;
+  }
   sum = -1;
   lwgrp_comm_exscan(&rank, &sum, 1, MPI_INT, MPI_SUM, &comm);
+  if (rank > 0 && sum != rank * (rank - 1) / 2) {
+    errors++;
+  }
 #endif
 
 #if 0
@@ -67,9 +540,25 @@ int main (int argc, char* argv[])
   #endif
 #endif
 
+  errors += test_ranges(&comm);
+  errors += test_isplit_interleave(&comm);
+  errors += test_nonblocking(&comm);
+  errors += test_persistent(&comm);
+  errors += test_sparse(&comm);
+
+  int all_errors;
+  MPI_Allreduce(&errors, &all_errors, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0) {
+    if (all_errors == 0) {
+      printf("testcommops: %d procs passed\n", ranks);
+    } else {
+      printf("testcommops: %d errors\n", all_errors);
+    }
+  }
+
   lwgrp_comm_free(&comm);
 
   MPI_Finalize();
 
-  return 0;
+  return (all_errors == 0) ? 0 : 1;
 }
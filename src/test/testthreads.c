@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mpi.h"
+#include "lwgrp.h"
+
+#define THREADS (4)
+#define ITERS   (20)
+#define COUNT   (100)
+
+/* each thread works on a team comm of its own */
+typedef struct {
+  int id;
+  lwgrp_comm team;
+  int errors;
+} thread_args;
+
+static void* run_thread(void* arg)
+{
+  thread_args* t = (thread_args*) arg;
+
+  int rank, ranks;
+  lwgrp_comm_rank(&t->team, &rank);
+  lwgrp_comm_size(&t->team, &ranks);
+
+  int* inbuf  = (int*) malloc(COUNT * sizeof(int));
+  int* outbuf = (int*) malloc(COUNT * sizeof(int));
+
+  int iter, i;
+  for (iter = 0; iter < ITERS; iter++) {
+    /* split the team while the other threads split theirs,
+     * so their comms pick contexts at the same time */
+    int color = (rank + iter + t->id) % 2;
+    lwgrp_comm half;
+    lwgrp_comm_split(&t->team, color, rank, &half);
+
+    int half_rank, half_ranks;
+    lwgrp_comm_rank(&half, &half_rank);
+    lwgrp_comm_size(&half, &half_ranks);
+
+    /* sum of team ranks with our color */
+    int expect_half = 0;
+    for (i = 0; i < ranks; i++) {
+      if ((i + iter + t->id) % 2 == color) {
+        expect_half += i;
+      }
+    }
+
+    for (i = 0; i < COUNT; i++) {
+      inbuf[i] = rank + i * t->id;
+    }
+    lwgrp_comm_allreduce(inbuf, outbuf, COUNT, MPI_INT, MPI_SUM, &half);
+    for (i = 0; i < COUNT; i++) {
+      if (outbuf[i] != expect_half + half_ranks * i * t->id) {
+        t->errors++;
+      }
+    }
+
+    /* a nonblocking allreduce on the full team */
+    lwgrp_request req;
+    lwgrp_comm_iallreduce(inbuf, outbuf, COUNT, MPI_INT, MPI_SUM, &t->team, &req);
+    lwgrp_wait(&req);
+    for (i = 0; i < COUNT; i++) {
+      if (outbuf[i] != ranks * (ranks - 1) / 2 + ranks * i * t->id) {
+        t->errors++;
+      }
+    }
+
+    lwgrp_comm_free(&half);
+  }
+
+  free(outbuf);
+  free(inbuf);
+
+  return NULL;
+}
+
+int main (int argc, char* argv[])
+{
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  if (provided < MPI_THREAD_MULTIPLE) {
+    if (rank == 0) {
+      printf("MPI_THREAD_MULTIPLE not supported, skipping\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+
+  lwgrp_comm world;
+  lwgrp_comm_build_from_mpicomm(MPI_COMM_WORLD, &world);
+
+  /* split a team for each thread, each gets a context of its own,
+   * reverse the order in every other team for variety */
+  thread_args args[THREADS];
+  int i;
+  for (i = 0; i < THREADS; i++) {
+    int key = (i % 2 == 0) ? rank : -rank;
+    args[i].id     = i;
+    args[i].errors = 0;
+    lwgrp_comm_split(&world, 0, key, &args[i].team);
+  }
+
+  pthread_t threads[THREADS];
+  for (i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, run_thread, &args[i]);
+  }
+  int errors = 0;
+  for (i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    errors += args[i].errors;
+    lwgrp_comm_free(&args[i].team);
+  }
+
+  int all_errors;
+  lwgrp_comm_allreduce(&errors, &all_errors, 1, MPI_INT, MPI_SUM, &world);
+  if (rank == 0) {
+    if (all_errors == 0) {
+      printf("testthreads: %d threads on %d procs passed\n", THREADS, ranks);
+    } else {
+      printf("testthreads: %d errors\n", all_errors);
+    }
+  }
+
+  lwgrp_comm_free(&world);
+
+  MPI_Finalize();
+  return (all_errors == 0) ? 0 : 1;
+}